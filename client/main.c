@@ -1208,6 +1208,7 @@ static void cmd_default_agent(int argc, char *argv[])
 }
 
 #define	DISTANCE_VAL_INVALID	0x7FFF
+#define	LIMIT_VAL_INVALID	0xFFFF
 
 static struct set_discovery_filter_args {
 	char *transport;
@@ -1218,11 +1219,15 @@ static struct set_discovery_filter_args {
 	size_t uuids_len;
 	dbus_bool_t duplicate;
 	dbus_bool_t discoverable;
+	dbus_uint16_t update_interval;
+	dbus_uint16_t rssi_delta;
 	bool set;
 	bool active;
 } filter = {
 	.rssi = DISTANCE_VAL_INVALID,
 	.pathloss = DISTANCE_VAL_INVALID,
+	.update_interval = LIMIT_VAL_INVALID,
+	.rssi_delta = LIMIT_VAL_INVALID,
 	.set = true,
 };
 
@@ -1300,6 +1305,15 @@ static void set_discovery_filter_setup(DBusMessageIter *iter, void *user_data)
 		g_dbus_dict_append_entry(&dict, "Pattern", DBUS_TYPE_STRING,
 						&args->pattern);
 
+	if (args->update_interval != LIMIT_VAL_INVALID)
+		g_dbus_dict_append_entry(&dict, "UpdateInterval",
+						DBUS_TYPE_UINT16,
+						&args->update_interval);
+
+	if (args->rssi_delta != LIMIT_VAL_INVALID)
+		g_dbus_dict_append_entry(&dict, "RSSIDelta", DBUS_TYPE_UINT16,
+						&args->rssi_delta);
+
 	dbus_message_iter_close_container(iter, &dict);
 }
 
@@ -1515,6 +1529,39 @@ static void cmd_scan_filter_pattern(int argc, char *argv[])
 		set_discovery_filter(false);
 }
 
+static void cmd_scan_filter_update_interval(int argc, char *argv[])
+{
+	if (argc < 2 || !strlen(argv[1])) {
+		if (filter.update_interval != LIMIT_VAL_INVALID)
+			bt_shell_printf("UpdateInterval: %u\n",
+						filter.update_interval);
+		return bt_shell_noninteractive_quit(EXIT_SUCCESS);
+	}
+
+	filter.update_interval = atoi(argv[1]);
+
+	filter.set = false;
+
+	if (filter.active)
+		set_discovery_filter(false);
+}
+
+static void cmd_scan_filter_rssi_delta(int argc, char *argv[])
+{
+	if (argc < 2 || !strlen(argv[1])) {
+		if (filter.rssi_delta != LIMIT_VAL_INVALID)
+			bt_shell_printf("RSSIDelta: %u\n", filter.rssi_delta);
+		return bt_shell_noninteractive_quit(EXIT_SUCCESS);
+	}
+
+	filter.rssi_delta = atoi(argv[1]);
+
+	filter.set = false;
+
+	if (filter.active)
+		set_discovery_filter(false);
+}
+
 static void filter_clear_uuids(void)
 {
 	g_strfreev(filter.uuids);
@@ -1554,6 +1601,16 @@ static void filter_clear_pattern(void)
 	filter.pattern = NULL;
 }
 
+static void filter_clear_update_interval(void)
+{
+	filter.update_interval = LIMIT_VAL_INVALID;
+}
+
+static void filter_clear_rssi_delta(void)
+{
+	filter.rssi_delta = LIMIT_VAL_INVALID;
+}
+
 struct clear_entry {
 	const char *name;
 	void (*clear) (void);
@@ -1567,6 +1624,8 @@ static const struct clear_entry filter_clear[] = {
 	{ "duplicate-data", filter_clear_duplicate },
 	{ "discoverable", filter_clear_discoverable },
 	{ "pattern", filter_clear_pattern },
+	{ "update-interval", filter_clear_update_interval },
+	{ "rssi-delta", filter_clear_rssi_delta },
 	{}
 };
 
@@ -2870,8 +2929,16 @@ static const struct bt_shell_menu scan_menu = {
 	{ "pattern", "[value]", cmd_scan_filter_pattern,
 				"Set/Get pattern filter",
 				NULL },
+	{ "update-interval", "[milliseconds]",
+				cmd_scan_filter_update_interval,
+				"Set/Get property update interval filter",
+				NULL },
+	{ "rssi-delta", "[dBm]", cmd_scan_filter_rssi_delta,
+				"Set/Get RSSI delta filter",
+				NULL },
 	{ "clear",
-	"[uuids/rssi/pathloss/transport/duplicate-data/discoverable/pattern]",
+	"[uuids/rssi/pathloss/transport/duplicate-data/discoverable/pattern/"
+	"update-interval/rssi-delta]",
 				cmd_scan_filter_clear,
 				"Clears discovery filter.",
 				filter_clear_generator },
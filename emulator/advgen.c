@@ -0,0 +1,596 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "lib/bluetooth.h"
+#include "lib/hci.h"
+
+#include "src/shared/util.h"
+#include "src/shared/crypto.h"
+#include "src/shared/btsnoop.h"
+#include "src/shared/timeout.h"
+#include "monitor/bt.h"
+#include "btdev.h"
+#include "advgen.h"
+
+#define ADVGEN_TICK_MS		10
+#define ADVGEN_STATS_MS		5000
+#define ADVGEN_BURST_MS		100
+
+#define DEFAULT_ADVERTISERS	100
+#define DEFAULT_RATE		1000
+#define DEFAULT_DATA_LEN	31
+#define MAX_ADVERTISERS		65536
+
+struct advertiser {
+	uint16_t type;
+	uint8_t  addr_type;
+	uint8_t  addr[6];
+	bool     rpa;
+	uint8_t  irk[16];
+	uint64_t rpa_expire;
+	int8_t   rssi;
+	uint8_t  sid;
+	uint16_t interval;
+	uint8_t  adv_data_len;
+	uint8_t  adv_data[BTDEV_MAX_ADV_REPORT_DATA];
+	uint8_t  scan_rsp_len;
+	uint8_t  scan_rsp[31];
+};
+
+struct advgen {
+	unsigned int seed;
+	int advertisers;
+	unsigned int rate;
+	unsigned int rpa_timeout;
+	uint8_t data_len;
+	bool ext;
+	uint16_t periodic_interval;
+
+	struct advertiser *adv;
+	unsigned int adv_count;
+	unsigned int adv_next;
+
+	struct bt_crypto *crypto;
+	unsigned int timeout_id;
+	uint64_t last;
+	uint64_t credit;
+
+	uint64_t stats_start;
+	unsigned int stats_reports;
+	unsigned int stats_delivered;
+};
+
+static uint64_t get_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void get_random(struct advgen *gen, uint8_t *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = rand_r(&gen->seed);
+}
+
+static struct advertiser *add_advertiser(struct advgen *gen)
+{
+	struct advertiser *adv;
+
+	if (gen->adv_count >= MAX_ADVERTISERS)
+		return NULL;
+
+	if (!(gen->adv_count & (gen->adv_count - 1))) {
+		unsigned int size = gen->adv_count ? gen->adv_count * 2 : 16;
+
+		adv = realloc(gen->adv, size * sizeof(*adv));
+		if (!adv)
+			return NULL;
+
+		gen->adv = adv;
+	}
+
+	adv = &gen->adv[gen->adv_count++];
+	memset(adv, 0, sizeof(*adv));
+
+	return adv;
+}
+
+static struct advertiser *find_advertiser(struct advgen *gen,
+					uint8_t addr_type, const uint8_t *addr)
+{
+	unsigned int i;
+
+	for (i = 0; i < gen->adv_count; i++) {
+		struct advertiser *adv = &gen->adv[i];
+
+		if (adv->addr_type == addr_type && !memcmp(adv->addr, addr, 6))
+			return adv;
+	}
+
+	return NULL;
+}
+
+static void set_rpa(struct advgen *gen, struct advertiser *adv)
+{
+	uint8_t *prand = adv->addr + 3;
+	uint8_t *hash = adv->addr;
+
+	get_random(gen, prand, 3);
+	prand[2] &= 0x3f;
+	prand[2] |= 0x40;
+
+	/* Without crypto support the address is merely not resolvable */
+	if (!gen->crypto || !bt_crypto_ah(gen->crypto, adv->irk, prand, hash))
+		get_random(gen, hash, 3);
+
+	adv->addr_type = 0x01;
+}
+
+static void init_rpa(struct advgen *gen, struct advertiser *adv,
+								uint64_t now)
+{
+	adv->rpa = true;
+	get_random(gen, adv->irk, 16);
+	set_rpa(gen, adv);
+
+	/* Spread the rotations over the whole timeout */
+	adv->rpa_expire = now + rand_r(&gen->seed) % (gen->rpa_timeout * 1000);
+}
+
+static uint8_t put_ad(uint8_t *data, uint8_t len, uint8_t max, uint8_t type,
+					const void *value, uint8_t value_len)
+{
+	if (len + 2 + value_len > max)
+		return len;
+
+	data[len] = value_len + 1;
+	data[len + 1] = type;
+	memcpy(data + len + 2, value, value_len);
+
+	return len + 2 + value_len;
+}
+
+static void add_synthetic(struct advgen *gen, unsigned int index,
+								uint64_t now)
+{
+	struct advertiser *adv;
+	uint8_t flags = 0x06;
+	uint8_t max, mfr[BTDEV_MAX_ADV_REPORT_DATA];
+	char name[18];
+
+	adv = add_advertiser(gen);
+	if (!adv)
+		return;
+
+	snprintf(name, sizeof(name), "advgen-%05u", index);
+
+	if (gen->ext) {
+		/* Periodic advertising needs a non-connectable set */
+		if (gen->periodic_interval) {
+			adv->type = 0x0000;
+			adv->interval = gen->periodic_interval;
+		} else if (index % 4 == 0) {
+			adv->type = 0x0001;
+		} else {
+			adv->type = 0x0000;
+		}
+
+		adv->sid = index % 16;
+	} else {
+		/* One in four is connectable and answers scan requests */
+		adv->type = index % 4 ? 0x0010 : 0x0013;
+	}
+
+	max = gen->data_len;
+	if (!gen->ext && max > 31)
+		max = 31;
+
+	if (adv->type & 0x0001)
+		adv->adv_data_len = put_ad(adv->adv_data, 0, max, 0x01,
+							&flags, 1);
+
+	adv->adv_data_len = put_ad(adv->adv_data, adv->adv_data_len, max,
+						0x09, name, strlen(name));
+
+	/* Fill up with Linux Foundation manufacturer data */
+	if (max > adv->adv_data_len + 4) {
+		uint8_t len = max - adv->adv_data_len - 2;
+
+		put_le16(0x05f1, mfr);
+		get_random(gen, mfr + 2, len - 2);
+		adv->adv_data_len = put_ad(adv->adv_data, adv->adv_data_len,
+						max, 0xff, mfr, len);
+	}
+
+	if (adv->type & 0x0002)
+		adv->scan_rsp_len = put_ad(adv->scan_rsp, 0, 31, 0x09, name,
+								strlen(name));
+
+	adv->rssi = -30 - rand_r(&gen->seed) % 60;
+
+	if (gen->rpa_timeout) {
+		init_rpa(gen, adv, now);
+	} else {
+		/* Static random address */
+		get_random(gen, adv->addr, 6);
+		adv->addr[5] |= 0xc0;
+		adv->addr_type = 0x01;
+	}
+}
+
+static void record_report(struct advgen *gen, uint16_t type,
+					uint8_t addr_type, const uint8_t *addr,
+					int8_t rssi, uint8_t sid,
+					uint16_t interval, const uint8_t *data,
+					uint8_t data_len)
+{
+	struct advertiser *adv;
+
+	/* Directed advertising is not replayed */
+	if (type & 0x0004)
+		return;
+
+	adv = find_advertiser(gen, addr_type, addr);
+	if (!adv) {
+		adv = add_advertiser(gen);
+		if (!adv)
+			return;
+
+		adv->addr_type = addr_type;
+		memcpy(adv->addr, addr, 6);
+		adv->rssi = rssi;
+	}
+
+	if (type & 0x0008) {
+		if (data_len > sizeof(adv->scan_rsp))
+			return;
+
+		memcpy(adv->scan_rsp, data, data_len);
+		adv->scan_rsp_len = data_len;
+		return;
+	}
+
+	if (data_len > sizeof(adv->adv_data))
+		return;
+
+	adv->type = type;
+	adv->sid = sid;
+	adv->interval = interval;
+	memcpy(adv->adv_data, data, data_len);
+	adv->adv_data_len = data_len;
+}
+
+static void load_adv_report(struct advgen *gen, const uint8_t *data,
+								uint16_t size)
+{
+	static const uint16_t types[] = { 0x0013, 0x0015, 0x0012, 0x0010,
+								0x001a };
+	uint8_t num_reports;
+
+	if (size < 1)
+		return;
+
+	num_reports = *data++;
+	size--;
+
+	/* Event type, address type, address, length, data and RSSI */
+	while (num_reports-- && size >= 10 && size >= 10 + data[8]) {
+		const uint8_t *addr = data + 2;
+		uint8_t len = data[8];
+
+		if (data[0] < ARRAY_SIZE(types)) {
+			uint16_t type = types[data[0]];
+
+			/* The scan response type follows the advertisement */
+			if (type == 0x001a) {
+				struct advertiser *adv;
+
+				adv = find_advertiser(gen, data[1], addr);
+				if (adv && adv->type == 0x0013)
+					type = 0x001b;
+			}
+
+			record_report(gen, type, data[1], addr, data[9 + len],
+							0xff, 0, data + 9, len);
+		}
+
+		data += 10 + len;
+		size -= 10 + len;
+	}
+}
+
+static void load_ext_adv_report(struct advgen *gen, const uint8_t *data,
+								uint16_t size)
+{
+	uint8_t num_reports;
+
+	if (size < 1)
+		return;
+
+	num_reports = *data++;
+	size--;
+
+	while (num_reports--) {
+		const struct bt_hci_le_ext_adv_report *report = (void *) data;
+		uint16_t type;
+
+		if (size < sizeof(*report) ||
+				size < sizeof(*report) + report->data_len)
+			return;
+
+		/* Only complete data is replayed */
+		type = le16_to_cpu(report->event_type);
+		if (!(type & 0x0060))
+			record_report(gen, type, report->addr_type,
+					report->addr, report->rssi,
+					report->sid,
+					le16_to_cpu(report->interval),
+					report->data, report->data_len);
+
+		data += sizeof(*report) + report->data_len;
+		size -= sizeof(*report) + report->data_len;
+	}
+}
+
+static bool load_capture(struct advgen *gen, const char *path)
+{
+	struct btsnoop *btsnoop;
+	uint8_t buf[BTSNOOP_MAX_PACKET_SIZE];
+	struct timeval tv;
+	uint16_t index, opcode, size;
+	unsigned int count = gen->adv_count;
+
+	btsnoop = btsnoop_open(path, 0);
+	if (!btsnoop)
+		return false;
+
+	while (btsnoop_read_hci(btsnoop, &tv, &index, &opcode, buf, &size)) {
+		const struct bt_hci_evt_hdr *hdr = (void *) buf;
+
+		if (opcode != BTSNOOP_OPCODE_EVENT_PKT || size < 3 ||
+					hdr->evt != BT_HCI_EVT_LE_META_EVENT)
+			continue;
+
+		switch (buf[2]) {
+		case BT_HCI_EVT_LE_ADV_REPORT:
+			load_adv_report(gen, buf + 3, size - 3);
+			break;
+		case BT_HCI_EVT_LE_EXT_ADV_REPORT:
+			load_ext_adv_report(gen, buf + 3, size - 3);
+			break;
+		}
+	}
+
+	btsnoop_unref(btsnoop);
+
+	printf("Advertising generator: %u advertisers from %s\n",
+					gen->adv_count - count, path);
+
+	return true;
+}
+
+static bool parse_bool(const char *value)
+{
+	return !strcasecmp(value, "yes") || !strcasecmp(value, "true") ||
+							!strcmp(value, "1");
+}
+
+static bool load_params(struct advgen *gen, const char *path)
+{
+	char line[512], key[32], value[PATH_MAX];
+	unsigned int lineno = 0;
+	FILE *fp;
+	int i;
+
+	fp = fopen(path, "re");
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s (%m)\n", path);
+		return false;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+
+		if (sscanf(line, " %31s %4095s", key, value) != 2 ||
+							key[0] == '#')
+			continue;
+
+		if (!strcmp(key, "advertisers")) {
+			gen->advertisers = atoi(value);
+		} else if (!strcmp(key, "rate")) {
+			gen->rate = strtoul(value, NULL, 0);
+		} else if (!strcmp(key, "rpa-timeout")) {
+			gen->rpa_timeout = strtoul(value, NULL, 0);
+		} else if (!strcmp(key, "data-length")) {
+			i = atoi(value);
+			if (i < 0 || i > BTDEV_MAX_ADV_REPORT_DATA)
+				i = BTDEV_MAX_ADV_REPORT_DATA;
+			gen->data_len = i;
+		} else if (!strcmp(key, "extended")) {
+			gen->ext = parse_bool(value);
+		} else if (!strcmp(key, "periodic-interval")) {
+			gen->periodic_interval = strtoul(value, NULL, 0);
+		} else if (!strcmp(key, "seed")) {
+			gen->seed = strtoul(value, NULL, 0);
+		} else if (!strcmp(key, "capture")) {
+			if (!load_capture(gen, value)) {
+				fprintf(stderr, "Failed to read capture %s\n",
+									value);
+				fclose(fp);
+				return false;
+			}
+		} else {
+			fprintf(stderr, "%s:%u: unknown parameter %s\n",
+							path, lineno, key);
+		}
+	}
+
+	fclose(fp);
+
+	return true;
+}
+
+static void send_report(struct advgen *gen, struct advertiser *adv,
+						const uint8_t *data, uint8_t len,
+						uint16_t type)
+{
+	struct btdev_adv_report report;
+
+	report.type = type;
+	report.addr_type = adv->addr_type;
+	memcpy(report.addr, adv->addr, 6);
+	report.rssi = adv->rssi + rand_r(&gen->seed) % 7 - 3;
+	report.sid = adv->sid;
+	report.interval = adv->interval;
+	report.data_len = len;
+	report.data = data;
+
+	gen->stats_delivered += btdev_broadcast_adv_report(&report);
+	gen->stats_reports++;
+}
+
+static void advertise(struct advgen *gen, struct advertiser *adv,
+								uint64_t now)
+{
+	if (adv->rpa && now >= adv->rpa_expire) {
+		set_rpa(gen, adv);
+		adv->rpa_expire = now + gen->rpa_timeout * 1000ULL;
+	}
+
+	send_report(gen, adv, adv->adv_data, adv->adv_data_len, adv->type);
+
+	if (!(adv->type & 0x0002) || !adv->scan_rsp_len)
+		return;
+
+	send_report(gen, adv, adv->scan_rsp, adv->scan_rsp_len,
+							adv->type | 0x0008);
+}
+
+static bool advgen_tick(void *user_data)
+{
+	struct advgen *gen = user_data;
+	uint64_t now = get_now();
+
+	/* Credit is kept in thousandths of an advertising event */
+	gen->credit += gen->rate * (now - gen->last);
+	if (gen->credit > gen->rate * (uint64_t) ADVGEN_BURST_MS)
+		gen->credit = gen->rate * (uint64_t) ADVGEN_BURST_MS;
+	gen->last = now;
+
+	while (gen->credit >= 1000) {
+		advertise(gen, &gen->adv[gen->adv_next], now);
+
+		if (++gen->adv_next == gen->adv_count)
+			gen->adv_next = 0;
+
+		gen->credit -= 1000;
+	}
+
+	if (now - gen->stats_start >= ADVGEN_STATS_MS) {
+		unsigned int ms = now - gen->stats_start;
+
+		printf("Advertising generator: %u reports/s, "
+				"%u delivered/s\n",
+				gen->stats_reports * 1000 / ms,
+				gen->stats_delivered * 1000 / ms);
+
+		gen->stats_start = now;
+		gen->stats_reports = 0;
+		gen->stats_delivered = 0;
+	}
+
+	return true;
+}
+
+struct advgen *advgen_new(const char *path)
+{
+	struct advgen *gen;
+	uint64_t now = get_now();
+	int i;
+
+	gen = calloc(1, sizeof(*gen));
+	if (!gen)
+		return NULL;
+
+	gen->seed = 1;
+	gen->advertisers = -1;
+	gen->rate = DEFAULT_RATE;
+	gen->data_len = DEFAULT_DATA_LEN;
+
+	gen->crypto = bt_crypto_new();
+
+	if (path && !load_capture(gen, path) && !load_params(gen, path)) {
+		advgen_free(gen);
+		return NULL;
+	}
+
+	/* Recorded resolvable private addresses keep rotating */
+	for (i = 0; gen->rpa_timeout && i < (int) gen->adv_count; i++) {
+		struct advertiser *adv = &gen->adv[i];
+
+		if (adv->addr_type == 0x01 && (adv->addr[5] & 0xc0) == 0x40)
+			init_rpa(gen, adv, now);
+	}
+
+	/* Synthetic advertisers unless a capture provides them */
+	if (gen->advertisers < 0)
+		gen->advertisers = gen->adv_count ? 0 : DEFAULT_ADVERTISERS;
+
+	for (i = 0; i < gen->advertisers; i++)
+		add_synthetic(gen, i, now);
+
+	if (!gen->adv_count || !gen->rate) {
+		fprintf(stderr, "No advertising to generate\n");
+		advgen_free(gen);
+		return NULL;
+	}
+
+	printf("Advertising generator: %u advertisers, %u events/s\n",
+						gen->adv_count, gen->rate);
+
+	gen->last = now;
+	gen->stats_start = now;
+	gen->timeout_id = timeout_add(ADVGEN_TICK_MS, advgen_tick, gen, NULL);
+	if (!gen->timeout_id) {
+		advgen_free(gen);
+		return NULL;
+	}
+
+	return gen;
+}
+
+void advgen_free(struct advgen *gen)
+{
+	if (!gen)
+		return;
+
+	if (gen->timeout_id)
+		timeout_remove(gen->timeout_id);
+
+	bt_crypto_unref(gen->crypto);
+
+	free(gen->adv);
+	free(gen);
+}
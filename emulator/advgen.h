@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+struct advgen;
+
+struct advgen *advgen_new(const char *path);
+void advgen_free(struct advgen *gen);
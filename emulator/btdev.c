@@ -21,6 +21,7 @@
 #include <sys/uio.h>
 #include <stdint.h>
 #include <errno.h>
+#include <time.h>
 
 #include "lib/bluetooth.h"
 #include "lib/hci.h"
@@ -54,11 +55,25 @@ struct btdev_conn {
 	uint8_t  type;
 	struct btdev *dev;
 	struct btdev_conn *link;
+	uint16_t acl_completed;
 };
 
+struct acl_pkt {
+	uint16_t handle;
+	uint16_t len;
+	uint64_t deliver;
+	uint8_t data[];
+};
+
+#define ACL_TICK_MS 1
+
 struct btdev {
 	enum btdev_type type;
 
+	int index;
+	struct btdev *next_bdaddr;
+	struct btdev *next_random;
+
 	struct queue *conns;
 
 	bool auth_init;
@@ -92,6 +107,15 @@ struct btdev {
 	uint8_t  feat_page_2[8];
 	uint16_t acl_mtu;
 	uint16_t acl_max_pkt;
+	uint32_t acl_rate;
+	unsigned int acl_latency;
+	unsigned int acl_ncp_interval;
+	struct queue *acl_tx;
+	struct queue *acl_air;
+	unsigned int acl_timer;
+	uint64_t acl_last;
+	uint64_t acl_ncp_last;
+	uint32_t acl_credit;
 	uint16_t iso_mtu;
 	uint16_t iso_max_pkt;
 	uint8_t  country_code;
@@ -140,6 +164,7 @@ struct btdev {
 	uint8_t  le_scan_type;
 	uint8_t  le_scan_own_addr_type;
 	uint8_t  le_filter_dup;
+	bool     le_ext_scan;
 	uint8_t  le_adv_enable;
 	uint8_t  le_ltk[16];
 	struct {
@@ -171,13 +196,27 @@ struct inquiry_data {
 
 #define DEFAULT_INQUIRY_INTERVAL 100 /* 100 miliseconds */
 
-#define MAX_BTDEV_ENTRIES 16
+#define MIN_BTDEV_ENTRIES 16
+#define MAX_BTDEV_ENTRIES 4096
+#define BTDEV_HASH_SIZE 256
 
 static const uint8_t LINK_KEY_NONE[16] = { 0 };
 static const uint8_t LINK_KEY_DUMMY[16] = {	0, 1, 2, 3, 4, 5, 6, 7,
 						8, 9, 0, 1, 2, 3, 4, 5 };
 
-static struct btdev *btdev_list[MAX_BTDEV_ENTRIES] = { };
+/*
+ * Devices are kept in a table that grows on demand, where the index of a
+ * device determines its address. Lookups by public and by random address
+ * go through hash chains, and LE advertising is only delivered to the
+ * devices that are registered as scanning (and vice versa).
+ */
+static struct btdev **btdev_list;
+static int btdev_list_size;
+static int btdev_count;
+static struct btdev *bdaddr_hash[BTDEV_HASH_SIZE];
+static struct btdev *random_hash[BTDEV_HASH_SIZE];
+static struct queue *le_scanners;
+static struct queue *le_advertisers;
 
 static int get_hook_index(struct btdev *btdev, enum btdev_hook_type type,
 								uint16_t opcode)
@@ -207,43 +246,142 @@ static bool run_hooks(struct btdev *btdev, enum btdev_hook_type type,
 					btdev->hook_list[index]->user_data);
 }
 
+static unsigned int bdaddr_hash_index(const uint8_t *bdaddr)
+{
+	unsigned int i, hash = 0;
+
+	for (i = 0; i < 6; i++)
+		hash = hash * 31 + bdaddr[i];
+
+	return hash % BTDEV_HASH_SIZE;
+}
+
+static void hash_remove(struct btdev **hash, struct btdev *btdev,
+					const uint8_t *addr, bool random)
+{
+	struct btdev **p = &hash[bdaddr_hash_index(addr)];
+
+	for (; *p; p = random ? &(*p)->next_random : &(*p)->next_bdaddr) {
+		if (*p != btdev)
+			continue;
+
+		*p = random ? btdev->next_random : btdev->next_bdaddr;
+		return;
+	}
+}
+
+static bool bdaddr_is_zero(const uint8_t *bdaddr)
+{
+	static const uint8_t zero[6];
+
+	return !memcmp(bdaddr, zero, 6);
+}
+
+static void set_random_addr(struct btdev *btdev, const uint8_t *addr)
+{
+	unsigned int index;
+
+	if (!bdaddr_is_zero(btdev->random_addr))
+		hash_remove(random_hash, btdev, btdev->random_addr, true);
+
+	memcpy(btdev->random_addr, addr, 6);
+
+	/* An unset random address never matches any lookup */
+	if (bdaddr_is_zero(addr))
+		return;
+
+	index = bdaddr_hash_index(addr);
+	btdev->next_random = random_hash[index];
+	random_hash[index] = btdev;
+}
+
 static inline int add_btdev(struct btdev *btdev)
 {
-	int i, index = -1;
+	int i;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (btdev_list[i] == NULL) {
-			index = i;
-			btdev_list[index] = btdev;
+	for (i = 0; i < btdev_list_size; i++) {
+		if (btdev_list[i] == NULL)
 			break;
-		}
 	}
 
-	return index;
+	if (i == btdev_list_size) {
+		struct btdev **list;
+		int size;
+
+		if (btdev_list_size == MAX_BTDEV_ENTRIES)
+			return -1;
+
+		size = btdev_list_size ? btdev_list_size * 2 :
+							MIN_BTDEV_ENTRIES;
+
+		list = realloc(btdev_list, size * sizeof(*list));
+		if (!list)
+			return -1;
+
+		memset(list + btdev_list_size, 0,
+				(size - btdev_list_size) * sizeof(*list));
+		btdev_list = list;
+		btdev_list_size = size;
+	}
+
+	if (!btdev_count) {
+		le_scanners = queue_new();
+		le_advertisers = queue_new();
+	}
+
+	btdev_list[i] = btdev;
+	btdev->index = i;
+	btdev_count++;
+
+	return i;
 }
 
 static inline int del_btdev(struct btdev *btdev)
 {
-	int i, index = -1;
+	int index = btdev->index;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (btdev_list[i] == btdev) {
-			index = i;
-			btdev_list[index] = NULL;
-			break;
-		}
+	if (index < 0 || index >= btdev_list_size ||
+					btdev_list[index] != btdev)
+		return -1;
+
+	hash_remove(bdaddr_hash, btdev, btdev->bdaddr, false);
+	if (!bdaddr_is_zero(btdev->random_addr))
+		hash_remove(random_hash, btdev, btdev->random_addr, true);
+
+	queue_remove(le_scanners, btdev);
+	queue_remove(le_advertisers, btdev);
+
+	btdev_list[index] = NULL;
+
+	if (!--btdev_count) {
+		queue_destroy(le_scanners, NULL);
+		queue_destroy(le_advertisers, NULL);
+		le_scanners = NULL;
+		le_advertisers = NULL;
+
+		free(btdev_list);
+		btdev_list = NULL;
+		btdev_list_size = 0;
 	}
 
 	return index;
 }
 
+static void hash_btdev(struct btdev *btdev)
+{
+	unsigned int index = bdaddr_hash_index(btdev->bdaddr);
+
+	btdev->next_bdaddr = bdaddr_hash[index];
+	bdaddr_hash[index] = btdev;
+}
+
 static inline struct btdev *find_btdev_by_bdaddr(const uint8_t *bdaddr)
 {
-	int i;
+	struct btdev *btdev = bdaddr_hash[bdaddr_hash_index(bdaddr)];
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (btdev_list[i] && !memcmp(btdev_list[i]->bdaddr, bdaddr, 6))
-			return btdev_list[i];
+	for (; btdev; btdev = btdev->next_bdaddr) {
+		if (!memcmp(btdev->bdaddr, bdaddr, 6))
+			return btdev;
 	}
 
 	return NULL;
@@ -252,32 +390,47 @@ static inline struct btdev *find_btdev_by_bdaddr(const uint8_t *bdaddr)
 static inline struct btdev *find_btdev_by_bdaddr_type(const uint8_t *bdaddr,
 							uint8_t bdaddr_type)
 {
-	int i;
+	struct btdev *btdev;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		int cmp;
+	if (bdaddr_type != 0x01)
+		return find_btdev_by_bdaddr(bdaddr);
 
-		if (!btdev_list[i])
-			continue;
+	btdev = random_hash[bdaddr_hash_index(bdaddr)];
 
-		if (bdaddr_type == 0x01)
-			cmp = memcmp(btdev_list[i]->random_addr, bdaddr, 6);
-		else
-			cmp = memcmp(btdev_list[i]->bdaddr, bdaddr, 6);
-
-		if (!cmp)
-			return btdev_list[i];
+	for (; btdev; btdev = btdev->next_random) {
+		if (!memcmp(btdev->random_addr, bdaddr, 6))
+			return btdev;
 	}
 
 	return NULL;
 }
 
-static void get_bdaddr(uint16_t id, uint8_t index, uint8_t *bdaddr)
+static void set_le_scan_enable(struct btdev *btdev, uint8_t enable)
+{
+	if (enable && !btdev->le_scan_enable)
+		queue_push_tail(le_scanners, btdev);
+	else if (!enable && btdev->le_scan_enable)
+		queue_remove(le_scanners, btdev);
+
+	btdev->le_scan_enable = enable;
+}
+
+static void set_le_adv_enable(struct btdev *btdev, uint8_t enable)
+{
+	if (enable && !btdev->le_adv_enable)
+		queue_push_tail(le_advertisers, btdev);
+	else if (!enable && btdev->le_adv_enable)
+		queue_remove(le_advertisers, btdev);
+
+	btdev->le_adv_enable = enable;
+}
+
+static void get_bdaddr(uint16_t id, uint16_t index, uint8_t *bdaddr)
 {
 	bdaddr[0] = id & 0xff;
 	bdaddr[1] = id >> 8;
-	bdaddr[2] = index;
-	bdaddr[3] = 0x01;
+	bdaddr[2] = index & 0xff;
+	bdaddr[3] = 0x01 + (index >> 8);
 	bdaddr[4] = 0xaa;
 	bdaddr[5] = 0x00;
 }
@@ -383,8 +536,8 @@ static void btdev_reset(struct btdev *btdev)
 	 * cleared upon HCI_Reset
 	 */
 
-	btdev->le_scan_enable		= 0x00;
-	btdev->le_adv_enable		= 0x00;
+	set_le_scan_enable(btdev, 0x00);
+	set_le_adv_enable(btdev, 0x00);
 }
 
 static int cmd_reset(struct btdev *dev, const void *data, uint8_t len)
@@ -720,10 +873,10 @@ static bool inquiry_callback(void *user_data)
 	int i;
 
 	/*Report devices only once and wait for inquiry timeout*/
-	if (data->iter == MAX_BTDEV_ENTRIES)
+	if (data->iter >= btdev_list_size)
 		return true;
 
-	for (i = data->iter; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = data->iter; i < btdev_list_size; i++) {
 		/*Lets sent 10 inquiry results at once */
 		if (sent + 10 == data->sent_count)
 			break;
@@ -2851,7 +3004,7 @@ static int cmd_set_random_address(struct btdev *dev, const void *data,
 	const struct bt_hci_cmd_le_set_random_address *cmd = data;
 	uint8_t status;
 
-	memcpy(dev->random_addr, cmd->addr, 6);
+	set_random_addr(dev, cmd->addr);
 	status = BT_HCI_ERR_SUCCESS;
 	cmd_complete(dev, BT_HCI_CMD_LE_SET_RANDOM_ADDRESS, &status,
 						sizeof(status));
@@ -3057,29 +3210,29 @@ static bool adv_match(struct btdev *scan, struct btdev *adv)
 
 static void le_set_adv_enable_complete(struct btdev *btdev)
 {
+	const struct queue_entry *entry;
 	uint8_t report_type;
-	int i;
 
 	report_type = get_adv_report_type(btdev->le_adv_type);
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (!btdev_list[i] || btdev_list[i] == btdev)
-			continue;
+	for (entry = queue_get_entries(le_scanners); entry;
+							entry = entry->next) {
+		struct btdev *scan = entry->data;
 
-		if (!btdev_list[i]->le_scan_enable)
+		if (scan == btdev)
 			continue;
 
-		if (!adv_match(btdev_list[i], btdev))
+		if (!adv_match(scan, btdev))
 			continue;
 
-		le_send_adv_report(btdev_list[i], btdev, report_type);
+		le_send_adv_report(scan, btdev, report_type);
 
-		if (btdev_list[i]->le_scan_type != 0x01)
+		if (scan->le_scan_type != 0x01)
 			continue;
 
 		/* ADV_IND & ADV_SCAN_IND generate a scan response */
 		if (btdev->le_adv_type == 0x00 || btdev->le_adv_type == 0x02)
-			le_send_adv_report(btdev_list[i], btdev, 0x04);
+			le_send_adv_report(scan, btdev, 0x04);
 	}
 }
 
@@ -3093,7 +3246,7 @@ static int cmd_set_adv_enable(struct btdev *dev, const void *data, uint8_t len)
 		goto done;
 	}
 
-	dev->le_adv_enable = cmd->enable;
+	set_le_adv_enable(dev, cmd->enable);
 	status = BT_HCI_ERR_SUCCESS;
 
 done:
@@ -3137,8 +3290,9 @@ static int cmd_set_scan_enable(struct btdev *dev, const void *data, uint8_t len)
 		goto done;
 	}
 
-	dev->le_scan_enable = cmd->enable;
+	set_le_scan_enable(dev, cmd->enable);
 	dev->le_filter_dup = cmd->filter_dup;
+	dev->le_ext_scan = false;
 	status = BT_HCI_ERR_SUCCESS;
 
 done:
@@ -3152,33 +3306,31 @@ static int cmd_set_scan_enable_complete(struct btdev *dev, const void *data,
 							uint8_t len)
 {
 	const struct bt_hci_cmd_le_set_scan_enable *cmd = data;
-	int i;
+	const struct queue_entry *entry;
 
 	if (!dev->le_scan_enable || !cmd->enable)
 		return 0;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (entry = queue_get_entries(le_advertisers); entry;
+							entry = entry->next) {
+		struct btdev *adv = entry->data;
 		uint8_t report_type;
 
-		if (!btdev_list[i] || btdev_list[i] == dev)
-			continue;
-
-		if (!btdev_list[i]->le_adv_enable)
+		if (adv == dev)
 			continue;
 
-		if (!adv_match(dev, btdev_list[i]))
+		if (!adv_match(dev, adv))
 			continue;
 
-		report_type = get_adv_report_type(btdev_list[i]->le_adv_type);
-		le_send_adv_report(dev, btdev_list[i], report_type);
+		report_type = get_adv_report_type(adv->le_adv_type);
+		le_send_adv_report(dev, adv, report_type);
 
 		if (dev->le_scan_type != 0x01)
 			continue;
 
 		/* ADV_IND & ADV_SCAN_IND generate a scan response */
-		if (btdev_list[i]->le_adv_type == 0x00 ||
-					btdev_list[i]->le_adv_type == 0x02)
-			le_send_adv_report(dev, btdev_list[i], 0x04);
+		if (adv->le_adv_type == 0x00 || adv->le_adv_type == 0x02)
+			le_send_adv_report(dev, adv, 0x04);
 	}
 
 	return 0;
@@ -3228,8 +3380,8 @@ static void le_conn_complete(struct btdev *btdev,
 		if (!conn)
 			return;
 
-		btdev->le_adv_enable = 0;
-		conn->link->dev->le_adv_enable = 0;
+		set_le_adv_enable(btdev, 0);
+		set_le_adv_enable(conn->link->dev, 0);
 
 		cc.status = status;
 		cc.peer_addr_type = btdev->le_scan_own_addr_type;
@@ -3717,7 +3869,7 @@ static int cmd_set_adv_rand_addr(struct btdev *dev, const void *data,
 	const struct bt_hci_cmd_le_set_adv_set_rand_addr *cmd = data;
 	uint8_t status = BT_HCI_ERR_SUCCESS;
 
-	memcpy(dev->random_addr, cmd->bdaddr, 6);
+	set_random_addr(dev, cmd->bdaddr);
 	cmd_complete(dev, BT_HCI_CMD_LE_SET_ADV_SET_RAND_ADDR, &status,
 						sizeof(status));
 
@@ -3815,26 +3967,126 @@ static void send_ext_adv(struct btdev *btdev, const struct btdev *remote,
 					1 + 24 + meta_event.lear.data_len);
 }
 
+static uint8_t get_legacy_report_type(uint16_t type)
+{
+	switch (type) {
+	case 0x0013:
+		return 0x00;
+	case 0x0015:
+		return 0x01;
+	case 0x0012:
+		return 0x02;
+	case 0x0010:
+		return 0x03;
+	case 0x001a:
+	case 0x001b:
+		return 0x04;
+	}
+
+	return 0xff;
+}
+
+static bool send_adv_report(struct btdev *btdev,
+					const struct btdev_adv_report *report)
+{
+	union {
+		struct bt_hci_evt_le_adv_report lar;
+		struct __packed {
+			uint8_t num_reports;
+			struct bt_hci_le_ext_adv_report lear;
+		} ext;
+		uint8_t raw[1 + 24 + BTDEV_MAX_ADV_REPORT_DATA];
+	} meta_event;
+	uint8_t type;
+
+	/* Scan responses only go to active scanners */
+	if ((report->type & 0x08) && btdev->le_scan_type != 0x01)
+		return false;
+
+	memset(&meta_event, 0, sizeof(meta_event));
+
+	if (btdev->le_ext_scan) {
+		struct bt_hci_le_ext_adv_report *lear = &meta_event.ext.lear;
+
+		meta_event.ext.num_reports = 1;
+		lear->event_type = cpu_to_le16(report->type);
+		lear->addr_type = report->addr_type;
+		memcpy(lear->addr, report->addr, 6);
+		lear->primary_phy = 0x01;
+		/* Legacy PDUs have no secondary channel or advertising set */
+		if (report->type & 0x10) {
+			lear->sid = 0xff;
+		} else {
+			lear->secondary_phy = 0x01;
+			lear->sid = report->sid;
+		}
+		lear->tx_power = 127;
+		lear->rssi = report->rssi;
+		lear->interval = cpu_to_le16(report->interval);
+		lear->data_len = report->data_len;
+		memcpy(lear->data, report->data, report->data_len);
+
+		le_meta_event(btdev, BT_HCI_EVT_LE_EXT_ADV_REPORT, &meta_event,
+						1 + 24 + report->data_len);
+		return true;
+	}
+
+	/* Legacy scanning only sees legacy PDUs */
+	type = get_legacy_report_type(report->type);
+	if (type == 0xff || report->data_len > 31)
+		return false;
+
+	meta_event.lar.num_reports = 1;
+	meta_event.lar.event_type = type;
+	meta_event.lar.addr_type = report->addr_type;
+	memcpy(meta_event.lar.addr, report->addr, 6);
+	meta_event.lar.data_len = report->data_len;
+	memcpy(meta_event.lar.data, report->data, report->data_len);
+	meta_event.raw[10 + report->data_len] = report->rssi;
+
+	le_meta_event(btdev, BT_HCI_EVT_LE_ADV_REPORT, &meta_event,
+						10 + report->data_len + 1);
+
+	return true;
+}
+
+unsigned int btdev_broadcast_adv_report(const struct btdev_adv_report *report)
+{
+	const struct queue_entry *entry;
+	unsigned int count = 0;
+
+	if (report->data_len > BTDEV_MAX_ADV_REPORT_DATA)
+		return 0;
+
+	for (entry = queue_get_entries(le_scanners); entry;
+							entry = entry->next) {
+		if (send_adv_report(entry->data, report))
+			count++;
+	}
+
+	return count;
+}
+
 static void le_set_ext_adv_enable_complete(struct btdev *btdev)
 {
+	const struct queue_entry *entry;
 	uint16_t report_type;
-	int i;
 
 	report_type = get_ext_adv_type(btdev->le_ext_adv_type);
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (!btdev_list[i] || btdev_list[i] == btdev)
-			continue;
+	for (entry = queue_get_entries(le_scanners); entry;
+							entry = entry->next) {
+		struct btdev *scan = entry->data;
 
-		if (!btdev_list[i]->le_scan_enable)
+		if (scan == btdev)
 			continue;
 
-		if (!ext_adv_match(btdev_list[i], btdev))
+		if (!ext_adv_match(scan, btdev))
 			continue;
 
-		send_ext_adv(btdev_list[i], btdev, report_type, false);
+		send_ext_adv(scan, btdev, report_type, false);
 
-		if (btdev_list[i]->le_scan_type != 0x01)
+		if (scan->le_scan_type != 0x01)
 			continue;
 
 		/* if scannable bit is set the send scan response */
@@ -3848,7 +4100,7 @@ static void le_set_ext_adv_enable_complete(struct btdev *btdev)
 			else
 				continue;
 
-			send_ext_adv(btdev_list[i], btdev, report_type, true);
+			send_ext_adv(scan, btdev, report_type, true);
 		}
 	}
 }
@@ -3857,13 +4109,12 @@ static int cmd_set_ext_adv_enable(struct btdev *dev, const void *data,
 							uint8_t len)
 {
 	const struct bt_hci_cmd_le_set_ext_adv_enable *cmd = data;
+	const struct bt_hci_cmd_ext_adv_set *eas = NULL;
 	uint8_t status;
 
 	if (dev->le_adv_enable == cmd->enable)
 		status = BT_HCI_ERR_COMMAND_DISALLOWED;
 	else {
-		const struct bt_hci_cmd_ext_adv_set *eas;
-
 		if (cmd->num_of_sets) {
 			eas = data + sizeof(*cmd);
 			if (eas->duration || cmd->num_of_sets > 1)
@@ -3874,14 +4125,29 @@ static int cmd_set_ext_adv_enable(struct btdev *dev, const void *data,
 			status = BT_HCI_ERR_SUCCESS;
 
 		if (status == BT_HCI_ERR_SUCCESS)
-			dev->le_adv_enable = cmd->enable;
+			set_le_adv_enable(dev, cmd->enable);
 	}
 
 	cmd_complete(dev, BT_HCI_CMD_LE_SET_EXT_ADV_ENABLE, &status,
 							sizeof(status));
 
-	if (status == BT_HCI_ERR_SUCCESS && dev->le_adv_enable)
-		le_set_ext_adv_enable_complete(dev);
+	if (status != BT_HCI_ERR_SUCCESS || !dev->le_adv_enable)
+		return 0;
+
+	le_set_ext_adv_enable_complete(dev);
+
+	/* Reports are only sent once, so that counts as all events */
+	if (eas && eas->max_events) {
+		struct bt_hci_evt_le_adv_set_term ev;
+
+		set_le_adv_enable(dev, 0x00);
+
+		ev.status = BT_HCI_ERR_LIMIT_REACHED;
+		ev.handle = eas->handle;
+		ev.conn_handle = cpu_to_le16(0x0000);
+		ev.num_evts = eas->max_events;
+		le_meta_event(dev, BT_HCI_EVT_LE_ADV_SET_TERM, &ev, sizeof(ev));
+	}
 
 	return 0;
 }
@@ -3987,8 +4253,9 @@ static int cmd_set_ext_scan_enable(struct btdev *dev, const void *data,
 	if (dev->le_scan_enable == cmd->enable)
 		status = BT_HCI_ERR_COMMAND_DISALLOWED;
 	else {
-		dev->le_scan_enable = cmd->enable;
+		set_le_scan_enable(dev, cmd->enable);
 		dev->le_filter_dup = cmd->filter_dup;
+		dev->le_ext_scan = true;
 		status = BT_HCI_ERR_SUCCESS;
 	}
 
@@ -4002,41 +4269,40 @@ static int cmd_set_ext_scan_enable_complete(struct btdev *dev, const void *data,
 							uint8_t len)
 {
 	const struct bt_hci_cmd_le_set_ext_scan_enable *cmd = data;
-	int i;
+	const struct queue_entry *entry;
 
 	if (!dev->le_scan_enable || !cmd->enable)
 		return 0;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (entry = queue_get_entries(le_advertisers); entry;
+							entry = entry->next) {
+		struct btdev *adv = entry->data;
 		uint16_t report_type;
 
-		if (!btdev_list[i] || btdev_list[i] == dev)
+		if (adv == dev)
 			continue;
 
-		if (!btdev_list[i]->le_adv_enable)
+		if (!ext_adv_match(dev, adv))
 			continue;
 
-		if (!ext_adv_match(dev, btdev_list[i]))
-			continue;
-
-		report_type = get_ext_adv_type(btdev_list[i]->le_ext_adv_type);
-		send_ext_adv(dev, btdev_list[i], report_type, false);
+		report_type = get_ext_adv_type(adv->le_ext_adv_type);
+		send_ext_adv(dev, adv, report_type, false);
 
 		if (dev->le_scan_type != 0x01)
 			continue;
 
 		/* if scannable bit is set the send scan response */
-		if (btdev_list[i]->le_ext_adv_type & 0x02) {
-			if (btdev_list[i]->le_ext_adv_type == 0x13)
+		if (adv->le_ext_adv_type & 0x02) {
+			if (adv->le_ext_adv_type == 0x13)
 				report_type = 0x1b;
-			else if (btdev_list[i]->le_ext_adv_type == 0x12)
+			else if (adv->le_ext_adv_type == 0x12)
 				report_type = 0x1a;
-			else if (!(btdev_list[i]->le_ext_adv_type & 0x10))
+			else if (!(adv->le_ext_adv_type & 0x10))
 				report_type &= 0x08;
 			else
 				continue;
 
-			send_ext_adv(dev, btdev_list[i], report_type, true);
+			send_ext_adv(dev, adv, report_type, true);
 		}
 	}
 
@@ -4075,8 +4341,8 @@ static void le_ext_conn_complete(struct btdev *btdev,
 			return;
 
 		if (!btdev->le_ext_adv_type) {
-			btdev->le_adv_enable = 0;
-			conn->link->dev->le_adv_enable = 0;
+			set_le_adv_enable(btdev, 0);
+			set_le_adv_enable(conn->link->dev, 0);
 		}
 
 		ev.status = status;
@@ -5087,6 +5353,7 @@ struct btdev *btdev_create(enum btdev_type type, uint16_t id)
 	}
 
 	get_bdaddr(id, index, btdev->bdaddr);
+	hash_btdev(btdev);
 
 	btdev->conns = queue_new();
 
@@ -5101,6 +5368,12 @@ void btdev_destroy(struct btdev *btdev)
 	if (btdev->inquiry_id > 0)
 		timeout_remove(btdev->inquiry_id);
 
+	if (btdev->acl_timer > 0)
+		timeout_remove(btdev->acl_timer);
+
+	queue_destroy(btdev->acl_tx, free);
+	queue_destroy(btdev->acl_air, free);
+
 	bt_crypto_unref(btdev->crypto);
 	del_btdev(btdev);
 
@@ -5123,6 +5396,25 @@ bool btdev_set_debug(struct btdev *btdev, btdev_debug_func_t callback,
 	return true;
 }
 
+bool btdev_set_acl_config(struct btdev *btdev,
+				const struct btdev_acl_config *config)
+{
+	if (!btdev || !config)
+		return false;
+
+	if (config->mtu)
+		btdev->acl_mtu = config->mtu;
+
+	if (config->max_pkt)
+		btdev->acl_max_pkt = config->max_pkt;
+
+	btdev->acl_rate = config->rate;
+	btdev->acl_latency = config->latency;
+	btdev->acl_ncp_interval = config->ncp_interval;
+
+	return true;
+}
+
 const uint8_t *btdev_get_bdaddr(struct btdev *btdev)
 {
 	return btdev->bdaddr;
@@ -5169,21 +5461,25 @@ void btdev_set_send_handler(struct btdev *btdev, btdev_send_func handler,
 	btdev->send_data = user_data;
 }
 
+static void send_num_completed(struct btdev *btdev, uint16_t handle,
+							uint16_t count)
+{
+	struct bt_hci_evt_num_completed_packets ncp;
+
+	ncp.num_handles = 1;
+	ncp.handle = cpu_to_le16(handle);
+	ncp.count = cpu_to_le16(count);
+
+	send_event(btdev, BT_HCI_EVT_NUM_COMPLETED_PACKETS, &ncp, sizeof(ncp));
+}
+
 static void num_completed_packets(struct btdev *btdev, uint16_t handle)
 {
 	struct btdev_conn *conn;
 
 	conn = queue_find(btdev->conns, match_handle, UINT_TO_PTR(handle));
-	if (conn) {
-		struct bt_hci_evt_num_completed_packets ncp;
-
-		ncp.num_handles = 1;
-		ncp.handle = cpu_to_le16(handle);
-		ncp.count = cpu_to_le16(1);
-
-		send_event(btdev, BT_HCI_EVT_NUM_COMPLETED_PACKETS,
-							&ncp, sizeof(ncp));
-	}
+	if (conn)
+		send_num_completed(btdev, handle, 1);
 }
 
 static const struct btdev_cmd *default_cmd(struct btdev *btdev, uint16_t opcode,
@@ -5315,11 +5611,14 @@ static void process_cmd(struct btdev *btdev, const void *data, uint16_t len)
 	}
 }
 
-static void send_acl(struct btdev *dev, const void *data, uint16_t len)
+static void forward_acl(struct btdev_conn *conn, const void *data,
+								uint16_t len)
 {
 	struct bt_hci_acl_hdr hdr;
 	struct iovec iov[3];
-	struct btdev_conn *conn;
+
+	if (!conn->link)
+		return;
 
 	/* Packet type */
 	iov[0].iov_base = (void *) data;
@@ -5330,13 +5629,6 @@ static void send_acl(struct btdev *dev, const void *data, uint16_t len)
 	 */
 	memcpy(&hdr, data + 1, sizeof(hdr));
 
-	conn = queue_find(dev->conns, match_handle,
-					UINT_TO_PTR(acl_handle(hdr.handle)));
-	if (!conn)
-		return;
-
-	num_completed_packets(dev, conn->handle);
-
 	if (acl_flags(hdr.handle) == ACL_START_NO_FLUSH)
 		hdr.handle = acl_handle_pack(conn->handle, ACL_START);
 
@@ -5349,6 +5641,165 @@ static void send_acl(struct btdev *dev, const void *data, uint16_t len)
 	send_packet(conn->link->dev, iov, 3);
 }
 
+static uint64_t acl_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void acl_report_completed(void *data, void *user_data)
+{
+	struct btdev_conn *conn = data;
+
+	if (!conn->acl_completed)
+		return;
+
+	send_num_completed(conn->dev, conn->handle, conn->acl_completed);
+	conn->acl_completed = 0;
+}
+
+static bool match_acl_completed(const void *data, const void *match_data)
+{
+	const struct btdev_conn *conn = data;
+
+	return conn->acl_completed > 0;
+}
+
+/*
+ * Buffered data path: packets leave the controller buffer at the air rate,
+ * are delivered to the remote after the air latency and are reported as
+ * completed at most once per completed packets interval.
+ */
+static bool acl_tick(void *user_data)
+{
+	struct btdev *dev = user_data;
+	uint64_t now = acl_now();
+	struct btdev_conn *conn;
+	struct acl_pkt *pkt;
+
+	if (dev->acl_rate) {
+		uint64_t credit = dev->acl_credit +
+				dev->acl_rate * (now - dev->acl_last) / 1000;
+		uint32_t burst = dev->acl_mtu + 5;
+
+		if (dev->acl_rate / 1000 > burst)
+			burst = dev->acl_rate / 1000;
+
+		dev->acl_credit = credit > burst ? burst : credit;
+	}
+
+	dev->acl_last = now;
+
+	while ((pkt = queue_peek_head(dev->acl_tx))) {
+		if (dev->acl_rate) {
+			if (dev->acl_credit < pkt->len)
+				break;
+
+			dev->acl_credit -= pkt->len;
+		}
+
+		queue_pop_head(dev->acl_tx);
+
+		conn = queue_find(dev->conns, match_handle,
+						UINT_TO_PTR(pkt->handle));
+		if (!conn) {
+			free(pkt);
+			continue;
+		}
+
+		conn->acl_completed++;
+
+		if (dev->acl_latency) {
+			pkt->deliver = now + dev->acl_latency;
+			queue_push_tail(dev->acl_air, pkt);
+			continue;
+		}
+
+		forward_acl(conn, pkt->data, pkt->len);
+		free(pkt);
+	}
+
+	while ((pkt = queue_peek_head(dev->acl_air))) {
+		if (pkt->deliver > now)
+			break;
+
+		queue_pop_head(dev->acl_air);
+
+		conn = queue_find(dev->conns, match_handle,
+						UINT_TO_PTR(pkt->handle));
+		if (conn)
+			forward_acl(conn, pkt->data, pkt->len);
+
+		free(pkt);
+	}
+
+	if (now - dev->acl_ncp_last >= dev->acl_ncp_interval) {
+		queue_foreach(dev->conns, acl_report_completed, NULL);
+		dev->acl_ncp_last = now;
+	}
+
+	if (queue_isempty(dev->acl_tx) && queue_isempty(dev->acl_air) &&
+			!queue_find(dev->conns, match_acl_completed, NULL)) {
+		dev->acl_timer = 0;
+		return false;
+	}
+
+	return true;
+}
+
+static void queue_acl(struct btdev *dev, struct btdev_conn *conn,
+					const void *data, uint16_t len)
+{
+	struct acl_pkt *pkt;
+
+	pkt = malloc(sizeof(*pkt) + len);
+	if (!pkt)
+		return;
+
+	pkt->handle = conn->handle;
+	pkt->len = len;
+	pkt->deliver = 0;
+	memcpy(pkt->data, data, len);
+
+	if (!dev->acl_tx) {
+		dev->acl_tx = queue_new();
+		dev->acl_air = queue_new();
+	}
+
+	queue_push_tail(dev->acl_tx, pkt);
+
+	if (dev->acl_timer)
+		return;
+
+	dev->acl_last = acl_now();
+	dev->acl_timer = timeout_add(ACL_TICK_MS, acl_tick, dev, NULL);
+}
+
+static void send_acl(struct btdev *dev, const void *data, uint16_t len)
+{
+	struct bt_hci_acl_hdr hdr;
+	struct btdev_conn *conn;
+
+	memcpy(&hdr, data + 1, sizeof(hdr));
+
+	conn = queue_find(dev->conns, match_handle,
+					UINT_TO_PTR(acl_handle(hdr.handle)));
+	if (!conn)
+		return;
+
+	if (dev->acl_rate || dev->acl_latency || dev->acl_ncp_interval) {
+		queue_acl(dev, conn, data, len);
+		return;
+	}
+
+	num_completed_packets(dev, conn->handle);
+
+	forward_acl(conn, data, len);
+}
+
 static void send_iso(struct btdev *dev, const void *data, uint16_t len)
 {
 	struct bt_hci_acl_hdr *hdr;
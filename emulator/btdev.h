@@ -71,6 +71,43 @@ typedef void (*btdev_destroy_func_t)(void *user_data);
 bool btdev_set_debug(struct btdev *btdev, btdev_debug_func_t callback,
 			void *user_data, btdev_destroy_func_t destroy);
 
+/*
+ * ACL buffer and data path model. Zero mtu or max_pkt keep the current
+ * buffer size; with zero rate, latency and ncp_interval packets are passed
+ * through and completed immediately.
+ */
+struct btdev_acl_config {
+	uint16_t mtu;			/* ACL data packet length */
+	uint16_t max_pkt;		/* Number of ACL data packets */
+	uint32_t rate;			/* Air rate in bytes per second */
+	unsigned int latency;		/* Air latency in milliseconds */
+	unsigned int ncp_interval;	/* Completed packets interval in ms */
+};
+
+bool btdev_set_acl_config(struct btdev *btdev,
+				const struct btdev_acl_config *config);
+
+#define BTDEV_MAX_ADV_REPORT_DATA	229
+
+/*
+ * Advertising report from an advertiser outside of the emulated
+ * controllers. The type uses the extended advertising report event type
+ * bits; controllers scanning with the legacy commands only receive the
+ * reports that have the legacy PDU bit set.
+ */
+struct btdev_adv_report {
+	uint16_t type;			/* Extended report event type */
+	uint8_t  addr_type;
+	uint8_t  addr[6];
+	int8_t   rssi;
+	uint8_t  sid;			/* Advertising set, extended only */
+	uint16_t interval;		/* Periodic advertising interval */
+	uint8_t  data_len;
+	const uint8_t *data;
+};
+
+unsigned int btdev_broadcast_adv_report(const struct btdev_adv_report *report);
+
 const uint8_t *btdev_get_bdaddr(struct btdev *btdev);
 uint8_t *btdev_get_features(struct btdev *btdev);
 
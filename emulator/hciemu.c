@@ -580,6 +580,25 @@ void hciemu_set_master_le_states(struct hciemu *hciemu, const uint8_t *le_states
 	btdev_set_le_states(hciemu->dev, le_states);
 }
 
+static void client_set_acl_config(void *data, void *user_data)
+{
+	struct hciemu_client *client = data;
+
+	btdev_set_acl_config(client->dev, user_data);
+}
+
+bool hciemu_set_acl_config(struct hciemu *hciemu,
+				const struct btdev_acl_config *config)
+{
+	if (!hciemu || !hciemu->dev || !config)
+		return false;
+
+	btdev_set_acl_config(hciemu->dev, config);
+	queue_foreach(hciemu->clients, client_set_acl_config, (void *) config);
+
+	return true;
+}
+
 bool hciemu_add_master_post_command_hook(struct hciemu *hciemu,
 			hciemu_command_func_t function, void *user_data)
 {
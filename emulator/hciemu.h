@@ -13,6 +13,7 @@
 
 struct hciemu;
 struct hciemu_client;
+struct btdev_acl_config;
 
 enum hciemu_type {
 	HCIEMU_TYPE_BREDRLE,
@@ -60,6 +61,9 @@ uint8_t hciemu_get_master_le_scan_enable(struct hciemu *hciemu);
 void hciemu_set_master_le_states(struct hciemu *hciemu,
 						const uint8_t *le_states);
 
+bool hciemu_set_acl_config(struct hciemu *hciemu,
+				const struct btdev_acl_config *config);
+
 typedef void (*hciemu_command_func_t)(uint16_t opcode, const void *data,
 						uint8_t len, void *user_data);
 
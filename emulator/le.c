@@ -2006,7 +2006,7 @@ static void phy_recv_callback(uint16_t type, const void *data,
 	}
 }
 
-struct bt_le *bt_le_new(void)
+static struct bt_le *le_new(const char *phy_name)
 {
 	unsigned char setup_cmd[2];
 	struct bt_le *hci;
@@ -2021,8 +2021,17 @@ struct bt_le *bt_le_new(void)
 
 	reset_defaults(hci);
 
+	if (phy_name) {
+		hci->phy = bt_phy_new_shm(phy_name);
+		if (!hci->phy) {
+			free(hci);
+			return NULL;
+		}
+	}
+
 	hci->vhci_fd = open("/dev/vhci", O_RDWR);
 	if (hci->vhci_fd < 0) {
+		bt_phy_unref(hci->phy);
 		free(hci);
 		return NULL;
 	}
@@ -2032,13 +2041,16 @@ struct bt_le *bt_le_new(void)
 
 	if (write(hci->vhci_fd, setup_cmd, sizeof(setup_cmd)) < 0) {
 		close(hci->vhci_fd);
+		bt_phy_unref(hci->phy);
 		free(hci);
 		return NULL;
 	}
 
 	mainloop_add_fd(hci->vhci_fd, EPOLLIN, vhci_read_callback, hci, NULL);
 
-	hci->phy = bt_phy_new();
+	if (!hci->phy)
+		hci->phy = bt_phy_new();
+
 	hci->crypto = bt_crypto_new();
 
 	bt_phy_register(hci->phy, phy_recv_callback, hci);
@@ -2046,6 +2058,16 @@ struct bt_le *bt_le_new(void)
 	return bt_le_ref(hci);
 }
 
+struct bt_le *bt_le_new(void)
+{
+	return le_new(NULL);
+}
+
+struct bt_le *bt_le_new_shm(const char *phy_name)
+{
+	return le_new(phy_name);
+}
+
 struct bt_le *bt_le_ref(struct bt_le *hci)
 {
 	if (!hci)
@@ -14,6 +14,7 @@
 struct bt_le;
 
 struct bt_le *bt_le_new(void);
+struct bt_le *bt_le_new_shm(const char *phy_name);
 
 struct bt_le *bt_le_ref(struct bt_le *le);
 void bt_le_unref(struct bt_le *le);
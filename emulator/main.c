@@ -17,13 +17,16 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <sys/uio.h>
 
 #include "src/shared/mainloop.h"
+#include "btdev.h"
 #include "serial.h"
 #include "server.h"
 #include "vhci.h"
 #include "amp.h"
 #include "le.h"
+#include "advgen.h"
 
 static void signal_callback(int signum, void *user_data)
 {
@@ -46,9 +49,20 @@ static void usage(void)
 		"\t-l[num]               Number of local controllers\n"
 		"\t-L                    Create LE only controller\n"
 		"\t-U[num]               Number of test LE controllers\n"
+		"\t-P, --phy-shm[=name]  Connect test LE controllers through\n"
+		"\t                      a shared memory radio\n"
 		"\t-B                    Create BR/EDR only controller\n"
 		"\t-A                    Create AMP controller\n"
 		"\t-T[num]               Number of test AMP controllers\n"
+		"\t-m, --acl-mtu <len>   ACL data packet length\n"
+		"\t-p, --acl-pkts <num>  Number of ACL data packets\n"
+		"\t-r, --acl-rate <B/s>  Simulated ACL air rate\n"
+		"\t-d, --acl-latency <ms>\n"
+		"\t                      Simulated ACL air latency\n"
+		"\t-n, --ncp-interval <ms>\n"
+		"\t                      Completed packets event interval\n"
+		"\t-a, --advgen[=file]   Generate advertising reports from a\n"
+		"\t                      parameter file or btsnoop capture\n"
 		"\t-h, --help            Show help options\n");
 }
 
@@ -60,7 +74,14 @@ static const struct option main_options[] = {
 	{ "bredr",   no_argument,       NULL, 'B' },
 	{ "amp",     no_argument,       NULL, 'A' },
 	{ "letest",  optional_argument, NULL, 'U' },
+	{ "phy-shm", optional_argument, NULL, 'P' },
 	{ "amptest", optional_argument, NULL, 'T' },
+	{ "acl-mtu", required_argument, NULL, 'm' },
+	{ "acl-pkts", required_argument, NULL, 'p' },
+	{ "acl-rate", required_argument, NULL, 'r' },
+	{ "acl-latency", required_argument, NULL, 'd' },
+	{ "ncp-interval", required_argument, NULL, 'n' },
+	{ "advgen",  optional_argument, NULL, 'a' },
 	{ "version", no_argument,	NULL, 'v' },
 	{ "help",    no_argument,	NULL, 'h' },
 	{ }
@@ -79,6 +100,10 @@ int main(int argc, char *argv[])
 	int amptest_count = 0;
 	int vhci_count = 0;
 	enum vhci_type vhci_type = VHCI_TYPE_BREDRLE;
+	struct btdev_acl_config acl_config = { };
+	const char *phy_name = NULL;
+	bool advgen_enabled = false;
+	const char *advgen_path = NULL;
 	int i;
 
 	mainloop_init();
@@ -86,7 +111,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "Ssl::LBAU::T::vh",
+		opt = getopt_long(argc, argv, "Ssl::LBAU::P::T::m:p:r:d:n:a::vh",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -119,12 +144,34 @@ int main(int argc, char *argv[])
 			else
 				letest_count = 1;
 			break;
+		case 'P':
+			phy_name = optarg ? optarg : "default";
+			break;
 		case 'T':
 			if (optarg)
 				amptest_count = atoi(optarg);
 			else
 				amptest_count = 1;
 			break;
+		case 'm':
+			acl_config.mtu = atoi(optarg);
+			break;
+		case 'p':
+			acl_config.max_pkt = atoi(optarg);
+			break;
+		case 'r':
+			acl_config.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			acl_config.latency = atoi(optarg);
+			break;
+		case 'n':
+			acl_config.ncp_interval = atoi(optarg);
+			break;
+		case 'a':
+			advgen_enabled = true;
+			advgen_path = optarg;
+			break;
 		case 'v':
 			printf("%s\n", VERSION);
 			return EXIT_SUCCESS;
@@ -147,7 +194,10 @@ int main(int argc, char *argv[])
 	for (i = 0; i < letest_count; i++) {
 		struct bt_le *le;
 
-		le = bt_le_new();
+		if (phy_name)
+			le = bt_le_new_shm(phy_name);
+		else
+			le = bt_le_new();
 		if (!le) {
 			fprintf(stderr, "Failed to create LE controller\n");
 			return EXIT_FAILURE;
@@ -172,6 +222,18 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "Failed to open Virtual HCI device\n");
 			return EXIT_FAILURE;
 		}
+
+		vhci_set_acl_config(vhci, &acl_config);
+	}
+
+	if (advgen_enabled) {
+		struct advgen *advgen;
+
+		advgen = advgen_new(advgen_path);
+		if (!advgen) {
+			fprintf(stderr, "Failed to start advertising generator\n");
+			return EXIT_FAILURE;
+		}
 	}
 
 	if (serial_enabled) {
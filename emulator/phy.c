@@ -14,11 +14,18 @@
 #endif
 
 #define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <time.h>
@@ -30,13 +37,68 @@
 
 #define BT_PHY_PORT 45023
 
+#define SHM_MAGIC		0x42545048	/* BTPH */
+#define SHM_NUM_SLOTS		4096		/* Power of two */
+#define SHM_SLOT_MTU		480
+#define SHM_MAX_PARTICIPANTS	128
+#define SHM_RX_BATCH		256
+
+/* Participant id of an entry whose socket is not bound yet */
+#define SHM_ID_BINDING		UINT64_MAX
+
+/*
+ * Shared memory transport: every participant maps the same ring. Senders
+ * claim a ticket with an atomic increment, fill the slot it maps to and
+ * publish it by storing the ticket + 1 as the slot sequence. Receivers
+ * follow the ring with their own cursor and validate the sequence after
+ * copying, so a receiver that falls a full ring behind loses frames, as
+ * a real receiver would, instead of stalling the senders. The ticket
+ * orders all frames and each one carries the sender's monotonic time.
+ *
+ * Participants that ran out of frames set their waiting flag and sleep
+ * on an abstract unix socket; senders only signal those. A joiner holds
+ * its entry with SHM_ID_BINDING until the socket is bound, so a refused
+ * wake-up only reclaims entries whose owner is really gone.
+ */
+struct shm_slot {
+	uint64_t seq;
+	uint64_t id;
+	uint64_t timestamp;
+	uint16_t type;
+	uint16_t len;
+	uint8_t  data[SHM_SLOT_MTU + 4];
+};
+
+struct shm_participant {
+	uint64_t id;
+	uint32_t waiting;
+	uint32_t reserved;
+};
+
+struct shm_ring {
+	uint32_t magic;
+	uint32_t num_slots;
+	uint32_t slot_size;
+	uint32_t users;
+	uint64_t head;
+	struct shm_participant participants[SHM_MAX_PARTICIPANTS];
+	struct shm_slot slots[SHM_NUM_SLOTS];
+};
+
 struct bt_phy {
 	volatile int ref_count;
 	int rx_fd;
 	int tx_fd;
 	uint64_t id;
+	uint64_t timestamp;
 	bt_phy_callback_func_t callback;
 	void *user_data;
+
+	char *shm_name;
+	struct shm_ring *ring;
+	struct shm_participant *self;
+	uint64_t rx_seq;
+	uint64_t drops;
 };
 
 struct bt_phy_hdr {
@@ -65,6 +127,344 @@ static bool get_random_bytes(void *buf, size_t num_bytes)
 	return true;
 }
 
+static uint64_t get_timestamp(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static socklen_t shm_wake_addr(const char *name, unsigned int index,
+						struct sockaddr_un *addr)
+{
+	int len;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	/* Abstract socket, the leading nul byte is part of the name */
+	len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+					"bt-phy/%s/%u", name, index);
+
+	return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+static void shm_wake(struct bt_phy *phy, unsigned int index)
+{
+	struct shm_participant *p = &phy->ring->participants[index];
+	struct sockaddr_un addr;
+	socklen_t len;
+	uint8_t dummy = 0;
+	uint64_t id;
+
+	/* The owner is only known to be bound once it published its id */
+	id = __atomic_load_n(&p->id, __ATOMIC_ACQUIRE);
+	if (!id || id == SHM_ID_BINDING)
+		return;
+
+	len = shm_wake_addr(phy->shm_name, index, &addr);
+
+	if (sendto(phy->tx_fd, &dummy, 1, MSG_DONTWAIT,
+				(struct sockaddr *) &addr, len) < 0 &&
+							errno == ECONNREFUSED)
+		/*
+		 * The owner seen before the send is gone; if a new one took
+		 * the entry meanwhile the id changed and it is left alone.
+		 */
+		__atomic_compare_exchange_n(&p->id, &id, 0, false,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static bool shm_send(struct bt_phy *phy, uint16_t type,
+					const struct iovec *iov, int iovcnt)
+{
+	struct shm_ring *ring = phy->ring;
+	struct shm_slot *slot;
+	uint64_t ticket;
+	size_t len = 0;
+	unsigned int i;
+	int n;
+
+	for (n = 0; n < iovcnt; n++)
+		len += iov[n].iov_len;
+
+	if (len > SHM_SLOT_MTU)
+		return false;
+
+	ticket = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+	slot = &ring->slots[ticket & (SHM_NUM_SLOTS - 1)];
+
+	/* Invalidate the slot before overwriting it */
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->id = phy->id;
+	slot->timestamp = get_timestamp();
+	slot->type = type;
+	slot->len = len;
+
+	for (n = 0, len = 0; n < iovcnt; n++) {
+		memcpy(slot->data + len, iov[n].iov_base, iov[n].iov_len);
+		len += iov[n].iov_len;
+	}
+
+	__atomic_store_n(&slot->seq, ticket + 1, __ATOMIC_RELEASE);
+
+	/* Pairs with the fence after a receiver sets its waiting flag */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	for (i = 0; i < SHM_MAX_PARTICIPANTS; i++) {
+		struct shm_participant *p = &ring->participants[i];
+
+		if (p == phy->self ||
+				!__atomic_load_n(&p->waiting, __ATOMIC_RELAXED))
+			continue;
+
+		if (__atomic_exchange_n(&p->waiting, 0, __ATOMIC_RELAXED))
+			shm_wake(phy, i);
+	}
+
+	return true;
+}
+
+static bool shm_pending(struct bt_phy *phy)
+{
+	struct shm_slot *slot;
+
+	slot = &phy->ring->slots[phy->rx_seq & (SHM_NUM_SLOTS - 1)];
+
+	return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) > phy->rx_seq;
+}
+
+static unsigned int shm_receive(struct bt_phy *phy)
+{
+	struct shm_ring *ring = phy->ring;
+	unsigned int count;
+
+	for (count = 0; count < SHM_RX_BATCH; count++) {
+		struct shm_slot *slot;
+		uint64_t seq, id, timestamp;
+		uint16_t type, len;
+		uint8_t buf[SHM_SLOT_MTU];
+
+		slot = &ring->slots[phy->rx_seq & (SHM_NUM_SLOTS - 1)];
+
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq <= phy->rx_seq)
+			break;
+
+		id = slot->id;
+		timestamp = slot->timestamp;
+		type = slot->type;
+		len = slot->len;
+		if (len <= sizeof(buf))
+			memcpy(buf, slot->data, len);
+
+		/* The slot may have been reused while copying */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (seq != phy->rx_seq + 1 || len > sizeof(buf) ||
+				__atomic_load_n(&slot->seq,
+						__ATOMIC_RELAXED) != seq) {
+			/* Overrun, skip ahead to the oldest valid frame */
+			seq = __atomic_load_n(&ring->head, __ATOMIC_RELAXED) -
+							SHM_NUM_SLOTS / 2;
+			if ((int64_t) (seq - phy->rx_seq) <= 0)
+				seq = phy->rx_seq + 1;
+
+			phy->drops += seq - phy->rx_seq;
+			phy->rx_seq = seq;
+			continue;
+		}
+
+		phy->rx_seq++;
+
+		if (id == phy->id)
+			continue;
+
+		phy->timestamp = timestamp;
+
+		if (phy->callback)
+			phy->callback(type, buf, len, phy->user_data);
+	}
+
+	return count;
+}
+
+static void shm_rx_callback(int fd, uint32_t events, void *user_data)
+{
+	struct bt_phy *phy = user_data;
+	uint8_t buf[64];
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		mainloop_remove_fd(fd);
+		return;
+	}
+
+	while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+
+	while (shm_receive(phy) < SHM_RX_BATCH) {
+		__atomic_store_n(&phy->self->waiting, 1, __ATOMIC_RELAXED);
+
+		/* Pairs with the fence after a sender publishes a slot */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		if (!shm_pending(phy))
+			return;
+
+		__atomic_store_n(&phy->self->waiting, 0, __ATOMIC_RELAXED);
+	}
+
+	/* Let other sources run and come back for the rest */
+	shm_wake(phy, phy->self - phy->ring->participants);
+}
+
+static struct shm_ring *shm_map(const char *path)
+{
+	struct shm_ring *ring;
+	struct stat st;
+	bool created = true;
+	int fd, i;
+
+	fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0 && errno == EEXIST) {
+		fd = shm_open(path, O_RDWR | O_CLOEXEC, 0);
+		created = false;
+	}
+
+	if (fd < 0)
+		return NULL;
+
+	if (created && ftruncate(fd, sizeof(*ring)) < 0) {
+		close(fd);
+		shm_unlink(path);
+		return NULL;
+	}
+
+	/* Wait for the creator to size the segment */
+	for (i = 0; i < 1000; i++) {
+		if (fstat(fd, &st) < 0 || st.st_size == sizeof(*ring))
+			break;
+
+		usleep(1000);
+	}
+
+	if (st.st_size != sizeof(*ring)) {
+		close(fd);
+		return NULL;
+	}
+
+	ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED,
+								fd, 0);
+	close(fd);
+
+	if (ring == MAP_FAILED)
+		return NULL;
+
+	if (created) {
+		ring->num_slots = SHM_NUM_SLOTS;
+		ring->slot_size = sizeof(struct shm_slot);
+		__atomic_store_n(&ring->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+		return ring;
+	}
+
+	for (i = 0; i < 1000; i++) {
+		if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) ==
+								SHM_MAGIC)
+			break;
+
+		usleep(1000);
+	}
+
+	if (ring->magic != SHM_MAGIC || ring->num_slots != SHM_NUM_SLOTS ||
+				ring->slot_size != sizeof(struct shm_slot)) {
+		munmap(ring, sizeof(*ring));
+		return NULL;
+	}
+
+	return ring;
+}
+
+static bool shm_join(struct bt_phy *phy)
+{
+	struct shm_ring *ring = phy->ring;
+	struct sockaddr_un addr;
+	socklen_t len;
+	unsigned int i;
+
+	phy->rx_fd = socket(PF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+									0);
+	if (phy->rx_fd < 0)
+		return false;
+
+	for (i = 0; i < SHM_MAX_PARTICIPANTS; i++) {
+		struct shm_participant *p = &ring->participants[i];
+		uint64_t id = 0;
+
+		if (!__atomic_compare_exchange_n(&p->id, &id, SHM_ID_BINDING,
+				false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			continue;
+
+		len = shm_wake_addr(phy->shm_name, i, &addr);
+		if (bind(phy->rx_fd, (struct sockaddr *) &addr, len) < 0) {
+			/* Still bound by a live owner, leave the entry alone */
+			__atomic_store_n(&p->id, id, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		p->waiting = 0;
+		__atomic_store_n(&p->id, phy->id, __ATOMIC_RELEASE);
+		phy->self = p;
+		break;
+	}
+
+	if (!phy->self) {
+		close(phy->rx_fd);
+		return false;
+	}
+
+	__atomic_fetch_add(&ring->users, 1, __ATOMIC_RELAXED);
+
+	phy->rx_seq = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	phy->tx_fd = socket(PF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (phy->tx_fd < 0) {
+		__atomic_store_n(&phy->self->id, 0, __ATOMIC_RELEASE);
+		__atomic_fetch_sub(&ring->users, 1, __ATOMIC_RELAXED);
+		close(phy->rx_fd);
+		return false;
+	}
+
+	mainloop_add_fd(phy->rx_fd, EPOLLIN, shm_rx_callback, phy, NULL);
+
+	/* Frames may have been sent between the head read and the watch */
+	shm_wake(phy, i);
+
+	return true;
+}
+
+static void shm_leave(struct bt_phy *phy)
+{
+	struct shm_ring *ring = phy->ring;
+	char path[NAME_MAX];
+
+	mainloop_remove_fd(phy->rx_fd);
+
+	close(phy->tx_fd);
+	close(phy->rx_fd);
+
+	__atomic_store_n(&phy->self->id, 0, __ATOMIC_RELEASE);
+
+	if (__atomic_sub_fetch(&ring->users, 1, __ATOMIC_ACQ_REL) == 0) {
+		snprintf(path, sizeof(path), "/bt-phy-%s", phy->shm_name);
+		shm_unlink(path);
+	}
+
+	munmap(ring, sizeof(*ring));
+}
+
 static void phy_rx_callback(int fd, uint32_t events, void *user_data)
 {
 	struct bt_phy *phy = user_data;
@@ -98,6 +498,9 @@ static void phy_rx_callback(int fd, uint32_t events, void *user_data)
 	if (le64_to_cpu(hdr.id) == phy->id)
 		return;
 
+	/* The sender may be on another host, only the arrival time is usable */
+	phy->timestamp = get_timestamp();
+
 	if (len - sizeof(hdr) != le16_to_cpu(hdr.len))
 		return;
 
@@ -182,6 +585,54 @@ struct bt_phy *bt_phy_new(void)
 	return bt_phy_ref(phy);
 }
 
+struct bt_phy *bt_phy_new_shm(const char *name)
+{
+	struct bt_phy *phy;
+	char path[NAME_MAX];
+
+	if (!name || strchr(name, '/'))
+		return NULL;
+
+	phy = calloc(1, sizeof(*phy));
+	if (!phy)
+		return NULL;
+
+	phy->shm_name = strdup(name);
+	if (!phy->shm_name) {
+		free(phy);
+		return NULL;
+	}
+
+	snprintf(path, sizeof(path), "/bt-phy-%s", name);
+
+	phy->ring = shm_map(path);
+	if (!phy->ring)
+		goto failed;
+
+	if (!get_random_bytes(&phy->id, sizeof(phy->id))) {
+		srandom(time(NULL) ^ getpid());
+		phy->id = random();
+	}
+
+	if (!phy->id || phy->id == SHM_ID_BINDING)
+		phy->id = 1;
+
+	if (!shm_join(phy)) {
+		munmap(phy->ring, sizeof(*phy->ring));
+		goto failed;
+	}
+
+	bt_phy_send(phy, BT_PHY_PKT_NULL, NULL, 0);
+
+	return bt_phy_ref(phy);
+
+failed:
+	free(phy->shm_name);
+	free(phy);
+
+	return NULL;
+}
+
 struct bt_phy *bt_phy_ref(struct bt_phy *phy)
 {
 	if (!phy)
@@ -200,6 +651,13 @@ void bt_phy_unref(struct bt_phy *phy)
 	if (__sync_sub_and_fetch(&phy->ref_count, 1))
 		return;
 
+	if (phy->ring) {
+		shm_leave(phy);
+		free(phy->shm_name);
+		free(phy);
+		return;
+	}
+
 	mainloop_remove_fd(phy->rx_fd);
 
 	close(phy->tx_fd);
@@ -267,6 +725,9 @@ bool bt_phy_send_vector(struct bt_phy *phy, uint16_t type,
 		msg.msg_iovlen++;
 	}
 
+	if (phy->ring)
+		return shm_send(phy, type, iov + 1, msg.msg_iovlen - 1);
+
 	memset(&addr, 0, sizeof(addr));
 	addr.sin_family = AF_INET;
 	addr.sin_port = htons(BT_PHY_PORT);
@@ -279,6 +740,14 @@ bool bt_phy_send_vector(struct bt_phy *phy, uint16_t type,
 	return true;
 }
 
+uint64_t bt_phy_get_timestamp(struct bt_phy *phy)
+{
+	if (!phy)
+		return 0;
+
+	return phy->timestamp;
+}
+
 bool bt_phy_register(struct bt_phy *phy, bt_phy_callback_func_t callback,
 							void *user_data)
 {
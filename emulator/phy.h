@@ -15,6 +15,7 @@
 struct bt_phy;
 
 struct bt_phy *bt_phy_new(void);
+struct bt_phy *bt_phy_new_shm(const char *name);
 
 struct bt_phy *bt_phy_ref(struct bt_phy *phy);
 void bt_phy_unref(struct bt_phy *phy);
@@ -32,6 +33,13 @@ typedef void (*bt_phy_callback_func_t)(uint16_t type, const void *data,
 bool bt_phy_register(struct bt_phy *phy, bt_phy_callback_func_t callback,
 							void *user_data);
 
+/*
+ * Time of the frame being received, in CLOCK_MONOTONIC nanoseconds. Shared
+ * memory frames carry their send time; UDP frames may come from another
+ * host whose clock is unrelated, so for them this is the arrival time.
+ */
+uint64_t bt_phy_get_timestamp(struct bt_phy *phy);
+
 #define BT_PHY_PKT_NULL		0x0000
 
 #define BT_PHY_PKT_ADV		0x0001
@@ -158,3 +158,12 @@ void vhci_close(struct vhci *vhci)
 
 	mainloop_remove_fd(vhci->fd);
 }
+
+bool vhci_set_acl_config(struct vhci *vhci,
+				const struct btdev_acl_config *config)
+{
+	if (!vhci)
+		return false;
+
+	return btdev_set_acl_config(vhci->btdev, config);
+}
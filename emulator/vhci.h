@@ -10,6 +10,7 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 
 enum vhci_type {
 	VHCI_TYPE_BREDRLE,
@@ -19,6 +20,9 @@ enum vhci_type {
 };
 
 struct vhci;
+struct btdev_acl_config;
 
 struct vhci *vhci_open(enum vhci_type type);
 void vhci_close(struct vhci *vhci);
+bool vhci_set_acl_config(struct vhci *vhci,
+				const struct btdev_acl_config *config);
@@ -37,7 +37,10 @@ typedef enum {
 
 struct agent_request {
 	agent_request_type_t type;
+	struct mesh_agent *agent;
 	struct l_dbus_message *msg;
+	l_dbus_message_func_t reply_cb;
+	uint32_t serial;
 	void *cb;
 	void *user_data;
 };
@@ -46,7 +49,7 @@ struct mesh_agent {
 	char *path;
 	char *owner;
 	struct mesh_agent_prov_caps caps;
-	struct agent_request *req;
+	struct l_queue *requests;
 };
 
 struct prov_action {
@@ -179,9 +182,9 @@ static bool parse_properties(struct mesh_agent *agent,
 	return true;
 }
 
-static void agent_free(void *agent_data)
+static void fail_request(void *data)
 {
-	struct mesh_agent *agent = agent_data;
+	struct agent_request *req = data;
 	int err;
 	mesh_agent_cb_t simple_cb;
 	mesh_agent_key_cb_t key_cb;
@@ -189,9 +192,11 @@ static void agent_free(void *agent_data)
 
 	err = MESH_ERROR_DOES_NOT_EXIST;
 
-	if (agent->req && agent->req->cb) {
-		struct agent_request *req = agent->req;
+	/* The reply will never be delivered now */
+	if (req->serial)
+		l_dbus_cancel(dbus_get_bus(), req->serial);
 
+	if (req->cb) {
 		switch (req->type) {
 		case MESH_AGENT_REQUEST_PUSH:
 		case MESH_AGENT_REQUEST_TWIST:
@@ -212,16 +217,23 @@ static void agent_free(void *agent_data)
 		case MESH_AGENT_REQUEST_OUT_NUMERIC:
 		case MESH_AGENT_REQUEST_OUT_ALPHA:
 		case MESH_AGENT_REQUEST_CAPABILITIES:
-			simple_cb = agent->req->cb;
+			simple_cb = req->cb;
 			simple_cb(req->user_data, err);
 		default:
 			break;
 		}
-
-		l_dbus_message_unref(req->msg);
-		l_free(req);
 	}
 
+	l_dbus_message_unref(req->msg);
+	l_free(req);
+}
+
+static void agent_free(void *agent_data)
+{
+	struct mesh_agent *agent = agent_data;
+
+	l_queue_destroy(agent->requests, fail_request);
+
 	l_free(agent->path);
 	l_free(agent->owner);
 	l_free(agent);
@@ -260,8 +272,10 @@ struct mesh_agent *mesh_agent_create(const char *path, const char *owner,
 	agent = l_new(struct mesh_agent, 1);
 	agent->owner = l_strdup(owner);
 	agent->path = l_strdup(path);
+	agent->requests = l_queue_new();
 
 	if (!parse_properties(agent, properties)) {
+		l_queue_destroy(agent->requests, NULL);
 		l_free(agent);
 		return NULL;
 	}
@@ -279,7 +293,8 @@ struct mesh_agent_prov_caps *mesh_agent_get_caps(struct mesh_agent *agent)
 	return &agent->caps;
 }
 
-static struct agent_request *create_request(agent_request_type_t type,
+static struct agent_request *create_request(struct mesh_agent *agent,
+						agent_request_type_t type,
 						void *cb, void *data)
 {
 	struct agent_request *req;
@@ -287,9 +302,71 @@ static struct agent_request *create_request(agent_request_type_t type,
 	req = l_new(struct agent_request, 1);
 
 	req->type = type;
+	req->agent = agent;
 	req->cb = cb;
 	req->user_data = data;
 
+	l_queue_push_tail(agent->requests, req);
+
+	return req;
+}
+
+static void send_request(struct agent_request *req)
+{
+	req->serial = l_dbus_send_with_reply(dbus_get_bus(),
+					l_dbus_message_ref(req->msg),
+					req->reply_cb, req, NULL);
+}
+
+static bool interactive_match(const void *a, const void *b)
+{
+	const struct agent_request *req = a;
+	bool sent = L_PTR_TO_UINT(b);
+
+	return req->type != MESH_AGENT_REQUEST_CAPABILITIES &&
+						!!req->serial == sent;
+}
+
+/*
+ * Several provisioning sessions may share one agent, so requests are
+ * tracked individually. Only one user interaction is shown at a time,
+ * the others wait in the agent queue in the order they were made.
+ */
+static void queue_request(struct agent_request *req,
+					struct l_dbus_message *msg,
+					l_dbus_message_func_t reply_cb)
+{
+	req->msg = msg;
+	req->reply_cb = reply_cb;
+
+	if (!l_queue_find(req->agent->requests, interactive_match,
+							L_UINT_TO_PTR(true)))
+		send_request(req);
+}
+
+static void send_next_request(struct mesh_agent *agent)
+{
+	struct agent_request *req;
+
+	if (l_queue_find(agent->requests, interactive_match,
+							L_UINT_TO_PTR(true)))
+		return;
+
+	req = l_queue_find(agent->requests, interactive_match,
+							L_UINT_TO_PTR(false));
+	if (req)
+		send_request(req);
+}
+
+static struct agent_request *reply_request(void *user_data)
+{
+	struct agent_request *req = user_data;
+
+	if (!l_queue_remove(req->agent->requests, req))
+		return NULL;
+
+	send_next_request(req->agent);
+
 	return req;
 }
 
@@ -309,17 +386,15 @@ static int get_reply_error(struct l_dbus_message *reply)
 
 static void properties_reply(struct l_dbus_message *reply, void *user_data)
 {
-	struct mesh_agent *agent = user_data;
 	struct agent_request *req;
 	mesh_agent_cb_t cb;
 	struct l_dbus_message_iter properties;
 	int err;
 
-	if (!l_queue_find(agents, simple_match, agent) || !agent->req)
+	req = reply_request(user_data);
+	if (!req)
 		return;
 
-	req = agent->req;
-
 	err = get_reply_error(reply);
 
 	if (err != MESH_ERROR_NONE)
@@ -330,7 +405,7 @@ static void properties_reply(struct l_dbus_message *reply, void *user_data)
 		goto done;
 	}
 
-	if (!parse_properties(agent, &properties))
+	if (!parse_properties(req->agent, &properties))
 		err = MESH_ERROR_FAILED;
 
 done:
@@ -341,17 +416,17 @@ done:
 
 	l_dbus_message_unref(req->msg);
 	l_free(req);
-	agent->req = NULL;
 }
 
 void mesh_agent_refresh(struct mesh_agent *agent, mesh_agent_cb_t cb,
 							void *user_data)
 {
 	struct l_dbus *dbus = dbus_get_bus();
+	struct agent_request *req;
 	struct l_dbus_message *msg;
 	struct l_dbus_message_builder *builder;
 
-	agent->req = create_request(MESH_AGENT_REQUEST_CAPABILITIES, (void *)cb,
+	req = create_request(agent, MESH_AGENT_REQUEST_CAPABILITIES, (void *)cb,
 								user_data);
 
 	msg = l_dbus_message_new_method_call(dbus, agent->owner, agent->path,
@@ -364,25 +439,22 @@ void mesh_agent_refresh(struct mesh_agent *agent, mesh_agent_cb_t cb,
 	l_dbus_message_builder_finalize(builder);
 	l_dbus_message_builder_destroy(builder);
 
-	l_dbus_send_with_reply(dbus_get_bus(), msg, properties_reply, agent,
-									NULL);
-
-	agent->req->msg = l_dbus_message_ref(msg);
+	req->msg = msg;
+	req->reply_cb = properties_reply;
+	send_request(req);
 }
 
 
 static void simple_reply(struct l_dbus_message *reply, void *user_data)
 {
-	struct mesh_agent *agent = user_data;
 	struct agent_request *req;
 	mesh_agent_cb_t cb;
 	int err;
 
-	if (!l_queue_find(agents, simple_match, agent) || !agent->req)
+	req = reply_request(user_data);
+	if (!req)
 		return;
 
-	req = agent->req;
-
 	err = get_reply_error(reply);
 
 	l_dbus_message_unref(req->msg);
@@ -393,22 +465,19 @@ static void simple_reply(struct l_dbus_message *reply, void *user_data)
 	}
 
 	l_free(req);
-	agent->req = NULL;
 }
 
 static void numeric_reply(struct l_dbus_message *reply, void *user_data)
 {
-	struct mesh_agent *agent = user_data;
 	struct agent_request *req;
 	mesh_agent_number_cb_t cb;
 	uint32_t count;
 	int err;
 
-	if (!l_queue_find(agents, simple_match, agent) || !agent->req)
+	req = reply_request(user_data);
+	if (!req)
 		return;
 
-	req = agent->req;
-
 	err = get_reply_error(reply);
 
 	count = 0;
@@ -428,12 +497,10 @@ static void numeric_reply(struct l_dbus_message *reply, void *user_data)
 	}
 
 	l_free(req);
-	agent->req = NULL;
 }
 
 static void key_reply(struct l_dbus_message *reply, void *user_data)
 {
-	struct mesh_agent *agent = user_data;
 	struct agent_request *req;
 	mesh_agent_key_cb_t cb;
 	struct l_dbus_message_iter iter_array;
@@ -441,11 +508,10 @@ static void key_reply(struct l_dbus_message *reply, void *user_data)
 	uint8_t *buf = NULL;
 	int err;
 
-	if (!l_queue_find(agents, simple_match, agent) || !agent->req)
+	req = reply_request(user_data);
+	if (!req)
 		return;
 
-	req = agent->req;
-
 	err = get_reply_error(reply);
 
 	if (err != MESH_ERROR_NONE)
@@ -485,7 +551,6 @@ done:
 	l_dbus_message_unref(req->msg);
 
 	l_free(req);
-	agent->req = NULL;
 }
 
 static int output_request(struct mesh_agent *agent, const char *action,
@@ -493,16 +558,14 @@ static int output_request(struct mesh_agent *agent, const char *action,
 					void *cb, void *user_data)
 {
 	struct l_dbus *dbus = dbus_get_bus();
+	struct agent_request *req;
 	struct l_dbus_message *msg;
 	struct l_dbus_message_builder *builder;
 
 	if (!l_queue_find(agents, simple_match, agent))
 		return MESH_ERROR_DOES_NOT_EXIST;
 
-	if (agent->req)
-		return MESH_ERROR_BUSY;
-
-	agent->req = create_request(type, cb, user_data);
+	req = create_request(agent, type, cb, user_data);
 	msg = l_dbus_message_new_method_call(dbus, agent->owner, agent->path,
 						MESH_PROVISION_AGENT_INTERFACE,
 						"DisplayNumeric");
@@ -516,10 +579,7 @@ static int output_request(struct mesh_agent *agent, const char *action,
 	l_debug("Send DisplayNumeric request to %s %s",
 						agent->owner, agent->path);
 
-	l_dbus_send_with_reply(dbus_get_bus(), msg, simple_reply, agent,
-									NULL);
-
-	agent->req->msg = l_dbus_message_ref(msg);
+	queue_request(req, msg, simple_reply);
 
 	return MESH_ERROR_NONE;
 }
@@ -529,6 +589,7 @@ static int prompt_input(struct mesh_agent *agent, const char *action,
 					void *cb, void *user_data)
 {
 	struct l_dbus *dbus = dbus_get_bus();
+	struct agent_request *req;
 	struct l_dbus_message *msg;
 	struct l_dbus_message_builder *builder;
 	const char *method_name;
@@ -537,10 +598,7 @@ static int prompt_input(struct mesh_agent *agent, const char *action,
 	if (!l_queue_find(agents, simple_match, agent))
 		return MESH_ERROR_DOES_NOT_EXIST;
 
-	if (agent->req)
-		return MESH_ERROR_BUSY;
-
-	agent->req = create_request(type, cb, user_data);
+	req = create_request(agent, type, cb, user_data);
 
 	method_name = numeric ? "PromptNumeric" : "PromptStatic";
 
@@ -559,9 +617,7 @@ static int prompt_input(struct mesh_agent *agent, const char *action,
 
 	reply_cb = numeric ? numeric_reply : key_reply;
 
-	l_dbus_send_with_reply(dbus_get_bus(), msg, reply_cb, agent, NULL);
-
-	agent->req->msg = l_dbus_message_ref(msg);
+	queue_request(req, msg, reply_cb);
 
 	return MESH_ERROR_NONE;
 }
@@ -571,16 +627,14 @@ static int request_key(struct mesh_agent *agent,
 					void *cb, void *user_data)
 {
 	struct l_dbus *dbus = dbus_get_bus();
+	struct agent_request *req;
 	struct l_dbus_message *msg;
 	const char *method_name;
 
 	if (!l_queue_find(agents, simple_match, agent))
 		return MESH_ERROR_DOES_NOT_EXIST;
 
-	if (agent->req)
-		return MESH_ERROR_BUSY;
-
-	agent->req = create_request(type, cb, user_data);
+	req = create_request(agent, type, cb, user_data);
 
 	method_name = (type == MESH_AGENT_REQUEST_PRIVATE_KEY) ?
 						"PrivateKey" : "PublicKey";
@@ -594,9 +648,7 @@ static int request_key(struct mesh_agent *agent,
 
 	l_debug("Send key request to %s %s", agent->owner, agent->path);
 
-	l_dbus_send_with_reply(dbus_get_bus(), msg, key_reply, agent, NULL);
-
-	agent->req->msg = l_dbus_message_ref(msg);
+	queue_request(req, msg, key_reply);
 
 	return MESH_ERROR_NONE;
 }
@@ -605,16 +657,14 @@ int mesh_agent_display_string(struct mesh_agent *agent, const char *str,
 				mesh_agent_cb_t cb, void *user_data)
 {
 	struct l_dbus *dbus = dbus_get_bus();
+	struct agent_request *req;
 	struct l_dbus_message *msg;
 	struct l_dbus_message_builder *builder;
 
 	if (!l_queue_find(agents, simple_match, agent))
 		return MESH_ERROR_DOES_NOT_EXIST;
 
-	if (agent->req)
-		return MESH_ERROR_BUSY;
-
-	agent->req = create_request(MESH_AGENT_REQUEST_OUT_ALPHA,
+	req = create_request(agent, MESH_AGENT_REQUEST_OUT_ALPHA,
 								cb, user_data);
 	msg = l_dbus_message_new_method_call(dbus, agent->owner, agent->path,
 						MESH_PROVISION_AGENT_INTERFACE,
@@ -628,10 +678,7 @@ int mesh_agent_display_string(struct mesh_agent *agent, const char *str,
 	l_debug("Send DisplayString request to %s %s",
 						agent->owner, agent->path);
 
-	l_dbus_send_with_reply(dbus_get_bus(), msg, simple_reply, agent,
-									NULL);
-
-	agent->req->msg = l_dbus_message_ref(msg);
+	queue_request(req, msg, simple_reply);
 
 	return MESH_ERROR_NONE;
 
@@ -731,3 +778,38 @@ void mesh_agent_cancel(struct mesh_agent *agent)
 
 	l_dbus_send(dbus, msg);
 }
+
+static bool request_user_match(const void *a, const void *b)
+{
+	const struct agent_request *req = a;
+
+	return req->user_data == b;
+}
+
+/*
+ * Drops the requests made on behalf of a session that is going away, so
+ * the agent is not prompted for it anymore. An interaction in progress
+ * is cancelled on the agent side and the next queued one is shown.
+ */
+void mesh_agent_cancel_requests(struct mesh_agent *agent, void *user_data)
+{
+	struct agent_request *req;
+
+	if (!l_queue_find(agents, simple_match, agent))
+		return;
+
+	while ((req = l_queue_remove_if(agent->requests, request_user_match,
+							user_data))) {
+		if (req->serial) {
+			l_dbus_cancel(dbus_get_bus(), req->serial);
+
+			if (req->type != MESH_AGENT_REQUEST_CAPABILITIES)
+				mesh_agent_cancel(agent);
+		}
+
+		l_dbus_message_unref(req->msg);
+		l_free(req);
+	}
+
+	send_next_request(agent);
+}
@@ -38,6 +38,7 @@ void mesh_agent_refresh(struct mesh_agent *agent, mesh_agent_cb_t cb,
 
 void mesh_agent_remove(struct mesh_agent *agent);
 void mesh_agent_cancel(struct mesh_agent *agent);
+void mesh_agent_cancel_requests(struct mesh_agent *agent, void *user_data);
 
 struct mesh_agent_prov_caps *mesh_agent_get_caps(struct mesh_agent *agent);
 
@@ -32,8 +32,76 @@ struct mesh_app_key {
 	uint8_t key_aid;
 	uint8_t new_key[16];
 	uint8_t new_key_aid;
+	struct mesh_ccm_cipher *cipher;
+	struct mesh_ccm_cipher *new_cipher;
 };
 
+/*
+ * Application keys bucketed by AID. A key sits in the bucket of its
+ * current AID and, while a Key Refresh is in progress, also in the bucket
+ * of its updated AID, so the receive path only tries keys that can match.
+ */
+struct appkey_index {
+	struct l_queue *aids[KEY_AID_MASK + 1];
+};
+
+struct appkey_index *appkey_index_new(void)
+{
+	return l_new(struct appkey_index, 1);
+}
+
+void appkey_index_free(struct appkey_index *index)
+{
+	int i;
+
+	if (!index)
+		return;
+
+	for (i = 0; i <= KEY_AID_MASK; i++)
+		l_queue_destroy(index->aids[i], NULL);
+
+	l_free(index);
+}
+
+static void index_aid(struct appkey_index *index, uint8_t key_aid,
+						struct mesh_app_key *key)
+{
+	struct l_queue **bucket = &index->aids[key_aid & KEY_AID_MASK];
+
+	if (!*bucket)
+		*bucket = l_queue_new();
+
+	l_queue_push_tail(*bucket, key);
+}
+
+static void index_key(struct mesh_net *net, struct mesh_app_key *key)
+{
+	struct appkey_index *index = mesh_net_get_app_index(net);
+
+	if (!index)
+		return;
+
+	index_aid(index, key->key_aid, key);
+
+	if (key->new_key_aid != APP_AID_INVALID &&
+					key->new_key_aid != key->key_aid)
+		index_aid(index, key->new_key_aid, key);
+}
+
+static void unindex_key(struct mesh_net *net, struct mesh_app_key *key)
+{
+	struct appkey_index *index = mesh_net_get_app_index(net);
+
+	if (!index)
+		return;
+
+	l_queue_remove(index->aids[key->key_aid & KEY_AID_MASK], key);
+
+	if (key->new_key_aid != APP_AID_INVALID)
+		l_queue_remove(index->aids[key->new_key_aid & KEY_AID_MASK],
+									key);
+}
+
 static bool match_key_index(const void *a, const void *b)
 {
 	const struct mesh_app_key *key = a;
@@ -50,33 +118,41 @@ static bool match_bound_key(const void *a, const void *b)
 	return key->net_idx == idx;
 }
 
-static void finalize_key(void *a, void *b)
+static void finalize_key(struct mesh_net *net, struct mesh_app_key *key,
+							uint16_t net_idx)
 {
-	struct mesh_app_key *key = a;
-	uint16_t net_idx = L_PTR_TO_UINT(b);
-
 	if (key->net_idx != net_idx)
 		return;
 
 	if (key->new_key_aid == APP_AID_INVALID)
 		return;
 
+	unindex_key(net, key);
+
 	key->key_aid = key->new_key_aid;
 
 	key->new_key_aid = APP_AID_INVALID;
 
 	memcpy(key->key, key->new_key, 16);
+
+	mesh_crypto_ccm_cipher_free(key->cipher);
+	key->cipher = key->new_cipher;
+	key->new_cipher = NULL;
+
+	index_key(net, key);
 }
 
 void appkey_finalize(struct mesh_net *net, uint16_t net_idx)
 {
+	const struct l_queue_entry *entry;
 	struct l_queue *app_keys;
 
 	app_keys = mesh_net_get_app_keys(net);
 	if (!app_keys)
 		return;
 
-	l_queue_foreach(app_keys, finalize_key, L_UINT_TO_PTR(net_idx));
+	for (entry = l_queue_get_entries(app_keys); entry; entry = entry->next)
+		finalize_key(net, entry->data, net_idx);
 }
 
 static struct mesh_app_key *app_key_new(void)
@@ -90,6 +166,7 @@ static struct mesh_app_key *app_key_new(void)
 static bool set_key(struct mesh_app_key *key, uint16_t app_idx,
 			const uint8_t *key_value, bool is_new)
 {
+	struct mesh_ccm_cipher **cipher;
 	uint8_t key_aid;
 
 	if (!mesh_crypto_k4(key_value, &key_aid))
@@ -103,6 +180,10 @@ static bool set_key(struct mesh_app_key *key, uint16_t app_idx,
 
 	memcpy(is_new ? key->new_key : key->key, key_value, 16);
 
+	cipher = is_new ? &key->new_cipher : &key->cipher;
+	mesh_crypto_ccm_cipher_free(*cipher);
+	*cipher = mesh_crypto_ccm_cipher_new(key_value);
+
 	return true;
 }
 
@@ -113,6 +194,8 @@ void appkey_key_free(void *data)
 	if (!key)
 		return;
 
+	mesh_crypto_ccm_cipher_free(key->cipher);
+	mesh_crypto_ccm_cipher_free(key->new_cipher);
 	l_free(key);
 }
 
@@ -146,6 +229,7 @@ bool appkey_key_init(struct mesh_net *net, uint16_t net_idx, uint16_t app_idx,
 		return false;
 
 	l_queue_push_tail(app_keys, key);
+	index_key(net, key);
 
 	return true;
 }
@@ -182,24 +266,49 @@ const uint8_t *appkey_get_key(struct mesh_net *net, uint16_t app_idx,
 	return app_key->new_key;
 }
 
-int appkey_get_key_idx(struct mesh_app_key *app_key,
-				const uint8_t **key, uint8_t *key_aid,
-				const uint8_t **new_key, uint8_t *new_key_aid)
+const struct l_queue_entry *appkey_get_aid_keys(struct mesh_net *net,
+							uint8_t key_aid)
+{
+	struct appkey_index *index = mesh_net_get_app_index(net);
+
+	if (!index)
+		return NULL;
+
+	return l_queue_get_entries(index->aids[key_aid & KEY_AID_MASK]);
+}
+
+int appkey_packet_decrypt(struct mesh_app_key *app_key, uint8_t key_aid,
+				uint8_t *virt, uint16_t virt_size,
+				const uint8_t *data, uint16_t size, bool szmict,
+				uint16_t src, uint16_t dst, uint32_t seq,
+				uint32_t iv_idx, uint8_t *out)
 {
 	if (!app_key)
 		return -1;
 
-	if (key && key_aid) {
-		*key = app_key->key;
-		*key_aid = app_key->key_aid;
+	if (app_key->cipher && app_key->key_aid == key_aid) {
+		if (mesh_crypto_ccm_cipher_payload_decrypt(app_key->cipher,
+					virt, virt_size, data, size, szmict,
+					src, dst, key_aid, seq, iv_idx, out)) {
+			print_packet("Used App Key", app_key->key, 16);
+			return app_key->app_idx;
+		}
+
+		print_packet("Failed App Key", app_key->key, 16);
 	}
 
-	if (new_key && new_key_aid) {
-		*new_key = app_key->new_key;
-		*new_key_aid = app_key->new_key_aid;
+	if (app_key->new_cipher && app_key->new_key_aid == key_aid) {
+		if (mesh_crypto_ccm_cipher_payload_decrypt(app_key->new_cipher,
+					virt, virt_size, data, size, szmict,
+					src, dst, key_aid, seq, iv_idx, out)) {
+			print_packet("Used App Key", app_key->new_key, 16);
+			return app_key->app_idx;
+		}
+
+		print_packet("Failed App Key", app_key->new_key, 16);
 	}
 
-	return app_key->app_idx;
+	return -1;
 }
 
 bool appkey_have_key(struct mesh_net *net, uint16_t app_idx)
@@ -267,8 +376,14 @@ int appkey_key_update(struct mesh_net *net, uint16_t net_idx, uint16_t app_idx,
 	if (memcmp(new_key, key->new_key, 16) == 0)
 		return MESH_STATUS_SUCCESS;
 
-	if (!set_key(key, app_idx, new_key, true))
+	unindex_key(net, key);
+
+	if (!set_key(key, app_idx, new_key, true)) {
+		index_key(net, key);
 		return MESH_STATUS_INSUFF_RESOURCES;
+	}
+
+	index_key(net, key);
 
 	node = mesh_net_node_get(net);
 
@@ -322,6 +437,7 @@ int appkey_key_add(struct mesh_net *net, uint16_t net_idx, uint16_t app_idx,
 	key->net_idx = net_idx;
 	key->app_idx = app_idx;
 	l_queue_push_tail(app_keys, key);
+	index_key(net, key);
 
 	return MESH_STATUS_SUCCESS;
 }
@@ -350,6 +466,7 @@ int appkey_key_delete(struct mesh_net *net, uint16_t net_idx,
 	node_app_key_delete(node, net_idx, app_idx);
 
 	l_queue_remove(app_keys, key);
+	unindex_key(net, key);
 	appkey_key_free(key);
 
 	if (!mesh_config_app_key_del(node_config_get(node), net_idx, app_idx))
@@ -377,6 +494,7 @@ void appkey_delete_bound_keys(struct mesh_net *net, uint16_t net_idx)
 		node_app_key_delete(node, net_idx, key->app_idx);
 		mesh_config_app_key_del(node_config_get(node), net_idx,
 								key->app_idx);
+		unindex_key(net, key);
 		appkey_key_free(key);
 
 		key = l_queue_remove_if(app_keys, match_bound_key,
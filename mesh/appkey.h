@@ -12,16 +12,23 @@
 #define MAX_APP_KEYS	32
 
 struct mesh_app_key;
+struct appkey_index;
 
 bool appkey_key_init(struct mesh_net *net, uint16_t net_idx, uint16_t app_idx,
 				uint8_t *key_value, uint8_t *new_key_value);
 void appkey_key_free(void *data);
+struct appkey_index *appkey_index_new(void);
+void appkey_index_free(struct appkey_index *index);
 void appkey_finalize(struct mesh_net *net, uint16_t net_idx);
 const uint8_t *appkey_get_key(struct mesh_net *net, uint16_t app_idx,
 							uint8_t *key_id);
-int appkey_get_key_idx(struct mesh_app_key *app_key,
-				const uint8_t **key, uint8_t *key_aid,
-				const uint8_t **new_key, uint8_t *new_key_aid);
+const struct l_queue_entry *appkey_get_aid_keys(struct mesh_net *net,
+							uint8_t key_aid);
+int appkey_packet_decrypt(struct mesh_app_key *app_key, uint8_t key_aid,
+				uint8_t *virt, uint16_t virt_size,
+				const uint8_t *data, uint16_t size, bool szmict,
+				uint16_t src, uint16_t dst, uint32_t seq,
+				uint32_t iv_idx, uint8_t *out);
 bool appkey_have_key(struct mesh_net *net, uint16_t app_idx);
 uint16_t appkey_net_idx(struct mesh_net *net, uint16_t app_idx);
 int appkey_key_add(struct mesh_net *net, uint16_t net_idx, uint16_t app_idx,
@@ -0,0 +1,272 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <ell/ell.h>
+
+#include "mesh/cache.h"
+
+/*
+ * Fixed capacity hash table of 64 bit keys and values with least recently
+ * used ordering. All entries are allocated up front and linked by index, so
+ * lookups, inserts and evictions never allocate and take constant time.
+ * Inserting into a full cache evicts the least recently used entry, callers
+ * that must never lose an entry check mesh_cache_count() first.
+ */
+
+#define CACHE_NIL	UINT32_MAX
+
+struct cache_entry {
+	uint64_t key;
+	uint64_t value;
+	uint32_t hnext;		/* Next entry in hash bucket */
+	uint32_t prev;		/* Towards most recently used */
+	uint32_t next;		/* Towards least recently used */
+};
+
+struct mesh_cache {
+	unsigned int capacity;
+	unsigned int count;
+	unsigned int shift;
+	uint32_t *buckets;
+	struct cache_entry *entries;
+	uint32_t head;		/* Most recently used */
+	uint32_t tail;		/* Least recently used */
+	uint32_t free;		/* Unused entries, linked by next */
+};
+
+static uint32_t bucket_of(const struct mesh_cache *cache, uint64_t key)
+{
+	return (key * 0x9e3779b97f4a7c15ULL) >> cache->shift;
+}
+
+static void lru_unlink(struct mesh_cache *cache, uint32_t idx)
+{
+	struct cache_entry *entry = &cache->entries[idx];
+
+	if (entry->prev != CACHE_NIL)
+		cache->entries[entry->prev].next = entry->next;
+	else
+		cache->head = entry->next;
+
+	if (entry->next != CACHE_NIL)
+		cache->entries[entry->next].prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+}
+
+static void lru_push_head(struct mesh_cache *cache, uint32_t idx)
+{
+	struct cache_entry *entry = &cache->entries[idx];
+
+	entry->prev = CACHE_NIL;
+	entry->next = cache->head;
+
+	if (cache->head != CACHE_NIL)
+		cache->entries[cache->head].prev = idx;
+	else
+		cache->tail = idx;
+
+	cache->head = idx;
+}
+
+static uint32_t hash_find(struct mesh_cache *cache, uint64_t key)
+{
+	uint32_t idx = cache->buckets[bucket_of(cache, key)];
+
+	while (idx != CACHE_NIL && cache->entries[idx].key != key)
+		idx = cache->entries[idx].hnext;
+
+	return idx;
+}
+
+static void hash_unlink(struct mesh_cache *cache, uint32_t idx)
+{
+	uint32_t *link = &cache->buckets[bucket_of(cache,
+						cache->entries[idx].key)];
+
+	while (*link != idx)
+		link = &cache->entries[*link].hnext;
+
+	*link = cache->entries[idx].hnext;
+}
+
+static void entry_release(struct mesh_cache *cache, uint32_t idx)
+{
+	hash_unlink(cache, idx);
+	lru_unlink(cache, idx);
+
+	cache->entries[idx].next = cache->free;
+	cache->free = idx;
+	cache->count--;
+}
+
+void mesh_cache_clear(struct mesh_cache *cache)
+{
+	unsigned int i;
+
+	if (!cache)
+		return;
+
+	for (i = 0; i < (1U << (64 - cache->shift)); i++)
+		cache->buckets[i] = CACHE_NIL;
+
+	for (i = 0; i < cache->capacity; i++)
+		cache->entries[i].next = i + 1 < cache->capacity ?
+							i + 1 : CACHE_NIL;
+
+	cache->head = CACHE_NIL;
+	cache->tail = CACHE_NIL;
+	cache->free = 0;
+	cache->count = 0;
+}
+
+struct mesh_cache *mesh_cache_new(unsigned int capacity)
+{
+	struct mesh_cache *cache;
+	unsigned int bits = 1;
+
+	if (!capacity || capacity >= CACHE_NIL / 2)
+		return NULL;
+
+	/* Keep the load factor at or below one half */
+	while ((1U << bits) < capacity * 2)
+		bits++;
+
+	cache = l_new(struct mesh_cache, 1);
+	cache->capacity = capacity;
+	cache->shift = 64 - bits;
+	cache->buckets = l_new(uint32_t, 1U << bits);
+	cache->entries = l_new(struct cache_entry, capacity);
+
+	mesh_cache_clear(cache);
+
+	return cache;
+}
+
+void mesh_cache_free(struct mesh_cache *cache)
+{
+	if (!cache)
+		return;
+
+	l_free(cache->buckets);
+	l_free(cache->entries);
+	l_free(cache);
+}
+
+unsigned int mesh_cache_count(struct mesh_cache *cache)
+{
+	return cache ? cache->count : 0;
+}
+
+unsigned int mesh_cache_capacity(struct mesh_cache *cache)
+{
+	return cache ? cache->capacity : 0;
+}
+
+bool mesh_cache_lookup(struct mesh_cache *cache, uint64_t key,
+							uint64_t *value)
+{
+	uint32_t idx;
+
+	if (!cache)
+		return false;
+
+	idx = hash_find(cache, key);
+	if (idx == CACHE_NIL)
+		return false;
+
+	if (cache->head != idx) {
+		lru_unlink(cache, idx);
+		lru_push_head(cache, idx);
+	}
+
+	if (value)
+		*value = cache->entries[idx].value;
+
+	return true;
+}
+
+void mesh_cache_insert(struct mesh_cache *cache, uint64_t key,
+							uint64_t value)
+{
+	uint32_t idx, bucket;
+
+	if (!cache)
+		return;
+
+	idx = hash_find(cache, key);
+	if (idx != CACHE_NIL) {
+		cache->entries[idx].value = value;
+
+		if (cache->head != idx) {
+			lru_unlink(cache, idx);
+			lru_push_head(cache, idx);
+		}
+
+		return;
+	}
+
+	if (cache->count == cache->capacity)
+		entry_release(cache, cache->tail);
+
+	idx = cache->free;
+	cache->free = cache->entries[idx].next;
+	cache->count++;
+
+	bucket = bucket_of(cache, key);
+	cache->entries[idx].key = key;
+	cache->entries[idx].value = value;
+	cache->entries[idx].hnext = cache->buckets[bucket];
+	cache->buckets[bucket] = idx;
+
+	lru_push_head(cache, idx);
+}
+
+bool mesh_cache_remove(struct mesh_cache *cache, uint64_t key)
+{
+	uint32_t idx;
+
+	if (!cache)
+		return false;
+
+	idx = hash_find(cache, key);
+	if (idx == CACHE_NIL)
+		return false;
+
+	entry_release(cache, idx);
+
+	return true;
+}
+
+unsigned int mesh_cache_foreach_remove(struct mesh_cache *cache,
+					mesh_cache_remove_func_t func,
+					void *user_data)
+{
+	unsigned int count = 0;
+	uint32_t idx, next;
+
+	if (!cache || !func)
+		return 0;
+
+	for (idx = cache->head; idx != CACHE_NIL; idx = next) {
+		struct cache_entry *entry = &cache->entries[idx];
+
+		next = entry->next;
+
+		if (func(entry->key, entry->value, user_data)) {
+			entry_release(cache, idx);
+			count++;
+		}
+	}
+
+	return count;
+}
@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+struct mesh_cache;
+
+typedef bool (*mesh_cache_remove_func_t)(uint64_t key, uint64_t value,
+							void *user_data);
+
+struct mesh_cache *mesh_cache_new(unsigned int capacity);
+void mesh_cache_free(struct mesh_cache *cache);
+void mesh_cache_clear(struct mesh_cache *cache);
+unsigned int mesh_cache_count(struct mesh_cache *cache);
+unsigned int mesh_cache_capacity(struct mesh_cache *cache);
+bool mesh_cache_lookup(struct mesh_cache *cache, uint64_t key,
+							uint64_t *value);
+void mesh_cache_insert(struct mesh_cache *cache, uint64_t key,
+							uint64_t value);
+bool mesh_cache_remove(struct mesh_cache *cache, uint64_t key);
+unsigned int mesh_cache_foreach_remove(struct mesh_cache *cache,
+					mesh_cache_remove_func_t func,
+					void *user_data);
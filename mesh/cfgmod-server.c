@@ -722,11 +722,11 @@ static uint16_t get_composition(struct mesh_node *node, uint8_t page,
 	return len + 1;
 }
 
-static bool cfg_srv_pkt(uint16_t src, uint16_t dst, uint16_t app_idx,
-				uint16_t net_idx, const uint8_t *data,
-				uint16_t size, const void *user_data)
+static bool cfg_srv_msg(struct mesh_node *node, uint16_t src, uint16_t dst,
+				uint16_t app_idx, uint16_t net_idx,
+				const uint8_t *data, uint16_t size,
+				uint16_t *len)
 {
-	struct mesh_node *node = (struct mesh_node *) user_data;
 	struct mesh_net *net;
 	const uint8_t *pkt = data;
 	uint32_t opcode;
@@ -1071,11 +1071,38 @@ static bool cfg_srv_pkt(uint16_t src, uint16_t dst, uint16_t app_idx,
 		break;
 	}
 
+	*len = n;
+
+	return true;
+}
+
+static bool cfg_srv_pkt(uint16_t src, uint16_t dst, uint16_t app_idx,
+				uint16_t net_idx, const uint8_t *data,
+				uint16_t size, const void *user_data)
+{
+	struct mesh_node *node = (struct mesh_node *) user_data;
+	struct mesh_config *cfg = node_config_get(node);
+	uint16_t n = 0;
+	bool result;
+
+	/*
+	 * Everything a single message changes is stored with one write,
+	 * and key changes reach storage before the status is sent. If
+	 * they don't, no status is sent so that the client retries.
+	 */
+	mesh_config_begin(cfg);
+	result = cfg_srv_msg(node, src, dst, app_idx, net_idx, data, size, &n);
+
+	if (!mesh_config_commit(cfg)) {
+		l_error("Failed to store configuration changes");
+		n = 0;
+	}
+
 	if (n)
 		mesh_model_send(node, dst, src, APP_IDX_DEV_LOCAL, net_idx,
 						DEFAULT_TTL, false, n, msg);
 
-	return true;
+	return result;
 }
 
 static void cfgmod_srv_unregister(void *user_data)
@@ -80,17 +80,15 @@ bool mesh_crypto_aes_cmac(const uint8_t key[16], const uint8_t *msg,
 	return aes_cmac_one(key, msg, msg_len, res);
 }
 
-bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
+static bool aes_ccm_encrypt(struct l_aead_cipher *cipher,
+					const uint8_t nonce[13],
 					const uint8_t *aad, uint16_t aad_len,
 					const void *msg, uint16_t msg_len,
 					void *out_msg,
 					void *out_mic, size_t mic_size)
 {
-	void *cipher;
 	bool result;
 
-	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
-
 	result = l_aead_cipher_encrypt(cipher, msg, msg_len, aad, aad_len,
 					nonce, 13, out_msg, msg_len + mic_size);
 
@@ -101,23 +99,19 @@ bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
 			*(uint64_t *)out_mic = l_get_be64(out_msg + msg_len);
 	}
 
-	l_aead_cipher_free(cipher);
-
 	return result;
 }
 
-bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
+static bool aes_ccm_decrypt(struct l_aead_cipher *cipher,
+				const uint8_t nonce[13],
 				const uint8_t *aad, uint16_t aad_len,
 				const void *enc_msg, uint16_t enc_msg_len,
 				void *out_msg,
 				void *out_mic, size_t mic_size)
 {
-	void *cipher;
 	bool result;
 	size_t out_msg_len = enc_msg_len - mic_size;
 
-	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
-
 	result = l_aead_cipher_decrypt(cipher, enc_msg, enc_msg_len,
 							aad, aad_len, nonce, 13,
 							out_msg, out_msg_len);
@@ -131,11 +125,99 @@ bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
 				l_get_be64(enc_msg + enc_msg_len - mic_size);
 	}
 
+	return result;
+}
+
+bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
+					const uint8_t *aad, uint16_t aad_len,
+					const void *msg, uint16_t msg_len,
+					void *out_msg,
+					void *out_mic, size_t mic_size)
+{
+	void *cipher;
+	bool result;
+
+	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
+
+	result = aes_ccm_encrypt(cipher, nonce, aad, aad_len, msg, msg_len,
+						out_msg, out_mic, mic_size);
+
 	l_aead_cipher_free(cipher);
 
 	return result;
 }
 
+bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
+				const uint8_t *aad, uint16_t aad_len,
+				const void *enc_msg, uint16_t enc_msg_len,
+				void *out_msg,
+				void *out_mic, size_t mic_size)
+{
+	void *cipher;
+	bool result;
+
+	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, key, 16, mic_size);
+
+	result = aes_ccm_decrypt(cipher, nonce, aad, aad_len,
+						enc_msg, enc_msg_len,
+						out_msg, out_mic, mic_size);
+
+	l_aead_cipher_free(cipher);
+
+	return result;
+}
+
+/*
+ * Prepared AES-CCM contexts for one key. Each ell AEAD cipher is bound to
+ * a MIC size and holds kernel resources, so the 32-bit and 64-bit MIC
+ * variants are only set up once a message of that kind has been seen.
+ */
+struct mesh_ccm_cipher {
+	uint8_t key[16];
+	struct l_aead_cipher *mic32;
+	struct l_aead_cipher *mic64;
+};
+
+static struct l_aead_cipher *ccm_cipher_get(struct mesh_ccm_cipher *cipher,
+							size_t mic_size)
+{
+	struct l_aead_cipher **ccm;
+
+	ccm = mic_size == 8 ? &cipher->mic64 : &cipher->mic32;
+
+	if (!*ccm)
+		*ccm = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, cipher->key,
+							16, mic_size);
+
+	return *ccm;
+}
+
+static void ccm_cipher_clear(struct mesh_ccm_cipher *cipher)
+{
+	l_aead_cipher_free(cipher->mic32);
+	l_aead_cipher_free(cipher->mic64);
+	cipher->mic32 = NULL;
+	cipher->mic64 = NULL;
+}
+
+struct mesh_ccm_cipher *mesh_crypto_ccm_cipher_new(const uint8_t key[16])
+{
+	struct mesh_ccm_cipher *cipher = l_new(struct mesh_ccm_cipher, 1);
+
+	memcpy(cipher->key, key, 16);
+
+	return cipher;
+}
+
+void mesh_crypto_ccm_cipher_free(struct mesh_ccm_cipher *cipher)
+{
+	if (!cipher)
+		return;
+
+	ccm_cipher_clear(cipher);
+	l_free(cipher);
+}
+
 bool mesh_crypto_k1(const uint8_t ikm[16], const uint8_t salt[16],
 		const void *info, size_t info_len, uint8_t okm[16])
 {
@@ -472,17 +554,16 @@ static void mesh_crypto_privacy_counter(uint32_t iv_index,
 	memcpy(privacy_counter + 9, payload, 7);
 }
 
-static bool mesh_crypto_pecb(const uint8_t privacy_key[16],
+static bool mesh_crypto_pecb(struct l_cipher *privacy,
 						uint32_t iv_index,
 						const uint8_t *payload,
 						uint8_t pecb[16])
 {
 	mesh_crypto_privacy_counter(iv_index, payload, pecb);
-	return aes_ecb_one(privacy_key, pecb, pecb);
+	return l_cipher_encrypt(privacy, pecb, pecb, 16);
 }
 
-static bool mesh_crypto_network_obfuscate(uint8_t *packet,
-						const uint8_t privacy_key[16],
+static bool network_obfuscate(uint8_t *packet, struct l_cipher *privacy,
 						uint32_t iv_index,
 						bool ctl, uint8_t ttl,
 						uint32_t seq, uint16_t src)
@@ -491,7 +572,7 @@ static bool mesh_crypto_network_obfuscate(uint8_t *packet,
 	uint8_t *net_hdr = packet + 1;
 	int i;
 
-	if (!mesh_crypto_pecb(privacy_key, iv_index, packet + 7, pecb))
+	if (!mesh_crypto_pecb(privacy, iv_index, packet + 7, pecb))
 		return false;
 
 	l_put_be16(src, net_hdr + 4);
@@ -504,8 +585,7 @@ static bool mesh_crypto_network_obfuscate(uint8_t *packet,
 	return true;
 }
 
-static bool mesh_crypto_network_clarify(uint8_t *packet,
-						const uint8_t privacy_key[16],
+static bool network_clarify(uint8_t *packet, struct l_cipher *privacy,
 						uint32_t iv_index,
 						bool *ctl, uint8_t *ttl,
 						uint32_t *seq, uint16_t *src)
@@ -514,7 +594,7 @@ static bool mesh_crypto_network_clarify(uint8_t *packet,
 	uint8_t *net_hdr = packet + 1;
 	int i;
 
-	if (!mesh_crypto_pecb(privacy_key, iv_index, packet + 7, pecb))
+	if (!mesh_crypto_pecb(privacy, iv_index, packet + 7, pecb))
 		return false;
 
 	for (i = 0; i < 6; i++)
@@ -528,6 +608,45 @@ static bool mesh_crypto_network_clarify(uint8_t *packet,
 	return true;
 }
 
+static bool mesh_crypto_network_obfuscate(uint8_t *packet,
+						const uint8_t privacy_key[16],
+						uint32_t iv_index,
+						bool ctl, uint8_t ttl,
+						uint32_t seq, uint16_t src)
+{
+	struct l_cipher *privacy;
+	bool result;
+
+	privacy = l_cipher_new(L_CIPHER_AES, privacy_key, 16);
+	if (!privacy)
+		return false;
+
+	result = network_obfuscate(packet, privacy, iv_index, ctl, ttl, seq,
+									src);
+	l_cipher_free(privacy);
+
+	return result;
+}
+
+static bool mesh_crypto_network_clarify(uint8_t *packet,
+						const uint8_t privacy_key[16],
+						uint32_t iv_index,
+						bool *ctl, uint8_t *ttl,
+						uint32_t *seq, uint16_t *src)
+{
+	struct l_cipher *privacy;
+	bool result;
+
+	privacy = l_cipher_new(L_CIPHER_AES, privacy_key, 16);
+	if (!privacy)
+		return false;
+
+	result = network_clarify(packet, privacy, iv_index, ctl, ttl, seq, src);
+	l_cipher_free(privacy);
+
+	return result;
+}
+
 bool mesh_crypto_packet_build(bool ctl, uint8_t ttl,
 				uint32_t seq,
 				uint16_t src, uint16_t dst,
@@ -743,21 +862,18 @@ bool mesh_crypto_payload_encrypt(uint8_t *aad, const uint8_t *payload,
 	return true;
 }
 
-bool mesh_crypto_payload_decrypt(uint8_t *aad, uint16_t aad_len,
+static bool payload_decrypt(struct l_aead_cipher *cipher,
+				uint8_t *aad, uint16_t aad_len,
 				const uint8_t *payload, uint16_t payload_len,
 				bool aszmic,
 				uint16_t src, uint16_t dst,
 				uint8_t key_aid, uint32_t seq,
-				uint32_t iv_index, uint8_t *out,
-				const uint8_t app_key[16])
+				uint32_t iv_index, uint8_t *out)
 {
 	uint8_t nonce[13];
 	uint32_t mic32;
 	uint64_t mic64;
 
-	if (payload_len < 5 || !out)
-		return false;
-
 	if (key_aid == APP_AID_DEV)
 		mesh_crypto_device_nonce(seq, src, dst, iv_index, aszmic,
 									nonce);
@@ -768,8 +884,7 @@ bool mesh_crypto_payload_decrypt(uint8_t *aad, uint16_t aad_len,
 	memcpy(out, payload, payload_len);
 
 	if (aszmic) {
-		if (!mesh_crypto_aes_ccm_decrypt(nonce, app_key,
-					aad, aad_len,
+		if (!aes_ccm_decrypt(cipher, nonce, aad, aad_len,
 					payload, payload_len,
 					out, &mic64, sizeof(mic64)))
 			return false;
@@ -780,8 +895,7 @@ bool mesh_crypto_payload_decrypt(uint8_t *aad, uint16_t aad_len,
 		if (mic64)
 			return false;
 	} else {
-		if (!mesh_crypto_aes_ccm_decrypt(nonce, app_key,
-					aad, aad_len,
+		if (!aes_ccm_decrypt(cipher, nonce, aad, aad_len,
 					payload, payload_len,
 					out, &mic32, sizeof(mic32)))
 			return false;
@@ -796,8 +910,57 @@ bool mesh_crypto_payload_decrypt(uint8_t *aad, uint16_t aad_len,
 	return true;
 }
 
-static bool mesh_crypto_packet_encrypt(uint8_t *packet, uint8_t packet_len,
-				const uint8_t network_key[16],
+bool mesh_crypto_payload_decrypt(uint8_t *aad, uint16_t aad_len,
+				const uint8_t *payload, uint16_t payload_len,
+				bool aszmic,
+				uint16_t src, uint16_t dst,
+				uint8_t key_aid, uint32_t seq,
+				uint32_t iv_index, uint8_t *out,
+				const uint8_t app_key[16])
+{
+	struct l_aead_cipher *cipher;
+	bool result;
+
+	if (payload_len < 5 || !out)
+		return false;
+
+	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, app_key, 16,
+							aszmic ? 8 : 4);
+	if (!cipher)
+		return false;
+
+	result = payload_decrypt(cipher, aad, aad_len, payload, payload_len,
+					aszmic, src, dst, key_aid, seq,
+					iv_index, out);
+	l_aead_cipher_free(cipher);
+
+	return result;
+}
+
+bool mesh_crypto_ccm_cipher_payload_decrypt(struct mesh_ccm_cipher *cipher,
+				uint8_t *aad, uint16_t aad_len,
+				const uint8_t *payload, uint16_t payload_len,
+				bool aszmic,
+				uint16_t src, uint16_t dst,
+				uint8_t key_aid, uint32_t seq,
+				uint32_t iv_index, uint8_t *out)
+{
+	struct l_aead_cipher *ccm;
+
+	if (payload_len < 5 || !out)
+		return false;
+
+	ccm = ccm_cipher_get(cipher, aszmic ? 8 : 4);
+	if (!ccm)
+		return false;
+
+	return payload_decrypt(ccm, aad, aad_len, payload, payload_len,
+					aszmic, src, dst, key_aid, seq,
+					iv_index, out);
+}
+
+static bool network_encrypt(uint8_t *packet, uint8_t packet_len,
+				struct l_aead_cipher *cipher,
 				uint32_t iv_index, bool proxy,
 				bool ctl, uint8_t ttl, uint32_t seq,
 				uint16_t src)
@@ -812,14 +975,12 @@ static bool mesh_crypto_packet_encrypt(uint8_t *packet, uint8_t packet_len,
 
 	/* Check for Long net-MIC */
 	if (ctl) {
-		if (!mesh_crypto_aes_ccm_encrypt(nonce, network_key,
-					NULL, 0,
+		if (!aes_ccm_encrypt(cipher, nonce, NULL, 0,
 					packet + 7, packet_len - 7 - 8,
 					packet + 7, NULL, 8))
 			return false;
 	} else {
-		if (!mesh_crypto_aes_ccm_encrypt(nonce, network_key,
-					NULL, 0,
+		if (!aes_ccm_encrypt(cipher, nonce, NULL, 0,
 					packet + 7, packet_len - 7 - 4,
 					packet + 7, NULL, 4))
 			return false;
@@ -828,43 +989,14 @@ static bool mesh_crypto_packet_encrypt(uint8_t *packet, uint8_t packet_len,
 	return true;
 }
 
-bool mesh_crypto_packet_encode(uint8_t *packet, uint8_t packet_len,
-				uint32_t iv_index,
-				const uint8_t network_key[16],
-				const uint8_t privacy_key[16])
-{
-	bool ctl;
-	uint8_t ttl;
-	uint32_t seq;
-	uint16_t src;
-	uint16_t dst;
-
-	if (!network_header_parse(packet, packet_len,
-						&ctl, &ttl, &seq, &src, &dst))
-		return false;
-
-	if (!mesh_crypto_packet_encrypt(packet, packet_len, network_key,
-							iv_index, !dst,
-							ctl, ttl, seq, src))
-
-		return false;
-
-	return mesh_crypto_network_obfuscate(packet, privacy_key, iv_index,
-							ctl, ttl, seq, src);
-}
-
-static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
-				const uint8_t network_key[16],
+static bool network_decrypt(uint8_t *packet, uint8_t packet_len,
+				struct l_aead_cipher *cipher,
 				uint32_t iv_index, bool proxy,
 				bool ctl, uint8_t ttl, uint32_t seq,
 				uint16_t src)
 {
 	uint8_t nonce[13];
 
-	/* Pre-check SRC address for illegal values */
-	if (!IS_UNICAST(src))
-		return false;
-
 	/* Detect Proxy packet by CTL == true && proxy == true */
 	if (ctl & proxy)
 		mesh_crypto_proxy_nonce(seq, src, iv_index, nonce);
@@ -875,8 +1007,7 @@ static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
 	if (ctl) {
 		uint64_t mic;
 
-		if (!mesh_crypto_aes_ccm_decrypt(nonce, network_key,
-					NULL, 0,
+		if (!aes_ccm_decrypt(cipher, nonce, NULL, 0,
 					packet + 7, packet_len - 7,
 					packet + 7, &mic, sizeof(mic)))
 			return false;
@@ -889,8 +1020,7 @@ static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
 	} else {
 		uint32_t mic;
 
-		if (!mesh_crypto_aes_ccm_decrypt(nonce, network_key,
-					NULL, 0,
+		if (!aes_ccm_decrypt(cipher, nonce, NULL, 0,
 					packet + 7, packet_len - 7,
 					packet + 7, &mic, sizeof(mic)))
 			return false;
@@ -905,6 +1035,77 @@ static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
 	return true;
 }
 
+static bool mesh_crypto_packet_encrypt(uint8_t *packet, uint8_t packet_len,
+				const uint8_t network_key[16],
+				uint32_t iv_index, bool proxy,
+				bool ctl, uint8_t ttl, uint32_t seq,
+				uint16_t src)
+{
+	struct l_aead_cipher *cipher;
+	bool result;
+
+	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, network_key, 16,
+								ctl ? 8 : 4);
+	if (!cipher)
+		return false;
+
+	result = network_encrypt(packet, packet_len, cipher, iv_index, proxy,
+							ctl, ttl, seq, src);
+	l_aead_cipher_free(cipher);
+
+	return result;
+}
+
+static bool mesh_crypto_packet_decrypt(uint8_t *packet, uint8_t packet_len,
+				const uint8_t network_key[16],
+				uint32_t iv_index, bool proxy,
+				bool ctl, uint8_t ttl, uint32_t seq,
+				uint16_t src)
+{
+	struct l_aead_cipher *cipher;
+	bool result;
+
+	/* Pre-check SRC address for illegal values */
+	if (!IS_UNICAST(src))
+		return false;
+
+	cipher = l_aead_cipher_new(L_AEAD_CIPHER_AES_CCM, network_key, 16,
+								ctl ? 8 : 4);
+	if (!cipher)
+		return false;
+
+	result = network_decrypt(packet, packet_len, cipher, iv_index, proxy,
+							ctl, ttl, seq, src);
+	l_aead_cipher_free(cipher);
+
+	return result;
+}
+
+bool mesh_crypto_packet_encode(uint8_t *packet, uint8_t packet_len,
+				uint32_t iv_index,
+				const uint8_t network_key[16],
+				const uint8_t privacy_key[16])
+{
+	bool ctl;
+	uint8_t ttl;
+	uint32_t seq;
+	uint16_t src;
+	uint16_t dst;
+
+	if (!network_header_parse(packet, packet_len,
+						&ctl, &ttl, &seq, &src, &dst))
+		return false;
+
+	if (!mesh_crypto_packet_encrypt(packet, packet_len, network_key,
+							iv_index, !dst,
+							ctl, ttl, seq, src))
+
+		return false;
+
+	return mesh_crypto_network_obfuscate(packet, privacy_key, iv_index,
+							ctl, ttl, seq, src);
+}
+
 bool mesh_crypto_packet_decode(const uint8_t *packet, uint8_t packet_len,
 				bool proxy, uint8_t *out, uint32_t iv_index,
 				const uint8_t network_key[16],
@@ -929,6 +1130,100 @@ bool mesh_crypto_packet_decode(const uint8_t *packet, uint8_t packet_len,
 							ctl, ttl, seq, src);
 }
 
+/* Prepared cipher contexts for the encryption and privacy keys */
+struct mesh_net_cipher {
+	struct l_cipher *privacy;
+	struct mesh_ccm_cipher ccm;
+};
+
+struct mesh_net_cipher *mesh_crypto_net_cipher_new(
+					const uint8_t network_key[16],
+					const uint8_t privacy_key[16])
+{
+	struct mesh_net_cipher *cipher;
+
+	cipher = l_new(struct mesh_net_cipher, 1);
+	cipher->privacy = l_cipher_new(L_CIPHER_AES, privacy_key, 16);
+
+	if (!cipher->privacy) {
+		l_free(cipher);
+		return NULL;
+	}
+
+	memcpy(cipher->ccm.key, network_key, 16);
+
+	return cipher;
+}
+
+void mesh_crypto_net_cipher_free(struct mesh_net_cipher *cipher)
+{
+	if (!cipher)
+		return;
+
+	l_cipher_free(cipher->privacy);
+	ccm_cipher_clear(&cipher->ccm);
+	l_free(cipher);
+}
+
+bool mesh_crypto_net_cipher_encode(struct mesh_net_cipher *cipher,
+					uint8_t *packet, uint8_t packet_len,
+					uint32_t iv_index)
+{
+	struct l_aead_cipher *ccm;
+	bool ctl;
+	uint8_t ttl;
+	uint32_t seq;
+	uint16_t src;
+	uint16_t dst;
+
+	if (!network_header_parse(packet, packet_len,
+						&ctl, &ttl, &seq, &src, &dst))
+		return false;
+
+	ccm = ccm_cipher_get(&cipher->ccm, ctl ? 8 : 4);
+	if (!ccm)
+		return false;
+
+	if (!network_encrypt(packet, packet_len, ccm, iv_index, !dst,
+							ctl, ttl, seq, src))
+		return false;
+
+	return network_obfuscate(packet, cipher->privacy, iv_index,
+							ctl, ttl, seq, src);
+}
+
+bool mesh_crypto_net_cipher_decode(struct mesh_net_cipher *cipher,
+					const uint8_t *packet,
+					uint8_t packet_len, bool proxy,
+					uint8_t *out, uint32_t iv_index)
+{
+	struct l_aead_cipher *ccm;
+	bool ctl;
+	uint8_t ttl;
+	uint32_t seq;
+	uint16_t src;
+
+	if (packet_len < 14)
+		return false;
+
+	memcpy(out, packet, packet_len);
+
+	if (!network_clarify(out, cipher->privacy, iv_index,
+						&ctl, &ttl, &seq, &src))
+		return false;
+
+	/* Pre-check SRC address for illegal values */
+	if (!IS_UNICAST(src))
+		return false;
+
+	ccm = ccm_cipher_get(&cipher->ccm, ctl ? 8 : 4);
+	if (!ccm)
+		return false;
+
+	return network_decrypt(out, packet_len, ccm, iv_index, proxy,
+							ctl, ttl, seq, src);
+}
+
 bool mesh_crypto_packet_label(uint8_t *packet, uint8_t packet_len,
 				uint16_t iv_index, uint8_t network_id)
 {
@@ -12,6 +12,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+struct mesh_ccm_cipher;
+struct mesh_net_cipher;
+
 bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
 					const uint8_t *aad, uint16_t aad_len,
 					const void *msg, uint16_t msg_len,
@@ -90,6 +93,15 @@ bool mesh_crypto_payload_decrypt(uint8_t *aad, uint16_t aad_len,
 				uint32_t seq_num, uint32_t iv_index,
 				uint8_t *out,
 				const uint8_t application_key[16]);
+struct mesh_ccm_cipher *mesh_crypto_ccm_cipher_new(const uint8_t key[16]);
+void mesh_crypto_ccm_cipher_free(struct mesh_ccm_cipher *cipher);
+bool mesh_crypto_ccm_cipher_payload_decrypt(struct mesh_ccm_cipher *cipher,
+				uint8_t *aad, uint16_t aad_len,
+				const uint8_t *payload, uint16_t payload_len,
+				bool aszmic,
+				uint16_t src, uint16_t dst,
+				uint8_t key_aid, uint32_t seq,
+				uint32_t iv_index, uint8_t *out);
 bool mesh_crypto_packet_encode(uint8_t *packet, uint8_t packet_len,
 				uint32_t iv_index,
 				const uint8_t network_key[16],
@@ -98,6 +110,17 @@ bool mesh_crypto_packet_decode(const uint8_t *packet, uint8_t packet_len,
 				bool proxy, uint8_t *out, uint32_t iv_index,
 				const uint8_t network_key[16],
 				const uint8_t privacy_key[16]);
+struct mesh_net_cipher *mesh_crypto_net_cipher_new(
+					const uint8_t network_key[16],
+					const uint8_t privacy_key[16]);
+void mesh_crypto_net_cipher_free(struct mesh_net_cipher *cipher);
+bool mesh_crypto_net_cipher_encode(struct mesh_net_cipher *cipher,
+					uint8_t *packet, uint8_t packet_len,
+					uint32_t iv_index);
+bool mesh_crypto_net_cipher_decode(struct mesh_net_cipher *cipher,
+					const uint8_t *packet,
+					uint8_t packet_len, bool proxy,
+					uint8_t *out, uint32_t iv_index);
 bool mesh_crypto_packet_label(uint8_t *packet, uint8_t packet_len,
 				uint16_t iv_index, uint8_t network_id);
 
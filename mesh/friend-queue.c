@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <ell/ell.h>
+
+#include "mesh/sar.h"
+#include "mesh/friend-queue.h"
+
+/*
+ * Friend Queue of a Low Power Node: a ring of fixed capacity, set to the
+ * cache size offered to the LPN when the friendship was established. The
+ * messages themselves are copied into buffers from a slab shared by all
+ * queues, so that servicing polls does not churn the heap.
+ */
+
+struct mesh_friend_queue {
+	void **slots;
+	unsigned int size;
+	unsigned int head;
+	unsigned int count;
+};
+
+static struct mesh_sar_slab *slab;
+static unsigned int num_queues;
+
+static unsigned int slot_of(const struct mesh_friend_queue *queue,
+							unsigned int i)
+{
+	return (queue->head + i) % queue->size;
+}
+
+struct mesh_friend_queue *mesh_friend_queue_new(unsigned int size)
+{
+	struct mesh_friend_queue *queue;
+
+	if (!size)
+		return NULL;
+
+	if (!num_queues++)
+		slab = mesh_sar_slab_new(0);
+
+	queue = l_new(struct mesh_friend_queue, 1);
+	queue->slots = l_new(void *, size);
+	queue->size = size;
+
+	return queue;
+}
+
+static void release(struct mesh_friend_queue *queue, unsigned int slot)
+{
+	mesh_sar_slab_release(slab, queue->slots[slot]);
+	queue->slots[slot] = NULL;
+}
+
+void mesh_friend_queue_free(struct mesh_friend_queue *queue)
+{
+	unsigned int i;
+
+	if (!queue)
+		return;
+
+	for (i = 0; i < queue->count; i++)
+		release(queue, slot_of(queue, i));
+
+	l_free(queue->slots);
+	l_free(queue);
+
+	if (!--num_queues) {
+		mesh_sar_slab_free(slab);
+		slab = NULL;
+	}
+}
+
+unsigned int mesh_friend_queue_length(struct mesh_friend_queue *queue)
+{
+	return queue ? queue->count : 0;
+}
+
+unsigned int mesh_friend_queue_size(struct mesh_friend_queue *queue)
+{
+	return queue ? queue->size : 0;
+}
+
+/* Returns true if the oldest message had to be discarded to make room */
+bool mesh_friend_queue_push(struct mesh_friend_queue *queue,
+						const void *data, size_t len)
+{
+	bool dropped = false;
+	void *msg;
+
+	if (!queue)
+		return false;
+
+	if (queue->count == queue->size) {
+		mesh_friend_queue_pop_head(queue);
+		dropped = true;
+	}
+
+	msg = mesh_sar_slab_alloc(slab, len);
+	memcpy(msg, data, len);
+
+	queue->slots[slot_of(queue, queue->count++)] = msg;
+
+	return dropped;
+}
+
+void *mesh_friend_queue_peek_head(struct mesh_friend_queue *queue)
+{
+	if (!queue || !queue->count)
+		return NULL;
+
+	return queue->slots[queue->head];
+}
+
+void mesh_friend_queue_pop_head(struct mesh_friend_queue *queue)
+{
+	if (!queue || !queue->count)
+		return;
+
+	release(queue, queue->head);
+	queue->head = slot_of(queue, 1);
+	queue->count--;
+}
+
+/*
+ * Discards every message that matches, closing up the gaps in place so
+ * that the remaining messages keep their order.
+ */
+unsigned int mesh_friend_queue_remove_if(struct mesh_friend_queue *queue,
+					l_queue_match_func_t match,
+					const void *user_data)
+{
+	unsigned int i, kept = 0;
+
+	if (!queue)
+		return 0;
+
+	for (i = 0; i < queue->count; i++) {
+		unsigned int slot = slot_of(queue, i);
+		void *msg = queue->slots[slot];
+
+		if (match(msg, user_data)) {
+			release(queue, slot);
+			continue;
+		}
+
+		if (kept != i) {
+			queue->slots[slot_of(queue, kept)] = msg;
+			queue->slots[slot] = NULL;
+		}
+
+		kept++;
+	}
+
+	i = queue->count - kept;
+	queue->count = kept;
+
+	return i;
+}
@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+struct mesh_friend_queue;
+
+struct mesh_friend_queue *mesh_friend_queue_new(unsigned int size);
+void mesh_friend_queue_free(struct mesh_friend_queue *queue);
+unsigned int mesh_friend_queue_length(struct mesh_friend_queue *queue);
+unsigned int mesh_friend_queue_size(struct mesh_friend_queue *queue);
+bool mesh_friend_queue_push(struct mesh_friend_queue *queue,
+						const void *data, size_t len);
+void *mesh_friend_queue_peek_head(struct mesh_friend_queue *queue);
+void mesh_friend_queue_pop_head(struct mesh_friend_queue *queue);
+unsigned int mesh_friend_queue_remove_if(struct mesh_friend_queue *queue,
+					l_queue_match_func_t match,
+					const void *user_data);
@@ -22,6 +22,7 @@
 #include "mesh/util.h"
 
 #include "mesh/friend.h"
+#include "mesh/friend-queue.h"
 
 #define MAX_FRND_GROUPS		20
 #define FRND_RELAY_WINDOW	250		/* 250 ms */
@@ -459,7 +460,8 @@ void friend_poll(struct mesh_net *net, uint16_t src, bool seq,
 						neg->receive_delay,
 						neg->frw,
 						neg->poll_timeout,
-						neg->fn_cnt, neg->lp_cnt);
+						neg->fn_cnt, neg->lp_cnt,
+						frnd_cache_size);
 
 		frnd->timeout = l_timeout_create_ms(
 					frnd->poll_timeout * 100,
@@ -498,28 +500,26 @@ void friend_poll(struct mesh_net *net, uint16_t src, bool seq,
 	/* Reset Poll Timeout */
 	l_timeout_modify_ms(frnd->timeout, frnd->poll_timeout * 100);
 
-	if (!l_queue_length(frnd->pkt_cache))
+	if (!mesh_friend_queue_length(frnd->pkt_cache))
 		goto update;
 
 	if (frnd->u.active.seq != frnd->u.active.last &&
 						frnd->u.active.seq != seq) {
-		pkt = l_queue_peek_head(frnd->pkt_cache);
-		if (pkt->cnt_out < pkt->cnt_in) {
+		pkt = mesh_friend_queue_peek_head(frnd->pkt_cache);
+		if (pkt->cnt_out < pkt->cnt_in)
 			pkt->cnt_out++;
-		} else {
-			pkt = l_queue_pop_head(frnd->pkt_cache);
-			l_free(pkt);
-		}
+		else
+			mesh_friend_queue_pop_head(frnd->pkt_cache);
 	}
 
-	pkt = l_queue_peek_head(frnd->pkt_cache);
+	pkt = mesh_friend_queue_peek_head(frnd->pkt_cache);
 
 	if (!pkt)
 		goto update;
 
 	frnd->u.active.seq = seq;
 	frnd->u.active.last = !seq;
-	md = !!(l_queue_length(frnd->pkt_cache) > 1);
+	md = !!(mesh_friend_queue_length(frnd->pkt_cache) > 1);
 
 	if (pkt->ctl) {
 		/* Make sure we don't change the bit-sense of MD,
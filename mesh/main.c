@@ -63,7 +63,11 @@ static void usage(void)
 	       "io:\n"
 	       "\t([hci]<index> | generic[:[hci]<index>])\n"
 	       "\t\tUse generic HCI io on interface hci<index>, or the first\n"
-	       "\t\tavailable one\n");
+	       "\t\tavailable one\n"
+	       "\tunix:<dir>[,name=<name>][,peers=<name>[+<name>...]]\n"
+	       "\t\t[,loss=<percent>][,delay=<ms>]\n"
+	       "\t\tUse simulated io over sockets in <dir>, shared with\n"
+	       "\t\tthe other nodes\n");
 }
 
 static void do_debug(const char *str, void *user_data)
@@ -161,6 +165,16 @@ static bool parse_io(const char *optarg, enum mesh_io_type *type, void **opts)
 		return false;
 	}
 
+	if (strstr(optarg, "unix:") == optarg) {
+		optarg += strlen("unix:");
+		if (!*optarg)
+			return false;
+
+		*type = MESH_IO_TYPE_UNIX;
+		*opts = l_strdup(optarg);
+		return true;
+	}
+
 	return false;
 }
 
@@ -42,7 +42,7 @@ static int8_t scan_rssi;
 static uint8_t scan_uuid[16];
 static struct mesh_node *scan_node;
 static struct l_timeout *scan_timeout;
-static struct add_data *add_pending;
+static struct l_queue *add_pending;
 static const uint8_t prvb[2] = {MESH_AD_TYPE_BEACON, 0x00};
 
 static void scan_cancel(struct l_timeout *timeout, void *user_data)
@@ -63,35 +63,57 @@ static void scan_cancel(struct l_timeout *timeout, void *user_data)
 	scan_timeout = NULL;
 }
 
-static void free_pending_add_call()
+static bool pending_match(const void *a, const void *b)
 {
-	if (!add_pending)
+	return a == b;
+}
+
+static bool pending_uuid_match(const void *a, const void *b)
+{
+	const struct add_data *pending = a;
+
+	return !memcmp(pending->uuid, b, sizeof(pending->uuid));
+}
+
+static bool add_is_pending(struct add_data *pending)
+{
+	return pending && l_queue_find(add_pending, pending_match, pending);
+}
+
+static void free_pending_add_call(struct add_data *pending)
+{
+	if (!l_queue_remove(add_pending, pending))
 		return;
 
-	if (add_pending->disc_watch)
-		l_dbus_remove_watch(dbus_get_bus(),
-						add_pending->disc_watch);
+	if (pending->disc_watch)
+		l_dbus_remove_watch(dbus_get_bus(), pending->disc_watch);
+
+	if (pending->msg)
+		l_dbus_message_unref(pending->msg);
 
-	if (add_pending->msg)
-		l_dbus_message_unref(add_pending->msg);
+	l_free(pending);
 
-	l_free(add_pending);
-	add_pending = NULL;
+	if (l_queue_isempty(add_pending)) {
+		l_queue_destroy(add_pending, NULL);
+		add_pending = NULL;
+	}
 }
 
 static void prov_disc_cb(struct l_dbus *bus, void *user_data)
 {
-	if (!add_pending)
+	struct add_data *pending = user_data;
+
+	if (!add_is_pending(pending))
 		return;
 
-	initiator_cancel(add_pending);
-	add_pending->disc_watch = 0;
+	initiator_cancel(pending);
+	pending->disc_watch = 0;
 
-	free_pending_add_call();
+	free_pending_add_call(pending);
 }
 
-static void send_add_failed(const char *owner, const char *path,
-							uint8_t status)
+static void send_add_failed(struct add_data *pending, const char *owner,
+					const char *path, uint8_t status)
 {
 	struct l_dbus *dbus = dbus_get_bus();
 	struct l_dbus_message_builder *builder;
@@ -102,41 +124,44 @@ static void send_add_failed(const char *owner, const char *path,
 						"AddNodeFailed");
 
 	builder = l_dbus_message_builder_new(msg);
-	dbus_append_byte_array(builder, add_pending->uuid, 16);
+	dbus_append_byte_array(builder, pending->uuid, 16);
 	l_dbus_message_builder_append_basic(builder, 's',
 						mesh_prov_status_str(status));
 	l_dbus_message_builder_finalize(builder);
 	l_dbus_message_builder_destroy(builder);
 	l_dbus_send(dbus, msg);
 
-	free_pending_add_call();
+	free_pending_add_call(pending);
 }
 
 static bool add_cmplt(void *user_data, uint8_t status,
 					struct mesh_prov_node_info *info)
 {
 	struct add_data *pending = user_data;
-	struct mesh_node *node = pending->node;
+	struct mesh_node *node;
 	struct l_dbus *dbus = dbus_get_bus();
 	struct l_dbus_message_builder *builder;
 	struct l_dbus_message *msg;
 	bool result;
 
-	if (pending != add_pending)
+	if (!add_is_pending(pending))
 		return false;
 
+	node = pending->node;
+
 	if (status != PROV_ERR_SUCCESS) {
-		send_add_failed(node_get_owner(node), node_get_app_path(node),
-									status);
+		send_add_failed(pending, node_get_owner(node),
+					node_get_app_path(node), status);
 		return false;
 	}
 
-	result = keyring_put_remote_dev_key(add_pending->node, info->unicast,
+	result = keyring_put_remote_dev_key(pending->node, info->unicast,
 					info->num_ele, info->device_key);
 
 	if (!result) {
-		send_add_failed(node_get_owner(node), node_get_app_path(node),
-						PROV_ERR_CANT_ASSIGN_ADDR);
+		send_add_failed(pending, node_get_owner(node),
+					node_get_app_path(node),
+					PROV_ERR_CANT_ASSIGN_ADDR);
 		return false;
 	}
 
@@ -146,7 +171,7 @@ static bool add_cmplt(void *user_data, uint8_t status,
 						"AddNodeComplete");
 
 	builder = l_dbus_message_builder_new(msg);
-	dbus_append_byte_array(builder, add_pending->uuid, 16);
+	dbus_append_byte_array(builder, pending->uuid, 16);
 	l_dbus_message_builder_append_basic(builder, 'q', &info->unicast);
 	l_dbus_message_builder_append_basic(builder, 'y', &info->num_ele);
 	l_dbus_message_builder_finalize(builder);
@@ -154,7 +179,7 @@ static bool add_cmplt(void *user_data, uint8_t status,
 
 	l_dbus_send(dbus, msg);
 
-	free_pending_add_call();
+	free_pending_add_call(pending);
 
 	return true;
 }
@@ -165,7 +190,7 @@ static void mgr_prov_data (struct l_dbus_message *reply, void *user_data)
 	uint16_t net_idx;
 	uint16_t primary;
 
-	if (pending != add_pending)
+	if (!add_is_pending(pending))
 		return;
 
 	if (l_dbus_message_is_error(reply))
@@ -174,9 +199,9 @@ static void mgr_prov_data (struct l_dbus_message *reply, void *user_data)
 	if (!l_dbus_message_get_arguments(reply, "qq", &net_idx, &primary))
 		return;
 
-	add_pending->primary = primary;
-	add_pending->net_idx = net_idx;
-	initiator_prov_data(net_idx, primary, add_pending);
+	pending->primary = primary;
+	pending->net_idx = net_idx;
+	initiator_prov_data(net_idx, primary, pending);
 }
 
 static bool add_data_get(void *user_data, uint8_t num_ele)
@@ -187,41 +212,49 @@ static bool add_data_get(void *user_data, uint8_t num_ele)
 	const char *app_path;
 	const char *sender;
 
-	if (pending != add_pending)
+	if (!add_is_pending(pending))
 		return false;
 
 	dbus = dbus_get_bus();
-	app_path = node_get_app_path(add_pending->node);
-	sender = node_get_owner(add_pending->node);
+	app_path = node_get_app_path(pending->node);
+	sender = node_get_owner(pending->node);
 
 	msg = l_dbus_message_new_method_call(dbus, sender, app_path,
 						MESH_PROVISIONER_INTERFACE,
 						"RequestProvData");
 
 	l_dbus_message_set_arguments(msg, "y", num_ele);
-	l_dbus_send_with_reply(dbus, msg, mgr_prov_data, add_pending, NULL);
+	l_dbus_send_with_reply(dbus, msg, mgr_prov_data, pending, NULL);
 
-	add_pending->num_ele = num_ele;
+	pending->num_ele = num_ele;
 
 	return true;
 }
 
 static void add_start(void *user_data, int err)
 {
+	struct add_data *pending = user_data;
 	struct l_dbus_message *reply;
 
 	l_debug("Start callback");
 
+	if (!add_is_pending(pending))
+		return;
+
 	if (err == MESH_ERROR_NONE)
-		reply = l_dbus_message_new_method_return(add_pending->msg);
+		reply = l_dbus_message_new_method_return(pending->msg);
 	else
-		reply = dbus_error(add_pending->msg, MESH_ERROR_FAILED,
+		reply = dbus_error(pending->msg, MESH_ERROR_FAILED,
 				"Failed to start provisioning initiator");
 
 	l_dbus_send(dbus_get_bus(), reply);
-	l_dbus_message_unref(add_pending->msg);
+	l_dbus_message_unref(pending->msg);
 
-	add_pending->msg = NULL;
+	pending->msg = NULL;
+
+	/* The initiator has already released its session */
+	if (err != MESH_ERROR_NONE)
+		free_pending_add_call(pending);
 }
 
 static struct l_dbus_message *add_node_call(struct l_dbus *dbus,
@@ -231,6 +264,7 @@ static struct l_dbus_message *add_node_call(struct l_dbus *dbus,
 	struct mesh_node *node = user_data;
 	struct l_dbus_message_iter iter_uuid, options;
 	struct l_dbus_message *reply;
+	struct add_data *pending;
 	uint8_t *uuid;
 	uint32_t n = 22;
 
@@ -252,32 +286,49 @@ static struct l_dbus_message *add_node_call(struct l_dbus *dbus,
 		scan_cancel(NULL, node);
 	}
 
+	if (l_queue_find(add_pending, pending_uuid_match, uuid))
+		return dbus_error(msg, MESH_ERROR_ALREADY_EXISTS,
+						"Device already being added");
+
+	if (l_queue_length(add_pending) >= mesh_get_prov_sessions())
+		return dbus_error(msg, MESH_ERROR_BUSY,
+					"Too many provisioning sessions");
+
 	/* Invoke Prov Initiator */
-	add_pending = l_new(struct add_data, 1);
-	memcpy(add_pending->uuid, uuid, 16);
-	add_pending->node = node;
-	add_pending->agent = node_get_agent(node);
+	pending = l_new(struct add_data, 1);
+	memcpy(pending->uuid, uuid, 16);
+	pending->node = node;
+	pending->agent = node_get_agent(node);
 
-	if (!node_is_provisioner(node) || (add_pending->agent == NULL)) {
+	if (!node_is_provisioner(node) || (pending->agent == NULL)) {
 		l_debug("Provisioner: %d", node_is_provisioner(node));
-		l_debug("Agent: %p", add_pending->agent);
+		l_debug("Agent: %p", pending->agent);
 		reply = dbus_error(msg, MESH_ERROR_NOT_AUTHORIZED,
 							"Missing Interfaces");
 		goto fail;
 	}
 
-	add_pending->msg = l_dbus_message_ref(msg);
-	initiator_start(PB_ADV, uuid, 99, 60, add_pending->agent, add_start,
-				add_data_get, add_cmplt, node, add_pending);
+	if (!add_pending)
+		add_pending = l_queue_new();
+
+	l_queue_push_tail(add_pending, pending);
+
+	pending->msg = l_dbus_message_ref(msg);
 
-	add_pending->disc_watch = l_dbus_add_disconnect_watch(dbus,
+	if (!initiator_start(PB_ADV, uuid, 99, 60, pending->agent, add_start,
+				add_data_get, add_cmplt, node, pending)) {
+		reply = dbus_error(msg, MESH_ERROR_BUSY, NULL);
+		free_pending_add_call(pending);
+		return reply;
+	}
+
+	pending->disc_watch = l_dbus_add_disconnect_watch(dbus,
 						node_get_owner(node),
-						prov_disc_cb, NULL, NULL);
+						prov_disc_cb, pending, NULL);
 
 	return NULL;
 fail:
-	l_free(add_pending);
-	add_pending = NULL;
+	l_free(pending);
 	return reply;
 }
 
@@ -776,6 +827,18 @@ static struct l_dbus_message *set_key_phase_call(struct l_dbus *dbus,
 	return l_dbus_message_new_method_return(msg);
 }
 
+static bool prov_sessions_getter(struct l_dbus *dbus,
+					struct l_dbus_message *msg,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	uint16_t sessions = mesh_get_prov_sessions();
+
+	l_dbus_message_builder_append_basic(builder, 'q', &sessions);
+
+	return true;
+}
+
 static void setup_management_interface(struct l_dbus_interface *iface)
 {
 	l_dbus_interface_method(iface, "AddNode", 0, add_node_call, "",
@@ -807,6 +870,8 @@ static void setup_management_interface(struct l_dbus_interface *iface)
 							"app_index", "app_key");
 	l_dbus_interface_method(iface, "SetKeyPhase", 0, set_key_phase_call, "",
 						"qy", "net_index", "phase");
+	l_dbus_interface_property(iface, "ProvSessions", 0, "q",
+						prov_sessions_getter, NULL);
 }
 
 bool manager_dbus_init(struct l_dbus *bus)
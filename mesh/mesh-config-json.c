@@ -39,6 +39,9 @@
 
 #define CHECK_KEY_IDX_RANGE(x) ((x) <= 4095)
 
+/* Delay used to coalesce bursts of non-critical configuration changes */
+#define CONFIG_FLUSH_DELAY_MS	500
+
 struct mesh_config {
 	json_object *jnode;
 	char *node_dir_path;
@@ -46,6 +49,10 @@ struct mesh_config {
 	uint32_t write_seq;
 	struct timeval write_time;
 	struct l_queue *idles;
+	struct l_timeout *flush_timeout;
+	unsigned int txn_depth;
+	bool dirty;
+	bool urgent;
 };
 
 struct write_info {
@@ -82,6 +89,102 @@ static bool save_config(json_object *jnode, const char *fname)
 	return result;
 }
 
+static void flush_config_to(struct l_timeout *timeout, void *user_data);
+
+static bool write_config(struct mesh_config *cfg)
+{
+	char *fname_tmp, *fname_bak, *fname_cfg;
+	bool result = false;
+
+	fname_cfg = cfg->node_dir_path;
+	fname_tmp = l_strdup_printf("%s%s", fname_cfg, tmp_ext);
+	fname_bak = l_strdup_printf("%s%s", fname_cfg, bak_ext);
+	remove(fname_tmp);
+
+	result = save_config(cfg->jnode, fname_tmp);
+
+	if (result) {
+		remove(fname_bak);
+
+		/* A newly created node has nothing to back up yet */
+		if ((rename(fname_cfg, fname_bak) < 0 && errno != ENOENT) ||
+					rename(fname_tmp, fname_cfg) < 0)
+			result = false;
+	}
+
+	remove(fname_tmp);
+
+	l_free(fname_tmp);
+	l_free(fname_bak);
+
+	gettimeofday(&cfg->write_time, NULL);
+
+	if (!result) {
+		/* Keep everything pending and try again later */
+		cfg->dirty = true;
+
+		if (cfg->flush_timeout)
+			l_timeout_modify_ms(cfg->flush_timeout,
+						CONFIG_FLUSH_DELAY_MS);
+		else
+			cfg->flush_timeout = l_timeout_create_ms(
+						CONFIG_FLUSH_DELAY_MS,
+						flush_config_to, cfg, NULL);
+
+		return false;
+	}
+
+	/* Whatever was pending is part of this write */
+	l_timeout_remove(cfg->flush_timeout);
+	cfg->flush_timeout = NULL;
+	cfg->dirty = false;
+	cfg->urgent = false;
+
+	return true;
+}
+
+static void flush_config_to(struct l_timeout *timeout, void *user_data)
+{
+	struct mesh_config *cfg = user_data;
+
+	if (!write_config(cfg))
+		l_error("Failed to flush configuration to %s",
+							cfg->node_dir_path);
+}
+
+/*
+ * Key material, addresses and IV Index must be on disk before the change
+ * is acknowledged. Since every write stores the whole node, anything that
+ * was deferred before goes out with it, so the on-disk order of changes
+ * is never reversed. Inside a transaction the write happens at commit.
+ */
+static bool sync_config(struct mesh_config *cfg)
+{
+	if (cfg->txn_depth) {
+		cfg->dirty = true;
+		cfg->urgent = true;
+		return true;
+	}
+
+	return write_config(cfg);
+}
+
+/* Model and feature state is written behind, coalescing bursts */
+static bool defer_config(struct mesh_config *cfg)
+{
+	cfg->dirty = true;
+
+	if (cfg->txn_depth || cfg->flush_timeout)
+		return true;
+
+	cfg->flush_timeout = l_timeout_create_ms(CONFIG_FLUSH_DELAY_MS,
+						flush_config_to, cfg, NULL);
+	if (!cfg->flush_timeout)
+		return write_config(cfg);
+
+	return true;
+}
+
 static bool get_int(json_object *jobj, const char *keyword, int *value)
 {
 	json_object *jvalue;
@@ -626,7 +729,7 @@ bool mesh_config_net_key_add(struct mesh_config *cfg, uint16_t idx,
 
 	json_object_array_add(jarray, jentry);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return sync_config(cfg);
 
 fail:
 	if (jentry)
@@ -668,7 +771,7 @@ bool mesh_config_net_key_update(struct mesh_config *cfg, uint16_t idx,
 	json_object_object_add(jentry, "keyRefresh",
 				json_object_new_int(KEY_REFRESH_PHASE_ONE));
 
-	return save_config(jnode, cfg->node_dir_path);
+	return sync_config(cfg);
 }
 
 bool mesh_config_net_key_del(struct mesh_config *cfg, uint16_t idx)
@@ -688,7 +791,7 @@ bool mesh_config_net_key_del(struct mesh_config *cfg, uint16_t idx)
 	if (!json_object_array_length(jarray))
 		json_object_object_del(jnode, "netKeys");
 
-	return save_config(jnode, cfg->node_dir_path);
+	return sync_config(cfg);
 }
 
 bool mesh_config_write_device_key(struct mesh_config *cfg, uint8_t *key)
@@ -696,7 +799,7 @@ bool mesh_config_write_device_key(struct mesh_config *cfg, uint8_t *key)
 	if (!cfg || !add_key_value(cfg->jnode, "deviceKey", key))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return sync_config(cfg);
 }
 
 bool mesh_config_write_token(struct mesh_config *cfg, uint8_t *token)
@@ -704,7 +807,7 @@ bool mesh_config_write_token(struct mesh_config *cfg, uint8_t *token)
 	if (!cfg || !add_u64_value(cfg->jnode, "token", token))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return sync_config(cfg);
 }
 
 bool mesh_config_app_key_add(struct mesh_config *cfg, uint16_t net_idx,
@@ -747,7 +850,7 @@ bool mesh_config_app_key_add(struct mesh_config *cfg, uint16_t net_idx,
 
 	json_object_array_add(jarray, jentry);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return sync_config(cfg);
 
 fail:
 
@@ -789,7 +892,7 @@ bool mesh_config_app_key_update(struct mesh_config *cfg, uint16_t app_idx,
 	if (!add_key_value(jentry, "key", key))
 		return false;
 
-	return save_config(jnode, cfg->node_dir_path);
+	return sync_config(cfg);
 }
 
 bool mesh_config_app_key_del(struct mesh_config *cfg, uint16_t net_idx,
@@ -810,7 +913,7 @@ bool mesh_config_app_key_del(struct mesh_config *cfg, uint16_t net_idx,
 	if (!json_object_array_length(jarray))
 		json_object_object_del(jnode, "appKeys");
 
-	return save_config(jnode, cfg->node_dir_path);
+	return sync_config(cfg);
 }
 
 bool mesh_config_model_binding_add(struct mesh_config *cfg, uint16_t ele_addr,
@@ -855,7 +958,7 @@ bool mesh_config_model_binding_add(struct mesh_config *cfg, uint16_t ele_addr,
 
 	json_object_array_add(jarray, jstring);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 bool mesh_config_model_binding_del(struct mesh_config *cfg, uint16_t ele_addr,
@@ -889,7 +992,7 @@ bool mesh_config_model_binding_del(struct mesh_config *cfg, uint16_t ele_addr,
 	if (!json_object_array_length(jarray))
 		json_object_object_del(jmodel, "bind");
 
-	return save_config(jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 static void free_model(void *data)
@@ -1475,7 +1578,7 @@ bool mesh_config_write_mode(struct mesh_config *cfg, const char *keyword,
 	if (!cfg || !write_mode(cfg->jnode, keyword, value))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 static bool write_relay_mode(json_object *jobj, uint8_t mode,
@@ -1511,7 +1614,7 @@ bool mesh_config_write_unicast(struct mesh_config *cfg, uint16_t unicast)
 	if (!cfg || !write_uint16_hex(cfg->jnode, "unicastAddress", unicast))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return sync_config(cfg);
 }
 
 bool mesh_config_write_relay_mode(struct mesh_config *cfg, uint8_t mode,
@@ -1521,7 +1624,7 @@ bool mesh_config_write_relay_mode(struct mesh_config *cfg, uint8_t mode,
 	if (!cfg || !write_relay_mode(cfg->jnode, mode, count, interval))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 bool mesh_config_write_net_transmit(struct mesh_config *cfg, uint8_t cnt,
@@ -1547,7 +1650,7 @@ bool mesh_config_write_net_transmit(struct mesh_config *cfg, uint8_t cnt,
 	json_object_object_del(jnode, "retransmit");
 	json_object_object_add(jnode, "retransmit", jrtx);
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 
 fail:
 	json_object_put(jrtx);
@@ -1572,7 +1675,7 @@ bool mesh_config_write_iv_index(struct mesh_config *cfg, uint32_t idx,
 	if (!write_int(jnode, "IVupdate", tmp))
 		return false;
 
-	return save_config(jnode, cfg->node_dir_path);
+	return sync_config(cfg);
 }
 
 static void add_model(void *a, void *b)
@@ -1802,7 +1905,7 @@ bool mesh_config_net_key_set_phase(struct mesh_config *cfg, uint16_t idx,
 		finish_key_refresh(jnode, idx);
 	}
 
-	return save_config(jnode, cfg->node_dir_path);
+	return sync_config(cfg);
 }
 
 bool mesh_config_model_pub_add(struct mesh_config *cfg, uint16_t ele_addr,
@@ -1865,7 +1968,7 @@ bool mesh_config_model_pub_add(struct mesh_config *cfg, uint16_t ele_addr,
 	json_object_object_add(jpub, "retransmit", jrtx);
 	json_object_object_add(jmodel, "publish", jpub);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 
 fail:
 	json_object_put(jpub);
@@ -1898,7 +2001,7 @@ bool mesh_config_model_pub_del(struct mesh_config *cfg, uint16_t addr,
 								"publish"))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 static void del_page(json_object *jarray, uint8_t page)
@@ -1958,7 +2061,7 @@ bool mesh_config_comp_page_add(struct mesh_config *cfg, uint8_t page,
 	json_object_array_add(jarray, jstring);
 	l_free(buf);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 bool mesh_config_comp_page_mv(struct mesh_config *cfg, uint8_t old, uint8_t nw)
@@ -2056,7 +2159,7 @@ bool mesh_config_model_sub_add(struct mesh_config *cfg, uint16_t ele_addr,
 
 	json_object_array_add(jarray, jstring);
 
-	return save_config(jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 bool mesh_config_model_sub_del(struct mesh_config *cfg, uint16_t ele_addr,
@@ -2096,7 +2199,7 @@ bool mesh_config_model_sub_del(struct mesh_config *cfg, uint16_t ele_addr,
 	if (!json_object_array_length(jarray))
 		json_object_object_del(jmodel, "subscribe");
 
-	return save_config(jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 bool mesh_config_model_sub_del_all(struct mesh_config *cfg, uint16_t addr,
@@ -2106,7 +2209,7 @@ bool mesh_config_model_sub_del_all(struct mesh_config *cfg, uint16_t addr,
 								"subscribe"))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 bool mesh_config_model_pub_enable(struct mesh_config *cfg, uint16_t ele_addr,
@@ -2135,7 +2238,7 @@ bool mesh_config_model_pub_enable(struct mesh_config *cfg, uint16_t ele_addr,
 	if (!enable)
 		json_object_object_del(jmodel, "publish");
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 bool mesh_config_model_sub_enable(struct mesh_config *cfg, uint16_t ele_addr,
@@ -2164,7 +2267,7 @@ bool mesh_config_model_sub_enable(struct mesh_config *cfg, uint16_t ele_addr,
 	if (!enable)
 		json_object_object_del(jmodel, "subscribe");
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 bool mesh_config_write_seq_number(struct mesh_config *cfg, uint32_t seq,
@@ -2248,7 +2351,7 @@ bool mesh_config_write_ttl(struct mesh_config *cfg, uint8_t ttl)
 	if (!cfg || !write_int(cfg->jnode, "defaultTTL", ttl))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 bool mesh_config_update_company_id(struct mesh_config *cfg, uint16_t cid)
@@ -2256,7 +2359,7 @@ bool mesh_config_update_company_id(struct mesh_config *cfg, uint16_t cid)
 	if (!cfg || !write_uint16_hex(cfg->jnode, "cid", cid))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 bool mesh_config_update_product_id(struct mesh_config *cfg, uint16_t pid)
@@ -2264,7 +2367,7 @@ bool mesh_config_update_product_id(struct mesh_config *cfg, uint16_t pid)
 	if (!cfg || !write_uint16_hex(cfg->jnode, "pid", pid))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 bool mesh_config_update_version_id(struct mesh_config *cfg, uint16_t vid)
@@ -2272,7 +2375,7 @@ bool mesh_config_update_version_id(struct mesh_config *cfg, uint16_t vid)
 	if (!cfg || !write_uint16_hex(cfg->jnode, "vid", vid))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 bool mesh_config_update_crpl(struct mesh_config *cfg, uint16_t crpl)
@@ -2280,7 +2383,7 @@ bool mesh_config_update_crpl(struct mesh_config *cfg, uint16_t crpl)
 	if (!cfg || !write_uint16_hex(cfg->jnode, "crpl", crpl))
 		return false;
 
-	return save_config(cfg->jnode, cfg->node_dir_path);
+	return defer_config(cfg);
 }
 
 static bool load_node(const char *fname, const uint8_t uuid[16],
@@ -2386,6 +2489,12 @@ void mesh_config_release(struct mesh_config *cfg)
 
 	l_queue_destroy(cfg->idles, release_idle);
 
+	/* Don't lose changes that are still being written behind */
+	if (cfg->dirty && !write_config(cfg))
+		l_error("Failed to flush configuration to %s",
+							cfg->node_dir_path);
+
+	l_timeout_remove(cfg->flush_timeout);
 	l_free(cfg->node_dir_path);
 	json_object_put(cfg->jnode);
 	l_free(cfg);
@@ -2394,30 +2503,9 @@ void mesh_config_release(struct mesh_config *cfg)
 static void idle_save_config(struct l_idle *idle, void *user_data)
 {
 	struct write_info *info = user_data;
-	char *fname_tmp, *fname_bak, *fname_cfg;
-	bool result = false;
-
-	fname_cfg = info->cfg->node_dir_path;
-	fname_tmp = l_strdup_printf("%s%s", fname_cfg, tmp_ext);
-	fname_bak = l_strdup_printf("%s%s", fname_cfg, bak_ext);
-	remove(fname_tmp);
-
-	result = save_config(info->cfg->jnode, fname_tmp);
-
-	if (result) {
-		remove(fname_bak);
-
-		if (rename(fname_cfg, fname_bak) < 0 ||
-					rename(fname_tmp, fname_cfg) < 0)
-			result = false;
-	}
-
-	remove(fname_tmp);
-
-	l_free(fname_tmp);
-	l_free(fname_bak);
+	bool result;
 
-	gettimeofday(&info->cfg->write_time, NULL);
+	result = write_config(info->cfg);
 
 	if (info->cb)
 		info->cb(info->user_data, result);
@@ -2451,11 +2539,37 @@ bool mesh_config_save(struct mesh_config *cfg, bool no_wait,
 
 		idle = l_idle_create(idle_save_config, info, NULL);
 		l_queue_push_tail(cfg->idles, idle);
+		cfg->dirty = true;
 	}
 
 	return true;
 }
 
+/*
+ * Group several changes into a single write. Transactions nest; the
+ * outermost commit writes immediately if key material or other state
+ * that must be durable changed, otherwise the write is deferred.
+ */
+void mesh_config_begin(struct mesh_config *cfg)
+{
+	if (cfg)
+		cfg->txn_depth++;
+}
+
+bool mesh_config_commit(struct mesh_config *cfg)
+{
+	if (!cfg || !cfg->txn_depth)
+		return false;
+
+	if (--cfg->txn_depth || !cfg->dirty)
+		return true;
+
+	if (!cfg->urgent)
+		return defer_config(cfg);
+
+	return write_config(cfg);
+}
+
 bool mesh_config_load_nodes(const char *cfgdir_name, mesh_config_node_func_t cb,
 								void *user_data)
 {
@@ -2522,6 +2636,11 @@ void mesh_config_destroy_nvm(struct mesh_config *cfg)
 	if (!cfg)
 		return;
 
+	/* Nothing pending may recreate the node file once it is gone */
+	l_timeout_remove(cfg->flush_timeout);
+	cfg->flush_timeout = NULL;
+	cfg->dirty = false;
+
 	node_dir = dirname(cfg->node_dir_path);
 	l_debug("Delete node config %s", node_dir);
 
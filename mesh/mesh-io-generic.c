@@ -28,6 +28,19 @@
 #include "mesh/mesh-io-api.h"
 #include "mesh/mesh-io-generic.h"
 
+/* Advertising sets used concurrently on extended advertising controllers */
+#define MAX_ADV_SETS	4
+
+/* Endless packets take turns on the sets, this many events at a time */
+#define UNLIMITED_BURST	8
+
+struct adv_set {
+	struct mesh_io_private *pvt;
+	struct tx_pkt *tx;
+	uint16_t interval;
+	uint8_t handle;
+};
+
 struct mesh_io_private {
 	struct bt_hci *hci;
 	void *user_data;
@@ -36,10 +49,13 @@ struct mesh_io_private {
 	struct l_queue *rx_regs;
 	struct l_queue *tx_pkts;
 	struct tx_pkt *tx;
+	struct adv_set sets[MAX_ADV_SETS];
+	uint8_t num_sets;
 	uint16_t index;
 	uint16_t interval;
 	bool sending;
 	bool active;
+	bool tx_ready;
 };
 
 struct pvt_rx_reg {
@@ -112,26 +128,12 @@ static void process_rx(struct mesh_io_private *pvt, int8_t rssi,
 	l_queue_foreach(pvt->rx_regs, process_rx_callbacks, &rx);
 }
 
-static void event_adv_report(struct mesh_io *io, const void *buf, uint8_t size)
+static void process_adv_data(struct mesh_io *io, int8_t rssi,
+					const uint8_t *addr, const uint8_t *adv,
+					uint8_t adv_len)
 {
-	const struct bt_hci_evt_le_adv_report *evt = buf;
-	const uint8_t *adv;
-	const uint8_t *addr;
-	uint32_t instant;
-	uint8_t adv_len;
+	uint32_t instant = get_instant();
 	uint16_t len = 0;
-	int8_t rssi;
-
-	if (evt->event_type != 0x03)
-		return;
-
-	instant = get_instant();
-	adv = evt->data;
-	adv_len = evt->data_len;
-	addr = evt->addr;
-
-	/* rssi is just beyond last byte of data */
-	rssi = (int8_t) adv[adv_len];
 
 	while (len < adv_len - 1) {
 		uint8_t field_len = adv[0];
@@ -153,6 +155,94 @@ static void event_adv_report(struct mesh_io *io, const void *buf, uint8_t size)
 	}
 }
 
+static void event_adv_report(struct mesh_io *io, const void *buf, uint8_t size)
+{
+	const struct bt_hci_evt_le_adv_report *evt = buf;
+
+	if (evt->event_type != 0x03)
+		return;
+
+	/* rssi is just beyond last byte of data */
+	process_adv_data(io, (int8_t) evt->data[evt->data_len], evt->addr,
+						evt->data, evt->data_len);
+}
+
+static void event_ext_adv_report(struct mesh_io *io, const void *buf,
+								uint8_t size)
+{
+	const struct bt_hci_evt_le_ext_adv_report *evt = buf;
+	const struct bt_hci_le_ext_adv_report *report;
+	const uint8_t *ptr = buf;
+	uint8_t i;
+
+	if (size < sizeof(*evt))
+		return;
+
+	ptr += sizeof(*evt);
+	size -= sizeof(*evt);
+
+	for (i = 0; i < evt->num_reports; i++) {
+		report = (const void *) ptr;
+
+		if (size < sizeof(*report) ||
+				size < sizeof(*report) + report->data_len)
+			return;
+
+		/* Legacy ADV_NONCONN_IND, as the one reported above */
+		if (L_LE16_TO_CPU(report->event_type) == 0x0010)
+			process_adv_data(io, report->rssi, report->addr,
+						report->data, report->data_len);
+
+		ptr += sizeof(*report) + report->data_len;
+		size -= sizeof(*report) + report->data_len;
+	}
+}
+
+static void tx_worker(void *user_data);
+
+static bool is_unlimited(const struct tx_pkt *tx)
+{
+	return tx->info.type == MESH_IO_TIMING_TYPE_GENERAL &&
+			tx->info.u.gen.cnt == MESH_IO_TX_COUNT_UNLIMITED;
+}
+
+static void event_adv_set_term(struct mesh_io *io, const void *buf,
+								uint8_t size)
+{
+	const struct bt_hci_evt_le_adv_set_term *evt = buf;
+	struct mesh_io_private *pvt = io->pvt;
+	struct adv_set *set;
+	int i;
+
+	if (size < sizeof(*evt) || evt->handle >= pvt->num_sets)
+		return;
+
+	set = &pvt->sets[evt->handle];
+
+	/* An endless packet ended its burst, it goes again after the rest */
+	if (set->tx && is_unlimited(set->tx))
+		l_queue_push_tail(pvt->tx_pkts, set->tx);
+	else
+		l_free(set->tx);
+
+	set->tx = NULL;
+
+	/* Resume any packet that was waiting for a free set */
+	if (!pvt->tx_timeout && !l_queue_isempty(pvt->tx_pkts)) {
+		tx_worker(pvt);
+		return;
+	}
+
+	for (i = 0; i < pvt->num_sets; i++) {
+		if (pvt->sets[i].tx)
+			return;
+	}
+
+	/* At end of any burst of ADVs, force new random addresses */
+	for (i = 0; i < pvt->num_sets; i++)
+		pvt->sets[i].interval = 0;
+}
+
 static void event_callback(const void *buf, uint8_t size, void *user_data)
 {
 	uint8_t event = l_get_u8(buf);
@@ -163,18 +253,93 @@ static void event_callback(const void *buf, uint8_t size, void *user_data)
 		event_adv_report(io, buf + 1, size - 1);
 		break;
 
+	case BT_HCI_EVT_LE_EXT_ADV_REPORT:
+		event_ext_adv_report(io, buf + 1, size - 1);
+		break;
+
+	case BT_HCI_EVT_LE_ADV_SET_TERM:
+		event_adv_set_term(io, buf + 1, size - 1);
+		break;
+
 	default:
 		l_debug("Other Meta Evt - %d", event);
 	}
 }
 
+static void restart_scan(struct mesh_io_private *pvt);
+
+static void start_tx(struct mesh_io_private *pvt)
+{
+	pvt->tx_ready = true;
+
+	/* Scanning waits as well, it has to use the same command set */
+	restart_scan(pvt);
+
+	if (!l_queue_isempty(pvt->tx_pkts))
+		l_idle_oneshot(tx_worker, pvt, NULL);
+}
+
+static void num_adv_sets_callback(const void *data, uint8_t size,
+							void *user_data)
+{
+	const struct bt_hci_rsp_le_read_num_supported_adv_sets *rsp = data;
+	struct mesh_io_private *pvt = user_data;
+	int i;
+
+	if (rsp->status) {
+		l_error("Failed to read number of advertising sets");
+		start_tx(pvt);
+		return;
+	}
+
+	/*
+	 * An endless packet would keep a single set to itself, so that
+	 * case stays with legacy advertising, which interleaves packets.
+	 */
+	if (rsp->num_of_sets < 2) {
+		l_debug("Too few advertising sets, using legacy advertising");
+		start_tx(pvt);
+		return;
+	}
+
+	pvt->num_sets = rsp->num_of_sets;
+	if (pvt->num_sets > MAX_ADV_SETS)
+		pvt->num_sets = MAX_ADV_SETS;
+
+	for (i = 0; i < pvt->num_sets; i++) {
+		pvt->sets[i].pvt = pvt;
+		pvt->sets[i].handle = i;
+	}
+
+	l_debug("Using %u advertising sets", pvt->num_sets);
+	start_tx(pvt);
+}
+
 static void local_commands_callback(const void *data, uint8_t size,
 							void *user_data)
 {
 	const struct bt_hci_rsp_read_local_commands *rsp = data;
+	struct mesh_io_private *pvt = user_data;
 
-	if (rsp->status)
+	if (rsp->status) {
 		l_error("Failed to read local commands");
+		start_tx(pvt);
+		return;
+	}
+
+	/* Set Advertising Set Random Address, Set Extended Advertising
+	 * Parameters, Data and Enable, Read Number of Supported Sets, Set
+	 * Extended Scan Parameters and Enable. Legacy and extended commands
+	 * can't be mixed, so all of them are needed.
+	 */
+	if ((rsp->commands[36] & 0xae) != 0xae ||
+				(rsp->commands[37] & 0x60) != 0x60) {
+		start_tx(pvt);
+		return;
+	}
+
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_READ_NUM_SUPPORTED_ADV_SETS,
+				NULL, 0, num_adv_sets_callback, pvt, NULL);
 }
 
 static void local_features_callback(const void *data, uint8_t size,
@@ -195,23 +360,26 @@ static void hci_generic_callback(const void *data, uint8_t size,
 		l_error("Failed to initialize HCI");
 }
 
+static void reset_adv_sets(struct mesh_io_private *pvt)
+{
+	int i;
+
+	for (i = 0; i < pvt->num_sets; i++) {
+		l_free(pvt->sets[i].tx);
+		pvt->sets[i].tx = NULL;
+		pvt->sets[i].interval = 0;
+	}
+
+	pvt->num_sets = 0;
+	pvt->tx_ready = false;
+}
+
 static void configure_hci(struct mesh_io_private *io)
 {
-	struct bt_hci_cmd_le_set_scan_parameters cmd;
 	struct bt_hci_cmd_set_event_mask cmd_sem;
 	struct bt_hci_cmd_le_set_event_mask cmd_slem;
 	struct bt_hci_cmd_le_set_random_address cmd_raddr;
 
-	/* Set scan parameters */
-	cmd.type = 0x00; /* Passive Scanning. No scanning PDUs shall be sent */
-	cmd.interval = 0x0030; /* Scan Interval = N * 0.625ms */
-	cmd.window = 0x0030; /* Scan Window = N * 0.625ms */
-	cmd.own_addr_type = 0x00; /* Public Device Address */
-	/* Accept all advertising packets except directed advertising packets
-	 * not addressed to this device (default).
-	 */
-	cmd.filter_policy = 0x00;
-
 	/* Set event mask
 	 *
 	 * Mask: 0x2000800002008890
@@ -234,7 +402,7 @@ static void configure_hci(struct mesh_io_private *io)
 
 	/* Set LE event mask
 	 *
-	 * Mask: 0x000000000000087f
+	 * Mask: 0x000000000002187f
 	 *   LE Connection Complete
 	 *   LE Advertising Report
 	 *   LE Connection Update Complete
@@ -243,10 +411,12 @@ static void configure_hci(struct mesh_io_private *io)
 	 *   LE Remote Connection Parameter Request
 	 *   LE Data Length Change
 	 *   LE PHY Update Complete
+	 *   LE Extended Advertising Report
+	 *   LE Advertising Set Terminated
 	 */
 	cmd_slem.mask[0] = 0x7f;
-	cmd_slem.mask[1] = 0x08;
-	cmd_slem.mask[2] = 0x00;
+	cmd_slem.mask[1] = 0x18;
+	cmd_slem.mask[2] = 0x02;
 	cmd_slem.mask[3] = 0x00;
 	cmd_slem.mask[4] = 0x00;
 	cmd_slem.mask[5] = 0x00;
@@ -257,6 +427,9 @@ static void configure_hci(struct mesh_io_private *io)
 	l_getrandom(cmd_raddr.addr, 6);
 	cmd_raddr.addr[5] |= 0xc0;
 
+	/* Hold transmissions until the advertising commands are known */
+	reset_adv_sets(io);
+
 	/* TODO: Move to suitable place. Set suitable masks */
 	/* Reset Command */
 	bt_hci_send(io->hci, BT_HCI_CMD_RESET, NULL, 0, hci_generic_callback,
@@ -264,7 +437,7 @@ static void configure_hci(struct mesh_io_private *io)
 
 	/* Read local supported commands */
 	bt_hci_send(io->hci, BT_HCI_CMD_READ_LOCAL_COMMANDS, NULL, 0,
-					local_commands_callback, NULL, NULL);
+					local_commands_callback, io, NULL);
 
 	/* Read local supported features */
 	bt_hci_send(io->hci, BT_HCI_CMD_READ_LOCAL_FEATURES, NULL, 0,
@@ -278,13 +451,34 @@ static void configure_hci(struct mesh_io_private *io)
 	bt_hci_send(io->hci, BT_HCI_CMD_LE_SET_EVENT_MASK, &cmd_slem,
 			sizeof(cmd_slem), hci_generic_callback, NULL, NULL);
 
-	/* Set LE random address */
+	/*
+	 * Set LE random address, used by the scanner with either command
+	 * set. Advertising sets get their own address.
+	 */
 	bt_hci_send(io->hci, BT_HCI_CMD_LE_SET_RANDOM_ADDRESS, &cmd_raddr,
 			sizeof(cmd_raddr), hci_generic_callback, NULL, NULL);
+}
+
+static void scan_enable(struct mesh_io_private *pvt, bool enable,
+					bt_hci_callback_func_t callback)
+{
+	struct bt_hci_cmd_le_set_ext_scan_enable ext_cmd;
+	struct bt_hci_cmd_le_set_scan_enable cmd;
 
-	/* Scan Params */
-	bt_hci_send(io->hci, BT_HCI_CMD_LE_SET_SCAN_PARAMETERS, &cmd,
-				sizeof(cmd), hci_generic_callback, NULL, NULL);
+	if (pvt->num_sets) {
+		ext_cmd.enable = enable ? 0x01 : 0x00;
+		ext_cmd.filter_dup = 0x00;	/* Report duplicates */
+		ext_cmd.duration = 0;		/* Until disabled */
+		ext_cmd.period = 0;
+		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_SCAN_ENABLE,
+				&ext_cmd, sizeof(ext_cmd), callback, pvt, NULL);
+		return;
+	}
+
+	cmd.enable = enable ? 0x01 : 0x00;
+	cmd.filter_dup = 0x00;	/* Report duplicates */
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
+				&cmd, sizeof(cmd), callback, pvt, NULL);
 }
 
 static void scan_enable_rsp(const void *buf, uint8_t size,
@@ -300,12 +494,26 @@ static void set_recv_scan_enable(const void *buf, uint8_t size,
 							void *user_data)
 {
 	struct mesh_io_private *pvt = user_data;
-	struct bt_hci_cmd_le_set_scan_enable cmd;
 
-	cmd.enable = 0x01;	/* Enable scanning */
-	cmd.filter_dup = 0x00;	/* Report duplicates */
-	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
-			&cmd, sizeof(cmd), scan_enable_rsp, pvt, NULL);
+	scan_enable(pvt, true, scan_enable_rsp);
+}
+
+static void set_ext_scan_params(struct mesh_io_private *pvt)
+{
+	struct {
+		struct bt_hci_cmd_le_set_ext_scan_params cmd;
+		struct bt_hci_le_scan_phy phy;
+	} __attribute__ ((packed)) cmd;
+
+	cmd.cmd.own_addr_type = 0x01;		/* ADDR_TYPE_RANDOM */
+	cmd.cmd.filter_policy = 0x00;		/* Accept all */
+	cmd.cmd.num_phys = 0x01;		/* LE 1M */
+	cmd.phy.type = pvt->active ? 0x01 : 0x00; /* Passive/Active */
+	cmd.phy.interval = L_CPU_TO_LE16(0x0010); /* 10 ms */
+	cmd.phy.window = L_CPU_TO_LE16(0x0010);	/* 10 ms */
+
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_SCAN_PARAMS,
+			&cmd, sizeof(cmd), set_recv_scan_enable, pvt, NULL);
 }
 
 static void scan_disable_rsp(const void *buf, uint8_t size,
@@ -318,6 +526,11 @@ static void scan_disable_rsp(const void *buf, uint8_t size,
 	if (status)
 		l_error("LE Scan disable failed (0x%02x)", status);
 
+	if (pvt->num_sets) {
+		set_ext_scan_params(pvt);
+		return;
+	}
+
 	cmd.type = pvt->active ? 0x01 : 0x00;	/* Passive/Active scanning */
 	cmd.interval = L_CPU_TO_LE16(0x0010);	/* 10 ms */
 	cmd.window = L_CPU_TO_LE16(0x0010);	/* 10 ms */
@@ -369,28 +582,21 @@ static bool find_active(const void *a, const void *b)
 
 static void restart_scan(struct mesh_io_private *pvt)
 {
-	struct bt_hci_cmd_le_set_scan_enable cmd;
-
-	if (l_queue_isempty(pvt->rx_regs))
+	if (!pvt->tx_ready || l_queue_isempty(pvt->rx_regs))
 		return;
 
 	pvt->active = l_queue_find(pvt->rx_regs, find_active, NULL);
-	cmd.enable = 0x00;	/* Disable scanning */
-	cmd.filter_dup = 0x00;	/* Report duplicates */
-	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
-				&cmd, sizeof(cmd), scan_disable_rsp, pvt, NULL);
+	scan_enable(pvt, false, scan_disable_rsp);
 }
 
 static void hci_init(void *user_data)
 {
 	struct mesh_io *io = user_data;
 	bool result = true;
-	bool restarted = false;
 
-	if (io->pvt->hci) {
-		restarted = true;
+	/* Scanning is restarted once the command set is known again */
+	if (io->pvt->hci)
 		bt_hci_unref(io->pvt->hci);
-	}
 
 	io->pvt->hci = bt_hci_new_user_channel(io->pvt->index);
 	if (!io->pvt->hci) {
@@ -406,9 +612,6 @@ static void hci_init(void *user_data)
 						event_callback, io, NULL);
 
 		l_debug("Started mesh on hci %u", io->pvt->index);
-
-		if (restarted)
-			restart_scan(io->pvt);
 	}
 
 	if (io->pvt->ready_callback)
@@ -461,6 +664,7 @@ static bool dev_destroy(struct mesh_io *io)
 
 	bt_hci_unref(pvt->hci);
 	l_timeout_remove(pvt->tx_timeout);
+	reset_adv_sets(pvt);
 	l_queue_destroy(pvt->rx_regs, l_free);
 	l_queue_destroy(pvt->tx_pkts, l_free);
 	l_free(pvt);
@@ -615,6 +819,183 @@ static void send_pkt(struct mesh_io_private *pvt, struct tx_pkt *tx,
 				set_send_adv_params, pvt, NULL);
 }
 
+static void set_ext_adv_params(struct mesh_io_private *pvt,
+					struct adv_set *set, uint16_t interval)
+{
+	struct bt_hci_cmd_le_set_ext_adv_params cmd;
+	struct bt_hci_cmd_le_set_adv_set_rand_addr cmd_raddr;
+	uint32_t hci_interval;
+
+	/* Legacy ADV_NONCONN_IND can not go below 20 ms */
+	hci_interval = (interval * 16) / 10;
+	if (hci_interval < 0x0020)
+		hci_interval = 0x0020;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.handle = set->handle;
+	cmd.evt_properties = L_CPU_TO_LE16(0x0010); /* Legacy ADV_NONCONN_IND */
+	l_put_le16(hci_interval, cmd.min_interval);
+	cmd.min_interval[2] = hci_interval >> 16;
+	memcpy(cmd.max_interval, cmd.min_interval, 3);
+	cmd.channel_map = 0x07;
+	cmd.own_addr_type = 0x01; /* ADDR_TYPE_RANDOM */
+	cmd.filter_policy = 0x00;
+	cmd.tx_power = 0x7f; /* No preference */
+	cmd.primary_phy = 0x01; /* LE 1M */
+	cmd.secondary_phy = 0x01; /* LE 1M */
+	cmd.sid = set->handle;
+
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_ADV_PARAMS,
+				&cmd, sizeof(cmd), NULL, NULL, NULL);
+
+	cmd_raddr.handle = set->handle;
+	l_getrandom(cmd_raddr.bdaddr, 6);
+	cmd_raddr.bdaddr[5] |= 0xc0;
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_ADV_SET_RAND_ADDR,
+			&cmd_raddr, sizeof(cmd_raddr), NULL, NULL, NULL);
+
+	set->interval = interval;
+}
+
+static void ext_adv_enable(struct mesh_io_private *pvt, struct adv_set *set,
+					bool enable, uint8_t max_events,
+					bt_hci_callback_func_t callback)
+{
+	struct {
+		struct bt_hci_cmd_le_set_ext_adv_enable cmd;
+		struct bt_hci_cmd_ext_adv_set set;
+	} __attribute__ ((packed)) cmd;
+
+	cmd.cmd.enable = enable ? 0x01 : 0x00;
+	cmd.cmd.num_of_sets = 1;
+	cmd.set.handle = set->handle;
+	cmd.set.duration = 0;
+	cmd.set.max_events = max_events;
+
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_ADV_ENABLE,
+				&cmd, sizeof(cmd), callback, set, NULL);
+}
+
+static void ext_adv_enable_rsp(const void *buf, uint8_t size,
+							void *user_data)
+{
+	struct adv_set *set = user_data;
+	uint8_t status = l_get_u8(buf);
+
+	if (!status)
+		return;
+
+	/* No Advertising Set Terminated event follows, release the set */
+	l_error("LE Ext Adv enable failed (0x%02x)", status);
+	l_free(set->tx);
+	set->tx = NULL;
+
+	if (!set->pvt->tx_timeout)
+		tx_worker(set->pvt);
+}
+
+static void ext_send_pkt(struct mesh_io_private *pvt, struct adv_set *set,
+				struct tx_pkt *tx, uint16_t interval,
+				uint8_t count)
+{
+	struct {
+		struct bt_hci_cmd_le_set_ext_adv_data cmd;
+		uint8_t data[31];
+	} __attribute__ ((packed)) cmd;
+
+	set->tx = tx;
+
+	/*
+	 * Parameters stay with the set between packets, so the only
+	 * commands needed per packet are the data and a bounded enable
+	 * that the controller ends on its own.
+	 */
+	if (set->interval != interval)
+		set_ext_adv_params(pvt, set, interval);
+
+	cmd.cmd.handle = set->handle;
+	cmd.cmd.operation = 0x03; /* Complete data */
+	cmd.cmd.fragment_preference = 0x01; /* No fragmentation */
+	cmd.cmd.data_len = tx->len + 1;
+	cmd.data[0] = tx->len;
+	memcpy(cmd.data + 1, tx->pkt, tx->len);
+
+	bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_EXT_ADV_DATA, &cmd,
+				sizeof(cmd.cmd) + cmd.cmd.data_len,
+				NULL, NULL, NULL);
+
+	ext_adv_enable(pvt, set, true,
+			count == MESH_IO_TX_COUNT_UNLIMITED ?
+						UNLIMITED_BURST : count,
+			ext_adv_enable_rsp);
+}
+
+static struct adv_set *get_free_set(struct mesh_io_private *pvt,
+							struct tx_pkt *tx)
+{
+	struct adv_set *set = NULL;
+	int i, num_free = 0;
+
+	for (i = 0; i < pvt->num_sets; i++) {
+		if (pvt->sets[i].tx)
+			continue;
+
+		if (!set)
+			set = &pvt->sets[i];
+
+		num_free++;
+	}
+
+	/* Never let endless packets take the last set */
+	if (is_unlimited(tx) && num_free < 2)
+		return NULL;
+
+	return set;
+}
+
+static void ext_tx_to(struct mesh_io_private *pvt, struct l_timeout *timeout)
+{
+	const struct l_queue_entry *entry;
+	struct adv_set *set = NULL;
+	struct tx_pkt *tx;
+	uint16_t ms;
+	uint8_t count;
+
+	l_timeout_remove(timeout);
+	pvt->tx_timeout = NULL;
+
+	/*
+	 * Endless packets may have to wait for a second free set, so send
+	 * the first packet that can go rather than stall the ones behind.
+	 */
+	for (entry = l_queue_get_entries(pvt->tx_pkts); entry;
+							entry = entry->next) {
+		set = get_free_set(pvt, entry->data);
+		if (set)
+			break;
+	}
+
+	/* Resumed by the Advertising Set Terminated event */
+	if (!entry)
+		return;
+
+	tx = entry->data;
+	l_queue_remove(pvt->tx_pkts, tx);
+
+	if (tx->info.type == MESH_IO_TIMING_TYPE_GENERAL) {
+		ms = tx->info.u.gen.interval;
+		count = tx->info.u.gen.cnt;
+	} else {
+		ms = 25;
+		count = 1;
+	}
+
+	ext_send_pkt(pvt, set, tx, ms, count);
+
+	/* Start the next packet on another set after its own delay */
+	tx_worker(pvt);
+}
+
 static void tx_to(struct l_timeout *timeout, void *user_data)
 {
 	struct mesh_io_private *pvt = user_data;
@@ -625,6 +1006,11 @@ static void tx_to(struct l_timeout *timeout, void *user_data)
 	if (!pvt)
 		return;
 
+	if (pvt->num_sets) {
+		ext_tx_to(pvt, timeout);
+		return;
+	}
+
 	tx = l_queue_pop_head(pvt->tx_pkts);
 	if (!tx) {
 		l_timeout_remove(timeout);
@@ -671,6 +1057,9 @@ static void tx_worker(void *user_data)
 	struct tx_pkt *tx;
 	uint32_t delay;
 
+	if (!pvt->tx_ready)
+		return;
+
 	tx = l_queue_peek_head(pvt->tx_pkts);
 	if (!tx)
 		return;
@@ -737,7 +1126,10 @@ static bool send_tx(struct mesh_io *io, struct mesh_io_send_info *info,
 	if (info->type == MESH_IO_TIMING_TYPE_POLL_RSP)
 		l_queue_push_head(pvt->tx_pkts, tx);
 	else {
-		if (pvt->tx)
+		/* Queued packets may be waiting for sets, not for a timer */
+		if (pvt->num_sets)
+			sending = !!pvt->tx_timeout;
+		else if (pvt->tx)
 			sending = true;
 		else
 			sending = !l_queue_isempty(pvt->tx_pkts);
@@ -749,7 +1141,7 @@ static bool send_tx(struct mesh_io *io, struct mesh_io_send_info *info,
 		 * guard against in-line cancelation of HCI command chain.
 		 */
 		if (info->type == MESH_IO_TIMING_TYPE_GENERAL && !sending &&
-							tx->info.u.gen.cnt == 1)
+				!pvt->num_sets && tx->info.u.gen.cnt == 1)
 			tx->info.u.gen.cnt++;
 	}
 
@@ -762,6 +1154,41 @@ static bool send_tx(struct mesh_io *io, struct mesh_io_send_info *info,
 	return true;
 }
 
+static void ext_tx_cancel(struct mesh_io_private *pvt, const uint8_t *data,
+								uint8_t len)
+{
+	struct tx_pattern pattern = {
+		.data = data,
+		.len = len
+	};
+	struct adv_set *set;
+	int i;
+
+	for (i = 0; i < pvt->num_sets; i++) {
+		set = &pvt->sets[i];
+
+		if (!set->tx)
+			continue;
+
+		if (len == 1 && !find_by_ad_type(set->tx,
+						L_UINT_TO_PTR(data[0])))
+			continue;
+
+		if (len != 1 && !find_by_pattern(set->tx, &pattern))
+			continue;
+
+		ext_adv_enable(pvt, set, false, 0, NULL);
+		l_free(set->tx);
+		set->tx = NULL;
+	}
+
+	if (l_queue_isempty(pvt->tx_pkts)) {
+		l_timeout_remove(pvt->tx_timeout);
+		pvt->tx_timeout = NULL;
+	} else if (!pvt->tx_timeout)
+		tx_worker(pvt);
+}
+
 static bool tx_cancel(struct mesh_io *io, const uint8_t *data, uint8_t len)
 {
 	struct mesh_io_private *pvt = io->pvt;
@@ -797,6 +1224,11 @@ static bool tx_cancel(struct mesh_io *io, const uint8_t *data, uint8_t len)
 		} while (tx);
 	}
 
+	if (pvt->num_sets) {
+		ext_tx_cancel(pvt, data, len);
+		return true;
+	}
+
 	if (l_queue_isempty(pvt->tx_pkts)) {
 		send_cancel(pvt);
 		l_timeout_remove(pvt->tx_timeout);
@@ -817,7 +1249,6 @@ static bool find_by_filter(const void *a, const void *b)
 static bool recv_register(struct mesh_io *io, const uint8_t *filter,
 			uint8_t len, mesh_io_recv_func_t cb, void *user_data)
 {
-	struct bt_hci_cmd_le_set_scan_enable cmd;
 	struct mesh_io_private *pvt = io->pvt;
 	struct pvt_rx_reg *rx_reg;
 	bool already_scanning;
@@ -844,13 +1275,13 @@ static bool recv_register(struct mesh_io *io, const uint8_t *filter,
 	if (l_queue_find(pvt->rx_regs, find_active, NULL))
 		active = true;
 
+	/* Scanning starts once the command set is known */
+	if (!pvt->tx_ready)
+		return true;
+
 	if (!already_scanning || pvt->active != active) {
 		pvt->active = active;
-		cmd.enable = 0x00;	/* Disable scanning */
-		cmd.filter_dup = 0x00;	/* Report duplicates */
-		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
-				&cmd, sizeof(cmd), scan_disable_rsp, pvt, NULL);
-
+		scan_enable(pvt, false, scan_disable_rsp);
 	}
 
 	return true;
@@ -859,7 +1290,6 @@ static bool recv_register(struct mesh_io *io, const uint8_t *filter,
 static bool recv_deregister(struct mesh_io *io, const uint8_t *filter,
 								uint8_t len)
 {
-	struct bt_hci_cmd_le_set_scan_enable cmd = {0, 0};
 	struct mesh_io_private *pvt = io->pvt;
 	struct pvt_rx_reg *rx_reg;
 	bool active = false;
@@ -873,14 +1303,14 @@ static bool recv_deregister(struct mesh_io *io, const uint8_t *filter,
 	if (l_queue_find(pvt->rx_regs, find_active, NULL))
 		active = true;
 
-	if (l_queue_isempty(pvt->rx_regs)) {
-		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
-					&cmd, sizeof(cmd), NULL, NULL, NULL);
+	if (!pvt->tx_ready)
+		return true;
 
-	} else if (active != pvt->active) {
+	if (l_queue_isempty(pvt->rx_regs))
+		scan_enable(pvt, false, NULL);
+	else if (active != pvt->active) {
 		pvt->active = active;
-		bt_hci_send(pvt->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
-				&cmd, sizeof(cmd), scan_disable_rsp, pvt, NULL);
+		scan_enable(pvt, false, scan_disable_rsp);
 	}
 
 	return true;
@@ -0,0 +1,649 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <ell/ell.h>
+
+#include "mesh/mesh-defs.h"
+#include "mesh/mesh-io.h"
+#include "mesh/mesh-io-api.h"
+#include "mesh/mesh-io-unix.h"
+
+/*
+ * Simulated advertising bearer for testing and benchmarking without a
+ * controller. Every node binds a datagram socket in a directory shared by
+ * all nodes. An advertisement is one datagram, the address of the sender
+ * followed by the AD structure. The peers list limits who hears a node,
+ * loss and delay apply to everything a node receives. Like a controller,
+ * a node puts one advertisement on air at a time.
+ *
+ * Options: <dir>[,name=<name>][,peers=<name>[+<name>...]]
+ *				[,loss=<percent>][,delay=<ms>]
+ */
+
+#define ADDR_LEN	6
+#define MAX_AD_LEN	31
+#define AIR_TIME_MS	1
+
+struct mesh_io_private {
+	struct l_io *io;
+	void *user_data;
+	mesh_io_ready_func_t ready_callback;
+	struct l_queue *rx_regs;
+	struct l_queue *tx_pkts;
+	struct l_queue *rx_pkts;
+	struct l_queue *air_pkts;
+	struct l_timeout *air_timeout;
+	char *dir;
+	char *name;
+	char **peers;
+	unsigned int loss;
+	unsigned int delay;
+	uint8_t addr[ADDR_LEN];
+};
+
+struct pvt_rx_reg {
+	mesh_io_recv_func_t cb;
+	void *user_data;
+	uint8_t len;
+	uint8_t filter[0];
+};
+
+struct tx_pkt {
+	struct mesh_io_private		*pvt;
+	struct l_timeout		*timeout;
+	struct mesh_io_send_info	info;
+	uint8_t				len;
+	uint8_t				pkt[MAX_AD_LEN];
+};
+
+struct rx_pkt {
+	struct mesh_io_private		*pvt;
+	struct l_timeout		*timeout;
+	uint32_t			instant;
+	uint8_t				addr[ADDR_LEN];
+	uint8_t				len;
+	uint8_t				pkt[MAX_AD_LEN];
+};
+
+struct air_pkt {
+	uint8_t				len;
+	uint8_t				buf[ADDR_LEN + MAX_AD_LEN];
+};
+
+struct tx_pattern {
+	const uint8_t			*data;
+	uint8_t				len;
+};
+
+static uint32_t get_instant(void)
+{
+	struct timeval tm;
+	uint32_t instant;
+
+	gettimeofday(&tm, NULL);
+	instant = tm.tv_sec * 1000;
+	instant += tm.tv_usec / 1000;
+
+	return instant;
+}
+
+static uint32_t instant_remaining_ms(uint32_t instant)
+{
+	instant -= get_instant();
+	return instant;
+}
+
+static void tx_free(void *data)
+{
+	struct tx_pkt *tx = data;
+
+	l_timeout_remove(tx->timeout);
+	l_free(tx);
+}
+
+static void rx_free(void *data)
+{
+	struct rx_pkt *rx = data;
+
+	l_timeout_remove(rx->timeout);
+	l_free(rx);
+}
+
+static void process_rx(struct mesh_io_private *pvt, uint32_t instant,
+				const uint8_t *addr, const uint8_t *data,
+				uint8_t len)
+{
+	struct mesh_io_recv_info info = {
+		.instant = instant,
+		.addr = addr,
+		.chan = 7,
+		.rssi = -40,
+	};
+	const struct l_queue_entry *entry;
+
+	entry = l_queue_get_entries(pvt->rx_regs);
+
+	while (entry) {
+		struct pvt_rx_reg *rx_reg = entry->data;
+
+		/* Callbacks may deregister themselves */
+		entry = entry->next;
+
+		if (len >= rx_reg->len &&
+				!memcmp(data, rx_reg->filter, rx_reg->len))
+			rx_reg->cb(rx_reg->user_data, &info, data, len);
+	}
+}
+
+static void rx_delay_to(struct l_timeout *timeout, void *user_data)
+{
+	struct rx_pkt *rx = user_data;
+	struct mesh_io_private *pvt = rx->pvt;
+
+	l_queue_remove(pvt->rx_pkts, rx);
+	process_rx(pvt, rx->instant, rx->addr, rx->pkt, rx->len);
+	rx_free(rx);
+}
+
+static bool rx_read(struct l_io *io, void *user_data)
+{
+	struct mesh_io_private *pvt = user_data;
+	uint8_t buf[ADDR_LEN + MAX_AD_LEN];
+	struct rx_pkt *rx;
+	uint32_t chance;
+	ssize_t len;
+
+	len = recv(l_io_get_fd(io), buf, sizeof(buf), MSG_DONTWAIT);
+	if (len <= ADDR_LEN)
+		return true;
+
+	if (pvt->loss) {
+		l_getrandom(&chance, sizeof(chance));
+		if (chance % 100 < pvt->loss)
+			return true;
+	}
+
+	if (!pvt->delay) {
+		process_rx(pvt, get_instant(), buf, buf + ADDR_LEN,
+							len - ADDR_LEN);
+		return true;
+	}
+
+	rx = l_new(struct rx_pkt, 1);
+	rx->pvt = pvt;
+	rx->instant = get_instant();
+	memcpy(rx->addr, buf, ADDR_LEN);
+	rx->len = len - ADDR_LEN;
+	memcpy(rx->pkt, buf + ADDR_LEN, rx->len);
+	rx->timeout = l_timeout_create_ms(pvt->delay, rx_delay_to, rx, NULL);
+	l_queue_push_tail(pvt->rx_pkts, rx);
+
+	return true;
+}
+
+static void send_to_peer(struct mesh_io_private *pvt, const char *name,
+					const uint8_t *buf, size_t len)
+{
+	struct sockaddr_un addr;
+
+	if (!strcmp(name, pvt->name))
+		return;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s", pvt->dir,
+									name);
+
+	/* A missing or congested peer is just a lost advertisement */
+	sendto(l_io_get_fd(pvt->io), buf, len, MSG_DONTWAIT,
+				(struct sockaddr *) &addr, sizeof(addr));
+}
+
+static void send_to_peers(struct mesh_io_private *pvt,
+						const struct air_pkt *pkt)
+{
+	struct dirent *entry;
+	DIR *dir;
+	int i;
+
+	if (pvt->peers) {
+		for (i = 0; pvt->peers[i]; i++)
+			send_to_peer(pvt, pvt->peers[i], pkt->buf, pkt->len);
+		return;
+	}
+
+	dir = opendir(pvt->dir);
+	if (!dir)
+		return;
+
+	while ((entry = readdir(dir))) {
+		if (entry->d_type != DT_SOCK)
+			continue;
+
+		send_to_peer(pvt, entry->d_name, pkt->buf, pkt->len);
+	}
+
+	closedir(dir);
+}
+
+static void air_to(struct l_timeout *timeout, void *user_data);
+
+static void air_send(struct mesh_io_private *pvt)
+{
+	struct air_pkt *pkt;
+
+	pkt = l_queue_pop_head(pvt->air_pkts);
+	if (!pkt) {
+		l_timeout_remove(pvt->air_timeout);
+		pvt->air_timeout = NULL;
+		return;
+	}
+
+	send_to_peers(pvt, pkt);
+	l_free(pkt);
+
+	if (pvt->air_timeout)
+		l_timeout_modify_ms(pvt->air_timeout, AIR_TIME_MS);
+	else
+		pvt->air_timeout = l_timeout_create_ms(AIR_TIME_MS, air_to,
+								pvt, NULL);
+}
+
+static void air_to(struct l_timeout *timeout, void *user_data)
+{
+	air_send(user_data);
+}
+
+static void transmit(struct mesh_io_private *pvt, struct tx_pkt *tx)
+{
+	struct air_pkt *pkt;
+
+	pkt = l_new(struct air_pkt, 1);
+	pkt->len = ADDR_LEN + tx->len;
+	memcpy(pkt->buf, pvt->addr, ADDR_LEN);
+	memcpy(pkt->buf + ADDR_LEN, tx->pkt, tx->len);
+	l_queue_push_tail(pvt->air_pkts, pkt);
+
+	if (!pvt->air_timeout)
+		air_send(pvt);
+}
+
+static uint16_t tx_interval(const struct tx_pkt *tx)
+{
+	return tx->info.u.gen.interval ? tx->info.u.gen.interval : 1;
+}
+
+/* Sends one advertisement, returns true once the packet is finished */
+static bool tx_step(struct tx_pkt *tx)
+{
+	transmit(tx->pvt, tx);
+
+	if (tx->info.type != MESH_IO_TIMING_TYPE_GENERAL)
+		return true;
+
+	if (tx->info.u.gen.cnt == MESH_IO_TX_COUNT_UNLIMITED)
+		return false;
+
+	return !--tx->info.u.gen.cnt;
+}
+
+static void tx_to(struct l_timeout *timeout, void *user_data)
+{
+	struct tx_pkt *tx = user_data;
+
+	if (tx_step(tx)) {
+		l_queue_remove(tx->pvt->tx_pkts, tx);
+		tx_free(tx);
+		return;
+	}
+
+	l_timeout_modify_ms(timeout, tx_interval(tx));
+}
+
+static uint32_t tx_delay(const struct mesh_io_send_info *info)
+{
+	uint8_t min_delay, max_delay;
+	uint32_t delay;
+
+	switch (info->type) {
+	case MESH_IO_TIMING_TYPE_GENERAL:
+		min_delay = info->u.gen.min_delay;
+		max_delay = info->u.gen.max_delay;
+		break;
+
+	case MESH_IO_TIMING_TYPE_POLL:
+		min_delay = info->u.poll.min_delay;
+		max_delay = info->u.poll.max_delay;
+		break;
+
+	case MESH_IO_TIMING_TYPE_POLL_RSP:
+		/* Delay until Instant + Delay */
+		delay = instant_remaining_ms(info->u.poll_rsp.instant +
+							info->u.poll_rsp.delay);
+		return delay > 255 ? 0 : delay;
+
+	default:
+		return 0;
+	}
+
+	if (min_delay >= max_delay)
+		return min_delay;
+
+	l_getrandom(&delay, sizeof(delay));
+	return min_delay + delay % (max_delay - min_delay);
+}
+
+static bool send_tx(struct mesh_io *io, struct mesh_io_send_info *info,
+					const uint8_t *data, uint16_t len)
+{
+	struct mesh_io_private *pvt = io->pvt;
+	struct tx_pkt *tx;
+	uint32_t delay;
+
+	if (!info || !data || !len || len > sizeof(tx->pkt))
+		return false;
+
+	tx = l_new(struct tx_pkt, 1);
+	tx->pvt = pvt;
+	memcpy(&tx->info, info, sizeof(tx->info));
+	memcpy(tx->pkt, data, len);
+	tx->len = len;
+
+	delay = tx_delay(info);
+
+	if (!delay) {
+		if (tx_step(tx)) {
+			tx_free(tx);
+			return true;
+		}
+
+		delay = tx_interval(tx);
+	}
+
+	tx->timeout = l_timeout_create_ms(delay, tx_to, tx, NULL);
+	l_queue_push_tail(pvt->tx_pkts, tx);
+
+	return true;
+}
+
+static bool find_by_ad_type(const void *a, const void *b)
+{
+	const struct tx_pkt *tx = a;
+	uint8_t ad_type = L_PTR_TO_UINT(b);
+
+	return !ad_type || ad_type == tx->pkt[0];
+}
+
+static bool find_by_pattern(const void *a, const void *b)
+{
+	const struct tx_pkt *tx = a;
+	const struct tx_pattern *pattern = b;
+
+	if (tx->len < pattern->len)
+		return false;
+
+	return (!memcmp(tx->pkt, pattern->data, pattern->len));
+}
+
+static bool tx_cancel(struct mesh_io *io, const uint8_t *data, uint8_t len)
+{
+	struct mesh_io_private *pvt = io->pvt;
+	struct tx_pattern pattern = {
+		.data = data,
+		.len = len
+	};
+	struct tx_pkt *tx;
+
+	if (!data)
+		return false;
+
+	do {
+		if (len == 1)
+			tx = l_queue_remove_if(pvt->tx_pkts, find_by_ad_type,
+						L_UINT_TO_PTR(data[0]));
+		else
+			tx = l_queue_remove_if(pvt->tx_pkts, find_by_pattern,
+								&pattern);
+
+		if (tx)
+			tx_free(tx);
+	} while (tx);
+
+	return true;
+}
+
+static bool find_by_filter(const void *a, const void *b)
+{
+	const struct pvt_rx_reg *rx_reg = a;
+	const uint8_t *filter = b;
+
+	return !memcmp(rx_reg->filter, filter, rx_reg->len);
+}
+
+static bool recv_register(struct mesh_io *io, const uint8_t *filter,
+			uint8_t len, mesh_io_recv_func_t cb, void *user_data)
+{
+	struct mesh_io_private *pvt = io->pvt;
+	struct pvt_rx_reg *rx_reg;
+
+	if (!cb || !filter || !len)
+		return false;
+
+	rx_reg = l_queue_remove_if(pvt->rx_regs, find_by_filter, filter);
+
+	l_free(rx_reg);
+	rx_reg = l_malloc(sizeof(*rx_reg) + len);
+
+	memcpy(rx_reg->filter, filter, len);
+	rx_reg->len = len;
+	rx_reg->cb = cb;
+	rx_reg->user_data = user_data;
+
+	l_queue_push_head(pvt->rx_regs, rx_reg);
+
+	return true;
+}
+
+static bool recv_deregister(struct mesh_io *io, const uint8_t *filter,
+								uint8_t len)
+{
+	struct mesh_io_private *pvt = io->pvt;
+	struct pvt_rx_reg *rx_reg;
+
+	rx_reg = l_queue_remove_if(pvt->rx_regs, find_by_filter, filter);
+	l_free(rx_reg);
+
+	return true;
+}
+
+static bool parse_opts(struct mesh_io_private *pvt, const char *opts)
+{
+	char **args;
+	bool result = true;
+	int i;
+
+	args = l_strsplit(opts, ',');
+	if (!args || !args[0] || !*args[0]) {
+		l_strfreev(args);
+		return false;
+	}
+
+	pvt->dir = l_strdup(args[0]);
+
+	for (i = 1; args[i] && result; i++) {
+		char *value = strchr(args[i], '=');
+		char *end;
+
+		if (!value) {
+			result = false;
+			break;
+		}
+
+		*value++ = '\0';
+
+		if (!strcmp(args[i], "name")) {
+			l_free(pvt->name);
+			pvt->name = l_strdup(value);
+		} else if (!strcmp(args[i], "peers")) {
+			l_strfreev(pvt->peers);
+			pvt->peers = l_strsplit(value, '+');
+		} else if (!strcmp(args[i], "loss")) {
+			pvt->loss = strtoul(value, &end, 10);
+			result = !*end && pvt->loss <= 100;
+		} else if (!strcmp(args[i], "delay")) {
+			pvt->delay = strtoul(value, &end, 10);
+			result = !*end;
+		} else
+			result = false;
+	}
+
+	l_strfreev(args);
+
+	if (!pvt->name)
+		pvt->name = l_strdup_printf("%d", getpid());
+
+	return result && !strchr(pvt->name, '/');
+}
+
+static void unix_init(void *user_data)
+{
+	struct mesh_io *io = user_data;
+
+	l_debug("Started mesh on %s/%s", io->pvt->dir, io->pvt->name);
+
+	if (io->pvt->ready_callback)
+		io->pvt->ready_callback(io->pvt->user_data, true);
+}
+
+static bool dev_destroy(struct mesh_io *io);
+
+static bool dev_init(struct mesh_io *io, void *opts,
+				mesh_io_ready_func_t cb, void *user_data)
+{
+	struct mesh_io_private *pvt;
+	struct sockaddr_un addr;
+	int fd;
+
+	if (!io || io->pvt || !opts)
+		return false;
+
+	pvt = l_new(struct mesh_io_private, 1);
+	io->pvt = pvt;
+
+	pvt->rx_regs = l_queue_new();
+	pvt->tx_pkts = l_queue_new();
+	pvt->rx_pkts = l_queue_new();
+	pvt->air_pkts = l_queue_new();
+
+	pvt->ready_callback = cb;
+	pvt->user_data = user_data;
+
+	if (!parse_opts(pvt, opts)) {
+		l_error("Invalid unix io options: %s", (const char *) opts);
+		goto fail;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s",
+				pvt->dir, pvt->name) >= (int) sizeof(addr.sun_path))
+		goto fail;
+
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		goto fail;
+
+	unlink(addr.sun_path);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		l_error("Failed to bind %s: %s", addr.sun_path,
+							strerror(errno));
+		close(fd);
+		goto fail;
+	}
+
+	pvt->io = l_io_new(fd);
+	l_io_set_close_on_destroy(pvt->io, true);
+	l_io_set_read_handler(pvt->io, rx_read, pvt, NULL);
+
+	l_getrandom(pvt->addr, ADDR_LEN);
+	pvt->addr[5] |= 0xc0;
+
+	l_idle_oneshot(unix_init, io, NULL);
+
+	return true;
+
+fail:
+	dev_destroy(io);
+	return false;
+}
+
+static bool dev_destroy(struct mesh_io *io)
+{
+	struct mesh_io_private *pvt = io->pvt;
+	char *path;
+
+	if (!pvt)
+		return true;
+
+	if (pvt->io) {
+		path = l_strdup_printf("%s/%s", pvt->dir, pvt->name);
+		unlink(path);
+		l_free(path);
+		l_io_destroy(pvt->io);
+	}
+
+	l_queue_destroy(pvt->rx_regs, l_free);
+	l_queue_destroy(pvt->tx_pkts, tx_free);
+	l_queue_destroy(pvt->rx_pkts, rx_free);
+	l_queue_destroy(pvt->air_pkts, l_free);
+	l_timeout_remove(pvt->air_timeout);
+	l_strfreev(pvt->peers);
+	l_free(pvt->name);
+	l_free(pvt->dir);
+	l_free(pvt);
+	io->pvt = NULL;
+
+	return true;
+}
+
+static bool dev_caps(struct mesh_io *io, struct mesh_io_caps *caps)
+{
+	struct mesh_io_private *pvt = io->pvt;
+
+	if (!pvt || !caps)
+		return false;
+
+	caps->max_num_filters = 255;
+	caps->window_accuracy = 50;
+
+	return true;
+}
+
+const struct mesh_io_api mesh_io_unix = {
+	.init = dev_init,
+	.destroy = dev_destroy,
+	.caps = dev_caps,
+	.send = send_tx,
+	.reg = recv_register,
+	.dereg = recv_deregister,
+	.cancel = tx_cancel,
+};
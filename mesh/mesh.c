@@ -34,6 +34,8 @@
 #define DEFAULT_PROV_TIMEOUT 60
 #define DEFAULT_CRPL 100
 #define DEFAULT_FRIEND_QUEUE_SZ 32
+#define DEFAULT_PROV_SESSIONS 1
+#define MAX_PROV_SESSIONS 16
 
 #define DEFAULT_ALGORITHMS 0x0001
 
@@ -54,9 +56,11 @@ struct bt_mesh {
 	bool lpn_support;
 	bool proxy_support;
 	uint16_t crpl;
+	uint16_t msg_cache_sz;
 	uint16_t algorithms;
 	uint16_t req_index;
 	uint8_t friend_queue_sz;
+	uint8_t prov_sessions;
 	uint8_t max_filters;
 	bool initialized;
 };
@@ -83,7 +87,9 @@ static struct bt_mesh mesh = {
 	.lpn_support = false,
 	.proxy_support = false,
 	.crpl = DEFAULT_CRPL,
+	.msg_cache_sz = MSG_CACHE_SIZE,
 	.friend_queue_sz = DEFAULT_FRIEND_QUEUE_SZ,
+	.prov_sessions = DEFAULT_PROV_SESSIONS,
 	.initialized = false
 };
 
@@ -198,11 +204,21 @@ uint16_t mesh_get_crpl(void)
 	return mesh.crpl;
 }
 
+uint16_t mesh_get_msg_cache_size(void)
+{
+	return mesh.msg_cache_sz;
+}
+
 uint8_t mesh_get_friend_queue_size(void)
 {
 	return mesh.friend_queue_sz;
 }
 
+uint8_t mesh_get_prov_sessions(void)
+{
+	return mesh.prov_sessions;
+}
+
 static void parse_settings(const char *mesh_conf_fname)
 {
 	struct l_settings *settings;
@@ -238,6 +254,10 @@ static void parse_settings(const char *mesh_conf_fname)
 							value <= 65535)
 		mesh.crpl = value;
 
+	if (l_settings_get_uint(settings, "General", "MsgCacheSize", &value) &&
+					value > 0 && value <= 65535)
+		mesh.msg_cache_sz = value;
+
 	if (l_settings_get_uint(settings, "General", "FriendQueueSize", &value)
 								&& value < 127)
 		mesh.friend_queue_sz = value;
@@ -245,6 +265,10 @@ static void parse_settings(const char *mesh_conf_fname)
 	if (l_settings_get_uint(settings, "General", "ProvTimeout", &value))
 		mesh.prov_timeout = value;
 
+	if (l_settings_get_uint(settings, "General", "ProvSessions", &value) &&
+					value > 0 && value <= MAX_PROV_SESSIONS)
+		mesh.prov_sessions = value;
+
 done:
 	l_settings_free(settings);
 }
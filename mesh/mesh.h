@@ -42,4 +42,6 @@ bool mesh_beacon_enabled(void);
 bool mesh_relay_supported(void);
 bool mesh_friendship_supported(void);
 uint16_t mesh_get_crpl(void);
+uint16_t mesh_get_msg_cache_size(void);
 uint8_t mesh_get_friend_queue_size(void);
+uint8_t mesh_get_prov_sessions(void);
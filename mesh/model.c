@@ -69,7 +69,8 @@ struct mod_forward {
 	bool done;
 };
 
-static struct l_queue *mesh_virtuals;
+/* Virtual labels keyed by virtual address, each entry a queue of labels */
+static struct l_hashmap *mesh_virtuals;
 
 static bool is_internal(uint32_t id)
 {
@@ -82,6 +83,7 @@ static bool is_internal(uint32_t id)
 static void unref_virt(void *data)
 {
 	struct mesh_virtual *virt = data;
+	struct l_queue *labels;
 
 	if (virt->ref_cnt > 0)
 		virt->ref_cnt--;
@@ -89,10 +91,22 @@ static void unref_virt(void *data)
 	if (virt->ref_cnt)
 		return;
 
-	l_queue_remove(mesh_virtuals, virt);
+	labels = l_hashmap_lookup(mesh_virtuals, L_UINT_TO_PTR(virt->addr));
+	l_queue_remove(labels, virt);
+
+	if (l_queue_isempty(labels)) {
+		l_hashmap_remove(mesh_virtuals, L_UINT_TO_PTR(virt->addr));
+		l_queue_destroy(labels, NULL);
+	}
+
 	l_free(virt);
 }
 
+static void free_virt_labels(void *data)
+{
+	l_queue_destroy(data, l_free);
+}
+
 static bool simple_match(const void *a, const void *b)
 {
 	return a == b;
@@ -391,51 +405,19 @@ static int app_packet_decrypt(struct mesh_net *net, const uint8_t *data,
 				uint8_t key_aid, uint32_t seq,
 				uint32_t iv_idx, uint8_t *out)
 {
-	struct l_queue *app_keys = mesh_net_get_app_keys(net);
 	const struct l_queue_entry *entry;
 
-	if (!app_keys)
-		return -1;
-
-	for (entry = l_queue_get_entries(app_keys); entry;
+	/* Only keys whose current or updated AID matches can decrypt */
+	for (entry = appkey_get_aid_keys(net, key_aid); entry;
 							entry = entry->next) {
-		const uint8_t *old_key = NULL, *new_key = NULL;
-		uint8_t old_key_aid, new_key_aid;
 		int app_idx;
-		bool decrypted;
-
-		app_idx = appkey_get_key_idx(entry->data,
-							&old_key, &old_key_aid,
-							&new_key, &new_key_aid);
-
-		if (app_idx < 0)
-			continue;
-
-		if (old_key && old_key_aid == key_aid) {
-			decrypted = mesh_crypto_payload_decrypt(virt, virt_size,
-					data, size, szmict, src, dst, key_aid,
-						seq, iv_idx, out, old_key);
-
-			if (decrypted) {
-				print_packet("Used App Key", old_key, 16);
-				return app_idx;
-			}
-
-			print_packet("Failed App Key", old_key, 16);
-		}
 
-		if (new_key && new_key_aid == key_aid) {
-			decrypted = mesh_crypto_payload_decrypt(virt, virt_size,
-					data, size, szmict, src, dst, key_aid,
-						seq, iv_idx, out, new_key);
-
-			if (decrypted) {
-				print_packet("Used App Key", new_key, 16);
-				return app_idx;
-			}
-
-			print_packet("Failed App Key", new_key, 16);
-		}
+		app_idx = appkey_packet_decrypt(entry->data, key_aid,
+						virt, virt_size, data, size,
+						szmict, src, dst, seq, iv_idx,
+						out);
+		if (app_idx >= 0)
+			return app_idx;
 	}
 
 	return -1;
@@ -474,15 +456,16 @@ static int virt_packet_decrypt(struct mesh_net *net, const uint8_t *data,
 				uint32_t iv_idx, uint8_t *out,
 				struct mesh_virtual **decrypt_virt)
 {
+	struct l_queue *labels;
 	const struct l_queue_entry *v;
 
-	for (v = l_queue_get_entries(mesh_virtuals); v; v = v->next) {
+	/* Several labels may hash to the same virtual address */
+	labels = l_hashmap_lookup(mesh_virtuals, L_UINT_TO_PTR(dst));
+
+	for (v = l_queue_get_entries(labels); v; v = v->next) {
 		struct mesh_virtual *virt = v->data;
 		int decrypt_idx;
 
-		if (virt->addr != dst)
-			continue;
-
 		decrypt_idx = app_packet_decrypt(net, data, size, szmict, src,
 							dst, virt->label, 16,
 							key_aid, seq, iv_idx,
@@ -669,24 +652,31 @@ static int update_binding(struct mesh_node *node, uint16_t addr, uint32_t id,
 
 static struct mesh_virtual *add_virtual(const uint8_t *v)
 {
-	struct mesh_virtual *virt = l_queue_find(mesh_virtuals,
-						find_virt_by_label, v);
+	struct mesh_virtual *virt;
+	struct l_queue *labels;
+	uint16_t addr;
+
+	if (!mesh_crypto_virtual_addr(v, &addr))
+		return NULL;
+
+	labels = l_hashmap_lookup(mesh_virtuals, L_UINT_TO_PTR(addr));
+	virt = l_queue_find(labels, find_virt_by_label, v);
 
 	if (virt) {
 		virt->ref_cnt++;
 		return virt;
 	}
 
-	virt = l_new(struct mesh_virtual, 1);
-
-	if (!mesh_crypto_virtual_addr(v, &virt->addr)) {
-		l_free(virt);
-		return NULL;
+	if (!labels) {
+		labels = l_queue_new();
+		l_hashmap_insert(mesh_virtuals, L_UINT_TO_PTR(addr), labels);
 	}
 
+	virt = l_new(struct mesh_virtual, 1);
+	virt->addr = addr;
 	memcpy(virt->label, v, 16);
 	virt->ref_cnt = 1;
-	l_queue_push_head(mesh_virtuals, virt);
+	l_queue_push_head(labels, virt);
 
 	return virt;
 }
@@ -1957,11 +1947,11 @@ done:
 
 void mesh_model_init(void)
 {
-	mesh_virtuals = l_queue_new();
+	mesh_virtuals = l_hashmap_new();
 }
 
 void mesh_model_cleanup(void)
 {
-	l_queue_destroy(mesh_virtuals, l_free);
+	l_hashmap_destroy(mesh_virtuals, free_virt_labels);
 	mesh_virtuals = NULL;
 }
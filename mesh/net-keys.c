@@ -28,6 +28,8 @@
 #define BEACON_INTERVAL_MIN	10
 #define BEACON_INTERVAL_MAX	600
 
+#define NID_MASK		0x7f
+
 struct net_beacon {
 	struct l_timeout *timeout;
 	uint32_t ts;
@@ -50,9 +52,13 @@ struct net_key {
 	uint8_t privacy[16];
 	uint8_t beacon[16];
 	uint8_t network[8];
+	struct mesh_net_cipher *cipher;
 };
 
 static struct l_queue *keys = NULL;
+
+/* Keys bucketed by NID, so a received packet only tries matching keys */
+static struct l_queue *nid_keys[NID_MASK + 1];
 static uint32_t last_master_id = 0;
 
 /* To avoid re-decrypting same packet for multiple nodes, cache and check */
@@ -63,6 +69,36 @@ static size_t cache_plainlen;
 static uint32_t cache_id;
 static uint32_t cache_iv_index;
 
+static void key_index(struct net_key *key)
+{
+	if (!nid_keys[key->nid])
+		nid_keys[key->nid] = l_queue_new();
+
+	/* Friendship credentials take priority, as in the key list */
+	if (key->friend_key)
+		l_queue_push_head(nid_keys[key->nid], key);
+	else
+		l_queue_push_tail(nid_keys[key->nid], key);
+}
+
+static void key_unindex(struct net_key *key)
+{
+	l_queue_remove(nid_keys[key->nid], key);
+
+	if (l_queue_isempty(nid_keys[key->nid])) {
+		l_queue_destroy(nid_keys[key->nid], NULL);
+		nid_keys[key->nid] = NULL;
+	}
+}
+
+static void key_free(void *data)
+{
+	struct net_key *key = data;
+
+	mesh_crypto_net_cipher_free(key->cipher);
+	l_free(key);
+}
+
 static bool match_master(const void *a, const void *b)
 {
 	const struct net_key *key = a;
@@ -117,8 +153,13 @@ uint32_t net_key_add(const uint8_t master[16])
 	if (!result)
 		goto fail;
 
+	key->cipher = mesh_crypto_net_cipher_new(key->encrypt, key->privacy);
+	if (!key->cipher)
+		goto fail;
+
 	key->id = ++last_master_id;
 	l_queue_push_tail(keys, key);
+	key_index(key);
 	return key->id;
 
 fail:
@@ -148,7 +189,11 @@ uint32_t net_key_frnd_add(uint32_t master_id, uint16_t lpn, uint16_t frnd,
 	result = mesh_crypto_k2(key->master, p, sizeof(p), &frnd_key->nid,
 				frnd_key->encrypt, frnd_key->privacy);
 
-	if (!result) {
+	if (result)
+		frnd_key->cipher = mesh_crypto_net_cipher_new(frnd_key->encrypt,
+							frnd_key->privacy);
+
+	if (!frnd_key->cipher) {
 		l_free(frnd_key);
 		return 0;
 	}
@@ -157,6 +202,7 @@ uint32_t net_key_frnd_add(uint32_t master_id, uint16_t lpn, uint16_t frnd,
 	frnd_key->ref_cnt++;
 	frnd_key->id = ++last_master_id;
 	l_queue_push_head(keys, frnd_key);
+	key_index(frnd_key);
 
 	return frnd_key->id;
 }
@@ -169,7 +215,8 @@ void net_key_unref(uint32_t id)
 		if (--key->ref_cnt == 0) {
 			l_timeout_remove(key->snb.timeout);
 			l_queue_remove(keys, key);
-			l_free(key);
+			key_unindex(key);
+			key_free(key);
 		}
 	}
 }
@@ -201,12 +248,12 @@ static void decrypt_net_pkt(void *a, void *b)
 	const struct net_key *key = a;
 	bool result;
 
-	if (cache_id || !key->ref_cnt || (cache_pkt[0] & 0x7f) != key->nid)
+	if (cache_id || !key->ref_cnt)
 		return;
 
-	result = mesh_crypto_packet_decode(cache_pkt, cache_len, false,
-						cache_plain, cache_iv_index,
-						key->encrypt, key->privacy);
+	result = mesh_crypto_net_cipher_decode(key->cipher, cache_pkt,
+						cache_len, false, cache_plain,
+						cache_iv_index);
 
 	if (result) {
 		cache_id = key->id;
@@ -234,8 +281,8 @@ uint32_t net_key_decrypt(uint32_t iv_index, const uint8_t *pkt, size_t len,
 	cache_len = len;
 	cache_iv_index = iv_index;
 
-	/* Try all network keys known to us */
-	l_queue_foreach(keys, decrypt_net_pkt, NULL);
+	/* Try the network keys known to us that share this NID */
+	l_queue_foreach(nid_keys[pkt[0] & NID_MASK], decrypt_net_pkt, NULL);
 
 done:
 	if (cache_id) {
@@ -254,8 +301,8 @@ bool net_key_encrypt(uint32_t id, uint32_t iv_index, uint8_t *pkt, size_t len)
 	if (!key)
 		return false;
 
-	result = mesh_crypto_packet_encode(pkt, len, iv_index, key->encrypt,
-							key->privacy);
+	result = mesh_crypto_net_cipher_encode(key->cipher, pkt, len,
+								iv_index);
 
 	if (!result)
 		return false;
@@ -517,6 +564,13 @@ void net_key_beacon_disable(uint32_t id)
 
 void net_key_cleanup(void)
 {
-	l_queue_destroy(keys, l_free);
+	int i;
+
+	for (i = 0; i <= NID_MASK; i++) {
+		l_queue_destroy(nid_keys[i], NULL);
+		nid_keys[i] = NULL;
+	}
+
+	l_queue_destroy(keys, key_free);
 	keys = NULL;
 }
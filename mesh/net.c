@@ -30,6 +30,10 @@
 #include "mesh/model.h"
 #include "mesh/appkey.h"
 #include "mesh/rpl.h"
+#include "mesh/cache.h"
+#include "mesh/sar.h"
+#include "mesh/friend-queue.h"
+#include "mesh/mesh.h"
 
 #define abs_diff(a, b) ((a) > (b) ? (a) - (b) : (b) - (a))
 
@@ -47,6 +51,9 @@
 #define SEG_TO	2
 #define MSG_TO	60
 
+/* Resolution of the timer wheel shared by all SAR contexts */
+#define SAR_TICK_MS	100
+
 #define DEFAULT_TRANSMIT_COUNT		1
 #define DEFAULT_TRANSMIT_INTERVAL	100
 
@@ -95,6 +102,7 @@ struct mesh_net {
 	struct mesh_node *node;
 	struct mesh_prov *prov;
 	struct l_queue *app_keys;
+	struct appkey_index *app_index;
 	unsigned int pkt_id;
 	unsigned int bea_id;
 	unsigned int beacon_id;
@@ -131,27 +139,24 @@ struct mesh_net {
 	uint16_t features;
 
 	struct l_queue *subnets;
-	struct l_queue *msg_cache;
-	struct l_queue *replay_cache;
-	struct l_queue *sar_in;
-	struct l_queue *sar_out;
+	struct mesh_cache *msg_cache;
+	struct mesh_cache *replay_cache;
+	struct mesh_sar_table *sar_in;
+	struct mesh_sar_table *sar_out;
 	struct l_queue *sar_queue;
+	struct mesh_net_sar_stats sar_stats;
 	struct l_queue *frnd_msgs;
 	struct l_queue *friends;
 	struct l_queue *negotiations;
 	struct l_queue *destinations;
 };
 
-struct mesh_msg {
-	uint16_t src;
-	uint32_t seq;
-	uint32_t mic;
-};
-
 struct mesh_sar {
 	unsigned int id;
-	struct l_timeout *seg_timeout;
-	struct l_timeout *msg_timeout;
+	struct mesh_net *net;
+	struct mesh_sar_timer *seg_timeout;
+	struct mesh_sar_timer *msg_timeout;
+	uint64_t start;
 	uint32_t flags;
 	uint32_t last_nak;
 	uint32_t iv_index;
@@ -217,7 +222,9 @@ struct net_beacon_data {
 	bool processed;
 };
 
-static struct l_queue *fast_cache;
+static struct mesh_cache *fast_cache;
+static struct mesh_sar_slab *sar_slab;
+static struct mesh_sar_wheel *sar_wheel;
 static struct l_queue *nets;
 
 static void net_rx(void *net_ptr, void *user_data);
@@ -305,8 +312,7 @@ static bool match_by_friend(const void *a, const void *b)
 
 static void free_friend_internals(struct mesh_friend *frnd)
 {
-	if (frnd->pkt_cache)
-		l_queue_destroy(frnd->pkt_cache, l_free);
+	mesh_friend_queue_free(frnd->pkt_cache);
 
 	l_free(frnd->u.active.grp_list);
 	frnd->u.active.grp_list = NULL;
@@ -358,7 +364,8 @@ static void frnd_kr_phase3(void *a, void *b)
 struct mesh_friend *mesh_friend_new(struct mesh_net *net, uint16_t dst,
 					uint8_t ele_cnt, uint8_t frd,
 					uint8_t frw, uint32_t fpt,
-					uint16_t fn_cnt, uint16_t lp_cnt)
+					uint16_t fn_cnt, uint16_t lp_cnt,
+					uint8_t cache_size)
 {
 	struct mesh_subnet *subnet;
 	struct mesh_friend *frnd = l_queue_find(net->friends,
@@ -383,7 +390,12 @@ struct mesh_friend *mesh_friend_new(struct mesh_net *net, uint16_t dst,
 	frnd->lp_cnt = lp_cnt;
 	frnd->poll_timeout = fpt;
 	frnd->ele_cnt = ele_cnt;
-	frnd->pkt_cache = l_queue_new();
+
+	/* Room for as many messages as the Friend Offer promised */
+	if (cache_size > FRND_CACHE_MAX)
+		cache_size = FRND_CACHE_MAX;
+
+	frnd->pkt_cache = mesh_friend_queue_new(cache_size);
 	frnd->net_key_upd = 0;
 
 	subnet = get_primary_subnet(net);
@@ -499,13 +511,14 @@ uint32_t mesh_net_next_seq_num(struct mesh_net *net)
 	return seq;
 }
 
-static struct mesh_sar *mesh_sar_new(size_t len)
+static struct mesh_sar *mesh_sar_new(struct mesh_net *net, size_t len)
 {
-	size_t size = sizeof(struct mesh_sar) + len;
 	struct mesh_sar *sar;
 
-	sar = l_malloc(size);
-	memset(sar, 0, size);
+	/* Buffer sized by segment count, recycled through the slab */
+	sar = mesh_sar_slab_alloc(sar_slab, len);
+	sar->net = net;
+
 	return sar;
 }
 
@@ -516,9 +529,23 @@ static void mesh_sar_free(void *data)
 	if (!sar)
 		return;
 
-	l_timeout_remove(sar->seg_timeout);
-	l_timeout_remove(sar->msg_timeout);
-	l_free(sar);
+	mesh_sar_timer_remove(sar->seg_timeout);
+	mesh_sar_timer_remove(sar->msg_timeout);
+	mesh_sar_slab_release(sar_slab, sar);
+}
+
+static void sar_update_peaks(struct mesh_net *net)
+{
+	struct mesh_net_sar_stats *stats = &net->sar_stats;
+	unsigned int count;
+
+	count = mesh_sar_table_count(net->sar_in);
+	if (count > stats->in_peak)
+		stats->in_peak = count;
+
+	count = mesh_sar_table_count(net->sar_out);
+	if (count > stats->out_peak)
+		stats->out_peak = count;
 }
 
 static void subnet_free(void *data)
@@ -617,20 +644,26 @@ struct mesh_net *mesh_net_new(struct mesh_node *node)
 	net->tx_interval = DEFAULT_TRANSMIT_INTERVAL;
 
 	net->subnets = l_queue_new();
-	net->msg_cache = l_queue_new();
-	net->sar_in = l_queue_new();
-	net->sar_out = l_queue_new();
+	net->msg_cache = mesh_cache_new(mesh_get_msg_cache_size());
+	net->sar_in = mesh_sar_table_new();
+	net->sar_out = mesh_sar_table_new();
 	net->sar_queue = l_queue_new();
 	net->frnd_msgs = l_queue_new();
 	net->destinations = l_queue_new();
 	net->app_keys = l_queue_new();
-	net->replay_cache = l_queue_new();
+	net->app_index = appkey_index_new();
 
 	if (!nets)
 		nets = l_queue_new();
 
 	if (!fast_cache)
-		fast_cache = l_queue_new();
+		fast_cache = mesh_cache_new(FAST_CACHE_SIZE);
+
+	if (!sar_slab)
+		sar_slab = mesh_sar_slab_new(sizeof(struct mesh_sar));
+
+	if (!sar_wheel)
+		sar_wheel = mesh_sar_wheel_new(SAR_TICK_MS);
 
 	return net;
 }
@@ -643,15 +676,16 @@ void mesh_net_free(void *user_data)
 		return;
 
 	l_queue_destroy(net->subnets, subnet_free);
-	l_queue_destroy(net->msg_cache, l_free);
-	l_queue_destroy(net->replay_cache, l_free);
-	l_queue_destroy(net->sar_in, mesh_sar_free);
-	l_queue_destroy(net->sar_out, mesh_sar_free);
+	mesh_cache_free(net->msg_cache);
+	mesh_cache_free(net->replay_cache);
+	mesh_sar_table_free(net->sar_in, mesh_sar_free);
+	mesh_sar_table_free(net->sar_out, mesh_sar_free);
 	l_queue_destroy(net->sar_queue, mesh_sar_free);
 	l_queue_destroy(net->frnd_msgs, l_free);
 	l_queue_destroy(net->friends, mesh_friend_free);
 	l_queue_destroy(net->negotiations, mesh_friend_free);
 	l_queue_destroy(net->destinations, l_free);
+	appkey_index_free(net->app_index);
 	l_queue_destroy(net->app_keys, appkey_key_free);
 
 	l_free(net);
@@ -659,10 +693,14 @@ void mesh_net_free(void *user_data)
 
 void mesh_net_cleanup(void)
 {
-	l_queue_destroy(fast_cache, l_free);
+	mesh_cache_free(fast_cache);
 	fast_cache = NULL;
 	l_queue_destroy(nets, mesh_net_free);
 	nets = NULL;
+	mesh_sar_wheel_free(sar_wheel);
+	sar_wheel = NULL;
+	mesh_sar_slab_free(sar_slab);
+	sar_slab = NULL;
 }
 
 bool mesh_net_set_seq_num(struct mesh_net *net, uint32_t seq)
@@ -1004,51 +1042,26 @@ void mesh_net_set_frnd_seq(struct mesh_net *net, bool seq)
 	net->friend_seq = seq;
 }
 
-static bool match_cache(const void *a, const void *b)
-{
-	const struct mesh_msg *msg = a;
-	const struct mesh_msg *tst = b;
-
-	if (msg->seq != tst->seq || msg->mic != tst->mic ||
-					msg->src != tst->src)
-		return false;
-
-	return true;
-}
-
+/*
+ * Messages are cached by SRC + SEQ with the MIC as value. A message with the
+ * same SRC and SEQ but a different MIC replaces the cached one. Once full,
+ * the least recently seen message is dropped.
+ */
 static bool msg_in_cache(struct mesh_net *net, uint16_t src, uint32_t seq,
 								uint32_t mic)
 {
-	struct mesh_msg *msg;
-	struct mesh_msg tst = {
-		.src = src,
-		.seq = seq,
-		.mic = mic,
-	};
+	uint64_t key = (uint64_t) src << 24 | (seq & SEQ_MASK);
+	uint64_t cached;
 
-	msg = l_queue_remove_if(net->msg_cache, match_cache, &tst);
-
-	if (msg) {
+	if (mesh_cache_lookup(net->msg_cache, key, &cached) && cached == mic) {
 		l_debug("Supressing duplicate %4.4x + %6.6x + %8.8x",
 							src, seq, mic);
-		l_queue_push_head(net->msg_cache, msg);
 		return true;
 	}
 
-	msg = l_new(struct mesh_msg, 1);
-	*msg = tst;
-	l_queue_push_head(net->msg_cache, msg);
+	mesh_cache_insert(net->msg_cache, key, mic);
 	l_debug("Add %4.4x + %6.6x + %8.8x", src, seq, mic);
 
-	if (l_queue_length(net->msg_cache) > MSG_CACHE_SIZE) {
-		msg = l_queue_peek_tail(net->msg_cache);
-		/* Remove Tail (oldest msg in cache) */
-		l_debug("Remove %4.4x + %6.6x + %8.8x",
-						msg->src, msg->seq, msg->mic);
-		if (l_queue_remove(net->msg_cache, msg))
-			l_free(msg);
-	}
-
 	return false;
 }
 
@@ -1068,22 +1081,6 @@ static bool match_sar_remote(const void *a, const void *b)
 	return sar->remote == remote;
 }
 
-static bool match_msg_timeout(const void *a, const void *b)
-{
-	const struct mesh_sar *sar = a;
-	const struct l_timeout *msg_timeout = b;
-
-	return sar->msg_timeout == msg_timeout;
-}
-
-static bool match_seg_timeout(const void *a, const void *b)
-{
-	const struct mesh_sar *sar = a;
-	const struct l_timeout *seg_timeout = b;
-
-	return sar->seg_timeout == seg_timeout;
-}
-
 static bool match_dest_dst(const void *a, const void *b)
 {
 	const struct mesh_destination *dest = a;
@@ -1194,7 +1191,7 @@ static bool match_ack(const void *a, const void *b)
 static void enqueue_friend_pkt(void *a, void *b)
 {
 	struct mesh_friend *frnd = a;
-	struct mesh_friend_msg *pkt, *rx = b;
+	struct mesh_friend_msg *rx = b;
 	size_t size;
 	int16_t i;
 
@@ -1226,25 +1223,17 @@ enqueue:
 	/* Special handling for Seg Ack -- Only one per message queue */
 	if (((rx->u.one[0].hdr >> OPCODE_HDR_SHIFT) & OPCODE_MASK) ==
 						NET_OP_SEG_ACKNOWLEDGE) {
-		void *old_head = l_queue_peek_head(frnd->pkt_cache);
-		/* Suppress duplicate ACKs */
-		do {
-			void *old = l_queue_remove_if(frnd->pkt_cache,
-							match_ack, rx);
-
-			if (!old)
-				break;
-
-			if (old_head == old)
-				/*
-				 * If we are discarding head for any
-				 * reason, reset FRND SEQ
-				 */
-				frnd->u.active.last = frnd->u.active.seq;
+		struct mesh_friend_queue *queue = frnd->pkt_cache;
+		void *old_head = mesh_friend_queue_peek_head(queue);
 
-			l_free(old);
-
-		} while (true);
+		/* Suppress duplicate ACKs */
+		if (mesh_friend_queue_remove_if(queue, match_ack, rx) &&
+				old_head != mesh_friend_queue_peek_head(queue))
+			/*
+			 * If we are discarding head for any
+			 * reason, reset FRND SEQ
+			 */
+			frnd->u.active.last = frnd->u.active.seq;
 	}
 
 	l_debug("%s for %4.4x from %4.4x ttl: %2.2x (seq: %6.6x) (ctl: %d)",
@@ -1258,20 +1247,13 @@ enqueue:
 	} else
 		size = sizeof(struct mesh_friend_msg);
 
-	pkt = l_malloc(size);
-	memcpy(pkt, rx, size);
-
-	l_queue_push_tail(frnd->pkt_cache, pkt);
-
-	if (l_queue_length(frnd->pkt_cache) > FRND_CACHE_MAX) {
-		/*
-		 * TODO: Guard against popping UPDATE packets
-		 * (disallowed per spec)
-		 */
-		pkt = l_queue_pop_head(frnd->pkt_cache);
-		l_free(pkt);
+	/*
+	 * A full queue discards its oldest message.
+	 * TODO: Guard against popping UPDATE packets
+	 * (disallowed per spec)
+	 */
+	if (mesh_friend_queue_push(frnd->pkt_cache, rx, size))
 		frnd->u.active.last = frnd->u.active.seq;
-	}
 }
 
 static void enqueue_update(void *a, void *b)
@@ -1473,52 +1455,47 @@ static void send_net_ack(struct mesh_net *net, struct mesh_sar *sar,
 				sizeof(msg));
 }
 
-static void inseg_to(struct l_timeout *seg_timeout, void *user_data)
+static void inseg_to(void *user_data)
 {
-	struct mesh_net *net = user_data;
-	struct mesh_sar *sar = l_queue_find(net->sar_in,
-					match_seg_timeout, seg_timeout);
+	struct mesh_sar *sar = user_data;
 
-	l_timeout_remove(seg_timeout);
-	if (!sar)
-		return;
+	sar->seg_timeout = NULL;
 
 	/* Send NAK */
 	l_debug("Timeout %p %3.3x", sar, sar->app_idx);
-	send_net_ack(net, sar, sar->flags);
+	send_net_ack(sar->net, sar, sar->flags);
 
-	sar->seg_timeout = l_timeout_create(SEG_TO, inseg_to, net, NULL);
+	sar->seg_timeout = mesh_sar_timer_add(sar_wheel, SEG_TO * 1000,
+							inseg_to, sar);
 }
 
-static void inmsg_to(struct l_timeout *msg_timeout, void *user_data)
+static void inmsg_to(void *user_data)
 {
-	struct mesh_net *net = user_data;
-	struct mesh_sar *sar = l_queue_remove_if(net->sar_in,
-			match_msg_timeout, msg_timeout);
-
-	l_timeout_remove(msg_timeout);
-	if (!sar)
-		return;
+	struct mesh_sar *sar = user_data;
+	struct mesh_net *net = sar->net;
+	uint32_t expected = 0xffffffff >> (31 - SEG_MAX(true, sar->len));
 
 	sar->msg_timeout = NULL;
+	mesh_sar_table_remove(net->sar_in, sar->remote, sar->seqZero);
+
+	if (sar->flags != expected)
+		net->sar_stats.in_timeouts++;
+
 	mesh_sar_free(sar);
 }
 
-static void outmsg_to(struct l_timeout *msg_timeout, void *user_data)
+static void outmsg_to(void *user_data)
 {
-	struct mesh_net *net = user_data;
-	struct mesh_sar *sar = l_queue_remove_if(net->sar_out,
-			match_msg_timeout, msg_timeout);
-
-	l_timeout_remove(msg_timeout);
-	if (!sar)
-		return;
+	struct mesh_sar *sar = user_data;
+	struct mesh_net *net = sar->net;
 
 	sar->msg_timeout = NULL;
+	mesh_sar_table_remove(net->sar_out, sar->remote, sar->seqZero);
+	net->sar_stats.out_failed++;
 	mesh_sar_free(sar);
 }
 
-static void outseg_to(struct l_timeout *seg_timeout, void *user_data);
+static void outseg_to(void *user_data);
 
 static void send_queued_sar(struct mesh_net *net, uint16_t dst)
 {
@@ -1529,10 +1506,11 @@ static void send_queued_sar(struct mesh_net *net, uint16_t dst)
 		return;
 
 	/* Out to current outgoing, and immediate expire Seg TO */
-	l_queue_push_head(net->sar_out, sar);
+	mesh_sar_table_insert(net->sar_out, sar->remote, sar->seqZero, sar);
 	sar->seg_timeout = NULL;
-	sar->msg_timeout = l_timeout_create(MSG_TO, outmsg_to, net, NULL);
-	outseg_to(NULL, net);
+	sar->msg_timeout = mesh_sar_timer_add(sar_wheel, MSG_TO * 1000,
+							outmsg_to, sar);
+	outseg_to(sar);
 }
 
 static void ack_received(struct mesh_net *net, bool timeout,
@@ -1546,7 +1524,11 @@ static void ack_received(struct mesh_net *net, bool timeout,
 
 	l_debug("ACK Rxed (%x) (to:%d): %8.8x", seq0, timeout, ack_flag);
 
-	outgoing = l_queue_find(net->sar_out, match_sar_seq0,
+	outgoing = mesh_sar_table_lookup(net->sar_out, src, seq0);
+
+	/* The ACK may come from a Friend on behalf of the destination */
+	if (!outgoing)
+		outgoing = mesh_sar_table_find(net->sar_out, match_sar_seq0,
 							L_UINT_TO_PTR(seq0));
 
 	if (!outgoing) {
@@ -1564,8 +1546,13 @@ static void ack_received(struct mesh_net *net, bool timeout,
 		l_debug("ob_sar_removal (%x)", outgoing->flags);
 
 		/* Note: ack_flags == 0x00000000 is a remote Cancel request */
+		if (ack_flag)
+			net->sar_stats.out_completed++;
+		else
+			net->sar_stats.out_failed++;
 
-		l_queue_remove(net->sar_out, outgoing);
+		mesh_sar_table_remove(net->sar_out, outgoing->remote,
+							outgoing->seqZero);
 		send_queued_sar(net, outgoing->remote);
 		mesh_sar_free(outgoing);
 
@@ -1591,76 +1578,64 @@ static void ack_received(struct mesh_net *net, bool timeout,
 		send_seg(net, net->tx_cnt, net->tx_interval, outgoing, i);
 	}
 
-	l_timeout_remove(outgoing->seg_timeout);
-	outgoing->seg_timeout = l_timeout_create(SEG_TO, outseg_to, net, NULL);
+	mesh_sar_timer_remove(outgoing->seg_timeout);
+	outgoing->seg_timeout = mesh_sar_timer_add(sar_wheel, SEG_TO * 1000,
+							outseg_to, outgoing);
 }
 
-static void outseg_to(struct l_timeout *seg_timeout, void *user_data)
+static void outseg_to(void *user_data)
 {
-	struct mesh_net *net = user_data;
-	struct mesh_sar *sar = l_queue_find(net->sar_out,
-					match_seg_timeout, seg_timeout);
-
-	l_timeout_remove(seg_timeout);
-	if (!sar)
-		return;
+	struct mesh_sar *sar = user_data;
 
 	sar->seg_timeout = NULL;
 
 	/* Re-Send missing segments by faking NACK */
-	ack_received(net, true, sar->remote, sar->src,
+	ack_received(sar->net, true, sar->remote, sar->src,
 					sar->seqZero, sar->last_nak);
 }
 
-static bool match_replay_cache(const void *a, const void *b)
-{
-	const struct mesh_rpl *rpe = a;
-	uint16_t src = L_PTR_TO_UINT(b);
-
-	return src == rpe->src;
-}
+/* Replay cache entries are keyed by SRC and hold IV Index << 24 | SEQ */
+#define RPL_IV_INDEX(v)		((uint32_t) ((v) >> 24))
+#define RPL_SEQ(v)		((uint32_t) ((v) & SEQ_MASK))
+#define RPL_VALUE(iv, seq)	((uint64_t) (iv) << 24 | ((seq) & SEQ_MASK))
 
-static bool clean_old_iv_index(void *a, void *b)
+static bool clean_old_iv_index(uint64_t key, uint64_t value, void *user_data)
 {
-	struct mesh_rpl *rpe = a;
-	uint32_t iv_index = L_PTR_TO_UINT(b);
+	uint32_t iv_index = L_PTR_TO_UINT(user_data);
 
 	if (iv_index < 2)
 		return false;
 
-	if (rpe->iv_index < iv_index - 1) {
-		l_free(rpe);
-		return true;
-	}
-
-	return false;
+	return RPL_IV_INDEX(value) < iv_index - 1;
 }
 
 static bool msg_check_replay_cache(struct mesh_net *net, uint16_t src,
 				uint16_t crpl, uint32_t seq, uint32_t iv_index)
 {
-	struct mesh_rpl *rpe;
+	uint64_t value;
 
 	/* If anything missing reject this message by returning true */
 	if (!net || !net->node)
 		return true;
 
-	rpe = l_queue_find(net->replay_cache, match_replay_cache,
-						L_UINT_TO_PTR(src));
+	if (!net->replay_cache)
+		net->replay_cache = mesh_cache_new(crpl);
 
-	if (rpe) {
-		if (iv_index > rpe->iv_index)
+	if (mesh_cache_lookup(net->replay_cache, src, &value)) {
+		if (iv_index > RPL_IV_INDEX(value))
 			return false;
 
 		/* Return true if (iv_index | seq) too low */
-		if (iv_index < rpe->iv_index || seq <= rpe->seq) {
+		if (iv_index < RPL_IV_INDEX(value) || seq <= RPL_SEQ(value)) {
 			l_debug("Ignoring replayed packet");
 			return true;
 		}
-	} else if (l_queue_length(net->replay_cache) >= crpl) {
+	} else if (mesh_cache_count(net->replay_cache) >= crpl ||
+			mesh_cache_count(net->replay_cache) ==
+				mesh_cache_capacity(net->replay_cache)) {
 		/* SRC not in Replay Cache... see if there is space for it */
 
-		int ret = l_queue_foreach_remove(net->replay_cache,
+		int ret = mesh_cache_foreach_remove(net->replay_cache,
 				clean_old_iv_index, L_UINT_TO_PTR(iv_index));
 
 		/* Return true if no space could be freed */
@@ -1676,25 +1651,12 @@ static bool msg_check_replay_cache(struct mesh_net *net, uint16_t src,
 static void msg_add_replay_cache(struct mesh_net *net, uint16_t src,
 						uint32_t seq, uint32_t iv_index)
 {
-	struct mesh_rpl *rpe;
-
 	if (!net || !net->replay_cache)
 		return;
 
-	rpe = l_queue_remove_if(net->replay_cache, match_replay_cache,
-						L_UINT_TO_PTR(src));
-
-	if (!rpe) {
-		rpe = l_new(struct mesh_rpl, 1);
-		rpe->src = src;
-	}
-
-	rpe->seq = seq;
-	rpe->iv_index = iv_index;
+	/* The check above made room, so no entry is ever evicted here */
+	mesh_cache_insert(net->replay_cache, src, RPL_VALUE(iv_index, seq));
 	rpl_put_entry(net->node, src, iv_index, seq);
-
-	/* Optimize so that most recent conversations stay earliest in cache */
-	l_queue_push_head(net->replay_cache, rpe);
 }
 
 static bool msg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
@@ -1898,6 +1860,21 @@ static void friend_seg_rxed(struct mesh_net *net,
 	frnd_msg->cnt_in++;
 }
 
+static void sar_rx_complete(struct mesh_net *net, struct mesh_sar *sar)
+{
+	struct mesh_net_sar_stats *stats = &net->sar_stats;
+	uint32_t latency = l_time_diff(sar->start, l_time_now());
+
+	if (!stats->in_completed || latency < stats->latency_min_us)
+		stats->latency_min_us = latency;
+
+	if (latency > stats->latency_max_us)
+		stats->latency_max_us = latency;
+
+	stats->latency_total_us += latency;
+	stats->in_completed++;
+}
+
 static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 					uint8_t ttl, uint32_t seq,
 					uint16_t net_idx,
@@ -1916,8 +1893,9 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 	 * DST could receive additional Segments after
 	 * completing due to a lost ACK, so re-ACK and discard
 	 */
-	sar_in = l_queue_find(net->sar_in, match_sar_remote,
-						L_UINT_TO_PTR(src));
+	sar_in = mesh_sar_table_lookup(net->sar_in, src, seqZero);
+	if (!sar_in)
+		sar_in = mesh_sar_table_lookup_addr(net->sar_in, src);
 
 	/* Discard *old* incoming-SAR-in-progress if this segment newer */
 	seqAuth = seq_auth(seq, seqZero);
@@ -1934,7 +1912,8 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 
 		if (newer) {
 			/* Cancel Old, start New */
-			l_queue_remove(net->sar_in, sar_in);
+			mesh_sar_table_remove(net->sar_in, sar_in->remote,
+							sar_in->seqZero);
 			mesh_sar_free(sar_in);
 			sar_in = NULL;
 		} else
@@ -1962,8 +1941,9 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 
 		l_debug("RXed (new: %04x %06x size: %d len: %d) %d of %d",
 				seqZero, seq, size, len, segO, segN);
-		l_debug("Queue Size: %d", l_queue_length(net->sar_in));
-		sar_in = mesh_sar_new(len);
+		l_debug("Queue Size: %d", mesh_sar_table_count(net->sar_in));
+		sar_in = mesh_sar_new(net, len);
+		sar_in->start = l_time_now();
 		sar_in->seqAuth = seqAuth;
 		sar_in->iv_index = iv_index;
 		sar_in->src = dst;
@@ -1973,11 +1953,12 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 		sar_in->len = len;
 		sar_in->last_seg = 0xff;
 		sar_in->net_idx = net_idx;
-		sar_in->msg_timeout = l_timeout_create(MSG_TO,
-					inmsg_to, net, NULL);
+		sar_in->msg_timeout = mesh_sar_timer_add(sar_wheel,
+					MSG_TO * 1000, inmsg_to, sar_in);
 
 		l_debug("First Seg %4.4x", sar_in->flags);
-		l_queue_push_head(net->sar_in, sar_in);
+		mesh_sar_table_insert(net->sar_in, src, seqZero, sar_in);
+		sar_update_peaks(net);
 	}
 
 	seg_off = segO * MAX_SEG_LEN;
@@ -1997,6 +1978,7 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 
 	if (sar_in->flags == expected) {
 		/* Got it all */
+		sar_rx_complete(net, sar_in);
 		send_net_ack(net, sar_in, expected);
 
 		msg_rxed(net, frnd, iv_index, ttl, seq, net_idx,
@@ -2004,22 +1986,23 @@ static bool seg_rxed(struct mesh_net *net, bool frnd, uint32_t iv_index,
 				sar_in->seqZero, sar_in->buf, sar_in->len);
 
 		/* Kill Inter-Seg timeout */
-		l_timeout_remove(sar_in->seg_timeout);
+		mesh_sar_timer_remove(sar_in->seg_timeout);
 		sar_in->seg_timeout = NULL;
 		return true;
 	}
 
 	if (reset_seg_to) {
 		/* Restart Inter-Seg Timeout */
-		l_timeout_remove(sar_in->seg_timeout);
+		mesh_sar_timer_remove(sar_in->seg_timeout);
+		sar_in->seg_timeout = NULL;
 
 		/* if this is the largest outstanding segment, send NAK now */
 		largest = (0xffffffff << segO) & expected;
 		if ((largest & sar_in->flags) == largest)
 			send_net_ack(net, sar_in, sar_in->flags);
 
-		sar_in->seg_timeout = l_timeout_create(SEG_TO,
-				inseg_to, net, NULL);
+		sar_in->seg_timeout = mesh_sar_timer_add(sar_wheel,
+					SEG_TO * 1000, inseg_to, sar_in);
 	} else
 		largest = 0;
 
@@ -2161,29 +2144,12 @@ static bool ctl_received(struct mesh_net *net, uint16_t key_id,
 	return true;
 }
 
-static bool find_fast_hash(const void *a, const void *b)
-{
-	const uint64_t *entry = a;
-	const uint64_t *test = b;
-
-	return *entry == *test;
-}
-
 static bool check_fast_cache(uint64_t hash)
 {
-	void *found = l_queue_find(fast_cache, find_fast_hash, &hash);
-	uint64_t *new_hash;
-
-	if (found)
+	if (mesh_cache_lookup(fast_cache, hash, NULL))
 		return false;
 
-	if (l_queue_length(fast_cache) >= FAST_CACHE_SIZE)
-		new_hash = l_queue_pop_head(fast_cache);
-	else
-		new_hash = l_malloc(sizeof(hash));
-
-	*new_hash = hash;
-	l_queue_push_tail(fast_cache, new_hash);
+	mesh_cache_insert(fast_cache, hash, 0);
 
 	return true;
 }
@@ -2478,12 +2444,15 @@ static void net_msg_recv(void *user_data, struct mesh_io_recv_info *info,
 	if (net_data.relay_advice == RELAY_ALWAYS ||
 			net_data.relay_advice == RELAY_ALLOWED) {
 		uint8_t ttl = net_data.out[1] & TTL_MASK;
+		/* Re-encrypt over the NetMIC that decryption stripped */
+		size_t size = net_data.out_size +
+					((net_data.out[1] & CTL) ? 8 : 4);
 
 		net_data.out[1] &=  ~TTL_MASK;
 		net_data.out[1] |= ttl - 1;
 		net_key_encrypt(net_data.key_id, net_data.iv_index,
-					net_data.out, net_data.out_size);
-		send_relay_pkt(net_data.net, net_data.out, net_data.out_size);
+						net_data.out, size);
+		send_relay_pkt(net_data.net, net_data.out, size);
 	}
 }
 
@@ -2493,7 +2462,7 @@ static void iv_upd_to(struct l_timeout *upd_timeout, void *user_data)
 
 	switch (net->iv_upd_state) {
 	case IV_UPD_UPDATING:
-		if (l_queue_length(net->sar_out) ||
+		if (mesh_sar_table_count(net->sar_out) ||
 					l_queue_length(net->sar_queue)) {
 			l_debug("don't leave IV Update until sar_out empty");
 			l_timeout_modify(net->iv_update_timeout, 10);
@@ -2512,7 +2481,7 @@ static void iv_upd_to(struct l_timeout *upd_timeout, void *user_data)
 							net->iv_index, false);
 		l_queue_foreach(net->subnets, refresh_beacon, net);
 		queue_friend_update(net);
-		l_queue_clear(net->msg_cache, l_free);
+		mesh_cache_clear(net->msg_cache);
 		break;
 
 	case IV_UPD_INIT:
@@ -2630,7 +2599,7 @@ static void update_iv_ivu_state(struct mesh_net *net, uint32_t iv_index,
 {
 	if ((iv_index - ivu) > (net->iv_index - net->iv_update)) {
 		/* Don't accept IV_Index changes when performing SAR Out */
-		if (l_queue_length(net->sar_out))
+		if (mesh_sar_table_count(net->sar_out))
 			return;
 	}
 
@@ -2870,7 +2839,7 @@ bool mesh_net_attach(struct mesh_net *net, struct mesh_io *io)
 			nets = l_queue_new();
 
 		if (!fast_cache)
-			fast_cache = l_queue_new();
+			fast_cache = mesh_cache_new(FAST_CACHE_SIZE);
 
 		mesh_io_register_recv_cb(io, snb, sizeof(snb),
 							beacon_recv, NULL);
@@ -2920,7 +2889,7 @@ bool mesh_net_iv_index_update(struct mesh_net *net)
 		return false;
 
 	l_debug("iv_upd_state = IV_UPD_UPDATING");
-	l_queue_clear(net->msg_cache, l_free);
+	mesh_cache_clear(net->msg_cache);
 
 	if (!mesh_config_write_iv_index(node_config_get(net->node),
 						net->iv_index + 1, true))
@@ -3128,7 +3097,7 @@ bool mesh_net_app_send(struct mesh_net *net, bool frnd_cred, uint16_t src,
 		return true;
 
 	/* Setup OTA Network send */
-	payload = mesh_sar_new(msg_len);
+	payload = mesh_sar_new(net, msg_len);
 	memcpy(payload->buf, msg, msg_len);
 	payload->len = msg_len;
 	payload->src = src;
@@ -3148,8 +3117,7 @@ bool mesh_net_app_send(struct mesh_net *net, bool frnd_cred, uint16_t src,
 		payload->id = ++net->sar_id_next;
 
 		/* Single thread SAR messages to same Unicast DST */
-		if (l_queue_find(net->sar_out, match_sar_remote,
-							L_UINT_TO_PTR(dst))) {
+		if (mesh_sar_table_lookup_addr(net->sar_out, dst)) {
 			/* Delay sending Outbound SAR unless prior
 			 * SAR to same DST has completed */
 
@@ -3176,11 +3144,13 @@ bool mesh_net_app_send(struct mesh_net *net, bool frnd_cred, uint16_t src,
 
 	/* Reliable: Cache; Unreliable: Flush*/
 	if (result && segmented && IS_UNICAST(dst)) {
-		l_queue_push_head(net->sar_out, payload);
-		payload->seg_timeout =
-			l_timeout_create(SEG_TO, outseg_to, net, NULL);
-		payload->msg_timeout =
-			l_timeout_create(MSG_TO, outmsg_to, net, NULL);
+		mesh_sar_table_insert(net->sar_out, dst, payload->seqZero,
+								payload);
+		sar_update_peaks(net);
+		payload->seg_timeout = mesh_sar_timer_add(sar_wheel,
+					SEG_TO * 1000, outseg_to, payload);
+		payload->msg_timeout = mesh_sar_timer_add(sar_wheel,
+					MSG_TO * 1000, outmsg_to, payload);
 		payload->id = ++net->sar_id_next;
 	} else
 		mesh_sar_free(payload);
@@ -3458,6 +3428,17 @@ struct l_queue *mesh_net_get_app_keys(struct mesh_net *net)
 	return net->app_keys;
 }
 
+struct appkey_index *mesh_net_get_app_index(struct mesh_net *net)
+{
+	if (!net)
+		return NULL;
+
+	if (!net->app_index)
+		net->app_index = appkey_index_new();
+
+	return net->app_index;
+}
+
 bool mesh_net_have_key(struct mesh_net *net, uint16_t idx)
 {
 	if (!net)
@@ -3498,6 +3479,18 @@ void mesh_net_transmit_params_get(struct mesh_net *net, uint8_t *count,
 	*count = net->tx_cnt;
 }
 
+void mesh_net_get_sar_stats(struct mesh_net *net,
+					struct mesh_net_sar_stats *stats)
+{
+	if (!net || !stats)
+		return;
+
+	*stats = net->sar_stats;
+	stats->in_active = mesh_sar_table_count(net->sar_in);
+	stats->out_active = mesh_sar_table_count(net->sar_out);
+	stats->out_queued = l_queue_length(net->sar_queue);
+}
+
 struct mesh_io *mesh_net_get_io(struct mesh_net *net)
 {
 	if (!net)
@@ -3702,5 +3695,31 @@ int mesh_net_set_heartbeat_pub(struct mesh_net *net, uint16_t dst,
 
 bool mesh_net_load_rpl(struct mesh_net *net)
 {
-	return rpl_get_list(net->node, net->replay_cache);
+	const struct l_queue_entry *entry;
+	struct l_queue *rpl_list;
+	unsigned int size;
+	bool result;
+
+	rpl_list = l_queue_new();
+	result = rpl_get_list(net->node, rpl_list);
+
+	/* Entries loaded from storage must all fit without evictions */
+	size = node_get_crpl(net->node);
+	if (size < l_queue_length(rpl_list))
+		size = l_queue_length(rpl_list);
+
+	mesh_cache_free(net->replay_cache);
+	net->replay_cache = mesh_cache_new(size);
+
+	for (entry = l_queue_get_entries(rpl_list); entry;
+							entry = entry->next) {
+		struct mesh_rpl *rpe = entry->data;
+
+		mesh_cache_insert(net->replay_cache, rpe->src,
+					RPL_VALUE(rpe->iv_index, rpe->seq));
+	}
+
+	l_queue_destroy(rpl_list, l_free);
+
+	return result;
 }
@@ -14,6 +14,8 @@
 
 struct mesh_io;
 struct mesh_node;
+struct appkey_index;
+struct mesh_friend_queue;
 
 #define DEV_ID	0
 
@@ -143,6 +145,22 @@ struct mesh_net_heartbeat_pub {
 	uint8_t ttl;
 };
 
+/* Lower transport Segmentation and Reassembly counters */
+struct mesh_net_sar_stats {
+	uint32_t in_active;
+	uint32_t in_peak;
+	uint32_t in_completed;
+	uint32_t in_timeouts;
+	uint32_t out_active;
+	uint32_t out_peak;
+	uint32_t out_queued;
+	uint32_t out_completed;
+	uint32_t out_failed;
+	uint32_t latency_min_us;	/* First to last segment received */
+	uint32_t latency_max_us;
+	uint64_t latency_total_us;
+};
+
 struct mesh_key_set {
 	bool frnd;
 	uint8_t nid;
@@ -166,7 +184,7 @@ struct friend_act {
 struct mesh_friend {
 	struct mesh_net *net;
 	struct l_timeout *timeout;
-	struct l_queue *pkt_cache;
+	struct mesh_friend_queue *pkt_cache;
 	void *pkt;
 	uint32_t poll_timeout;
 	uint32_t net_key_cur;
@@ -282,6 +300,7 @@ bool mesh_net_get_key(struct mesh_net *net, bool new_key, uint16_t idx,
 bool mesh_net_attach(struct mesh_net *net, struct mesh_io *io);
 struct mesh_io *mesh_net_detach(struct mesh_net *net);
 struct l_queue *mesh_net_get_app_keys(struct mesh_net *net);
+struct appkey_index *mesh_net_get_app_index(struct mesh_net *net);
 
 void mesh_net_transport_send(struct mesh_net *net, uint32_t key_id,
 				uint16_t net_idx, uint32_t iv_index,
@@ -305,7 +324,8 @@ bool mesh_net_dst_unreg(struct mesh_net *net, uint16_t dst);
 struct mesh_friend *mesh_friend_new(struct mesh_net *net, uint16_t dst,
 					uint8_t ele_cnt, uint8_t frd,
 					uint8_t frw, uint32_t fpt,
-					uint16_t fn_cnt, uint16_t lp_cnt);
+					uint16_t fn_cnt, uint16_t lp_cnt,
+					uint8_t cache_size);
 void mesh_friend_free(void *frnd);
 bool mesh_friend_clear(struct mesh_net *net, struct mesh_friend *frnd);
 void mesh_friend_sub_add(struct mesh_net *net, uint16_t lpn, uint8_t ele_cnt,
@@ -332,6 +352,8 @@ bool mesh_net_key_list_get(struct mesh_net *net, uint8_t *buf, uint16_t *count);
 uint16_t mesh_net_get_primary_idx(struct mesh_net *net);
 uint32_t mesh_net_friend_timeout(struct mesh_net *net, uint16_t addr);
 struct mesh_io *mesh_net_get_io(struct mesh_net *net);
+void mesh_net_get_sar_stats(struct mesh_net *net,
+					struct mesh_net_sar_stats *stats);
 struct mesh_node *mesh_net_node_get(struct mesh_net *net);
 bool mesh_net_have_key(struct mesh_net *net, uint16_t net_idx);
 bool mesh_net_is_local_address(struct mesh_net *net, uint16_t src,
@@ -295,6 +295,7 @@ static void free_node_resources(void *data)
 	mesh_agent_remove(node->agent);
 	mesh_config_release(node->cfg);
 	mesh_net_free(node->net);
+	rpl_cleanup(node);
 	l_free(node->storage_dir);
 	l_free(node);
 }
@@ -389,7 +390,7 @@ static bool init_storage_dir(struct mesh_node *node)
 	node->storage_dir = l_strdup(dir_name);
 
 	/* Initialize directory for storing RPL info */
-	return rpl_init(node->storage_dir);
+	return rpl_init(node);
 }
 
 static void update_net_settings(struct mesh_node *node)
@@ -93,8 +93,6 @@ struct idle_rx {
 
 static struct l_queue *pb_sessions = NULL;
 
-static const uint8_t filter[1] = { MESH_AD_TYPE_PROVISION };
-
 static void pb_adv_packet(void *user_data, const uint8_t *pkt, uint16_t len);
 
 static void idle_rx_adv(void *user_data)
@@ -122,6 +120,15 @@ static void pb_adv_send(struct pb_adv_session *session,
 		mesh_send_pkt(count, interval, data, len);
 }
 
+static void pb_adv_cancel(struct pb_adv_session *session)
+{
+	uint8_t pattern[5] = { MESH_AD_TYPE_PROVISION };
+
+	/* Leave the PDUs of other links in flight */
+	l_put_be32(session->link_id, pattern + 1);
+	mesh_send_cancel(pattern, sizeof(pattern));
+}
+
 static void send_adv_segs(struct pb_adv_session *session, const uint8_t *data,
 							uint16_t size)
 {
@@ -134,7 +141,7 @@ static void send_adv_segs(struct pb_adv_session *session, const uint8_t *data,
 	if (!size)
 		return;
 
-	mesh_send_cancel(filter, sizeof(filter));
+	pb_adv_cancel(session);
 
 	l_put_be32(session->link_id, buf + 1);
 	buf[1 + 4] = ++session->local_trans_num;
@@ -201,6 +208,31 @@ static bool user_match (const void *a, const void *b)
 	return session->user_data == b;
 }
 
+static bool link_match(const void *a, const void *b)
+{
+	const struct pb_adv_session *session = a;
+
+	return !session->loop && session->link_id == L_PTR_TO_UINT(b);
+}
+
+static bool open_match(const void *a, const void *b)
+{
+	const struct pb_adv_session *session = a;
+	const uint8_t *uuid = b;
+
+	if (session->loop || session->initiator || session->link_id)
+		return false;
+
+	return !memcmp(session->uuid, uuid, sizeof(session->uuid));
+}
+
+static bool acceptor_match(const void *a, const void *b)
+{
+	const struct pb_adv_session *session = a;
+
+	return !session->initiator;
+}
+
 static void tx_timeout(struct l_timeout *timeout, void *user_data)
 {
 	struct pb_adv_session *session = user_data;
@@ -209,7 +241,7 @@ static void tx_timeout(struct l_timeout *timeout, void *user_data)
 	if (!l_queue_find(pb_sessions, session_match, session))
 		return;
 
-	mesh_send_cancel(filter, sizeof(filter));
+	pb_adv_cancel(session);
 
 	l_debug("TX timeout");
 	cb = session->close_cb;
@@ -239,7 +271,7 @@ static void send_open_req(struct pb_adv_session *session)
 	open_req.opcode = PB_ADV_OPEN_REQ;
 	memcpy(open_req.uuid, session->uuid, 16);
 
-	mesh_send_cancel(filter, sizeof(filter));
+	pb_adv_cancel(session);
 
 	pb_adv_send(session, MESH_IO_TX_COUNT_UNLIMITED, 500, &open_req,
 							sizeof(open_req));
@@ -253,7 +285,7 @@ static void send_open_cfm(struct pb_adv_session *session)
 	open_cfm.trans_num = 0;
 	open_cfm.opcode = PB_ADV_OPEN_CFM;
 
-	mesh_send_cancel(filter, sizeof(filter));
+	pb_adv_cancel(session);
 
 	pb_adv_send(session, MESH_IO_TX_COUNT_UNLIMITED, 500, &open_cfm,
 							sizeof(open_cfm));
@@ -285,7 +317,7 @@ static void send_close_ind(struct pb_adv_session *session, uint8_t reason)
 	close_ind.opcode = PB_ADV_CLOSE;
 	close_ind.reason = reason;
 
-	mesh_send_cancel(filter, sizeof(filter));
+	pb_adv_cancel(session);
 
 	pb_adv_send(session, 10, 100, &close_ind, sizeof(close_ind));
 }
@@ -389,7 +421,7 @@ static void pb_adv_packet(void *user_data, const uint8_t *pkt, uint16_t len)
 		if (session->local_acked > trans_num)
 			return;
 
-		mesh_send_cancel(filter, sizeof(filter));
+		pb_adv_cancel(session);
 		session->local_acked = trans_num;
 		session->ack_cb(session->user_data, trans_num);
 		break;
@@ -473,6 +505,29 @@ static void pb_adv_packet(void *user_data, const uint8_t *pkt, uint16_t len)
 	}
 }
 
+static void pb_adv_rx(void *user_data, const uint8_t *pkt, uint16_t len)
+{
+	struct pb_adv_session *session;
+	uint32_t link_id;
+
+	if (len < 7)
+		return;
+
+	link_id = l_get_be32(pkt + 1);
+	if (!link_id)
+		return;
+
+	/* Demultiplex on Link ID, or on UUID for a link being opened */
+	session = l_queue_find(pb_sessions, link_match,
+						L_UINT_TO_PTR(link_id));
+
+	if (!session && pkt[6] == PB_ADV_OPEN_REQ && len >= 7 + 16)
+		session = l_queue_find(pb_sessions, open_match, pkt + 7);
+
+	if (session)
+		pb_adv_packet(session, pkt, len);
+}
+
 bool pb_adv_reg(bool initiator, mesh_prov_open_func_t open_cb,
 		mesh_prov_close_func_t close_cb,
 		mesh_prov_receive_func_t rx_cb, mesh_prov_ack_func_t ack_cb,
@@ -485,8 +540,12 @@ bool pb_adv_reg(bool initiator, mesh_prov_open_func_t open_cb,
 
 	old_session = l_queue_find(pb_sessions, uuid_match, uuid);
 
-	/* Reject 2nd session if not looping back */
-	if (l_queue_length(pb_sessions) && !old_session)
+	/*
+	 * Any number of Initiator links may run side by side, each on its
+	 * own Link ID, but only one Acceptor may be waiting to be opened.
+	 */
+	if (!initiator && !old_session &&
+			l_queue_find(pb_sessions, acceptor_match, NULL))
 		return false;
 
 	/* Reject looping to more than one session or with same role*/
@@ -503,19 +562,23 @@ bool pb_adv_reg(bool initiator, mesh_prov_open_func_t open_cb,
 	session->initiator = initiator;
 	memcpy(session->uuid, uuid, 16);
 
-	l_queue_push_head(pb_sessions, session);
-
 	if (initiator) {
-		l_getrandom(&session->link_id, sizeof(session->link_id));
+		do {
+			l_getrandom(&session->link_id,
+						sizeof(session->link_id));
+		} while (!session->link_id || l_queue_find(pb_sessions,
+				link_match, L_UINT_TO_PTR(session->link_id)));
+
 		session->tx_timeout = l_timeout_create(60, tx_timeout,
 							session, NULL);
 	}
 
+	l_queue_push_head(pb_sessions, session);
+
 	/* Setup Loop-back if complementary session with same UUID */
 	if (old_session) {
 		session->loop = old_session;
 		old_session->loop = session;
-		mesh_unreg_prov_rx(pb_adv_packet);
 
 		if (initiator)
 			send_open_req(session);
@@ -525,7 +588,7 @@ bool pb_adv_reg(bool initiator, mesh_prov_open_func_t open_cb,
 		return true;
 	}
 
-	mesh_reg_prov_rx(pb_adv_packet, session);
+	mesh_reg_prov_rx(pb_adv_rx, NULL);
 
 	if (initiator)
 		send_open_req(session);
@@ -545,9 +608,14 @@ void pb_adv_unreg(void *user_data)
 	session->tx_timeout = NULL;
 	send_close_ind(session, 0);
 	l_queue_remove(pb_sessions, session);
+
+	if (session->loop)
+		session->loop->loop = NULL;
+
 	l_free(session);
 
 	if (!l_queue_length(pb_sessions)) {
+		mesh_unreg_prov_rx(pb_adv_rx);
 		l_queue_destroy(pb_sessions, l_free);
 		pb_sessions = NULL;
 	}
@@ -637,7 +637,8 @@ bool acceptor_start(uint8_t num_ele, uint8_t uuid[16],
 		mesh_prov_acceptor_complete_func_t complete_cb,
 		void *caller_data)
 {
-	struct mesh_agent_prov_caps *caps;
+	static const struct mesh_agent_prov_caps no_oob;
+	const struct mesh_agent_prov_caps *caps;
 	uint8_t beacon[24] = {MESH_AD_TYPE_BEACON,
 						BEACON_TYPE_UNPROVISIONED};
 	uint8_t len = sizeof(beacon) - sizeof(uint32_t);
@@ -657,7 +658,10 @@ bool acceptor_start(uint8_t num_ele, uint8_t uuid[16],
 	prov->previous = -1;
 	prov->caller_data = caller_data;
 
+	/* Without an agent, only No OOB is possible */
 	caps = mesh_agent_get_caps(agent);
+	if (!caps)
+		caps = &no_oob;
 
 	/* TODO: Should we sanity check values here or elsewhere? */
 	prov->conf_inputs.caps.num_ele = num_ele;
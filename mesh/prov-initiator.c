@@ -47,8 +47,6 @@ static const uint16_t expected_pdu_size[] = {
 
 #define BEACON_TYPE_UNPROVISIONED		0x00
 
-static const uint8_t pkt_filter = MESH_AD_TYPE_PROVISION;
-
 enum int_state {
 	INT_PROV_IDLE = 0,
 	INT_PROV_INVITE_SENT,
@@ -100,19 +98,51 @@ struct mesh_prov_initiator {
 	uint8_t uuid[16];
 };
 
-static struct mesh_prov_initiator *prov = NULL;
+static struct l_queue *initiators = NULL;
+
+static bool prov_match(const void *a, const void *b)
+{
+	return a == b;
+}
+
+static bool caller_match(const void *a, const void *b)
+{
+	const struct mesh_prov_initiator *prov = a;
+
+	return prov->caller_data == b;
+}
+
+static bool uuid_match(const void *a, const void *b)
+{
+	const struct mesh_prov_initiator *prov = a;
+
+	return !memcmp(prov->uuid, b, sizeof(prov->uuid));
+}
+
+static bool initiator_valid(struct mesh_prov_initiator *prov)
+{
+	return prov && l_queue_find(initiators, prov_match, prov);
+}
 
-static void initiator_free(void)
+static void initiator_free(struct mesh_prov_initiator *prov)
 {
-	if (prov)
-		l_timeout_remove(prov->timeout);
+	if (!l_queue_remove(initiators, prov))
+		return;
 
-	mesh_send_cancel(&pkt_filter, sizeof(pkt_filter));
+	l_timeout_remove(prov->timeout);
 
+	/* Only cancels the PDUs of this session's link */
 	pb_adv_unreg(prov);
 
+	/* Let queued prompts of other sessions reach the agent */
+	mesh_agent_cancel_requests(prov->agent, prov);
+
 	l_free(prov);
-	prov = NULL;
+
+	if (l_queue_isempty(initiators)) {
+		l_queue_destroy(initiators, NULL);
+		initiators = NULL;
+	}
 }
 
 static void int_prov_close(void *user_data, uint8_t reason)
@@ -122,7 +152,7 @@ static void int_prov_close(void *user_data, uint8_t reason)
 
 	if (reason != PROV_ERR_SUCCESS) {
 		prov->complete_cb(prov->caller_data, reason, NULL);
-		initiator_free();
+		initiator_free(prov);
 		return;
 	}
 
@@ -132,7 +162,7 @@ static void int_prov_close(void *user_data, uint8_t reason)
 	info.num_ele = prov->conf_inputs.caps.num_ele;
 
 	prov->complete_cb(prov->caller_data, PROV_ERR_SUCCESS, &info);
-	initiator_free();
+	initiator_free(prov);
 }
 
 static void swap_u256_bytes(uint8_t *u256)
@@ -150,11 +180,10 @@ static void swap_u256_bytes(uint8_t *u256)
 static void int_prov_open(void *user_data, prov_trans_tx_t trans_tx,
 				void *trans_data, uint8_t transport)
 {
-	struct mesh_prov_initiator *rx_prov = user_data;
+	struct mesh_prov_initiator *prov = user_data;
 	struct prov_invite_msg msg = { PROV_INVITE, { 30 }};
 
-	/* Only one provisioning session may be open at a time */
-	if (rx_prov != prov)
+	if (!initiator_valid(prov))
 		return;
 
 	/* Only one provisioning session may be open at a time */
@@ -254,7 +283,8 @@ static uint32_t digit_mod(uint8_t power)
 	return ret;
 }
 
-static void calc_local_material(const uint8_t *random)
+static void calc_local_material(struct mesh_prov_initiator *prov,
+							const uint8_t *random)
 {
 	/* Calculate SessionKey while the data is fresh */
 	mesh_crypto_prov_prov_salt(prov->salt,
@@ -282,10 +312,10 @@ static void send_confirm(struct mesh_prov_initiator *prov)
 
 static void number_cb(void *user_data, int err, uint32_t number)
 {
-	struct mesh_prov_initiator *rx_prov = user_data;
+	struct mesh_prov_initiator *prov = user_data;
 	struct prov_fail_msg msg;
 
-	if (prov != rx_prov)
+	if (!initiator_valid(prov))
 		return;
 
 	if (err) {
@@ -304,10 +334,10 @@ static void number_cb(void *user_data, int err, uint32_t number)
 
 static void static_cb(void *user_data, int err, uint8_t *key, uint32_t len)
 {
-	struct mesh_prov_initiator *rx_prov = user_data;
+	struct mesh_prov_initiator *prov = user_data;
 	struct prov_fail_msg msg;
 
-	if (prov != rx_prov)
+	if (!initiator_valid(prov))
 		return;
 
 	if (err || !key || len != 16) {
@@ -335,11 +365,11 @@ static void send_pub_key(struct mesh_prov_initiator *prov)
 
 static void pub_key_cb(void *user_data, int err, uint8_t *key, uint32_t len)
 {
-	struct mesh_prov_initiator *rx_prov = user_data;
+	struct mesh_prov_initiator *prov = user_data;
 	struct prov_fail_msg msg;
 	uint8_t fail_code[2];
 
-	if (prov != rx_prov)
+	if (!initiator_valid(prov))
 		return;
 
 	if (err || !key || len != 64) {
@@ -384,8 +414,10 @@ void initiator_prov_data(uint16_t net_idx, uint16_t primary, void *caller_data)
 	struct mesh_net *net;
 	uint32_t iv_index;
 	uint8_t snb_flags;
+	struct mesh_prov_initiator *prov;
 
-	if (!prov || caller_data != prov->caller_data)
+	prov = l_queue_find(initiators, caller_match, caller_data);
+	if (!prov)
 		return;
 
 	if (prov->state != INT_PROV_RAND_ACKED)
@@ -493,7 +525,7 @@ static void get_random_key(struct mesh_prov_initiator *prov, uint8_t action,
 	l_put_be32(oob_key, prov->rand_auth_workspace + 44);
 }
 
-static void int_prov_auth(void)
+static void int_prov_auth(struct mesh_prov_initiator *prov)
 {
 	uint8_t fail_code[2];
 	uint32_t oob_key;
@@ -620,12 +652,13 @@ static void int_prov_start_auth(const struct mesh_agent_prov_caps *prov_caps,
 
 static void int_prov_rx(void *user_data, const uint8_t *data, uint16_t len)
 {
-	struct mesh_prov_initiator *rx_prov = user_data;
+	struct mesh_prov_initiator *prov = user_data;
+	struct mesh_agent_prov_caps *caps;
 	uint8_t *out;
 	uint8_t type = *data++;
 	uint8_t fail_code[2];
 
-	if (rx_prov != prov || !prov->trans_tx)
+	if (!initiator_valid(prov) || !prov->trans_tx)
 		return;
 
 	l_debug("Provisioning packet received type: %2.2x (%u octets)",
@@ -671,10 +704,11 @@ static void int_prov_rx(void *user_data, const uint8_t *data, uint16_t len)
 
 		/*
 		 * Select auth mechanism from methods supported by both
-		 * parties.
+		 * parties. Without an agent, only No OOB is possible.
 		 */
-		int_prov_start_auth(mesh_agent_get_caps(prov->agent),
-						&prov->conf_inputs.caps,
+		caps = mesh_agent_get_caps(prov->agent);
+		if (caps)
+			int_prov_start_auth(caps, &prov->conf_inputs.caps,
 						&prov->conf_inputs.start);
 
 		if (prov->conf_inputs.start.pub_key == 0x01) {
@@ -716,7 +750,7 @@ static void int_prov_rx(void *user_data, const uint8_t *data, uint16_t len)
 			goto failure;
 		}
 
-		int_prov_auth();
+		int_prov_auth(prov);
 		break;
 
 	case PROV_INP_CMPLT: /* Provisioning Input Complete */
@@ -737,7 +771,7 @@ static void int_prov_rx(void *user_data, const uint8_t *data, uint16_t len)
 		prov->state = INT_PROV_RAND_ACKED;
 
 		/* RXed Device Confirmation */
-		calc_local_material(data);
+		calc_local_material(prov, data);
 		memcpy(prov->rand_auth_workspace + 16, data, 16);
 		print_packet("RandomDevice", data, 16);
 
@@ -764,13 +798,13 @@ static void int_prov_rx(void *user_data, const uint8_t *data, uint16_t len)
 		l_debug("Provisioning Complete");
 		prov->state = INT_PROV_IDLE;
 		int_prov_close(prov, PROV_ERR_SUCCESS);
-		break;
+		return;
 
 	case PROV_FAILED: /* Failed */
 		l_error("Provisioning Failed (reason: %d)", data[0]);
 		prov->state = INT_PROV_IDLE;
 		int_prov_close(prov, data[0]);
-		break;
+		return;
 
 	default:
 		l_error("Unknown Pkt %2.2x", type);
@@ -778,7 +812,8 @@ static void int_prov_rx(void *user_data, const uint8_t *data, uint16_t len)
 		goto failure;
 	}
 
-	if (prov)
+	/* The session may have been cancelled by one of the callbacks */
+	if (initiator_valid(prov))
 		prov->previous = type;
 
 	return;
@@ -792,9 +827,9 @@ failure:
 
 static void int_prov_ack(void *user_data, uint8_t msg_num)
 {
-	struct mesh_prov_initiator *rx_prov = user_data;
+	struct mesh_prov_initiator *prov = user_data;
 
-	if (rx_prov != prov || !prov->trans_tx)
+	if (!initiator_valid(prov) || !prov->trans_tx)
 		return;
 
 	switch (prov->state) {
@@ -810,7 +845,7 @@ static void int_prov_ack(void *user_data, uint8_t msg_num)
 
 	case INT_PROV_KEY_SENT:
 		if (prov->conf_inputs.start.pub_key)
-			int_prov_auth();
+			int_prov_auth(prov);
 		break;
 
 	case INT_PROV_IDLE:
@@ -830,9 +865,10 @@ static void int_prov_ack(void *user_data, uint8_t msg_num)
 
 static void initiator_open_cb(void *user_data, int err)
 {
+	struct mesh_prov_initiator *prov = user_data;
 	bool result;
 
-	if (!prov)
+	if (!initiator_valid(prov))
 		return;
 
 	if (err != MESH_ERROR_NONE)
@@ -847,14 +883,19 @@ static void initiator_open_cb(void *user_data, int err)
 		goto fail;
 	}
 
-	if (!prov)
+	if (!initiator_valid(prov))
 		return;
 
 	prov->start_cb(prov->caller_data, MESH_ERROR_NONE);
 	return;
 fail:
 	prov->start_cb(prov->caller_data, err);
-	initiator_free();
+	initiator_free(prov);
+}
+
+static void initiator_open_idle(void *user_data)
+{
+	initiator_open_cb(user_data, MESH_ERROR_NONE);
 }
 
 bool initiator_start(enum trans_type transport,
@@ -867,11 +908,17 @@ bool initiator_start(enum trans_type transport,
 		mesh_prov_initiator_complete_func_t complete_cb,
 		void *node, void *caller_data)
 {
+	struct mesh_prov_initiator *prov;
+
 	/* Invoked from Add() method in mesh-api.txt, to add a
 	 * remote unprovisioned device network.
 	 */
 
-	if (prov)
+	if (l_queue_length(initiators) >= mesh_get_prov_sessions())
+		return false;
+
+	/* Only one session per device */
+	if (l_queue_find(initiators, uuid_match, uuid))
 		return false;
 
 	prov = l_new(struct mesh_prov_initiator, 1);
@@ -885,12 +932,21 @@ bool initiator_start(enum trans_type transport,
 	prov->previous = -1;
 	memcpy(prov->uuid, uuid, 16);
 
-	mesh_agent_refresh(prov->agent, initiator_open_cb, prov);
+	if (!initiators)
+		initiators = l_queue_new();
+
+	l_queue_push_tail(initiators, prov);
+
+	/* Without an agent there are no capabilities to refresh */
+	if (agent)
+		mesh_agent_refresh(prov->agent, initiator_open_cb, prov);
+	else
+		l_idle_oneshot(initiator_open_idle, prov, NULL);
 
 	return true;
 }
 
-void initiator_cancel(void *user_data)
+void initiator_cancel(void *caller_data)
 {
-	initiator_free();
+	initiator_free(l_queue_find(initiators, caller_match, caller_data));
 }
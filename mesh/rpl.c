@@ -30,102 +30,178 @@
 #include "mesh/util.h"
 #include "mesh/rpl.h"
 
-const char *rpl_dir = "/rpl";
+/*
+ * The Replay Protection List of a node is kept in two files below
+ * <node>/rpl: "snapshot" holds all entries as of the last compaction and
+ * "journal" has one record appended for every change since then. Both use
+ * the same fixed size record format:
+ *
+ *	magic (1) | op (1) | src (2) | iv_index (4) | seq (3) | checksum (1)
+ *
+ * Records are applied in order, snapshot first. A record that is incomplete
+ * or fails the checksum ends the journal, it is the remainder of a write
+ * interrupted by a crash and gets truncated away.
+ *
+ * Rather than the last accepted sequence number, the files hold a high
+ * water mark RPL_SEQ_MARGIN ahead of it. A record is only appended, and
+ * synced before the message is accepted, once a source passes its mark, so
+ * every accepted message is covered by storage without a write per message.
+ * After a crash the marks are applied as they are, at the cost of dropping
+ * up to RPL_SEQ_MARGIN messages per source that were never seen. On a clean
+ * shutdown the marks are lowered to the accepted values.
+ *
+ * Marks only ever move forward while running: a put with a lower
+ * (iv_index, seq) than the current entry is ignored, and a new snapshot is
+ * renamed into place before the journal is truncated. Whatever reached the
+ * files before a crash is therefore never lost or rolled back by recovery.
+ */
 
-bool rpl_put_entry(struct mesh_node *node, uint16_t src, uint32_t iv_index,
-								uint32_t seq)
-{
-	const char *node_path;
-	char src_file[PATH_MAX];
-	char seq_txt[7];
-	bool result = false;
-	DIR *dir;
-	int fd;
+#define RPL_RECORD_MAGIC	0x52
+#define RPL_RECORD_PUT		0x01
+#define RPL_RECORD_DEL		0x02
+#define RPL_RECORD_SIZE		12
 
-	if (!IS_UNICAST(src))
-		return false;
+/* Compact once the journal is this many times larger than the list */
+#define RPL_COMPACT_RATIO	4
+#define RPL_COMPACT_MIN		1024
 
-	node_path = node_get_storage_dir(node);
+/* Sequence numbers a stored mark is kept ahead of the accepted one */
+#define RPL_SEQ_MARGIN		64
 
-	if (strlen(node_path) + strlen(rpl_dir) + 15 >= PATH_MAX)
-		return false;
+struct rpl_journal {
+	struct mesh_node *node;
+	char *path;
+	int fd;
+	struct l_hashmap *entries;
+	unsigned int records;
+};
 
-	snprintf(src_file, PATH_MAX, "%s%s/%8.8x", node_path, rpl_dir,
-								iv_index);
-	dir = opendir(src_file);
+struct rpl_entry {
+	struct mesh_rpl rpl;			/* Last accepted */
+	uint32_t mark;				/* Stored seq for rpl.iv_index */
+};
 
-	if (!dir)
-		mkdir(src_file, 0755);
-	else
-		closedir(dir);
+const char *rpl_dir = "/rpl";
 
-	snprintf(src_file, PATH_MAX, "%s%s/%8.8x/%4.4x", node_path, rpl_dir,
-								iv_index, src);
+static struct l_queue *journals;
 
-	fd = open(src_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-	if (fd >= 0) {
-		snprintf(seq_txt, 7, "%6.6x", seq);
-		if (write(fd, seq_txt, 6) == 6)
-			result = true;
+static bool match_node(const void *a, const void *b)
+{
+	const struct rpl_journal *journal = a;
 
-		close(fd);
-	}
+	return journal->node == b;
+}
 
-	if (!result)
-		return false;
+static struct rpl_journal *get_journal(struct mesh_node *node)
+{
+	return l_queue_find(journals, match_node, node);
+}
 
-	/* Delete RPL entry from old iv_index (if it exists) */
-	iv_index--;
-	snprintf(src_file, PATH_MAX, "%s%s/%8.8x/%4.4x", node_path, rpl_dir,
-								iv_index, src);
-	remove(src_file);
+static uint8_t record_checksum(const uint8_t *rec)
+{
+	uint8_t sum = 0;
+	int i;
 
+	for (i = 0; i < RPL_RECORD_SIZE - 1; i++)
+		sum += rec[i];
 
-	return result;
+	return ~sum;
 }
 
-void rpl_del_entry(struct mesh_node *node, uint16_t src)
+static void build_record(uint8_t *rec, uint8_t op, uint16_t src,
+						uint32_t iv_index, uint32_t seq)
 {
-	const char *node_path;
-	char rpl_path[PATH_MAX];
-	struct dirent *entry;
-	DIR *dir;
+	rec[0] = RPL_RECORD_MAGIC;
+	rec[1] = op;
+	l_put_le16(src, rec + 2);
+	l_put_le32(iv_index, rec + 4);
+	l_put_le16(seq, rec + 8);
+	rec[10] = seq >> 16;
+	rec[11] = record_checksum(rec);
+}
 
-	if (!IS_UNICAST(src))
-		return;
+static struct rpl_entry *set_entry(struct rpl_journal *journal,
+				uint16_t src, uint32_t iv_index, uint32_t seq)
+{
+	struct rpl_entry *entry;
+
+	entry = l_hashmap_lookup(journal->entries, L_UINT_TO_PTR(src));
+	if (!entry) {
+		entry = l_new(struct rpl_entry, 1);
+		entry->rpl.src = src;
+		l_hashmap_insert(journal->entries, L_UINT_TO_PTR(src), entry);
+	} else if (iv_index < entry->rpl.iv_index ||
+			(iv_index == entry->rpl.iv_index &&
+						seq < entry->rpl.seq))
+		return entry;
+
+	entry->rpl.iv_index = iv_index;
+	entry->rpl.seq = seq;
+
+	return entry;
+}
 
-	node_path = node_get_storage_dir(node);
+/* Entries read from storage only know the mark */
+static void set_stored_entry(struct rpl_journal *journal, uint16_t src,
+						uint32_t iv_index, uint32_t seq)
+{
+	struct rpl_entry *entry;
 
-	if (strlen(node_path) + strlen(rpl_dir) + 15 >= PATH_MAX)
-		return;
+	entry = set_entry(journal, src, iv_index, seq);
+	entry->mark = entry->rpl.seq;
+}
+
+static bool apply_record(struct rpl_journal *journal, const uint8_t *rec)
+{
+	uint32_t iv_index, seq;
+	uint16_t src;
 
-	snprintf(rpl_path, PATH_MAX, "%s%s", node_path, rpl_dir);
-	dir = opendir(rpl_path);
+	if (rec[0] != RPL_RECORD_MAGIC || rec[11] != record_checksum(rec))
+		return false;
 
-	if (!dir)
-		return;
+	src = l_get_le16(rec + 2);
+	iv_index = l_get_le32(rec + 4);
+	seq = l_get_le16(rec + 8) | rec[10] << 16;
 
-	/* Remove all instances of src address */
-	while ((entry = readdir(dir)) != NULL) {
-		if (entry->d_type == DT_DIR && entry->d_name[0] != '.') {
-			snprintf(rpl_path, PATH_MAX, "%s%s/%s/%4.4x",
-					node_path, rpl_dir, entry->d_name, src);
-			remove(rpl_path);
-		}
+	if (!IS_UNICAST(src))
+		return false;
+
+	switch (rec[1]) {
+	case RPL_RECORD_PUT:
+		set_stored_entry(journal, src, iv_index, seq);
+		return true;
+	case RPL_RECORD_DEL:
+		l_free(l_hashmap_remove(journal->entries, L_UINT_TO_PTR(src)));
+		return true;
 	}
 
-	closedir(dir);
+	return false;
 }
 
-static bool match_src(const void *a, const void *b)
+/* Returns the number of valid records read from fd */
+static unsigned int load_records(struct rpl_journal *journal, int fd)
 {
-	const struct mesh_rpl *rpl = a;
-	uint16_t src = L_PTR_TO_UINT(b);
+	uint8_t buf[RPL_RECORD_SIZE * 256];
+	unsigned int count = 0;
+	ssize_t len, i;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (i = 0; i + RPL_RECORD_SIZE <= len; i += RPL_RECORD_SIZE) {
+			if (!apply_record(journal, buf + i))
+				return count;
+
+			count++;
+		}
+
+		/* Partial record at the end of the file */
+		if (i != len)
+			break;
+	}
 
-	return rpl->src == src;
+	return count;
 }
 
-static void get_entries(const char *iv_path, struct l_queue *rpl_list)
+static void add_legacy_entries(const char *iv_path, struct l_queue *rpl_list)
 {
 	struct mesh_rpl *rpl;
 	struct dirent *entry;
@@ -143,149 +219,388 @@ static void get_entries(const char *iv_path, struct l_queue *rpl_list)
 		return;
 
 	iv_txt = basename(iv_path);
-	if (sscanf(iv_txt, "%08x", &iv_index) != 1)
+	if (sscanf(iv_txt, "%08x", &iv_index) != 1) {
+		closedir(dir);
 		return;
+	}
 
 	memset(seq_txt, 0, sizeof(seq_txt));
 
 	while ((entry = readdir(dir)) != NULL) {
 		/* RPL sequences are stored in src files under iv_index */
-		if (entry->d_type == DT_REG) {
-			if (sscanf(entry->d_name, "%04hx", &src) != 1)
-				continue;
-
-			snprintf(src_path, PATH_MAX, "%s/%4.4x", iv_path, src);
-			fd = open(src_path, O_RDONLY);
-
-			if (fd < 0)
-				continue;
-
-			if (read(fd, seq_txt, 6) == 6 &&
-					sscanf(seq_txt, "%06x", &seq) == 1) {
-
-				rpl = l_queue_find(rpl_list, match_src,
-						L_UINT_TO_PTR(src));
-
-				if (rpl) {
-					/* Replace older entries */
-					if (rpl->iv_index < iv_index) {
-						rpl->iv_index = iv_index;
-						rpl->seq = seq;
-					}
-				} else if (seq <= SEQ_MASK && IS_UNICAST(src)) {
-					rpl = l_new(struct mesh_rpl, 1);
-					rpl->src = src;
-					rpl->iv_index = iv_index;
-					rpl->seq = seq;
-
-					l_queue_push_head(rpl_list, rpl);
-				}
-			}
-			close(fd);
+		if (entry->d_type != DT_REG)
+			continue;
+
+		if (sscanf(entry->d_name, "%04hx", &src) != 1)
+			continue;
+
+		snprintf(src_path, PATH_MAX, "%s/%4.4x", iv_path, src);
+		fd = open(src_path, O_RDONLY);
+
+		if (fd < 0)
+			continue;
+
+		if (read(fd, seq_txt, 6) == 6 &&
+				sscanf(seq_txt, "%06x", &seq) == 1 &&
+				seq <= SEQ_MASK && IS_UNICAST(src)) {
+			rpl = l_new(struct mesh_rpl, 1);
+			rpl->src = src;
+			rpl->iv_index = iv_index;
+			rpl->seq = seq;
+
+			l_queue_push_tail(rpl_list, rpl);
 		}
+
+		close(fd);
 	}
 
 	closedir(dir);
 }
 
-bool rpl_get_list(struct mesh_node *node, struct l_queue *rpl_list)
+/*
+ * Older versions stored one file per source below a directory per IV Index.
+ * Pick up any such entries and remove the directories.
+ */
+static bool import_legacy(struct rpl_journal *journal)
 {
-	const char *node_path;
+	const struct l_queue_entry *l;
+	struct l_queue *rpl_list;
 	struct dirent *entry;
-	char *rpl_path;
-	size_t len;
+	char path[PATH_MAX];
+	bool found = false;
 	DIR *dir;
 
-	if (!rpl_list)
+	dir = opendir(journal->path);
+	if (!dir)
 		return false;
 
-	node_path = node_get_storage_dir(node);
+	rpl_list = l_queue_new();
 
-	len = strlen(node_path) + strlen(rpl_dir) + 15;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_type != DT_DIR || entry->d_name[0] == '.')
+			continue;
+
+		snprintf(path, PATH_MAX, "%s/%s", journal->path,
+								entry->d_name);
+		add_legacy_entries(path, rpl_list);
+		del_path(path);
+		found = true;
+	}
 
-	if (len > PATH_MAX)
-		return false;
+	closedir(dir);
+
+	for (l = l_queue_get_entries(rpl_list); l; l = l->next) {
+		struct mesh_rpl *rpl = l->data;
 
-	rpl_path = l_malloc(len);
-	snprintf(rpl_path, len, "%s%s", node_path, rpl_dir);
+		set_stored_entry(journal, rpl->src, rpl->iv_index, rpl->seq);
+	}
 
-	dir = opendir(rpl_path);
+	l_queue_destroy(rpl_list, l_free);
 
-	if (!dir) {
-		l_error("Failed to read RPL dir: %s", rpl_path);
-		l_free(rpl_path);
-		return false;
+	return found;
+}
+
+struct snapshot_data {
+	uint8_t *buf;
+	size_t len;
+};
+
+static void add_snapshot_record(const void *key, void *value, void *user_data)
+{
+	struct rpl_entry *entry = value;
+	struct snapshot_data *data = user_data;
+
+	build_record(data->buf + data->len, RPL_RECORD_PUT, entry->rpl.src,
+					entry->rpl.iv_index, entry->mark);
+	data->len += RPL_RECORD_SIZE;
+}
+
+static bool compact(struct rpl_journal *journal)
+{
+	char tmp[PATH_MAX], snapshot[PATH_MAX];
+	struct snapshot_data data;
+	bool result = false;
+	int fd;
+
+	snprintf(tmp, PATH_MAX, "%s/snapshot.tmp", journal->path);
+	snprintf(snapshot, PATH_MAX, "%s/snapshot", journal->path);
+
+	data.buf = l_malloc(l_hashmap_size(journal->entries) *
+							RPL_RECORD_SIZE + 1);
+	data.len = 0;
+	l_hashmap_foreach(journal->entries, add_snapshot_record, &data);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+							S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		goto done;
+
+	if (write(fd, data.buf, data.len) != (ssize_t) data.len ||
+							fdatasync(fd) < 0) {
+		close(fd);
+		remove(tmp);
+		goto done;
 	}
 
-	while ((entry = readdir(dir)) != NULL) {
-		/* RPL sequences are stored in files under iv_indexs */
-		if (entry->d_type == DT_DIR && entry->d_name[0] != '.') {
-			snprintf(rpl_path, len, "%s%s/%s",
-					node_path, rpl_dir, entry->d_name);
-			get_entries(rpl_path, rpl_list);
-		}
+	close(fd);
+
+	if (rename(tmp, snapshot) < 0) {
+		remove(tmp);
+		goto done;
 	}
 
-	l_free(rpl_path);
-	closedir(dir);
+	/* The snapshot now covers everything the journal held */
+	if (ftruncate(journal->fd, 0) < 0)
+		goto done;
 
-	return true;
+	fdatasync(journal->fd);
+	journal->records = 0;
+	result = true;
+
+done:
+	l_free(data.buf);
+
+	if (!result)
+		l_error("Failed to compact RPL in %s", journal->path);
+
+	return result;
 }
 
-void rpl_update(struct mesh_node *node, uint32_t cur)
+static bool append_record(struct rpl_journal *journal, uint8_t op,
+				uint16_t src, uint32_t iv_index, uint32_t seq)
 {
-	uint32_t old = cur - 1;
-	const char *node_path;
-	struct dirent *entry;
-	char path[PATH_MAX];
-	DIR *dir;
+	uint8_t rec[RPL_RECORD_SIZE];
+	unsigned int limit;
 
-	node_path = node_get_storage_dir(node);
-	if (!node_path)
+	build_record(rec, op, src, iv_index, seq);
+
+	if (write(journal->fd, rec, sizeof(rec)) != sizeof(rec))
+		return false;
+
+	journal->records++;
+
+	limit = l_hashmap_size(journal->entries) * RPL_COMPACT_RATIO;
+	if (journal->records >= RPL_COMPACT_MIN && journal->records > limit)
+		return compact(journal);
+
+	return fdatasync(journal->fd) == 0;
+}
+
+bool rpl_put_entry(struct mesh_node *node, uint16_t src, uint32_t iv_index,
+								uint32_t seq)
+{
+	struct rpl_journal *journal;
+	struct rpl_entry *entry;
+	bool covered = false;
+
+	if (!IS_UNICAST(src))
+		return false;
+
+	journal = get_journal(node);
+	if (!journal)
+		return false;
+
+	entry = l_hashmap_lookup(journal->entries, L_UINT_TO_PTR(src));
+	if (entry && entry->rpl.iv_index == iv_index && seq <= entry->mark)
+		covered = true;
+
+	entry = set_entry(journal, src, iv_index, seq);
+
+	if (covered || entry->rpl.seq != seq || entry->rpl.iv_index != iv_index)
+		return true;
+
+	entry->mark = seq + RPL_SEQ_MARGIN;
+	if (entry->mark > SEQ_MASK)
+		entry->mark = SEQ_MASK;
+
+	return append_record(journal, RPL_RECORD_PUT, src, iv_index,
+								entry->mark);
+}
+
+void rpl_del_entry(struct mesh_node *node, uint16_t src)
+{
+	struct rpl_journal *journal;
+	struct rpl_entry *entry;
+
+	if (!IS_UNICAST(src))
 		return;
 
-	if (strlen(node_path) + strlen(rpl_dir) + 15 >= PATH_MAX)
+	journal = get_journal(node);
+	if (!journal)
 		return;
 
-	/* Make sure path exists */
-	snprintf(path, PATH_MAX, "%s%s", node_path, rpl_dir);
-	mkdir(path, 0755);
+	entry = l_hashmap_remove(journal->entries, L_UINT_TO_PTR(src));
+	if (!entry)
+		return;
 
-	dir = opendir(path);
-	if (!dir)
+	l_free(entry);
+	append_record(journal, RPL_RECORD_DEL, src, 0, 0);
+}
+
+static void copy_entry(const void *key, void *value, void *user_data)
+{
+	struct rpl_entry *entry = value;
+	struct l_queue *rpl_list = user_data;
+
+	l_queue_push_head(rpl_list, l_memdup(&entry->rpl,
+						sizeof(entry->rpl)));
+}
+
+bool rpl_get_list(struct mesh_node *node, struct l_queue *rpl_list)
+{
+	struct rpl_journal *journal;
+
+	if (!rpl_list)
+		return false;
+
+	journal = get_journal(node);
+	if (!journal) {
+		l_error("RPL not initialized");
+		return false;
+	}
+
+	l_hashmap_foreach(journal->entries, copy_entry, rpl_list);
+
+	return true;
+}
+
+static bool remove_stale(const void *key, void *value, void *user_data)
+{
+	struct rpl_entry *entry = value;
+	uint32_t cur = L_PTR_TO_UINT(user_data);
+
+	if (entry->rpl.iv_index == cur || entry->rpl.iv_index == cur - 1)
+		return false;
+
+	l_free(entry);
+	return true;
+}
+
+void rpl_update(struct mesh_node *node, uint32_t cur)
+{
+	struct rpl_journal *journal;
+
+	journal = get_journal(node);
+	if (!journal)
 		return;
 
-	/* Cleanup any stale or malformed trees */
-	while ((entry = readdir(dir)) != NULL) {
-		if (entry->d_type == DT_DIR && entry->d_name[0] != '.') {
-			uint32_t val;
-			bool del = false;
-
-			if (strlen(entry->d_name) != 8)
-				del = true;
-			else if (sscanf(entry->d_name, "%08x", &val) != 1)
-				del = true;
-
-			/* Delete all invalid iv_index trees */
-			if (del || (val != cur && val != old)) {
-				snprintf(path, PATH_MAX, "%s%s/%s",
-					node_path, rpl_dir, entry->d_name);
-				del_path(path);
-			}
-		}
+	/* Drop entries of any IV Index other than the current and previous */
+	if (l_hashmap_foreach_remove(journal->entries, remove_stale,
+							L_UINT_TO_PTR(cur)))
+		compact(journal);
+}
+
+static void journal_free(void *data)
+{
+	struct rpl_journal *journal = data;
+
+	if (journal->fd >= 0) {
+		fdatasync(journal->fd);
+		close(journal->fd);
 	}
 
-	closedir(dir);
+	l_hashmap_destroy(journal->entries, l_free);
+	l_free(journal->path);
+	l_free(journal);
 }
 
-bool rpl_init(const char *node_path)
+static bool load_journal(struct rpl_journal *journal)
 {
 	char path[PATH_MAX];
+	bool dirty;
+	int fd;
+
+	snprintf(path, PATH_MAX, "%s/snapshot", journal->path);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		load_records(journal, fd);
+		close(fd);
+	}
+
+	snprintf(path, PATH_MAX, "%s/journal", journal->path);
+	journal->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+							S_IRUSR | S_IWUSR);
+	if (journal->fd < 0)
+		return false;
+
+	journal->records = load_records(journal, journal->fd);
+
+	/* Cut off a torn record so that appends stay aligned */
+	if (ftruncate(journal->fd, journal->records * RPL_RECORD_SIZE) < 0)
+		return false;
+
+	dirty = import_legacy(journal);
+
+	if (dirty || journal->records >= RPL_COMPACT_MIN)
+		return compact(journal);
+
+	return true;
+}
+
+bool rpl_init(struct mesh_node *node)
+{
+	struct rpl_journal *journal;
+	const char *node_path;
+
+	if (get_journal(node))
+		return true;
+
+	node_path = node_get_storage_dir(node);
+	if (!node_path)
+		return false;
 
 	if (strlen(node_path) + strlen(rpl_dir) + 15 >= PATH_MAX)
 		return false;
 
-	snprintf(path, PATH_MAX, "%s%s", node_path, rpl_dir);
-	mkdir(path, 0755);
+	journal = l_new(struct rpl_journal, 1);
+	journal->node = node;
+	journal->path = l_strdup_printf("%s%s", node_path, rpl_dir);
+	journal->entries = l_hashmap_new();
+
+	mkdir(journal->path, 0755);
+
+	if (!load_journal(journal)) {
+		l_error("Failed to open RPL journal in %s", journal->path);
+		journal_free(journal);
+		return false;
+	}
+
+	if (!journals)
+		journals = l_queue_new();
+
+	l_queue_push_tail(journals, journal);
+
 	return true;
 }
+
+static void lower_mark(const void *key, void *value, void *user_data)
+{
+	struct rpl_entry *entry = value;
+
+	entry->mark = entry->rpl.seq;
+}
+
+void rpl_cleanup(struct mesh_node *node)
+{
+	struct rpl_journal *journal;
+
+	journal = l_queue_remove_if(journals, match_node, node);
+	if (!journal)
+		return;
+
+	/*
+	 * Nothing is accepted anymore, store the exact values unless the
+	 * storage went away with the node.
+	 */
+	if (access(journal->path, F_OK) == 0) {
+		l_hashmap_foreach(journal->entries, lower_mark, NULL);
+		compact(journal);
+	}
+
+	journal_free(journal);
+
+	if (l_queue_isempty(journals)) {
+		l_queue_destroy(journals, NULL);
+		journals = NULL;
+	}
+}
@@ -19,4 +19,5 @@ bool rpl_put_entry(struct mesh_node *node, uint16_t src, uint32_t iv_index,
 void rpl_del_entry(struct mesh_node *node, uint16_t src);
 bool rpl_get_list(struct mesh_node *node, struct l_queue *rpl_list);
 void rpl_update(struct mesh_node *node, uint32_t iv_index);
-bool rpl_init(const char *node_path);
+bool rpl_init(struct mesh_node *node);
+void rpl_cleanup(struct mesh_node *node);
@@ -0,0 +1,510 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stddef.h>
+
+#include <ell/ell.h>
+
+#include "mesh/sar.h"
+
+/*
+ * Support for the Segmentation and Reassembly contexts of the lower
+ * transport layer:
+ *
+ * - a table of contexts keyed by peer address and SeqZero. Buckets are
+ *   selected by address only, so the one transfer in progress with a given
+ *   peer is found as cheaply as an exact match.
+ * - a slab of context buffers in a few size classes by segment count, which
+ *   recycles freed buffers instead of returning them to the heap.
+ * - a timer wheel driven by a single l_timeout, so that the segment and
+ *   message timers of all contexts share one timer instead of owning two.
+ */
+
+#define TABLE_MIN_BUCKETS	16
+
+struct table_node {
+	struct table_node *next;
+	void *data;
+	uint16_t addr;
+	uint16_t seq_zero;
+};
+
+struct mesh_sar_table {
+	struct table_node **buckets;
+	struct table_node *free;
+	unsigned int mask;
+	unsigned int count;
+};
+
+static unsigned int bucket_of(const struct mesh_sar_table *table,
+								uint16_t addr)
+{
+	return ((addr * 0x9e37U) >> 8) & table->mask;
+}
+
+static void table_resize(struct mesh_sar_table *table, unsigned int size)
+{
+	struct table_node **old = table->buckets;
+	unsigned int old_size = table->mask + 1;
+	unsigned int i;
+
+	table->buckets = l_new(struct table_node *, size);
+	table->mask = size - 1;
+
+	for (i = 0; i < old_size; i++) {
+		struct table_node *node = old[i];
+
+		while (node) {
+			struct table_node *next = node->next;
+			unsigned int b = bucket_of(table, node->addr);
+
+			node->next = table->buckets[b];
+			table->buckets[b] = node;
+			node = next;
+		}
+	}
+
+	l_free(old);
+}
+
+struct mesh_sar_table *mesh_sar_table_new(void)
+{
+	struct mesh_sar_table *table = l_new(struct mesh_sar_table, 1);
+
+	table->buckets = l_new(struct table_node *, TABLE_MIN_BUCKETS);
+	table->mask = TABLE_MIN_BUCKETS - 1;
+
+	return table;
+}
+
+void mesh_sar_table_free(struct mesh_sar_table *table,
+					l_queue_destroy_func_t destroy)
+{
+	struct table_node *node;
+	unsigned int i;
+
+	if (!table)
+		return;
+
+	for (i = 0; i <= table->mask; i++) {
+		while ((node = table->buckets[i])) {
+			table->buckets[i] = node->next;
+
+			if (destroy)
+				destroy(node->data);
+
+			l_free(node);
+		}
+	}
+
+	while ((node = table->free)) {
+		table->free = node->next;
+		l_free(node);
+	}
+
+	l_free(table->buckets);
+	l_free(table);
+}
+
+unsigned int mesh_sar_table_count(struct mesh_sar_table *table)
+{
+	return table ? table->count : 0;
+}
+
+bool mesh_sar_table_insert(struct mesh_sar_table *table, uint16_t addr,
+					uint16_t seq_zero, void *data)
+{
+	struct table_node *node;
+	unsigned int b;
+
+	if (!table || !data)
+		return false;
+
+	if (mesh_sar_table_lookup(table, addr, seq_zero))
+		return false;
+
+	/* Keep chains short as the number of transfers grows */
+	if (table->count >= 2 * (table->mask + 1))
+		table_resize(table, 2 * (table->mask + 1));
+
+	node = table->free;
+	if (node)
+		table->free = node->next;
+	else
+		node = l_new(struct table_node, 1);
+
+	node->data = data;
+	node->addr = addr;
+	node->seq_zero = seq_zero;
+
+	b = bucket_of(table, addr);
+	node->next = table->buckets[b];
+	table->buckets[b] = node;
+	table->count++;
+
+	return true;
+}
+
+void *mesh_sar_table_lookup(struct mesh_sar_table *table, uint16_t addr,
+							uint16_t seq_zero)
+{
+	struct table_node *node;
+
+	if (!table)
+		return NULL;
+
+	for (node = table->buckets[bucket_of(table, addr)]; node;
+							node = node->next) {
+		if (node->addr == addr && node->seq_zero == seq_zero)
+			return node->data;
+	}
+
+	return NULL;
+}
+
+void *mesh_sar_table_lookup_addr(struct mesh_sar_table *table, uint16_t addr)
+{
+	struct table_node *node;
+
+	if (!table)
+		return NULL;
+
+	for (node = table->buckets[bucket_of(table, addr)]; node;
+							node = node->next) {
+		if (node->addr == addr)
+			return node->data;
+	}
+
+	return NULL;
+}
+
+void *mesh_sar_table_remove(struct mesh_sar_table *table, uint16_t addr,
+							uint16_t seq_zero)
+{
+	struct table_node **link;
+	struct table_node *node;
+	void *data;
+
+	if (!table)
+		return NULL;
+
+	for (link = &table->buckets[bucket_of(table, addr)]; *link;
+						link = &(*link)->next) {
+		node = *link;
+
+		if (node->addr != addr || node->seq_zero != seq_zero)
+			continue;
+
+		*link = node->next;
+		data = node->data;
+
+		node->next = table->free;
+		table->free = node;
+		table->count--;
+
+		return data;
+	}
+
+	return NULL;
+}
+
+void *mesh_sar_table_find(struct mesh_sar_table *table,
+				mesh_sar_match_func_t match, const void *user_data)
+{
+	struct table_node *node;
+	unsigned int i;
+
+	if (!table || !match)
+		return NULL;
+
+	for (i = 0; i <= table->mask; i++) {
+		for (node = table->buckets[i]; node; node = node->next) {
+			if (match(node->data, user_data))
+				return node->data;
+		}
+	}
+
+	return NULL;
+}
+
+/* Buffer classes for 4, 8, 16 and 32 segments of 12 octets */
+static const size_t slab_len[] = { 48, 96, 192, 384 };
+
+#define SLAB_CLASSES	L_ARRAY_SIZE(slab_len)
+#define SLAB_NONE	SLAB_CLASSES
+#define SLAB_MAX_FREE	32
+
+struct slab_obj {
+	struct slab_obj *next;
+	unsigned int cls;
+	uint64_t data[];
+};
+
+struct mesh_sar_slab {
+	size_t hdr_size;
+	struct slab_obj *free[SLAB_CLASSES];
+	unsigned int num_free[SLAB_CLASSES];
+};
+
+struct mesh_sar_slab *mesh_sar_slab_new(size_t hdr_size)
+{
+	struct mesh_sar_slab *slab = l_new(struct mesh_sar_slab, 1);
+
+	slab->hdr_size = hdr_size;
+
+	return slab;
+}
+
+void mesh_sar_slab_free(struct mesh_sar_slab *slab)
+{
+	struct slab_obj *obj;
+	unsigned int i;
+
+	if (!slab)
+		return;
+
+	for (i = 0; i < SLAB_CLASSES; i++) {
+		while ((obj = slab->free[i])) {
+			slab->free[i] = obj->next;
+			l_free(obj);
+		}
+	}
+
+	l_free(slab);
+}
+
+void *mesh_sar_slab_alloc(struct mesh_sar_slab *slab, size_t len)
+{
+	struct slab_obj *obj;
+	unsigned int cls;
+	size_t size;
+
+	for (cls = 0; cls < SLAB_CLASSES; cls++) {
+		if (len <= slab_len[cls])
+			break;
+	}
+
+	size = slab->hdr_size + (cls < SLAB_CLASSES ? slab_len[cls] : len);
+
+	if (cls < SLAB_CLASSES && slab->free[cls]) {
+		obj = slab->free[cls];
+		slab->free[cls] = obj->next;
+		slab->num_free[cls]--;
+	} else
+		obj = l_malloc(sizeof(*obj) + size);
+
+	obj->next = NULL;
+	obj->cls = cls;
+	memset(obj->data, 0, size);
+
+	return obj->data;
+}
+
+void mesh_sar_slab_release(struct mesh_sar_slab *slab, void *data)
+{
+	struct slab_obj *obj;
+
+	if (!data)
+		return;
+
+	obj = (struct slab_obj *) ((uint8_t *) data -
+					offsetof(struct slab_obj, data));
+
+	if (obj->cls == SLAB_NONE ||
+				slab->num_free[obj->cls] >= SLAB_MAX_FREE) {
+		l_free(obj);
+		return;
+	}
+
+	obj->next = slab->free[obj->cls];
+	slab->free[obj->cls] = obj;
+	slab->num_free[obj->cls]++;
+}
+
+#define WHEEL_SLOTS	256
+#define WHEEL_MASK	(WHEEL_SLOTS - 1)
+
+struct mesh_sar_timer {
+	struct mesh_sar_timer *next;
+	struct mesh_sar_timer **pprev;
+	struct mesh_sar_wheel *wheel;
+	uint32_t expires;
+	mesh_sar_timer_func_t func;
+	void *user_data;
+};
+
+struct mesh_sar_wheel {
+	struct l_timeout *timeout;
+	struct mesh_sar_timer *slots[WHEEL_SLOTS];
+	struct mesh_sar_timer *free;
+	unsigned int tick_ms;
+	unsigned int count;
+	uint32_t now;
+	bool armed;
+};
+
+static void timer_link(struct mesh_sar_timer **head,
+						struct mesh_sar_timer *timer)
+{
+	timer->next = *head;
+	timer->pprev = head;
+
+	if (*head)
+		(*head)->pprev = &timer->next;
+
+	*head = timer;
+}
+
+static void timer_unlink(struct mesh_sar_timer *timer)
+{
+	*timer->pprev = timer->next;
+
+	if (timer->next)
+		timer->next->pprev = timer->pprev;
+
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+static void timer_release(struct mesh_sar_timer *timer)
+{
+	struct mesh_sar_wheel *wheel = timer->wheel;
+
+	timer->func = NULL;
+	timer->next = wheel->free;
+	wheel->free = timer;
+	wheel->count--;
+}
+
+static void wheel_tick(struct l_timeout *timeout, void *user_data)
+{
+	struct mesh_sar_wheel *wheel = user_data;
+	struct mesh_sar_timer *expired = NULL;
+	struct mesh_sar_timer *timer, *next;
+
+	wheel->now++;
+
+	/*
+	 * Move everything due to a private list before calling out, since
+	 * the callbacks are free to add or remove any timer.
+	 */
+	for (timer = wheel->slots[wheel->now & WHEEL_MASK]; timer;
+								timer = next) {
+		next = timer->next;
+
+		if ((int32_t) (timer->expires - wheel->now) > 0)
+			continue;
+
+		timer_unlink(timer);
+		timer_link(&expired, timer);
+	}
+
+	while ((timer = expired)) {
+		mesh_sar_timer_func_t func = timer->func;
+		void *data = timer->user_data;
+
+		timer_unlink(timer);
+		timer_release(timer);
+		func(data);
+	}
+
+	if (wheel->count)
+		l_timeout_modify_ms(wheel->timeout, wheel->tick_ms);
+	else
+		wheel->armed = false;
+}
+
+struct mesh_sar_wheel *mesh_sar_wheel_new(unsigned int tick_ms)
+{
+	struct mesh_sar_wheel *wheel = l_new(struct mesh_sar_wheel, 1);
+
+	wheel->tick_ms = tick_ms ? tick_ms : 1;
+
+	return wheel;
+}
+
+void mesh_sar_wheel_free(struct mesh_sar_wheel *wheel)
+{
+	struct mesh_sar_timer *timer;
+	unsigned int i;
+
+	if (!wheel)
+		return;
+
+	l_timeout_remove(wheel->timeout);
+
+	for (i = 0; i < WHEEL_SLOTS; i++) {
+		while ((timer = wheel->slots[i])) {
+			timer_unlink(timer);
+			l_free(timer);
+		}
+	}
+
+	while ((timer = wheel->free)) {
+		wheel->free = timer->next;
+		l_free(timer);
+	}
+
+	l_free(wheel);
+}
+
+unsigned int mesh_sar_wheel_count(struct mesh_sar_wheel *wheel)
+{
+	return wheel ? wheel->count : 0;
+}
+
+struct mesh_sar_timer *mesh_sar_timer_add(struct mesh_sar_wheel *wheel,
+					unsigned int ms,
+					mesh_sar_timer_func_t func,
+					void *user_data)
+{
+	struct mesh_sar_timer *timer;
+	uint32_t ticks;
+
+	if (!wheel || !func)
+		return NULL;
+
+	timer = wheel->free;
+	if (timer)
+		wheel->free = timer->next;
+	else
+		timer = l_new(struct mesh_sar_timer, 1);
+
+	/* Round up, and one more for the partial tick already running */
+	ticks = (ms + wheel->tick_ms - 1) / wheel->tick_ms + 1;
+
+	timer->wheel = wheel;
+	timer->expires = wheel->now + ticks;
+	timer->func = func;
+	timer->user_data = user_data;
+	timer_link(&wheel->slots[timer->expires & WHEEL_MASK], timer);
+	wheel->count++;
+
+	if (!wheel->timeout)
+		wheel->timeout = l_timeout_create_ms(wheel->tick_ms,
+						wheel_tick, wheel, NULL);
+	else if (!wheel->armed)
+		l_timeout_modify_ms(wheel->timeout, wheel->tick_ms);
+
+	wheel->armed = true;
+
+	return timer;
+}
+
+void mesh_sar_timer_remove(struct mesh_sar_timer *timer)
+{
+	if (!timer || !timer->func)
+		return;
+
+	timer_unlink(timer);
+	timer_release(timer);
+}
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+struct mesh_sar_table;
+struct mesh_sar_slab;
+struct mesh_sar_wheel;
+struct mesh_sar_timer;
+
+typedef bool (*mesh_sar_match_func_t)(const void *data, const void *user_data);
+typedef void (*mesh_sar_timer_func_t)(void *user_data);
+
+struct mesh_sar_table *mesh_sar_table_new(void);
+void mesh_sar_table_free(struct mesh_sar_table *table,
+					l_queue_destroy_func_t destroy);
+unsigned int mesh_sar_table_count(struct mesh_sar_table *table);
+bool mesh_sar_table_insert(struct mesh_sar_table *table, uint16_t addr,
+					uint16_t seq_zero, void *data);
+void *mesh_sar_table_lookup(struct mesh_sar_table *table, uint16_t addr,
+							uint16_t seq_zero);
+void *mesh_sar_table_lookup_addr(struct mesh_sar_table *table,
+							uint16_t addr);
+void *mesh_sar_table_remove(struct mesh_sar_table *table, uint16_t addr,
+							uint16_t seq_zero);
+void *mesh_sar_table_find(struct mesh_sar_table *table,
+				mesh_sar_match_func_t match, const void *user_data);
+
+struct mesh_sar_slab *mesh_sar_slab_new(size_t hdr_size);
+void mesh_sar_slab_free(struct mesh_sar_slab *slab);
+void *mesh_sar_slab_alloc(struct mesh_sar_slab *slab, size_t len);
+void mesh_sar_slab_release(struct mesh_sar_slab *slab, void *data);
+
+struct mesh_sar_wheel *mesh_sar_wheel_new(unsigned int tick_ms);
+void mesh_sar_wheel_free(struct mesh_sar_wheel *wheel);
+unsigned int mesh_sar_wheel_count(struct mesh_sar_wheel *wheel);
+struct mesh_sar_timer *mesh_sar_timer_add(struct mesh_sar_wheel *wheel,
+					unsigned int ms,
+					mesh_sar_timer_func_t func,
+					void *user_data);
+void mesh_sar_timer_remove(struct mesh_sar_timer *timer);
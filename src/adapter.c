@@ -23,7 +23,6 @@
 #include <sys/ioctl.h>
 #include <sys/file.h>
 #include <sys/stat.h>
-#include <dirent.h>
 
 #include <glib.h>
 #include <dbus/dbus.h>
@@ -85,6 +84,9 @@
 #define HCI_RSSI_INVALID	127
 #define DISTANCE_VAL_INVALID	0x7FFF
 #define PATHLOSS_MAX		137
+#define UPDATE_INTERVAL_INVALID	0xFFFF
+#define UPDATE_INTERVAL_MAX	60000
+#define RSSI_DELTA_MAX		127
 
 /*
  * These are known security keys that have been compromised.
@@ -165,6 +167,8 @@ struct discovery_filter {
 	GSList *uuids;
 	bool duplicate;
 	bool discoverable;
+	uint16_t update_interval;
+	uint16_t rssi_delta;
 };
 
 struct discovery_client {
@@ -502,10 +506,8 @@ static void store_adapter_info(struct btd_adapter *adapter)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/settings",
 					btd_adapter_get_storage_dir(adapter));
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_save(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -2463,6 +2465,32 @@ static bool parse_pattern(DBusMessageIter *value,
 	return true;
 }
 
+static bool parse_update_interval(DBusMessageIter *value,
+					struct discovery_filter *filter)
+{
+	if (dbus_message_iter_get_arg_type(value) != DBUS_TYPE_UINT16)
+		return false;
+
+	dbus_message_iter_get_basic(value, &filter->update_interval);
+	if (filter->update_interval > UPDATE_INTERVAL_MAX)
+		return false;
+
+	return true;
+}
+
+static bool parse_rssi_delta(DBusMessageIter *value,
+					struct discovery_filter *filter)
+{
+	if (dbus_message_iter_get_arg_type(value) != DBUS_TYPE_UINT16)
+		return false;
+
+	dbus_message_iter_get_basic(value, &filter->rssi_delta);
+	if (filter->rssi_delta > RSSI_DELTA_MAX)
+		return false;
+
+	return true;
+}
+
 struct filter_parser {
 	const char *name;
 	bool (*func)(DBusMessageIter *iter, struct discovery_filter *filter);
@@ -2474,6 +2502,8 @@ struct filter_parser {
 	{ "DuplicateData", parse_duplicate_data },
 	{ "Discoverable", parse_discoverable },
 	{ "Pattern", parse_pattern },
+	{ "UpdateInterval", parse_update_interval },
+	{ "RSSIDelta", parse_rssi_delta },
 	{ }
 };
 
@@ -2515,6 +2545,8 @@ static bool parse_discovery_filter_dict(struct btd_adapter *adapter,
 	(*filter)->duplicate = false;
 	(*filter)->discoverable = false;
 	(*filter)->pattern = NULL;
+	(*filter)->update_interval = UPDATE_INTERVAL_INVALID;
+	(*filter)->rssi_delta = 0;
 
 	dbus_message_iter_init(msg, &iter);
 	if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY ||
@@ -2559,12 +2591,23 @@ static bool parse_discovery_filter_dict(struct btd_adapter *adapter,
 	    (*filter)->rssi != DISTANCE_VAL_INVALID)
 		goto invalid_args;
 
+	/*
+	 * Clients asking for duplicate data want to see every report unless
+	 * they explicitly limit the update rate, everybody else gets the
+	 * configured default so that it only gets lowered on request.
+	 */
+	if ((*filter)->update_interval == UPDATE_INTERVAL_INVALID)
+		(*filter)->update_interval = (*filter)->duplicate ? 0 :
+						btd_opts.update_interval;
+
 	DBG("filtered discovery params: transport: %d rssi: %d pathloss: %d "
-		" duplicate data: %s discoverable %s pattern %s",
+		" duplicate data: %s discoverable %s pattern %s "
+		"update interval %u rssi delta %u",
 		(*filter)->type, (*filter)->rssi, (*filter)->pathloss,
 		(*filter)->duplicate ? "true" : "false",
 		(*filter)->discoverable ? "true" : "false",
-		(*filter)->pattern);
+		(*filter)->pattern, (*filter)->update_interval,
+		(*filter)->rssi_delta);
 
 	return true;
 
@@ -3760,7 +3803,7 @@ static int generate_and_write_irk(uint8_t *irk, GKeyFile *key_file,
 	g_key_file_set_string(key_file, "General", "IdentityResolvingKey",
 								str_irk_out);
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_save(filename, str, length);
 	g_free(str);
 	DBG("Generated IRK written to file");
 	return 0;
@@ -3777,7 +3820,7 @@ static int load_irk(struct btd_adapter *adapter, uint8_t *irk)
 					btd_adapter_get_storage_dir(adapter));
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	str_irk = g_key_file_get_string(key_file, "General",
 						"IdentityResolvingKey", NULL);
@@ -4447,21 +4490,15 @@ static void load_devices(struct btd_adapter *adapter)
 	GSList *irks = NULL;
 	GSList *params = NULL;
 	GSList *added_devices = NULL;
-	DIR *dir;
-	struct dirent *entry;
+	GSList *names, *l;
 
 	snprintf(dirname, PATH_MAX, STORAGEDIR "/%s",
 					btd_adapter_get_storage_dir(adapter));
 
-	dir = opendir(dirname);
-	if (!dir) {
-		btd_error(adapter->dev_id,
-				"Unable to open adapter storage directory: %s",
-								dirname);
-		return;
-	}
+	names = btd_storage_list_dirs(dirname);
 
-	while ((entry = readdir(dir)) != NULL) {
+	for (l = names; l; l = g_slist_next(l)) {
+		const char *name = l->data;
 		struct btd_device *device;
 		char filename[PATH_MAX];
 		GKeyFile *key_file;
@@ -4473,29 +4510,26 @@ static void load_devices(struct btd_adapter *adapter)
 		struct conn_param *param;
 		uint8_t bdaddr_type;
 
-		if (entry->d_type == DT_UNKNOWN)
-			entry->d_type = util_get_dt(dirname, entry->d_name);
-
-		if (entry->d_type != DT_DIR || bachk(entry->d_name) < 0)
+		if (bachk(name) < 0)
 			continue;
 
 		snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 					btd_adapter_get_storage_dir(adapter),
-					entry->d_name);
+					name);
 
 		key_file = g_key_file_new();
-		g_key_file_load_from_file(key_file, filename, 0, NULL);
+		btd_storage_load(key_file, filename);
 
-		key_info = get_key_info(key_file, entry->d_name);
+		key_info = get_key_info(key_file, name);
 
 		bdaddr_type = get_le_addr_type(key_file);
 
-		ltk_info = get_ltk_info(key_file, entry->d_name, bdaddr_type);
+		ltk_info = get_ltk_info(key_file, name, bdaddr_type);
 
-		slave_ltk_info = get_slave_ltk_info(key_file, entry->d_name,
+		slave_ltk_info = get_slave_ltk_info(key_file, name,
 								bdaddr_type);
 
-		irk_info = get_irk_info(key_file, entry->d_name, bdaddr_type);
+		irk_info = get_irk_info(key_file, name, bdaddr_type);
 
 		// If any key for the device is blocked, we discard all.
 		if ((key_info && key_info->is_blocked) ||
@@ -4539,19 +4573,18 @@ static void load_devices(struct btd_adapter *adapter)
 		if (irk_info)
 			irks = g_slist_append(irks, irk_info);
 
-		param = get_conn_param(key_file, entry->d_name, bdaddr_type);
+		param = get_conn_param(key_file, name, bdaddr_type);
 		if (param)
 			params = g_slist_append(params, param);
 
-		list = g_slist_find_custom(adapter->devices, entry->d_name,
+		list = g_slist_find_custom(adapter->devices, name,
 							device_address_cmp);
 		if (list) {
 			device = list->data;
 			goto device_exist;
 		}
 
-		device = device_create_from_storage(adapter, entry->d_name,
-							key_file);
+		device = device_create_from_storage(adapter, name, key_file);
 		if (!device)
 			goto free;
 
@@ -4584,7 +4617,7 @@ free:
 		g_key_file_free(key_file);
 	}
 
-	closedir(dir);
+	g_slist_free_full(names, g_free);
 
 	load_link_keys(adapter, keys, btd_opts.debug_keys);
 	g_slist_free_full(keys, g_free);
@@ -5427,14 +5460,13 @@ static void convert_names_entry(char *key, char *value, void *user_data)
 		return;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", address, str);
-	create_file(filename, S_IRUSR | S_IWUSR);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 	g_key_file_set_string(key_file, "General", "Name", value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
+	btd_storage_save(filename, data, length);
 	g_free(data);
 
 	g_key_file_free(key_file);
@@ -5655,17 +5687,15 @@ static void convert_entry(char *key, char *value, void *user_data)
 			converter->address, key);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	set_device_type(key_file, type);
 
 	converter->cb(key_file, value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_save(filename, data, length);
 
 	g_free(data);
 
@@ -5752,16 +5782,14 @@ static void store_sdp_record(char *local, char *peer, int handle, char *value)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	sprintf(handle_str, "0x%8.8X", handle);
 	g_key_file_set_string(key_file, "ServiceRecords", handle_str, value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_save(filename, data, length);
 
 	g_free(data);
 
@@ -5827,15 +5855,13 @@ static void convert_sdp_entry(char *key, char *value, void *user_data)
 								dst_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	store_attribute_uuid(key_file, start, end, prim_uuid, uuid);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_save(filename, data, length);
 
 	g_free(data);
 	g_key_file_free(key_file);
@@ -5878,7 +5904,7 @@ static void convert_primaries_entry(char *key, char *value, void *user_data)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/attributes", address,
 									key);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	for (service = services; *service; service++) {
 		ret = sscanf(*service, "%04hX#%04hX#%s", &start, &end,
@@ -5898,8 +5924,7 @@ static void convert_primaries_entry(char *key, char *value, void *user_data)
 	if (length == 0)
 		goto end;
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-	g_file_set_contents(filename, data, length, NULL);
+	btd_storage_save(filename, data, length);
 
 	if (device_type < 0)
 		goto end;
@@ -5910,14 +5935,12 @@ static void convert_primaries_entry(char *key, char *value, void *user_data)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", address, key);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 	set_device_type(key_file, device_type);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_save(filename, data, length);
 
 end:
 	g_free(data);
@@ -5957,16 +5980,14 @@ static void convert_ccc_entry(char *key, char *value, void *user_data)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/ccc", src_addr,
 								dst_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	sprintf(group, "%hu", handle);
 	g_key_file_set_string(key_file, group, "Value", value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_save(filename, data, length);
 
 	g_free(data);
 	g_key_file_free(key_file);
@@ -6004,16 +6025,14 @@ static void convert_gatt_entry(char *key, char *value, void *user_data)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/gatt", src_addr,
 								dst_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	sprintf(group, "%hu", handle);
 	g_key_file_set_string(key_file, group, "Value", value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_save(filename, data, length);
 
 	g_free(data);
 	g_key_file_free(key_file);
@@ -6050,15 +6069,13 @@ static void convert_proximity_entry(char *key, char *value, void *user_data)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/proximity", src_addr,
 									key);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	g_key_file_set_string(key_file, alert, "Level", value);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_save(filename, data, length);
 
 	g_free(data);
 	g_key_file_free(key_file);
@@ -6154,10 +6171,8 @@ static void convert_config(struct btd_adapter *adapter, const char *filename,
 	if (read_local_name(&adapter->bdaddr, str) == 0)
 		g_key_file_set_string(key_file, "General", "Alias", str);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
+	btd_storage_save(filename, data, length);
 	g_free(data);
 }
 
@@ -6228,7 +6243,6 @@ static void load_config(struct btd_adapter *adapter)
 {
 	GKeyFile *key_file;
 	char filename[PATH_MAX];
-	struct stat st;
 	GError *gerr = NULL;
 
 	key_file = g_key_file_new();
@@ -6236,12 +6250,12 @@ static void load_config(struct btd_adapter *adapter)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/settings",
 					btd_adapter_get_storage_dir(adapter));
 
-	if (stat(filename, &st) < 0) {
+	if (!btd_storage_exists(filename)) {
 		convert_config(adapter, filename, key_file);
 		convert_device_storage(adapter);
 	}
 
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	/* Get alias */
 	adapter->stored_alias = g_key_file_get_string(key_file, "General",
@@ -6556,6 +6570,32 @@ static void filter_duplicate_data(void *data, void *user_data)
 	*duplicate = client->discovery_filter->duplicate;
 }
 
+struct update_limits {
+	uint16_t interval;
+	uint8_t rssi_delta;
+};
+
+/*
+ * Discovery clients are merged as a logical OR, so the client asking for the
+ * most frequent updates determines the limits applied to all of them.
+ */
+static void merge_update_limits(void *data, void *user_data)
+{
+	struct discovery_client *client = data;
+	struct discovery_filter *filter = client->discovery_filter;
+	struct update_limits *limits = user_data;
+	uint16_t interval = btd_opts.update_interval;
+	uint8_t rssi_delta = btd_opts.rssi_delta;
+
+	if (filter) {
+		interval = filter->update_interval;
+		rssi_delta = filter->rssi_delta;
+	}
+
+	limits->interval = MIN(limits->interval, interval);
+	limits->rssi_delta = MIN(limits->rssi_delta, rssi_delta);
+}
+
 static bool device_is_discoverable(struct btd_adapter *adapter,
 					struct eir_data *eir, const char *addr,
 					uint8_t bdaddr_type)
@@ -6615,6 +6655,7 @@ static void update_found_devices(struct btd_adapter *adapter,
 	bool name_known, discoverable;
 	char addr[18];
 	bool duplicate = false;
+	struct update_limits limits;
 	struct queue *matched_monitors = NULL;
 
 	if (bdaddr_type != BDADDR_BREDR)
@@ -6699,10 +6740,12 @@ static void update_found_devices(struct btd_adapter *adapter,
 
 	device_set_legacy(dev, legacy);
 
-	if (adapter->filtered_discovery)
-		device_set_rssi_with_delta(dev, rssi, 0);
-	else
-		device_set_rssi(dev, rssi);
+	limits.interval = btd_opts.update_interval;
+	limits.rssi_delta = btd_opts.rssi_delta;
+	g_slist_foreach(adapter->discovery_list, merge_update_limits, &limits);
+
+	device_set_update_interval(dev, limits.interval);
+	device_set_rssi_with_delta(dev, rssi, limits.rssi_delta);
 
 	if (eir_data.tx_power != 127)
 		device_set_tx_power(dev, eir_data.tx_power);
@@ -7952,7 +7995,7 @@ static void store_link_key(struct btd_adapter *adapter,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", key[i]);
@@ -7962,10 +8005,8 @@ static void store_link_key(struct btd_adapter *adapter,
 	g_key_file_set_integer(key_file, "LinkKey", "Type", type);
 	g_key_file_set_integer(key_file, "LinkKey", "PINLength", pin_length);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_save(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -8042,7 +8083,7 @@ static void store_longtermkey(struct btd_adapter *adapter, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	/* Old files may contain this so remove it in case it exists */
 	g_key_file_remove_key(key_file, "LongTermKey", "Master", NULL);
@@ -8059,10 +8100,8 @@ static void store_longtermkey(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, group, "EDiv", ediv);
 	g_key_file_set_uint64(key_file, group, "Rand", rand);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_save(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -8174,7 +8213,7 @@ static void store_csrk(struct btd_adapter *adapter, const bdaddr_t *peer,
 			btd_adapter_get_storage_dir(adapter), device_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", key[i]);
@@ -8183,10 +8222,8 @@ static void store_csrk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, group, "Counter", counter);
 	g_key_file_set_boolean(key_file, group, "Authenticated", auth);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_save(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -8244,17 +8281,15 @@ static void store_irk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(str + (i * 2), "%2.2X", key[i]);
 
 	g_key_file_set_string(key_file, "IdentityResolvingKey", "Key", str);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	store_data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, store_data, length, NULL);
+	btd_storage_save(filename, store_data, length);
 	g_free(store_data);
 
 	g_key_file_free(key_file);
@@ -8332,7 +8367,7 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	g_key_file_set_integer(key_file, "ConnectionParameters",
 						"MinInterval", min_interval);
@@ -8343,10 +8378,8 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, "ConnectionParameters",
 						"Timeout", timeout);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	store_data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, store_data, length, NULL);
+	btd_storage_save(filename, store_data, length);
 	g_free(store_data);
 
 	g_key_file_free(key_file);
@@ -8982,7 +9015,7 @@ static void remove_keys(struct btd_adapter *adapter,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 			btd_adapter_get_storage_dir(adapter), device_addr);
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	if (type == BDADDR_BREDR) {
 		g_key_file_remove_group(key_file, "LinkKey", NULL);
@@ -8994,7 +9027,7 @@ static void remove_keys(struct btd_adapter *adapter,
 	}
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_save(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -9128,7 +9161,7 @@ static bool get_static_addr(struct btd_adapter *adapter)
 						(const char **)addrs, len);
 
 	str = g_key_file_to_data(file, &len, NULL);
-	g_file_set_contents(STORAGEDIR "/addresses", str, len, NULL);
+	btd_storage_save(STORAGEDIR "/addresses", str, len);
 	g_free(str);
 
 	ret = true;
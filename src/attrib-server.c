@@ -764,7 +764,7 @@ static int read_device_ccc(struct btd_device *device, uint16_t handle,
 	}
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	sprintf(group, "%hu", handle);
 
@@ -911,17 +911,15 @@ static uint16_t write_value(struct gatt_channel *channel, uint16_t handle,
 		}
 
 		key_file = g_key_file_new();
-		g_key_file_load_from_file(key_file, filename, 0, NULL);
+		btd_storage_load(key_file, filename);
 
 		sprintf(group, "%hu", handle);
 		sprintf(value, "%hX", cccval);
 		g_key_file_set_string(key_file, group, "Value", value);
 
 		data = g_key_file_to_data(key_file, &length, NULL);
-		if (length > 0) {
-			create_file(filename, S_IRUSR | S_IWUSR);
-			g_file_set_contents(filename, data, length, NULL);
-		}
+		if (length > 0)
+			btd_storage_save(filename, data, length);
 
 		g_free(data);
 		g_free(filename);
@@ -1175,7 +1173,7 @@ guint attrib_channel_attach(GAttrib *attrib)
 
 		filename = btd_device_get_storage_path(device, "ccc");
 		if (filename) {
-			unlink(filename);
+			btd_storage_remove(filename);
 			g_free(filename);
 		}
 	}
@@ -22,6 +22,17 @@ typedef enum {
 	BT_GATT_CACHE_NO,
 } bt_gatt_cache_t;
 
+typedef enum {
+	BT_GATT_NFY_BATCH_OFF,
+	BT_GATT_NFY_BATCH_ON,
+	BT_GATT_NFY_BATCH_ADAPTIVE,
+} bt_gatt_nfy_batch_t;
+
+typedef enum {
+	BT_STORAGE_FILES,
+	BT_STORAGE_LOG,
+} bt_storage_t;
+
 enum jw_repairing_t {
 	JW_REPAIRING_NEVER,
 	JW_REPAIRING_CONFIRM,
@@ -96,6 +107,8 @@ struct btd_opts {
 	uint32_t	pairto;
 	uint32_t	discovto;
 	uint32_t	tmpto;
+	uint16_t	update_interval;
+	uint8_t		rssi_delta;
 	uint8_t		privacy;
 
 	struct btd_defaults defaults;
@@ -115,6 +128,8 @@ struct btd_opts {
 	bt_gatt_cache_t gatt_cache;
 	uint16_t	gatt_mtu;
 	uint8_t		gatt_channels;
+	bt_gatt_nfy_batch_t gatt_nfy_batch;
+	uint16_t	gatt_nfy_latency;
 	enum mps_mode_t	mps;
 
 	struct btd_avdtp_opts avdtp;
@@ -122,6 +137,8 @@ struct btd_opts {
 	uint8_t		key_size;
 
 	enum jw_repairing_t jw_repairing;
+
+	bt_storage_t	storage;
 };
 
 extern struct btd_opts btd_opts;
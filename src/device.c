@@ -20,7 +20,6 @@
 #include <fcntl.h>
 #include <stdbool.h>
 #include <errno.h>
-#include <dirent.h>
 #include <time.h>
 
 #include <glib.h>
@@ -38,6 +37,7 @@
 #include "src/shared/att.h"
 #include "src/shared/queue.h"
 #include "src/shared/gatt-db.h"
+#include "src/shared/gatt-cache.h"
 #include "src/shared/gatt-client.h"
 #include "src/shared/gatt-server.h"
 #include "src/shared/ad.h"
@@ -71,8 +71,6 @@
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
-#define RSSI_THRESHOLD		8
-
 #define GATT_PRIM_SVC_UUID_STR "2800"
 #define GATT_SND_SVC_UUID_STR  "2801"
 #define GATT_INCLUDE_UUID_STR "2802"
@@ -164,6 +162,30 @@ struct csrk_info {
 	uint32_t counter;
 };
 
+/* Properties updated from advertising reports which are rate limited */
+enum {
+	PROP_RSSI,
+	PROP_TX_POWER,
+	PROP_MANUFACTURER_DATA,
+	PROP_SERVICE_DATA,
+	PROP_ADVERTISING_DATA,
+	PROP_LIMITED_MAX
+};
+
+static const char *limited_props[PROP_LIMITED_MAX] = {
+	"RSSI",
+	"TxPower",
+	"ManufacturerData",
+	"ServiceData",
+	"AdvertisingData",
+};
+
+struct prop_limit {
+	struct btd_device *dev;
+	gint64 last;				/* Last emission (ms) */
+	guint timer;				/* Pending emission */
+};
+
 enum {
 	WAKE_FLAG_DEFAULT = 0,
 	WAKE_FLAG_ENABLED,
@@ -268,6 +290,8 @@ struct btd_device {
 	bool		legacy;
 	int8_t		rssi;
 	int8_t		tx_power;
+	uint16_t	update_interval;	/* Property rate limit (ms) */
+	struct prop_limit limits[PROP_LIMITED_MAX];
 
 	GIOChannel	*att_io;
 	guint		store_id;
@@ -393,7 +417,7 @@ static gboolean store_device_info_cb(gpointer user_data)
 				device_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	g_key_file_set_string(key_file, "General", "Name", device->name);
 
@@ -463,10 +487,8 @@ static gboolean store_device_info_cb(gpointer user_data)
 	if (device->remote_csrk)
 		store_csrk(device->remote_csrk, key_file, "RemoteSignatureKey");
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_save(filename, str, length);
 	g_free(str);
 
 	g_key_file_free(key_file);
@@ -522,10 +544,9 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 	ba2str(&dev->bdaddr, d_addr);
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
 			btd_adapter_get_storage_dir(dev->adapter), d_addr);
-	create_file(filename, S_IRUSR | S_IWUSR);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 	data_old = g_key_file_to_data(key_file, &length_old, NULL);
 
 	g_key_file_set_string(key_file, "General", "Name", name);
@@ -533,7 +554,7 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 	data = g_key_file_to_data(key_file, &length, NULL);
 
 	if ((length != length_old) || (memcmp(data, data_old, length)))
-		g_file_set_contents(filename, data, length, NULL);
+		btd_storage_save(filename, data, length);
 
 	g_free(data);
 	g_free(data_old);
@@ -669,6 +690,7 @@ static void svc_dev_remove(gpointer user_data)
 static void device_free(gpointer user_data)
 {
 	struct btd_device *device = user_data;
+	int i;
 
 	btd_gatt_client_destroy(device->client_dbus);
 	device->client_dbus = NULL;
@@ -699,6 +721,11 @@ static void device_free(gpointer user_data)
 	if (device->temporary_timer)
 		g_source_remove(device->temporary_timer);
 
+	for (i = 0; i < PROP_LIMITED_MAX; i++) {
+		if (device->limits[i].timer)
+			g_source_remove(device->limits[i].timer);
+	}
+
 	if (device->connect)
 		dbus_message_unref(device->connect);
 
@@ -1831,74 +1858,151 @@ void device_add_eir_uuids(struct btd_device *dev, GSList *uuids)
 						DEVICE_INTERFACE, "UUIDs");
 }
 
-static void add_manufacturer_data(void *data, void *user_data)
+static gboolean limited_prop_timeout(gpointer user_data)
 {
-	struct eir_msd *msd = data;
-	struct btd_device *dev = user_data;
+	struct prop_limit *limit = user_data;
+	struct btd_device *dev = limit->dev;
 
-	if (!bt_ad_add_manufacturer_data(dev->ad, msd->company, msd->data,
-								msd->data_len))
+	limit->timer = 0;
+	limit->last = g_get_monotonic_time() / 1000;
+
+	g_dbus_emit_property_changed(dbus_conn, dev->path, DEVICE_INTERFACE,
+					limited_props[limit - dev->limits]);
+
+	return FALSE;
+}
+
+/*
+ * Emit PropertiesChanged for a property updated from advertising reports at
+ * most once per update_interval. Changes arriving in between are coalesced
+ * into a single emission at the end of the interval which then carries the
+ * latest value.
+ */
+static void emit_limited_prop(struct btd_device *dev, int prop)
+{
+	struct prop_limit *limit = &dev->limits[prop];
+	gint64 now, elapsed;
+
+	if (limit->timer)
 		return;
 
-	g_dbus_emit_property_changed(dbus_conn, dev->path,
-					DEVICE_INTERFACE, "ManufacturerData");
+	now = g_get_monotonic_time() / 1000;
+	elapsed = now - limit->last;
+
+	if (elapsed >= dev->update_interval) {
+		limit->last = now;
+		g_dbus_emit_property_changed(dbus_conn, dev->path,
+					DEVICE_INTERFACE, limited_props[prop]);
+		return;
+	}
+
+	limit->dev = dev;
+	limit->timer = g_timeout_add(dev->update_interval - elapsed,
+						limited_prop_timeout, limit);
+}
+
+/* Emit right away, e.g. when a value is invalidated */
+static void flush_limited_prop(struct btd_device *dev, int prop)
+{
+	struct prop_limit *limit = &dev->limits[prop];
+
+	if (limit->timer) {
+		g_source_remove(limit->timer);
+		limit->timer = 0;
+	}
+
+	limit->last = g_get_monotonic_time() / 1000;
+
+	g_dbus_emit_property_changed(dbus_conn, dev->path, DEVICE_INTERFACE,
+							limited_props[prop]);
+}
+
+void device_set_update_interval(struct btd_device *dev, uint16_t interval)
+{
+	dev->update_interval = interval;
+}
+
+struct ad_update {
+	struct btd_device *dev;
+	bool changed;
+};
+
+static void add_manufacturer_data(void *data, void *user_data)
+{
+	struct eir_msd *msd = data;
+	struct ad_update *update = user_data;
+
+	if (bt_ad_add_manufacturer_data(update->dev->ad, msd->company,
+						msd->data, msd->data_len))
+		update->changed = true;
 }
 
 void device_set_manufacturer_data(struct btd_device *dev, GSList *list,
 								bool duplicate)
 {
+	struct ad_update update = { .dev = dev, .changed = false };
+
 	if (duplicate)
 		bt_ad_clear_manufacturer_data(dev->ad);
 
-	g_slist_foreach(list, add_manufacturer_data, dev);
+	g_slist_foreach(list, add_manufacturer_data, &update);
+
+	if (update.changed)
+		emit_limited_prop(dev, PROP_MANUFACTURER_DATA);
 }
 
 static void add_service_data(void *data, void *user_data)
 {
 	struct eir_sd *sd = data;
-	struct btd_device *dev = user_data;
+	struct ad_update *update = user_data;
 	bt_uuid_t uuid;
 
 	if (bt_string_to_uuid(&uuid, sd->uuid) < 0)
 		return;
 
-	if (!bt_ad_add_service_data(dev->ad, &uuid, sd->data, sd->data_len))
-		return;
-
-	g_dbus_emit_property_changed(dbus_conn, dev->path,
-					DEVICE_INTERFACE, "ServiceData");
+	if (bt_ad_add_service_data(update->dev->ad, &uuid, sd->data,
+								sd->data_len))
+		update->changed = true;
 }
 
 void device_set_service_data(struct btd_device *dev, GSList *list,
 							bool duplicate)
 {
+	struct ad_update update = { .dev = dev, .changed = false };
+
 	if (duplicate)
 		bt_ad_clear_service_data(dev->ad);
 
-	g_slist_foreach(list, add_service_data, dev);
+	g_slist_foreach(list, add_service_data, &update);
+
+	if (update.changed)
+		emit_limited_prop(dev, PROP_SERVICE_DATA);
 }
 
 static void add_data(void *data, void *user_data)
 {
 	struct eir_ad *ad = data;
-	struct btd_device *dev = user_data;
+	struct ad_update *update = user_data;
 
-	if (!bt_ad_add_data(dev->ad, ad->type, ad->data, ad->len))
+	if (!bt_ad_add_data(update->dev->ad, ad->type, ad->data, ad->len))
 		return;
 
 	if (ad->type == EIR_TRANSPORT_DISCOVERY)
-		g_dbus_emit_property_changed(dbus_conn, dev->path,
-						DEVICE_INTERFACE,
-						"AdvertisingData");
+		update->changed = true;
 }
 
 void device_set_data(struct btd_device *dev, GSList *list,
 							bool duplicate)
 {
+	struct ad_update update = { .dev = dev, .changed = false };
+
 	if (duplicate)
 		bt_ad_clear_data(dev->ad);
 
-	g_slist_foreach(list, add_data, dev);
+	g_slist_foreach(list, add_data, &update);
+
+	if (update.changed)
+		emit_limited_prop(dev, PROP_ADVERTISING_DATA);
 }
 
 static struct btd_service *find_connectable_service(struct btd_device *dev,
@@ -2289,180 +2393,63 @@ static void store_services(struct btd_device *device)
 	}
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_save(filename, data, length);
 
 	free(prim_uuid);
 	g_free(data);
 	g_key_file_free(key_file);
 }
 
-struct gatt_saver {
-	struct btd_device *device;
-	uint16_t ext_props;
-	GKeyFile *key_file;
-};
-
-static void db_hash_read_value_cb(struct gatt_db_attribute *attrib,
-						int err, const uint8_t *value,
-						size_t length, void *user_data)
-{
-	const uint8_t **hash = user_data;
-
-	if (err || (length != 16))
-		return;
-
-	*hash = value;
-}
-
-static void store_desc(struct gatt_db_attribute *attr, void *user_data)
+static void gatt_cache_filename(struct btd_device *device, char *filename,
+								size_t size)
 {
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	const bt_uuid_t *uuid;
-	bt_uuid_t ext_uuid;
-	uint16_t handle_num;
-
-	handle_num = gatt_db_attribute_get_handle(attr);
-	sprintf(handle, "%04hx", handle_num);
-
-	uuid = gatt_db_attribute_get_type(attr);
-	bt_uuid_to_string(uuid, uuid_str, sizeof(uuid_str));
-
-	bt_uuid16_create(&ext_uuid, GATT_CHARAC_EXT_PROPER_UUID);
-	if (!bt_uuid_cmp(uuid, &ext_uuid) && saver->ext_props)
-		sprintf(value, "%04hx:%s", saver->ext_props, uuid_str);
-	else
-		sprintf(value, "%s", uuid_str);
-
-	g_key_file_set_string(key_file, "Attributes", handle, value);
-}
-
-static void store_chrc(struct gatt_db_attribute *attr, void *user_data)
-{
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	uint16_t handle_num, value_handle;
-	uint8_t properties;
-	bt_uuid_t uuid, hash_uuid;
-
-	if (!gatt_db_attribute_get_char_data(attr, &handle_num, &value_handle,
-						&properties, &saver->ext_props,
-						&uuid)) {
-		warn("Error storing characteristic - can't get data");
-		return;
-	}
-
-	sprintf(handle, "%04hx", handle_num);
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
-
-	/* Store Database Hash  value if available */
-	bt_uuid16_create(&hash_uuid, GATT_CHARAC_DB_HASH);
-	if (!bt_uuid_cmp(&uuid, &hash_uuid)) {
-		const uint8_t *hash = NULL;
-
-		attr = gatt_db_get_attribute(saver->device->db, value_handle);
-
-		gatt_db_attribute_read(attr, 0, BT_ATT_OP_READ_REQ, NULL,
-					db_hash_read_value_cb, &hash);
-		if (hash)
-			sprintf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hhx:"
-				"%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx"
-				"%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx"
-				"%02hhx%02hhx:%s", value_handle, properties,
-				hash[0], hash[1], hash[2], hash[3],
-				hash[4], hash[5], hash[6], hash[7],
-				hash[8], hash[9], hash[10], hash[11],
-				hash[12], hash[13], hash[14], hash[15],
-				uuid_str);
-		else
-			sprintf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hhx:%s",
-				value_handle, properties, uuid_str);
-
-	} else
-		sprintf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hhx:%s",
-				value_handle, properties, uuid_str);
+	char dst_addr[18];
 
-	g_key_file_set_string(key_file, "Attributes", handle, value);
+	ba2str(&device->bdaddr, dst_addr);
 
-	gatt_db_service_foreach_desc(attr, store_desc, saver);
+	snprintf(filename, size, STORAGEDIR "/%s/cache/%s.gatt",
+				btd_adapter_get_storage_dir(device->adapter),
+				dst_addr);
 }
 
-static void store_incl(struct gatt_db_attribute *attr, void *user_data)
+/*
+ * Older releases kept the attributes in the [Attributes] group of the text
+ * cache, drop it once the binary cache has been written.
+ */
+static void remove_text_gatt_db(struct btd_device *device)
 {
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	struct gatt_db_attribute *service;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	uint16_t handle_num, start, end;
-	bt_uuid_t uuid;
-
-	if (!gatt_db_attribute_get_incl_data(attr, &handle_num, &start, &end)) {
-		warn("Error storing included service - can't get data");
-		return;
-	}
-
-	service = gatt_db_get_attribute(saver->device->db, start);
-	if (!service) {
-		warn("Error storing included service - can't find it");
-		return;
-	}
+	char filename[PATH_MAX];
+	char dst_addr[18];
+	GKeyFile *key_file;
+	char *data;
+	gsize length = 0;
 
-	sprintf(handle, "%04hx", handle_num);
+	ba2str(&device->bdaddr, dst_addr);
 
-	gatt_db_attribute_get_service_uuid(service, &uuid);
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
-	sprintf(value, GATT_INCLUDE_UUID_STR ":%04hx:%04hx:%s", start,
-								end, uuid_str);
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
+				btd_adapter_get_storage_dir(device->adapter),
+				dst_addr);
 
-	g_key_file_set_string(key_file, "Attributes", handle, value);
-}
+	key_file = g_key_file_new();
+	btd_storage_load(key_file, filename);
 
-static void store_service(struct gatt_db_attribute *attr, void *user_data)
-{
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char uuid_str[MAX_LEN_UUID_STR], handle[6], value[256];
-	uint16_t start, end;
-	bt_uuid_t uuid;
-	bool primary;
-	char *type;
+	if (g_key_file_has_group(key_file, "Attributes")) {
+		g_key_file_remove_group(key_file, "Attributes", NULL);
 
-	if (!gatt_db_attribute_get_service_data(attr, &start, &end, &primary,
-								&uuid)) {
-		warn("Error storing service - can't get data");
-		return;
+		data = g_key_file_to_data(key_file, &length, NULL);
+		btd_storage_save(filename, data, length);
+		g_free(data);
 	}
 
-	sprintf(handle, "%04hx", start);
-
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
-
-	if (primary)
-		type = GATT_PRIM_SVC_UUID_STR;
-	else
-		type = GATT_SND_SVC_UUID_STR;
-
-	sprintf(value, "%s:%04hx:%s", type, end, uuid_str);
-
-	g_key_file_set_string(key_file, "Attributes", handle, value);
-
-	gatt_db_service_foreach_incl(attr, store_incl, saver);
-	gatt_db_service_foreach_char(attr, store_chrc, saver);
+	g_key_file_free(key_file);
 }
 
 static void store_gatt_db(struct btd_device *device)
 {
 	char filename[PATH_MAX];
-	char dst_addr[18];
-	GKeyFile *key_file;
-	char *data;
-	gsize length = 0;
-	struct gatt_saver saver;
+	void *data;
+	ssize_t length;
 
 	if (device_address_is_private(device)) {
 		DBG("Can't store GATT db for private addressed device %s",
@@ -2473,29 +2460,19 @@ static void store_gatt_db(struct btd_device *device)
 	if (!gatt_cache_is_enabled(device))
 		return;
 
-	ba2str(&device->bdaddr, dst_addr);
-
-	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
-				btd_adapter_get_storage_dir(device->adapter),
-				dst_addr);
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
-
-	/* Remove current attributes since it might have changed */
-	g_key_file_remove_group(key_file, "Attributes", NULL);
+	length = gatt_cache_encode(device->db, &data);
+	if (length < 0) {
+		error("Unable to encode GATT db: %s (%zd)", strerror(-length),
+								-length);
+		return;
+	}
 
-	saver.key_file = key_file;
-	saver.device = device;
+	gatt_cache_filename(device, filename, sizeof(filename));
 
-	gatt_db_foreach_service(device->db, NULL, store_service, &saver);
+	if (btd_storage_save(filename, data, length) == 0)
+		remove_text_gatt_db(device);
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
-
-	g_free(data);
-	g_key_file_free(key_file);
+	free(data);
 }
 
 
@@ -3118,7 +3095,7 @@ static char *load_cached_name(struct btd_device *device, const char *local,
 
 	key_file = g_key_file_new();
 
-	if (!g_key_file_load_from_file(key_file, filename, 0, NULL))
+	if (!btd_storage_load(key_file, filename))
 		goto failed;
 
 	str = g_key_file_get_string(key_file, "General", "Name", NULL);
@@ -3217,7 +3194,7 @@ static void convert_info(struct btd_device *device, GKeyFile *key_file)
 			device_addr);
 
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_save(filename, str, length);
 	g_free(str);
 
 	store_device_info(device);
@@ -3377,7 +3354,7 @@ static void load_att_info(struct btd_device *device, const char *local,
 			peer);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 	groups = g_key_file_get_groups(key_file, NULL);
 
 	for (handle = groups; *handle; handle++) {
@@ -3748,35 +3725,72 @@ static int load_gatt_db_impl(GKeyFile *key_file, char **keys,
 	return 0;
 }
 
-static void load_gatt_db(struct btd_device *device, const char *local,
+static bool load_gatt_db_text(struct btd_device *device, const char *local,
 							const char *peer)
 {
 	char **keys, filename[PATH_MAX];
 	GKeyFile *key_file;
-
-	if (!gatt_cache_is_enabled(device))
-		return;
-
-	DBG("Restoring %s gatt database from file", peer);
+	int err;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 	keys = g_key_file_get_keys(key_file, "Attributes", NULL, NULL);
 
 	if (!keys) {
 		warn("No cache for %s", peer);
 		g_key_file_free(key_file);
-		return;
+		return false;
 	}
 
-	if (load_gatt_db_impl(key_file, keys, device->db))
+	err = load_gatt_db_impl(key_file, keys, device->db);
+	if (err)
 		warn("Unable to load gatt db from file for %s", peer);
 
 	g_strfreev(keys);
 	g_key_file_free(key_file);
 
+	return !err;
+}
+
+static bool load_gatt_db_binary(struct btd_device *device)
+{
+	char filename[PATH_MAX];
+	size_t length;
+	void *data;
+	int err;
+
+	gatt_cache_filename(device, filename, sizeof(filename));
+
+	data = btd_storage_map(filename, &length);
+	if (!data)
+		return false;
+
+	err = gatt_cache_decode(device->db, data, length);
+	if (err < 0)
+		warn("Unable to load gatt db from %s: %s (%d)", filename,
+							strerror(-err), -err);
+
+	btd_storage_unmap(data, length);
+
+	return !err;
+}
+
+static void load_gatt_db(struct btd_device *device, const char *local,
+							const char *peer)
+{
+	if (!gatt_cache_is_enabled(device))
+		return;
+
+	DBG("Restoring %s gatt database from file", peer);
+
+	if (!load_gatt_db_binary(device)) {
+		/* Convert caches written by older versions */
+		if (load_gatt_db_text(device, local, peer))
+			store_gatt_db(device);
+	}
+
 	g_slist_free_full(device->primaries, g_free);
 	device->primaries = NULL;
 	gatt_db_foreach_service(device->db, NULL, add_primary,
@@ -4358,36 +4372,6 @@ uint16_t btd_device_get_version(struct btd_device *device)
 	return device->version;
 }
 
-static void delete_folder_tree(const char *dirname)
-{
-	DIR *dir;
-	struct dirent *entry;
-	char filename[PATH_MAX];
-
-	dir = opendir(dirname);
-	if (dir == NULL)
-		return;
-
-	while ((entry = readdir(dir)) != NULL) {
-		if (g_str_equal(entry->d_name, ".") ||
-				g_str_equal(entry->d_name, ".."))
-			continue;
-
-		if (entry->d_type == DT_UNKNOWN)
-			entry->d_type = util_get_dt(dirname, entry->d_name);
-
-		snprintf(filename, PATH_MAX, "%s/%s", dirname, entry->d_name);
-
-		if (entry->d_type == DT_DIR)
-			delete_folder_tree(filename);
-		else
-			unlink(filename);
-	}
-	closedir(dir);
-
-	rmdir(dirname);
-}
-
 void device_remove_bonding(struct btd_device *device, uint8_t bdaddr_type)
 {
 	if (bdaddr_type == BDADDR_BREDR)
@@ -4427,21 +4411,19 @@ static void device_remove_stored(struct btd_device *device)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s",
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
-	delete_folder_tree(filename);
+	btd_storage_remove(filename);
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
 				btd_adapter_get_storage_dir(device->adapter),
 				device_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 	g_key_file_remove_group(key_file, "ServiceRecords", NULL);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	if (length > 0)
+		btd_storage_save(filename, data, length);
 
 	g_free(data);
 	g_key_file_free(key_file);
@@ -4829,13 +4811,13 @@ static void update_bredr_services(struct browse_req *req, sdp_list_t *recs)
 								dstaddr);
 
 	sdp_key_file = g_key_file_new();
-	g_key_file_load_from_file(sdp_key_file, sdp_file, 0, NULL);
+	btd_storage_load(sdp_key_file, sdp_file);
 
 	snprintf(att_file, PATH_MAX, STORAGEDIR "/%s/%s/attributes", srcaddr,
 								dstaddr);
 
 	att_key_file = g_key_file_new();
-	g_key_file_load_from_file(att_key_file, att_file, 0, NULL);
+	btd_storage_load(att_key_file, att_file);
 
 	for (seq = recs; seq; seq = seq->next) {
 		sdp_record_t *rec = (sdp_record_t *) seq->data;
@@ -4888,10 +4870,8 @@ next:
 
 	if (sdp_key_file) {
 		data = g_key_file_to_data(sdp_key_file, &length, NULL);
-		if (length > 0) {
-			create_file(sdp_file, S_IRUSR | S_IWUSR);
-			g_file_set_contents(sdp_file, data, length, NULL);
-		}
+		if (length > 0)
+			btd_storage_save(sdp_file, data, length);
 
 		g_free(data);
 		g_key_file_free(sdp_key_file);
@@ -4899,10 +4879,8 @@ next:
 
 	if (att_key_file) {
 		data = g_key_file_to_data(att_key_file, &length, NULL);
-		if (length > 0) {
-			create_file(att_file, S_IRUSR | S_IWUSR);
-			g_file_set_contents(att_file, data, length, NULL);
-		}
+		if (length > 0)
+			btd_storage_save(att_file, data, length);
 
 		g_free(data);
 		g_key_file_free(att_key_file);
@@ -5218,6 +5196,19 @@ static void gatt_client_init(struct btd_device *device)
 	btd_gatt_client_connected(device->client_dbus);
 }
 
+static uint8_t nfy_batch_mode(void)
+{
+	switch (btd_opts.gatt_nfy_batch) {
+	case BT_GATT_NFY_BATCH_OFF:
+		return BT_GATT_SERVER_NFY_BATCH_OFF;
+	case BT_GATT_NFY_BATCH_ADAPTIVE:
+		return BT_GATT_SERVER_NFY_BATCH_ADAPTIVE;
+	case BT_GATT_NFY_BATCH_ON:
+	default:
+		return BT_GATT_SERVER_NFY_BATCH_ON;
+	}
+}
+
 static void gatt_server_init(struct btd_device *device,
 				struct btd_gatt_database *database)
 {
@@ -5239,6 +5230,8 @@ static void gatt_server_init(struct btd_device *device,
 
 	bt_att_set_enc_key_size(device->att, device->ltk_enc_size);
 	bt_gatt_server_set_debug(device->server, gatt_debug, NULL, NULL);
+	bt_gatt_server_set_nfy_batching(device->server, nfy_batch_mode(),
+						btd_opts.gatt_nfy_latency);
 
 	btd_gatt_database_server_connected(database, device->server);
 }
@@ -5784,7 +5777,7 @@ void device_store_svc_chng_ccc(struct btd_device *device, uint8_t bdaddr_type,
 				device_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	/* for bonded devices this is done on every connection so limit writes
 	 * to storage if no change needed
@@ -5807,10 +5800,8 @@ void device_store_svc_chng_ccc(struct btd_device *device, uint8_t bdaddr_type,
 									value);
 	}
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
 	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
+	btd_storage_save(filename, str, length);
 	g_free(str);
 
 done:
@@ -5829,7 +5820,7 @@ void device_load_svc_chng_ccc(struct btd_device *device, uint16_t *ccc_le,
 				device_addr);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 
 	if (!g_key_file_has_group(key_file, "ServiceChanged")) {
 		if (ccc_le)
@@ -5864,6 +5855,12 @@ void device_set_rssi_with_delta(struct btd_device *device, int8_t rssi,
 		DBG("rssi %d", rssi);
 
 		device->rssi = rssi;
+
+		/* Invalidation is reported right away */
+		if (rssi == 0) {
+			flush_limited_prop(device, PROP_RSSI);
+			return;
+		}
 	} else {
 		int delta;
 
@@ -5881,13 +5878,12 @@ void device_set_rssi_with_delta(struct btd_device *device, int8_t rssi,
 		device->rssi = rssi;
 	}
 
-	g_dbus_emit_property_changed(dbus_conn, device->path,
-						DEVICE_INTERFACE, "RSSI");
+	emit_limited_prop(device, PROP_RSSI);
 }
 
 void device_set_rssi(struct btd_device *device, int8_t rssi)
 {
-	device_set_rssi_with_delta(device, rssi, RSSI_THRESHOLD);
+	device_set_rssi_with_delta(device, rssi, btd_opts.rssi_delta);
 }
 
 void device_set_tx_power(struct btd_device *device, int8_t tx_power)
@@ -5902,8 +5898,10 @@ void device_set_tx_power(struct btd_device *device, int8_t tx_power)
 
 	device->tx_power = tx_power;
 
-	g_dbus_emit_property_changed(dbus_conn, device->path,
-						DEVICE_INTERFACE, "TxPower");
+	if (tx_power == 127)
+		flush_limited_prop(device, PROP_TX_POWER);
+	else
+		emit_limited_prop(device, PROP_TX_POWER);
 }
 
 void device_set_flags(struct btd_device *device, uint8_t flags)
@@ -6679,7 +6677,7 @@ static sdp_list_t *read_device_records(struct btd_device *device)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
 	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	btd_storage_load(key_file, filename);
 	keys = g_key_file_get_keys(key_file, "ServiceRecords", NULL, NULL);
 
 	for (handle = keys; handle && *handle; handle++) {
@@ -157,6 +157,8 @@ struct notify {
 	uint16_t handle, ccc_handle;
 	uint8_t *value;
 	uint16_t len;
+	uint8_t *pdu;
+	uint16_t pdu_len;
 	bt_gatt_server_conf_func_t conf;
 	void *user_data;
 };
@@ -173,6 +175,7 @@ struct device_state {
 	bool out_of_sync;
 	struct queue *ccc_states;
 	struct notify *pending;
+	struct bt_gatt_server *server;
 };
 
 typedef uint8_t (*btd_gatt_database_ccc_write_t) (struct pending_op *op,
@@ -180,6 +183,7 @@ typedef uint8_t (*btd_gatt_database_ccc_write_t) (struct pending_op *op,
 typedef void (*btd_gatt_database_destroy_t) (void *data);
 
 struct ccc_state {
+	struct device_state *state;
 	uint16_t handle;
 	uint16_t value;
 };
@@ -189,6 +193,7 @@ struct ccc_cb_data {
 	btd_gatt_database_ccc_write_t callback;
 	btd_gatt_database_destroy_t destroy;
 	void *user_data;
+	struct queue *subscribers;	/* ccc_state with a non-zero value */
 };
 
 struct device_info {
@@ -203,6 +208,7 @@ static void ccc_cb_free(void *data)
 	if (ccc_cb->destroy)
 		ccc_cb->destroy(ccc_cb->user_data);
 
+	queue_destroy(ccc_cb->subscribers, NULL);
 	free(ccc_cb);
 }
 
@@ -264,6 +270,61 @@ static struct ccc_state *find_ccc_state(struct device_state *dev_state,
 							UINT_TO_PTR(handle));
 }
 
+static struct ccc_cb_data *find_ccc_cb(struct btd_gatt_database *database,
+							uint16_t handle)
+{
+	return queue_find(database->ccc_callbacks, ccc_cb_match_handle,
+							UINT_TO_PTR(handle));
+}
+
+static void ccc_state_set_value(struct btd_gatt_database *database,
+					struct ccc_state *ccc, uint16_t value)
+{
+	struct ccc_cb_data *ccc_cb;
+
+	ccc_cb = find_ccc_cb(database, ccc->handle);
+	if (ccc_cb) {
+		if (value && !ccc->value)
+			queue_push_tail(ccc_cb->subscribers, ccc);
+		else if (!value && ccc->value)
+			queue_remove(ccc_cb->subscribers, ccc);
+	}
+
+	ccc->value = value;
+}
+
+static void ccc_state_unsubscribe(void *data, void *user_data)
+{
+	struct ccc_state *ccc = data;
+	struct btd_gatt_database *database = user_data;
+	struct ccc_cb_data *ccc_cb;
+
+	if (!ccc->value)
+		return;
+
+	ccc_cb = find_ccc_cb(database, ccc->handle);
+	if (ccc_cb)
+		queue_remove(ccc_cb->subscribers, ccc);
+}
+
+static void ccc_state_free(void *data)
+{
+	struct ccc_state *ccc = data;
+
+	ccc_state_unsubscribe(ccc, ccc->state->db);
+	free(ccc);
+}
+
+static void device_state_set_server(struct device_state *state,
+						struct bt_gatt_server *server)
+{
+	if (state->server == server)
+		return;
+
+	bt_gatt_server_unref(state->server);
+	state->server = server ? bt_gatt_server_ref(server) : NULL;
+}
+
 static struct device_state *device_state_create(struct btd_gatt_database *db,
 							const bdaddr_t *bdaddr,
 							uint8_t bdaddr_type)
@@ -283,7 +344,8 @@ static void device_state_free(void *data)
 {
 	struct device_state *state = data;
 
-	queue_destroy(state->ccc_states, free);
+	queue_destroy(state->ccc_states, ccc_state_free);
+	bt_gatt_server_unref(state->server);
 
 	if (state->pending) {
 		free(state->pending->value);
@@ -320,6 +382,7 @@ static void att_disconnected(int err, void *user_data)
 
 	state->disc_id = 0;
 	state->out_of_sync = false;
+	device_state_set_server(state, NULL);
 
 	device = btd_adapter_find_device(state->db->adapter, &state->bdaddr,
 							state->bdaddr_type);
@@ -422,6 +485,7 @@ static struct ccc_state *get_ccc_state(struct btd_gatt_database *database,
 		return ccc;
 
 	ccc = new0(struct ccc_state, 1);
+	ccc->state = dev_state;
 	ccc->handle = handle;
 	queue_push_tail(dev_state->ccc_states, ccc);
 
@@ -1009,8 +1073,18 @@ static void gatt_ccc_write_cb(struct gatt_db_attribute *attrib,
 			pending_op_free(op);
 	}
 
-	if (!ecode)
-		ccc->value = val;
+	if (!ecode) {
+		ccc_state_set_value(database, ccc, val);
+
+		/* Keep the server around for notifying this subscriber */
+		if (val && !ccc->state->server) {
+			struct btd_device *device = att_get_device(att);
+
+			if (device)
+				device_state_set_server(ccc->state,
+					btd_device_get_gatt_server(device));
+		}
+	}
 
 done:
 	gatt_db_attribute_write_result(attrib, id, ecode);
@@ -1042,6 +1116,7 @@ service_add_ccc(struct gatt_db_attribute *service,
 	gatt_db_attribute_set_fixed_length(ccc, 2);
 
 	ccc_cb->handle = gatt_db_attribute_get_handle(ccc);
+	ccc_cb->subscribers = queue_new();
 	ccc_cb->callback = write_callback;
 	ccc_cb->destroy = destroy;
 	ccc_cb->user_data = user_data;
@@ -1399,12 +1474,46 @@ remove:
 	}
 }
 
+static void send_notification_to_subscriber(void *data, void *user_data)
+{
+	struct ccc_state *ccc = data;
+	struct notify *notify = user_data;
+	struct device_state *state = ccc->state;
+
+	/*
+	 * Let the full lookup deal with subscribers that are not connected,
+	 * it caches what needs to be sent on reconnection and drops the
+	 * state of devices that are gone or no longer bonded.
+	 */
+	if (!state->server) {
+		send_notification_to_device(state, notify);
+		return;
+	}
+
+	if (notify->conf) {
+		if (!(ccc->value & 0x0002))
+			return;
+
+		bt_gatt_server_send_indication(state->server, notify->handle,
+						notify->value, notify->len,
+						notify->conf,
+						notify->user_data, NULL);
+		return;
+	}
+
+	bt_gatt_server_send_notification_pdu(state->server, notify->pdu,
+					notify->pdu_len,
+					state->cli_feat[0] &
+					BT_GATT_CHRC_CLI_FEAT_NFY_MULTI);
+}
+
 static void send_notification_to_devices(struct btd_gatt_database *database,
 					uint16_t handle, uint8_t *value,
 					uint16_t len, uint16_t ccc_handle,
 					bt_gatt_server_conf_func_t conf,
 					void *user_data)
 {
+	struct ccc_cb_data *ccc_cb;
 	struct notify notify;
 
 	memset(&notify, 0, sizeof(notify));
@@ -1417,8 +1526,39 @@ static void send_notification_to_devices(struct btd_gatt_database *database,
 	notify.conf = conf;
 	notify.user_data = user_data;
 
-	queue_foreach(database->device_states, send_notification_to_device,
+	/*
+	 * Service Changed has to reach every known device, including the
+	 * ones currently not connected, so walk all of them.
+	 */
+	ccc_cb = find_ccc_cb(database, ccc_handle);
+	if (conf == service_changed_conf || !ccc_cb) {
+		queue_foreach(database->device_states,
+					send_notification_to_device, &notify);
+		return;
+	}
+
+	if (queue_isempty(ccc_cb->subscribers))
+		return;
+
+	/* Build the notification once and reuse it for every subscriber */
+	if (!conf) {
+		notify.pdu_len = len + 2;
+		notify.pdu = malloc(notify.pdu_len);
+		if (!notify.pdu)
+			return;
+
+		put_le16(handle, notify.pdu);
+		memcpy(notify.pdu + 2, value, len);
+	}
+
+	DBG("GATT server sending %s to %u devices",
+				conf ? "indication" : "notification",
+				queue_length(ccc_cb->subscribers));
+
+	queue_foreach(ccc_cb->subscribers, send_notification_to_subscriber,
 								&notify);
+
+	free(notify.pdu);
 }
 
 static void send_service_changed(struct btd_gatt_database *database,
@@ -1477,7 +1617,8 @@ static void remove_device_ccc(void *data, void *user_data)
 {
 	struct device_state *state = data;
 
-	queue_remove_all(state->ccc_states, ccc_match_service, user_data, free);
+	queue_remove_all(state->ccc_states, ccc_match_service, user_data,
+							ccc_state_free);
 }
 
 static bool match_gatt_record(const void *data, const void *user_data)
@@ -3741,7 +3882,12 @@ void btd_gatt_database_server_connected(struct btd_gatt_database *database,
 	bt_gatt_server_set_authorize(server, server_authorize, database);
 
 	state = find_device_state(database, &bdaddr, bdaddr_type);
-	if (!state || !state->pending)
+	if (!state)
+		return;
+
+	device_state_set_server(state, server);
+
+	if (!state->pending)
 		return;
 
 	send_notification_to_device(state, state->pending);
@@ -3785,8 +3931,9 @@ static void restore_ccc(struct btd_gatt_database *database,
 	queue_push_tail(database->device_states, dev_state);
 
 	ccc = new0(struct ccc_state, 1);
+	ccc->state = dev_state;
 	ccc->handle = gatt_db_attribute_get_handle(database->svc_chngd_ccc);
-	ccc->value = value;
+	ccc_state_set_value(database, ccc, value);
 	queue_push_tail(dev_state->ccc_states, ccc);
 }
 
@@ -50,12 +50,15 @@
 #include "dbus-common.h"
 #include "agent.h"
 #include "profile.h"
+#include "storage.h"
 
 #define BLUEZ_NAME "org.bluez"
 
 #define DEFAULT_PAIRABLE_TIMEOUT       0 /* disabled */
 #define DEFAULT_DISCOVERABLE_TIMEOUT 180 /* 3 minutes */
 #define DEFAULT_TEMPORARY_TIMEOUT     30 /* 30 seconds */
+#define DEFAULT_UPDATE_INTERVAL      500 /* 500 milliseconds */
+#define DEFAULT_RSSI_DELTA             8 /* 8 dBm */
 
 #define SHUTDOWN_GRACE_SECONDS 10
 
@@ -79,6 +82,9 @@ static const char *supported_options[] = {
 	"Privacy",
 	"JustWorksRepairing",
 	"TemporaryTimeout",
+	"StorageBackend",
+	"PropertyUpdateInterval",
+	"RSSIUpdateThreshold",
 	NULL
 };
 
@@ -135,6 +141,8 @@ static const char *gatt_options[] = {
 	"KeySize",
 	"ExchangeMTU",
 	"Channels",
+	"NotifyBatching",
+	"NotifyLatency",
 	NULL
 };
 
@@ -229,6 +237,32 @@ static bt_gatt_cache_t parse_gatt_cache(const char *cache)
 	}
 }
 
+static bt_gatt_nfy_batch_t parse_gatt_nfy_batch(const char *batch)
+{
+	if (!strcmp(batch, "on")) {
+		return BT_GATT_NFY_BATCH_ON;
+	} else if (!strcmp(batch, "off")) {
+		return BT_GATT_NFY_BATCH_OFF;
+	} else if (!strcmp(batch, "adaptive")) {
+		return BT_GATT_NFY_BATCH_ADAPTIVE;
+	} else {
+		DBG("Invalid value for NotifyBatching=%s", batch);
+		return BT_GATT_NFY_BATCH_ON;
+	}
+}
+
+static bt_storage_t parse_storage(const char *storage)
+{
+	if (!strcmp(storage, "files")) {
+		return BT_STORAGE_FILES;
+	} else if (!strcmp(storage, "log")) {
+		return BT_STORAGE_LOG;
+	} else {
+		DBG("Invalid value for StorageBackend=%s", storage);
+		return BT_STORAGE_FILES;
+	}
+}
+
 static enum jw_repairing_t parse_jw_repairing(const char *jw_repairing)
 {
 	if (!strcmp(jw_repairing, "never")) {
@@ -617,6 +651,30 @@ static void parse_config(GKeyFile *config)
 		btd_opts.tmpto = val;
 	}
 
+	val = g_key_file_get_integer(config, "General",
+						"PropertyUpdateInterval", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		val = MIN(val, 60000);
+		val = MAX(val, 0);
+		DBG("update_interval=%d", val);
+		btd_opts.update_interval = val;
+	}
+
+	val = g_key_file_get_integer(config, "General",
+						"RSSIUpdateThreshold", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		val = MIN(val, 127);
+		val = MAX(val, 0);
+		DBG("rssi_delta=%d", val);
+		btd_opts.rssi_delta = val;
+	}
+
 	str = g_key_file_get_string(config, "General", "Name", &err);
 	if (err) {
 		DBG("%s", err->message);
@@ -708,6 +766,15 @@ static void parse_config(GKeyFile *config)
 	else
 		btd_opts.refresh_discovery = boolean;
 
+	str = g_key_file_get_string(config, "General", "StorageBackend", &err);
+	if (err) {
+		g_clear_error(&err);
+	} else {
+		DBG("StorageBackend=%s", str);
+		btd_opts.storage = parse_storage(str);
+		g_free(str);
+	}
+
 	str = g_key_file_get_string(config, "GATT", "Cache", &err);
 	if (err) {
 		DBG("%s", err->message);
@@ -752,6 +819,28 @@ static void parse_config(GKeyFile *config)
 		btd_opts.gatt_channels = val;
 	}
 
+	str = g_key_file_get_string(config, "GATT", "NotifyBatching", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		DBG("NotifyBatching=%s", str);
+		btd_opts.gatt_nfy_batch = parse_gatt_nfy_batch(str);
+		g_free(str);
+	}
+
+	val = g_key_file_get_integer(config, "GATT", "NotifyLatency", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else {
+		/* Ensure the latency is within a valid range. */
+		val = MIN(val, 1000);
+		val = MAX(val, 1);
+		DBG("NotifyLatency=%d", val);
+		btd_opts.gatt_nfy_latency = val;
+	}
+
 	str = g_key_file_get_string(config, "AVDTP", "SessionMode", &err);
 	if (err) {
 		DBG("%s", err->message);
@@ -801,6 +890,8 @@ static void init_defaults(void)
 	btd_opts.pairto = DEFAULT_PAIRABLE_TIMEOUT;
 	btd_opts.discovto = DEFAULT_DISCOVERABLE_TIMEOUT;
 	btd_opts.tmpto = DEFAULT_TEMPORARY_TIMEOUT;
+	btd_opts.update_interval = DEFAULT_UPDATE_INTERVAL;
+	btd_opts.rssi_delta = DEFAULT_RSSI_DELTA;
 	btd_opts.reverse_discovery = TRUE;
 	btd_opts.name_resolv = TRUE;
 	btd_opts.debug_keys = FALSE;
@@ -822,6 +913,8 @@ static void init_defaults(void)
 	btd_opts.gatt_cache = BT_GATT_CACHE_ALWAYS;
 	btd_opts.gatt_mtu = BT_ATT_MAX_LE_MTU;
 	btd_opts.gatt_channels = 3;
+	btd_opts.gatt_nfy_batch = BT_GATT_NFY_BATCH_ON;
+	btd_opts.gatt_nfy_latency = 10;
 
 	btd_opts.avdtp.session_mode = BT_IO_MODE_BASIC;
 	btd_opts.avdtp.stream_mode = BT_IO_MODE_BASIC;
@@ -1093,6 +1186,8 @@ int main(int argc, char *argv[])
 
 	adapter_cleanup();
 
+	btd_storage_cleanup();
+
 	rfkill_exit();
 
 	if (btd_opts.mode != BT_MODE_LE)
@@ -20,6 +20,7 @@
 #include "src/shared/queue.h"
 #include "src/shared/util.h"
 #include "src/shared/timeout.h"
+#include "src/shared/trace.h"
 #include "lib/bluetooth.h"
 #include "lib/l2cap.h"
 #include "lib/uuid.h"
@@ -463,6 +464,8 @@ static bool timeout_cb(void *user_data)
 	att_debug(att, "(chan %p) Operation timed out: 0x%02x", chan,
 						op->opcode);
 
+	BT_TRACE(att_timeout, att, op, op->id, op->opcode);
+
 	if (att->timeout_callback)
 		att->timeout_callback(op->id, op->opcode, att->timeout_data);
 
@@ -530,6 +533,9 @@ static bool can_write_data(struct io *io, void *user_data)
 		return true;
 	}
 
+	BT_TRACE(att_write, chan->att, op, op->id, op->opcode, op->len,
+								chan->fd);
+
 	/* Based on the operation type, set either the pending request or the
 	 * pending indication. If it came from the write queue, then there is
 	 * no need to keep it around.
@@ -828,6 +834,8 @@ fail:
 	rsp_opcode = BT_ATT_OP_ERROR_RSP;
 
 done:
+	BT_TRACE(att_complete, att, op, op->id, op->opcode, rsp_opcode);
+
 	if (op->callback)
 		op->callback(rsp_opcode, rsp_pdu, rsp_pdu_len, op->user_data);
 
@@ -853,6 +861,9 @@ static void handle_conf(struct bt_att_chan *chan, uint8_t *pdu, ssize_t pdu_len)
 		return;
 	}
 
+	BT_TRACE(att_complete, att, op, op->id, op->opcode,
+						BT_ATT_OP_HANDLE_CONF);
+
 	if (op->callback)
 		op->callback(BT_ATT_OP_HANDLE_CONF, NULL, 0, op->user_data);
 
@@ -1349,6 +1360,15 @@ uint16_t bt_att_get_mtu(struct bt_att *att)
 	return att->mtu;
 }
 
+/* Number of PDUs not bound to a channel that are waiting to be written */
+unsigned int bt_att_get_queue_len(struct bt_att *att)
+{
+	if (!att)
+		return 0;
+
+	return queue_length(att->write_queue);
+}
+
 bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu)
 {
 	struct bt_att_chan *chan;
@@ -1472,7 +1492,7 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 				bt_att_destroy_func_t destroy)
 {
 	struct att_send_op *op;
-	bool result;
+	struct queue *queue;
 
 	if (!att || queue_isempty(att->chans))
 		return 0;
@@ -1490,10 +1510,10 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	/* Add the op to the correct queue based on its type */
 	switch (op->type) {
 	case ATT_OP_TYPE_REQ:
-		result = queue_push_tail(att->req_queue, op);
+		queue = att->req_queue;
 		break;
 	case ATT_OP_TYPE_IND:
-		result = queue_push_tail(att->ind_queue, op);
+		queue = att->ind_queue;
 		break;
 	case ATT_OP_TYPE_CMD:
 	case ATT_OP_TYPE_NFY:
@@ -1501,16 +1521,19 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	case ATT_OP_TYPE_RSP:
 	case ATT_OP_TYPE_CONF:
 	default:
-		result = queue_push_tail(att->write_queue, op);
+		queue = att->write_queue;
 		break;
 	}
 
-	if (!result) {
+	if (!queue_push_tail(queue, op)) {
 		free(op->pdu);
 		free(op);
 		return 0;
 	}
 
+	BT_TRACE(att_send, att, op, op->id, op->opcode, op->len,
+							queue_length(queue));
+
 	wakeup_writer(att);
 
 	return op->id;
@@ -1538,6 +1561,9 @@ unsigned int bt_att_chan_send(struct bt_att_chan *chan, uint8_t opcode,
 		return 0;
 	}
 
+	BT_TRACE(att_send, chan->att, op, op->id, op->opcode, op->len,
+						queue_length(chan->queue));
+
 	wakeup_chan_writer(chan, NULL);
 
 	return op->id;
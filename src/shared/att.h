@@ -50,6 +50,7 @@ bool bt_att_set_debug(struct bt_att *att, uint8_t level,
 			bt_att_destroy_func_t destroy);
 
 uint16_t bt_att_get_mtu(struct bt_att *att);
+unsigned int bt_att_get_queue_len(struct bt_att *att);
 bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu);
 uint8_t bt_att_get_link_type(struct bt_att *att);
 
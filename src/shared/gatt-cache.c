@@ -0,0 +1,564 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/gatt-cache.h"
+
+/*
+ * Binary GATT client cache.
+ *
+ * The file consists of a fixed header followed by an array of fixed size
+ * attribute records in handle order and a table of the UUIDs referenced by
+ * those records, so it can be loaded straight from a mapping without any
+ * parsing:
+ *
+ *	0	magic "BTGC"
+ *	4	version
+ *	5	flags
+ *	6	number of UUIDs (le16)
+ *	8	number of records (le16)
+ *	10	reserved
+ *	16	database hash
+ *
+ * Each record holds the attribute type, an 8 bit properties field, the
+ * attribute handle and two type specific 16 bit fields:
+ *
+ *	service		end handle	UUID index
+ *	include		start handle	end handle
+ *	characteristic	value handle	UUID index
+ *	descriptor	UUID index	value (extended properties)
+ *
+ * UUIDs are stored as their type (16, 32 or 128) followed by the value in
+ * little endian byte order.
+ */
+
+#define CACHE_MAGIC		"BTGC"
+#define CACHE_VERSION		1
+#define CACHE_FLAG_HASH		0x01
+
+#define CACHE_HDR_SIZE		32
+#define CACHE_REC_SIZE		8
+#define CACHE_UUID_SIZE		17
+
+#define REC_PRIMARY		0x01
+#define REC_SECONDARY		0x02
+#define REC_INCLUDE		0x03
+#define REC_CHARAC		0x04
+#define REC_DESC		0x05
+
+struct cache_encoder {
+	struct gatt_db *db;
+	uint8_t *recs;
+	unsigned int num_recs;
+	unsigned int max_recs;
+	bt_uuid_t *uuids;
+	unsigned int num_uuids;
+	unsigned int max_uuids;
+	uint8_t hash[16];
+	bool has_hash;
+	uint16_t ext_props;
+	bool failed;
+};
+
+static int intern_uuid(struct cache_encoder *enc, const bt_uuid_t *uuid)
+{
+	unsigned int i;
+
+	for (i = 0; i < enc->num_uuids; i++) {
+		if (enc->uuids[i].type == uuid->type &&
+					!bt_uuid_cmp(&enc->uuids[i], uuid))
+			return i;
+	}
+
+	if (enc->num_uuids == UINT16_MAX)
+		return -ENOSPC;
+
+	if (enc->num_uuids == enc->max_uuids) {
+		unsigned int max = enc->max_uuids ? enc->max_uuids * 2 : 16;
+		bt_uuid_t *uuids;
+
+		uuids = realloc(enc->uuids, max * sizeof(*uuids));
+		if (!uuids)
+			return -ENOMEM;
+
+		enc->uuids = uuids;
+		enc->max_uuids = max;
+	}
+
+	enc->uuids[enc->num_uuids] = *uuid;
+
+	return enc->num_uuids++;
+}
+
+static void add_record(struct cache_encoder *enc, uint8_t type,
+				uint8_t props, uint16_t handle,
+				uint16_t a, uint16_t b)
+{
+	uint8_t *rec;
+
+	if (enc->failed)
+		return;
+
+	if (enc->num_recs == UINT16_MAX) {
+		enc->failed = true;
+		return;
+	}
+
+	if (enc->num_recs == enc->max_recs) {
+		unsigned int max = enc->max_recs ? enc->max_recs * 2 : 64;
+		uint8_t *recs;
+
+		recs = realloc(enc->recs, max * CACHE_REC_SIZE);
+		if (!recs) {
+			enc->failed = true;
+			return;
+		}
+
+		enc->recs = recs;
+		enc->max_recs = max;
+	}
+
+	rec = enc->recs + enc->num_recs++ * CACHE_REC_SIZE;
+	rec[0] = type;
+	rec[1] = props;
+	put_le16(handle, rec + 2);
+	put_le16(a, rec + 4);
+	put_le16(b, rec + 6);
+}
+
+static void add_uuid_record(struct cache_encoder *enc, uint8_t type,
+				uint8_t props, uint16_t handle, uint16_t a,
+				const bt_uuid_t *uuid)
+{
+	int idx;
+
+	idx = intern_uuid(enc, uuid);
+	if (idx < 0) {
+		enc->failed = true;
+		return;
+	}
+
+	add_record(enc, type, props, handle, a, idx);
+}
+
+static void encode_desc(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct cache_encoder *enc = user_data;
+	const bt_uuid_t *uuid;
+	bt_uuid_t ext_uuid;
+	uint16_t val = 0;
+	int idx;
+
+	uuid = gatt_db_attribute_get_type(attr);
+
+	bt_uuid16_create(&ext_uuid, GATT_CHARAC_EXT_PROPER_UUID);
+	if (!bt_uuid_cmp(uuid, &ext_uuid))
+		val = enc->ext_props;
+
+	idx = intern_uuid(enc, uuid);
+	if (idx < 0) {
+		enc->failed = true;
+		return;
+	}
+
+	add_record(enc, REC_DESC, 0, gatt_db_attribute_get_handle(attr), idx,
+									val);
+}
+
+static void read_hash_cb(struct gatt_db_attribute *attrib, int err,
+				const uint8_t *value, size_t length,
+				void *user_data)
+{
+	struct cache_encoder *enc = user_data;
+
+	if (err || length != sizeof(enc->hash))
+		return;
+
+	memcpy(enc->hash, value, length);
+	enc->has_hash = true;
+}
+
+static void encode_chrc(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct cache_encoder *enc = user_data;
+	uint16_t handle, value_handle;
+	uint8_t properties;
+	bt_uuid_t uuid, hash_uuid;
+
+	if (!gatt_db_attribute_get_char_data(attr, &handle, &value_handle,
+						&properties, &enc->ext_props,
+						&uuid)) {
+		enc->failed = true;
+		return;
+	}
+
+	add_uuid_record(enc, REC_CHARAC, properties, handle, value_handle,
+									&uuid);
+
+	/* Keep the Database Hash value in the header */
+	bt_uuid16_create(&hash_uuid, GATT_CHARAC_DB_HASH);
+	if (!bt_uuid_cmp(&uuid, &hash_uuid)) {
+		struct gatt_db_attribute *value;
+
+		value = gatt_db_get_attribute(enc->db, value_handle);
+		if (value)
+			gatt_db_attribute_read(value, 0, BT_ATT_OP_READ_REQ,
+						NULL, read_hash_cb, enc);
+	}
+
+	gatt_db_service_foreach_desc(attr, encode_desc, enc);
+}
+
+static void encode_incl(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct cache_encoder *enc = user_data;
+	uint16_t handle, start, end;
+
+	if (!gatt_db_attribute_get_incl_data(attr, &handle, &start, &end)) {
+		enc->failed = true;
+		return;
+	}
+
+	add_record(enc, REC_INCLUDE, 0, handle, start, end);
+}
+
+static void encode_service(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct cache_encoder *enc = user_data;
+	uint16_t start, end;
+	bt_uuid_t uuid;
+	bool primary;
+
+	if (!gatt_db_attribute_get_service_data(attr, &start, &end, &primary,
+								&uuid)) {
+		enc->failed = true;
+		return;
+	}
+
+	add_uuid_record(enc, primary ? REC_PRIMARY : REC_SECONDARY, 0, start,
+								end, &uuid);
+
+	gatt_db_service_foreach_incl(attr, encode_incl, enc);
+	gatt_db_service_foreach_char(attr, encode_chrc, enc);
+}
+
+static bool put_uuid(const bt_uuid_t *uuid, uint8_t *dst)
+{
+	memset(dst, 0, CACHE_UUID_SIZE);
+
+	dst[0] = uuid->type;
+
+	switch (uuid->type) {
+	case BT_UUID16:
+		put_le16(uuid->value.u16, dst + 1);
+		return true;
+	case BT_UUID32:
+		put_le32(uuid->value.u32, dst + 1);
+		return true;
+	case BT_UUID128:
+		bswap_128(&uuid->value.u128, dst + 1);
+		return true;
+	case BT_UUID_UNSPEC:
+		break;
+	}
+
+	return false;
+}
+
+static bool get_uuid(const uint8_t *src, bt_uuid_t *uuid)
+{
+	uint128_t u128;
+
+	switch (src[0]) {
+	case BT_UUID16:
+		bt_uuid16_create(uuid, get_le16(src + 1));
+		return true;
+	case BT_UUID32:
+		bt_uuid32_create(uuid, get_le32(src + 1));
+		return true;
+	case BT_UUID128:
+		bswap_128(src + 1, &u128);
+		bt_uuid128_create(uuid, u128);
+		return true;
+	}
+
+	return false;
+}
+
+ssize_t gatt_cache_encode(struct gatt_db *db, void **data)
+{
+	struct cache_encoder enc;
+	uint8_t *buf, *ptr;
+	size_t len;
+	unsigned int i;
+
+	if (!db || !data)
+		return -EINVAL;
+
+	memset(&enc, 0, sizeof(enc));
+	enc.db = db;
+
+	gatt_db_foreach_service(db, NULL, encode_service, &enc);
+
+	if (enc.failed) {
+		free(enc.recs);
+		free(enc.uuids);
+		return -ENOMEM;
+	}
+
+	len = CACHE_HDR_SIZE + enc.num_recs * CACHE_REC_SIZE +
+					enc.num_uuids * CACHE_UUID_SIZE;
+
+	buf = malloc(len);
+	if (!buf) {
+		free(enc.recs);
+		free(enc.uuids);
+		return -ENOMEM;
+	}
+
+	memset(buf, 0, CACHE_HDR_SIZE);
+	memcpy(buf, CACHE_MAGIC, 4);
+	buf[4] = CACHE_VERSION;
+	buf[5] = enc.has_hash ? CACHE_FLAG_HASH : 0;
+	put_le16(enc.num_uuids, buf + 6);
+	put_le16(enc.num_recs, buf + 8);
+	if (enc.has_hash)
+		memcpy(buf + 16, enc.hash, sizeof(enc.hash));
+
+	ptr = buf + CACHE_HDR_SIZE;
+
+	if (enc.num_recs)
+		memcpy(ptr, enc.recs, enc.num_recs * CACHE_REC_SIZE);
+
+	ptr += enc.num_recs * CACHE_REC_SIZE;
+
+	for (i = 0; i < enc.num_uuids; i++, ptr += CACHE_UUID_SIZE) {
+		if (!put_uuid(&enc.uuids[i], ptr))
+			break;
+	}
+
+	free(enc.recs);
+	free(enc.uuids);
+
+	if (i < enc.num_uuids) {
+		free(buf);
+		return -EINVAL;
+	}
+
+	*data = buf;
+
+	return len;
+}
+
+static bool check_header(const uint8_t *data, size_t len,
+				uint16_t *num_uuids, uint16_t *num_recs)
+{
+	if (len < CACHE_HDR_SIZE)
+		return false;
+
+	if (memcmp(data, CACHE_MAGIC, 4) || data[4] != CACHE_VERSION)
+		return false;
+
+	*num_uuids = get_le16(data + 6);
+	*num_recs = get_le16(data + 8);
+
+	return len == (size_t) CACHE_HDR_SIZE + *num_recs * CACHE_REC_SIZE +
+					*num_uuids * CACHE_UUID_SIZE;
+}
+
+bool gatt_cache_get_hash(const void *data, size_t len, uint8_t hash[16])
+{
+	const uint8_t *buf = data;
+	uint16_t num_uuids, num_recs;
+
+	if (!buf || !check_header(buf, len, &num_uuids, &num_recs))
+		return false;
+
+	if (!(buf[5] & CACHE_FLAG_HASH))
+		return false;
+
+	memcpy(hash, buf + 16, 16);
+
+	return true;
+}
+
+static void write_value_cb(struct gatt_db_attribute *attrib, int err,
+							void *user_data)
+{
+	int *result = user_data;
+
+	if (err)
+		*result = -EIO;
+}
+
+static int write_value(struct gatt_db_attribute *attr, const uint8_t *value,
+								size_t len)
+{
+	int err = 0;
+
+	if (!gatt_db_attribute_write(attr, 0, value, len, 0, NULL,
+						write_value_cb, &err))
+		return -EIO;
+
+	return err;
+}
+
+static int load_record(struct gatt_db *db, struct gatt_db_attribute **service,
+				const uint8_t *rec, const bt_uuid_t *uuids,
+				uint16_t num_uuids, const uint8_t *hash)
+{
+	struct gatt_db_attribute *attr;
+	uint16_t handle = get_le16(rec + 2);
+	uint16_t a = get_le16(rec + 4);
+	uint16_t b = get_le16(rec + 6);
+	bt_uuid_t hash_uuid, ext_uuid;
+	uint8_t val[2];
+
+	switch (rec[0]) {
+	case REC_PRIMARY:
+	case REC_SECONDARY:
+		if (*service)
+			gatt_db_service_set_active(*service, true);
+
+		*service = gatt_db_get_attribute(db, handle);
+		return *service ? 0 : -EIO;
+	case REC_INCLUDE:
+		if (!*service)
+			return -EIO;
+
+		attr = gatt_db_get_attribute(db, a);
+		if (!attr)
+			return -EIO;
+
+		attr = gatt_db_service_insert_included(*service, handle, attr);
+		return attr ? 0 : -EIO;
+	case REC_CHARAC:
+		if (!*service || b >= num_uuids)
+			return -EIO;
+
+		attr = gatt_db_service_insert_characteristic(*service, a,
+							&uuids[b], 0, rec[1],
+							NULL, NULL, NULL);
+		if (!attr || gatt_db_attribute_get_handle(attr) != a)
+			return -EIO;
+
+		bt_uuid16_create(&hash_uuid, GATT_CHARAC_DB_HASH);
+		if (hash && !bt_uuid_cmp(&uuids[b], &hash_uuid))
+			return write_value(attr, hash, 16);
+
+		return 0;
+	case REC_DESC:
+		if (!*service || a >= num_uuids)
+			return -EIO;
+
+		bt_uuid16_create(&ext_uuid, GATT_CHARAC_EXT_PROPER_UUID);
+		if (!bt_uuid_cmp(&uuids[a], &ext_uuid) && !b)
+			return -EIO;
+
+		attr = gatt_db_service_insert_descriptor(*service, handle,
+							&uuids[a], 0, NULL,
+							NULL, NULL);
+		if (!attr || gatt_db_attribute_get_handle(attr) != handle)
+			return -EIO;
+
+		if (!b)
+			return 0;
+
+		put_le16(b, val);
+		return write_value(attr, val, sizeof(val));
+	}
+
+	return -EIO;
+}
+
+int gatt_cache_decode(struct gatt_db *db, const void *data, size_t len)
+{
+	const uint8_t *buf = data, *recs, *rec, *hash = NULL;
+	struct gatt_db_attribute *service = NULL;
+	uint16_t num_uuids, num_recs, i;
+	bt_uuid_t *uuids;
+	int err = 0;
+
+	if (!db || !buf)
+		return -EINVAL;
+
+	if (!check_header(buf, len, &num_uuids, &num_recs))
+		return -EILSEQ;
+
+	if (buf[5] & CACHE_FLAG_HASH)
+		hash = buf + 16;
+
+	recs = buf + CACHE_HDR_SIZE;
+
+	uuids = malloc((num_uuids ? num_uuids : 1) * sizeof(*uuids));
+	if (!uuids)
+		return -ENOMEM;
+
+	rec = recs + num_recs * CACHE_REC_SIZE;
+
+	for (i = 0; i < num_uuids; i++, rec += CACHE_UUID_SIZE) {
+		if (!get_uuid(rec, &uuids[i])) {
+			free(uuids);
+			return -EILSEQ;
+		}
+	}
+
+	/* Services go first so that included services can be resolved */
+	for (i = 0, rec = recs; i < num_recs; i++, rec += CACHE_REC_SIZE) {
+		uint16_t start, end;
+
+		if (rec[0] != REC_PRIMARY && rec[0] != REC_SECONDARY)
+			continue;
+
+		start = get_le16(rec + 2);
+		end = get_le16(rec + 4);
+
+		if (get_le16(rec + 6) >= num_uuids || end < start) {
+			err = -EILSEQ;
+			goto done;
+		}
+
+		if (!gatt_db_insert_service(db, start,
+					&uuids[get_le16(rec + 6)],
+					rec[0] == REC_PRIMARY,
+					end - start + 1)) {
+			err = -EIO;
+			goto done;
+		}
+	}
+
+	for (i = 0, rec = recs; i < num_recs; i++, rec += CACHE_REC_SIZE) {
+		err = load_record(db, &service, rec, uuids, num_uuids, hash);
+		if (err)
+			goto done;
+	}
+
+	if (service)
+		gatt_db_service_set_active(service, true);
+
+done:
+	if (err)
+		gatt_db_clear(db);
+
+	free(uuids);
+
+	return err;
+}
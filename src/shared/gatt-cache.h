@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct gatt_db;
+
+ssize_t gatt_cache_encode(struct gatt_db *db, void **data);
+int gatt_cache_decode(struct gatt_db *db, const void *data, size_t len);
+bool gatt_cache_get_hash(const void *data, size_t len, uint8_t hash[16]);
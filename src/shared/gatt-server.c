@@ -81,6 +81,7 @@ struct nfy_mult_data {
 	uint8_t *pdu;
 	uint16_t offset;
 	uint16_t len;
+	unsigned int count;
 };
 
 struct bt_gatt_server {
@@ -116,6 +117,9 @@ struct bt_gatt_server {
 	void *authorize_data;
 
 	struct nfy_mult_data *nfy_mult;
+	uint8_t nfy_batch;
+	unsigned int nfy_latency;
+	struct bt_gatt_server_nfy_stats nfy_stats;
 };
 
 static void bt_gatt_server_free(struct bt_gatt_server *server)
@@ -139,6 +143,13 @@ static void bt_gatt_server_free(struct bt_gatt_server *server)
 
 	queue_destroy(server->prep_queue, prep_write_data_destroy);
 
+	if (server->nfy_mult) {
+		if (server->nfy_mult->id)
+			timeout_remove(server->nfy_mult->id);
+		free(server->nfy_mult->pdu);
+		free(server->nfy_mult);
+	}
+
 	gatt_db_unref(server->db);
 	bt_att_unref(server->att);
 	free(server);
@@ -1622,6 +1633,8 @@ struct bt_gatt_server *bt_gatt_server_new(struct gatt_db *db,
 	server->max_prep_queue_len = DEFAULT_MAX_PREP_QUEUE_LEN;
 	server->prep_queue = queue_new();
 	server->min_enc_size = min_enc_size;
+	server->nfy_batch = BT_GATT_SERVER_NFY_BATCH_ON;
+	server->nfy_latency = NFY_MULT_TIMEOUT;
 
 	if (!gatt_server_register_att_handlers(server)) {
 		bt_gatt_server_free(server);
@@ -1686,71 +1699,240 @@ bool bt_gatt_server_set_debug(struct bt_gatt_server *server,
 	return true;
 }
 
+static void nfy_stats_update(struct bt_gatt_server *server, uint8_t opcode,
+							unsigned int count)
+{
+	server->nfy_stats.notifications += count;
+	server->nfy_stats.pdus++;
+
+	if (opcode == BT_ATT_OP_HANDLE_NFY_MULT)
+		server->nfy_stats.mult_pdus++;
+}
+
+static bool send_notification(struct bt_gatt_server *server, uint16_t handle,
+					const uint8_t *value, uint16_t length)
+{
+	uint16_t mtu = bt_att_get_mtu(server->att);
+	uint8_t pdu[mtu];
+
+	put_le16(handle, pdu);
+
+	length = MIN(mtu - 3, length);
+	memcpy(pdu + 2, value, length);
+
+	if (!bt_att_send(server->att, BT_ATT_OP_HANDLE_NFY, pdu, length + 2,
+							NULL, NULL, NULL))
+		return false;
+
+	nfy_stats_update(server, BT_ATT_OP_HANDLE_NFY, 1);
+
+	return true;
+}
+
+static void flush_notify_multiple(struct bt_gatt_server *server)
+{
+	struct nfy_mult_data *data = server->nfy_mult;
+	uint16_t len;
+
+	if (!data || !data->count)
+		return;
+
+	if (data->id) {
+		timeout_remove(data->id);
+		data->id = 0;
+	}
+
+	/* A single value doesn't need the Multiple Handle Value format */
+	if (data->count == 1) {
+		len = get_le16(data->pdu + 2);
+		memmove(data->pdu + 2, data->pdu + 4, len);
+
+		if (bt_att_send(server->att, BT_ATT_OP_HANDLE_NFY, data->pdu,
+						len + 2, NULL, NULL, NULL))
+			nfy_stats_update(server, BT_ATT_OP_HANDLE_NFY, 1);
+	} else if (bt_att_send(server->att, BT_ATT_OP_HANDLE_NFY_MULT,
+					data->pdu, data->offset, NULL, NULL,
+					NULL))
+		nfy_stats_update(server, BT_ATT_OP_HANDLE_NFY_MULT,
+								data->count);
+
+	data->offset = 0;
+	data->count = 0;
+}
+
 static bool notify_multiple(void *user_data)
 {
 	struct bt_gatt_server *server = user_data;
 
-	bt_att_send(server->att, BT_ATT_OP_HANDLE_NFY_MULT,
-			server->nfy_mult->pdu, server->nfy_mult->offset, NULL,
-			NULL, NULL);
+	server->nfy_mult->id = 0;
+	server->nfy_stats.timeout_flushes++;
 
-	free(server->nfy_mult->pdu);
-	free(server->nfy_mult);
-	server->nfy_mult = NULL;
+	flush_notify_multiple(server);
 
 	return false;
 }
 
-bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
-					uint16_t handle, const uint8_t *value,
-					uint16_t length, bool multiple)
+static bool nfy_batching(struct bt_gatt_server *server, bool multiple)
 {
-	struct nfy_mult_data *data = NULL;
-	bool result;
+	if (!multiple)
+		return false;
 
-	if (!server || (length && !value))
+	switch (server->nfy_batch) {
+	case BT_GATT_SERVER_NFY_BATCH_OFF:
 		return false;
+	case BT_GATT_SERVER_NFY_BATCH_ADAPTIVE:
+		/*
+		 * Only hold values back while the link is busy anyway, or
+		 * while a batch is open to keep them in order.
+		 */
+		if (server->nfy_mult && server->nfy_mult->count)
+			return true;
+
+		return bt_att_get_queue_len(server->att) > 0;
+	case BT_GATT_SERVER_NFY_BATCH_ON:
+	default:
+		return true;
+	}
+}
 
-	if (multiple)
-		data = server->nfy_mult;
+static struct nfy_mult_data *nfy_mult_get(struct bt_gatt_server *server,
+								uint16_t len)
+{
+	struct nfy_mult_data *data = server->nfy_mult;
+	uint8_t *pdu;
 
 	if (!data) {
 		data = new0(struct nfy_mult_data, 1);
-		data->len = bt_att_get_mtu(server->att) - 1;
-		data->pdu = malloc(data->len);
+		server->nfy_mult = data;
 	}
 
-	put_le16(handle, data->pdu + data->offset);
-	data->offset += 2;
+	if (data->len == len)
+		return data;
 
-	length = MIN(data->len - data->offset, length);
+	/* MTU has changed, send what has been collected so far */
+	flush_notify_multiple(server);
+
+	pdu = realloc(data->pdu, len);
+	if (!pdu)
+		return NULL;
 
-	if (multiple) {
-		put_le16(length, data->pdu + data->offset);
-		data->offset += 2;
+	data->pdu = pdu;
+	data->len = len;
+
+	return data;
+}
+
+/*
+ * multiple indicates that the remote supports Multiple Handle Value
+ * Notifications, whether they are actually combined is up to the batching
+ * policy set with bt_gatt_server_set_nfy_batching().
+ */
+bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
+					uint16_t handle, const uint8_t *value,
+					uint16_t length, bool multiple)
+{
+	struct nfy_mult_data *data;
+	uint16_t mtu;
+
+	if (!server || (length && !value))
+		return false;
+
+	if (!nfy_batching(server, multiple)) {
+		flush_notify_multiple(server);
+		return send_notification(server, handle, value, length);
 	}
 
-	memcpy(data->pdu + data->offset, value, length);
-	data->offset += length;
+	mtu = bt_att_get_mtu(server->att);
+
+	/* Values that don't fit a Multiple Handle Value PDU go on their own */
+	if (length + 4 > mtu - 1) {
+		flush_notify_multiple(server);
+		return send_notification(server, handle, value, length);
+	}
 
-	if (multiple) {
-		if (!server->nfy_mult)
-			server->nfy_mult = data;
+	data = nfy_mult_get(server, mtu - 1);
+	if (!data)
+		return send_notification(server, handle, value, length);
 
-		if (!server->nfy_mult->id)
-			server->nfy_mult->id = timeout_add(NFY_MULT_TIMEOUT,
-						   notify_multiple, server,
-						   NULL);
+	if (data->offset + 4 + length > data->len) {
+		server->nfy_stats.full_flushes++;
+		flush_notify_multiple(server);
+	}
 
+	put_le16(handle, data->pdu + data->offset);
+	put_le16(length, data->pdu + data->offset + 2);
+	memcpy(data->pdu + data->offset + 4, value, length);
+	data->offset += 4 + length;
+	data->count++;
+
+	/* Flush right away once not even an empty value would fit */
+	if (data->offset + 4 > data->len) {
+		server->nfy_stats.full_flushes++;
+		flush_notify_multiple(server);
 		return true;
 	}
 
-	result = !!bt_att_send(server->att, BT_ATT_OP_HANDLE_NFY,
-				data->pdu, data->offset, NULL, NULL, NULL);
-	free(data->pdu);
-	free(data);
+	if (!data->id)
+		data->id = timeout_add(server->nfy_latency, notify_multiple,
+								server, NULL);
 
-	return result;
+	return true;
+}
+
+/*
+ * Takes a Handle Value Notification PDU without the opcode, the handle
+ * followed by the value, so that the same PDU can be sent to many servers.
+ */
+bool bt_gatt_server_send_notification_pdu(struct bt_gatt_server *server,
+					const uint8_t *pdu, uint16_t length,
+					bool multiple)
+{
+	uint16_t mtu;
+
+	if (!server || !pdu || length < 2)
+		return false;
+
+	/* Batched values are copied into a Multiple Handle Value PDU */
+	if (nfy_batching(server, multiple))
+		return bt_gatt_server_send_notification(server, get_le16(pdu),
+						pdu + 2, length - 2, multiple);
+
+	flush_notify_multiple(server);
+
+	mtu = bt_att_get_mtu(server->att);
+
+	if (!bt_att_send(server->att, BT_ATT_OP_HANDLE_NFY, pdu,
+				MIN(length, mtu - 1), NULL, NULL, NULL))
+		return false;
+
+	nfy_stats_update(server, BT_ATT_OP_HANDLE_NFY, 1);
+
+	return true;
+}
+
+bool bt_gatt_server_set_nfy_batching(struct bt_gatt_server *server,
+					uint8_t mode, unsigned int latency)
+{
+	if (!server || mode > BT_GATT_SERVER_NFY_BATCH_ADAPTIVE)
+		return false;
+
+	flush_notify_multiple(server);
+
+	server->nfy_batch = mode;
+	server->nfy_latency = latency ? latency : NFY_MULT_TIMEOUT;
+
+	return true;
+}
+
+bool bt_gatt_server_get_nfy_stats(struct bt_gatt_server *server,
+					struct bt_gatt_server_nfy_stats *stats)
+{
+	if (!server || !stats)
+		return false;
+
+	memcpy(stats, &server->nfy_stats, sizeof(*stats));
+
+	return true;
 }
 
 struct ind_data {
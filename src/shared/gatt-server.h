@@ -40,6 +40,26 @@ bool bt_gatt_server_set_authorize(struct bt_gatt_server *server,
 bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
 					uint16_t length, bool multiple);
+bool bt_gatt_server_send_notification_pdu(struct bt_gatt_server *server,
+					const uint8_t *pdu, uint16_t length,
+					bool multiple);
+
+#define BT_GATT_SERVER_NFY_BATCH_OFF		0x00
+#define BT_GATT_SERVER_NFY_BATCH_ON		0x01
+#define BT_GATT_SERVER_NFY_BATCH_ADAPTIVE	0x02
+
+struct bt_gatt_server_nfy_stats {
+	uint64_t notifications;		/* Values notified */
+	uint64_t pdus;			/* PDUs carrying them */
+	uint64_t mult_pdus;		/* Multiple Handle Value PDUs */
+	uint64_t full_flushes;		/* Batches sent because MTU was full */
+	uint64_t timeout_flushes;	/* Batches sent after latency expired */
+};
+
+bool bt_gatt_server_set_nfy_batching(struct bt_gatt_server *server,
+					uint8_t mode, unsigned int latency);
+bool bt_gatt_server_get_nfy_stats(struct bt_gatt_server *server,
+					struct bt_gatt_server_nfy_stats *stats);
 
 bool bt_gatt_server_send_indication(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
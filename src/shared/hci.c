@@ -23,6 +23,7 @@
 #include "src/shared/io.h"
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
+#include "src/shared/trace.h"
 #include "src/shared/hci.h"
 
 #define BTPROTO_HCI	1
@@ -135,6 +136,9 @@ static bool io_write_callback(struct io *io, void *user_data)
 	if (cmd) {
 		send_command(hci, cmd->opcode, cmd->data, cmd->size);
 		queue_push_tail(hci->rsp_queue, cmd);
+
+		BT_TRACE(hci_write, hci, cmd->id, cmd->opcode, cmd->size,
+								hci->num_cmds);
 	}
 
 	hci->writer_active = false;
@@ -182,6 +186,8 @@ static void process_response(struct bt_hci *hci, uint16_t opcode,
 	if (!cmd)
 		return;
 
+	BT_TRACE(hci_complete, hci, cmd->id, opcode, size);
+
 	/* Take a reference before calling the callback since that can unref
 	 * its reference destroying the instance.
 	 */
@@ -476,6 +482,9 @@ unsigned int bt_hci_send(struct bt_hci *hci, uint16_t opcode,
 		return 0;
 	}
 
+	BT_TRACE(hci_send, hci, cmd->id, opcode, size,
+					queue_length(hci->cmd_queue));
+
 	wakeup_writer(hci);
 
 	return cmd->id;
@@ -17,6 +17,7 @@
 #include <glib.h>
 
 #include "src/shared/io.h"
+#include "src/shared/trace.h"
 
 struct io_watch {
 	struct io *io;
@@ -153,11 +154,16 @@ static gboolean watch_callback(GIOChannel *channel, GIOCondition cond,
 	if (!destroy && (cond & (G_IO_ERR | G_IO_NVAL)))
 		return FALSE;
 
+	BT_TRACE(io_dispatch, g_io_channel_unix_get_fd(channel), cond,
+							watch->callback);
+
 	if (watch->callback)
 		result = watch->callback(watch->io, watch->user_data);
 	else
 		result = false;
 
+	BT_TRACE(io_return, g_io_channel_unix_get_fd(channel), result);
+
 	return result ? TRUE : FALSE;
 }
 
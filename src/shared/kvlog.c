@@ -0,0 +1,1122 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/kvlog.h"
+
+/*
+ * On-disk layout: a fixed file header followed by a sequence of records.
+ * Records are only ever appended. A record with KVLOG_FLAG_COMMIT closes a
+ * transaction; records following the last commit marker are discarded on
+ * load, so a crash in the middle of a transaction never exposes a partial
+ * update. The in-memory index maps each live key to the location of its
+ * latest value, and compaction rewrites only those values into a new file.
+ */
+
+#define KVLOG_MAGIC		"BTKVLOG"
+#define KVLOG_VERSION		1
+
+#define KVLOG_REC_PUT		0x01
+#define KVLOG_REC_DEL		0x02
+
+#define KVLOG_FLAG_COMMIT	0x01
+
+#define KVLOG_MAX_VALUE		(16 * 1024 * 1024)
+#define KVLOG_FLUSH_SIZE	(64 * 1024)
+#define KVLOG_COMPACT_MIN	(64 * 1024)
+#define KVLOG_INDEX_MIN		64
+
+struct kvlog_file_hdr {
+	uint8_t  magic[8];
+	uint32_t version;
+	uint32_t flags;
+} __attribute__ ((packed));
+
+struct kvlog_rec_hdr {
+	uint32_t crc;
+	uint8_t  type;
+	uint8_t  flags;
+	uint16_t key_len;
+	uint32_t val_len;
+} __attribute__ ((packed));
+
+struct kvlog_entry {
+	struct kvlog_entry *next;
+	uint32_t hash;
+	uint32_t len;
+	off_t offset;
+	uint16_t key_len;
+	char key[];
+};
+
+struct kvlog_op {
+	uint8_t type;
+	uint32_t len;
+	size_t rec_offset;
+	char *key;
+};
+
+struct kvlog_txn {
+	struct queue *ops;
+	uint8_t *buf;
+	size_t buf_len;
+	size_t buf_size;
+	size_t last_rec;
+	size_t flushed;
+};
+
+struct kvlog {
+	int fd;
+	char *path;
+	bool sync;
+	off_t size;
+	uint64_t live;
+	unsigned int compactions;
+	struct kvlog_entry **table;
+	unsigned int table_size;
+	unsigned int entries;
+	struct kvlog_txn *txn;
+};
+
+static uint32_t crc_table[4][256];
+
+static void crc_table_init(void)
+{
+	uint32_t c;
+	unsigned int i, j;
+
+	if (crc_table[0][1])
+		return;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		crc_table[0][i] = c;
+	}
+
+	for (i = 0; i < 256; i++) {
+		c = crc_table[0][i];
+		for (j = 1; j < 4; j++) {
+			c = crc_table[0][c & 0xff] ^ (c >> 8);
+			crc_table[j][i] = c;
+		}
+	}
+}
+
+/* Standard CRC-32, processed a word at a time (slicing-by-4) */
+static uint32_t crc32_update(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	crc = ~crc;
+
+	while (len >= 4) {
+		crc ^= p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+		crc = crc_table[3][crc & 0xff] ^
+			crc_table[2][(crc >> 8) & 0xff] ^
+			crc_table[1][(crc >> 16) & 0xff] ^
+			crc_table[0][crc >> 24];
+		p += 4;
+		len -= 4;
+	}
+
+	while (len--)
+		crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+static uint32_t key_hash(const char *key, size_t len)
+{
+	uint32_t hash = 2166136261u;
+
+	while (len--) {
+		hash ^= (uint8_t) *key++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static size_t rec_size(size_t key_len, size_t val_len)
+{
+	return sizeof(struct kvlog_rec_hdr) + key_len + val_len;
+}
+
+static struct kvlog_entry **index_lookup(struct kvlog *log, const char *key,
+						size_t key_len, uint32_t hash)
+{
+	struct kvlog_entry **entry;
+
+	entry = &log->table[hash & (log->table_size - 1)];
+
+	for (; *entry; entry = &(*entry)->next) {
+		if ((*entry)->hash != hash || (*entry)->key_len != key_len)
+			continue;
+
+		if (!memcmp((*entry)->key, key, key_len))
+			break;
+	}
+
+	return entry;
+}
+
+static void index_resize(struct kvlog *log, unsigned int size)
+{
+	struct kvlog_entry **table;
+	unsigned int i;
+
+	table = new0(struct kvlog_entry *, size);
+
+	for (i = 0; i < log->table_size; i++) {
+		struct kvlog_entry *entry = log->table[i];
+
+		while (entry) {
+			struct kvlog_entry *next = entry->next;
+			unsigned int bucket = entry->hash & (size - 1);
+
+			entry->next = table[bucket];
+			table[bucket] = entry;
+			entry = next;
+		}
+	}
+
+	free(log->table);
+	log->table = table;
+	log->table_size = size;
+}
+
+static void index_put(struct kvlog *log, const char *key, size_t key_len,
+						off_t offset, uint32_t len)
+{
+	struct kvlog_entry **slot, *entry;
+	uint32_t hash = key_hash(key, key_len);
+
+	slot = index_lookup(log, key, key_len, hash);
+	if (*slot) {
+		entry = *slot;
+		log->live -= rec_size(entry->key_len, entry->len);
+		goto done;
+	}
+
+	entry = malloc(sizeof(*entry) + key_len + 1);
+	if (!entry)
+		return;
+
+	entry->next = NULL;
+	entry->hash = hash;
+	entry->key_len = key_len;
+	memcpy(entry->key, key, key_len);
+	entry->key[key_len] = '\0';
+	*slot = entry;
+
+	if (++log->entries > log->table_size)
+		index_resize(log, log->table_size * 2);
+
+done:
+	entry->offset = offset;
+	entry->len = len;
+	log->live += rec_size(entry->key_len, entry->len);
+}
+
+static void index_del(struct kvlog *log, const char *key, size_t key_len)
+{
+	struct kvlog_entry **slot, *entry;
+
+	slot = index_lookup(log, key, key_len, key_hash(key, key_len));
+	if (!*slot)
+		return;
+
+	entry = *slot;
+	*slot = entry->next;
+
+	log->live -= rec_size(entry->key_len, entry->len);
+	log->entries--;
+	free(entry);
+}
+
+static void index_clear(struct kvlog *log)
+{
+	unsigned int i;
+
+	for (i = 0; i < log->table_size; i++) {
+		struct kvlog_entry *entry = log->table[i];
+
+		while (entry) {
+			struct kvlog_entry *next = entry->next;
+
+			free(entry);
+			entry = next;
+		}
+
+		log->table[i] = NULL;
+	}
+
+	log->entries = 0;
+	log->live = 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len, off_t offset)
+{
+	const uint8_t *p = buf;
+
+	while (len) {
+		ssize_t written = pwrite(fd, p, len, offset);
+
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		p += written;
+		len -= written;
+		offset += written;
+	}
+
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len, off_t offset)
+{
+	uint8_t *p = buf;
+
+	while (len) {
+		ssize_t got = pread(fd, p, len, offset);
+
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		if (!got)
+			return -EIO;
+
+		p += got;
+		len -= got;
+		offset += got;
+	}
+
+	return 0;
+}
+
+static bool parse_rec(const uint8_t *data, size_t size, size_t offset,
+					struct kvlog_rec_hdr *hdr, size_t *len)
+{
+	uint32_t crc;
+
+	if (size - offset < sizeof(*hdr))
+		return false;
+
+	memcpy(hdr, data + offset, sizeof(*hdr));
+	hdr->crc = le32_to_cpu(hdr->crc);
+	hdr->key_len = le16_to_cpu(hdr->key_len);
+	hdr->val_len = le32_to_cpu(hdr->val_len);
+
+	if (hdr->type != KVLOG_REC_PUT && hdr->type != KVLOG_REC_DEL)
+		return false;
+
+	if (!hdr->key_len || hdr->val_len > KVLOG_MAX_VALUE)
+		return false;
+
+	*len = rec_size(hdr->key_len, hdr->val_len);
+	if (size - offset < *len)
+		return false;
+
+	crc = crc32_update(0, data + offset + 4, *len - 4);
+
+	return crc == hdr->crc;
+}
+
+/* Apply an already validated record, returns its size */
+static size_t apply_rec(struct kvlog *log, const uint8_t *data, size_t offset)
+{
+	struct kvlog_rec_hdr hdr;
+	const char *key = (const char *) data + offset + sizeof(hdr);
+
+	memcpy(&hdr, data + offset, sizeof(hdr));
+	hdr.key_len = le16_to_cpu(hdr.key_len);
+	hdr.val_len = le32_to_cpu(hdr.val_len);
+
+	if (hdr.type == KVLOG_REC_PUT)
+		index_put(log, key, hdr.key_len,
+				offset + sizeof(hdr) + hdr.key_len,
+				hdr.val_len);
+	else
+		index_del(log, key, hdr.key_len);
+
+	return rec_size(hdr.key_len, hdr.val_len);
+}
+
+static int replay(struct kvlog *log, off_t size)
+{
+	struct kvlog_file_hdr fhdr;
+	struct kvlog_rec_hdr hdr;
+	uint8_t *data;
+	size_t offset, txn_start, committed, len;
+
+	if ((size_t) size < sizeof(fhdr))
+		return -EINVAL;
+
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, log->fd, 0);
+	if (data == MAP_FAILED)
+		return -errno;
+
+	memcpy(&fhdr, data, sizeof(fhdr));
+	if (memcmp(fhdr.magic, KVLOG_MAGIC, sizeof(KVLOG_MAGIC)) ||
+				le32_to_cpu(fhdr.version) != KVLOG_VERSION) {
+		munmap(data, size);
+		return -EINVAL;
+	}
+
+	offset = committed = txn_start = sizeof(fhdr);
+
+	while (parse_rec(data, size, offset, &hdr, &len)) {
+		offset += len;
+
+		if (!(hdr.flags & KVLOG_FLAG_COMMIT))
+			continue;
+
+		/* Transaction complete, apply all of its records */
+		while (txn_start < offset)
+			txn_start += apply_rec(log, data, txn_start);
+
+		committed = offset;
+	}
+
+	munmap(data, size);
+
+	/* Drop a torn or uncommitted tail left behind by a crash */
+	if ((off_t) committed < size && ftruncate(log->fd, committed) < 0)
+		return -errno;
+
+	log->size = committed;
+
+	return 0;
+}
+
+static int write_file_hdr(int fd)
+{
+	struct kvlog_file_hdr fhdr;
+
+	memset(&fhdr, 0, sizeof(fhdr));
+	memcpy(fhdr.magic, KVLOG_MAGIC, sizeof(KVLOG_MAGIC));
+	fhdr.version = cpu_to_le32(KVLOG_VERSION);
+
+	return write_all(fd, &fhdr, sizeof(fhdr), 0);
+}
+
+struct kvlog *kvlog_open(const char *path, bool *created)
+{
+	struct kvlog *log;
+	struct stat st;
+	int fd, err;
+
+	if (!path)
+		return NULL;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return NULL;
+
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0 || fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	crc_table_init();
+
+	log = new0(struct kvlog, 1);
+	log->fd = fd;
+	log->path = strdup(path);
+	log->sync = true;
+	log->table_size = KVLOG_INDEX_MIN;
+	log->table = new0(struct kvlog_entry *, log->table_size);
+
+	if (created)
+		*created = !st.st_size;
+
+	if (!st.st_size) {
+		err = write_file_hdr(fd);
+		if (!err && fsync(fd) < 0)
+			err = -errno;
+
+		log->size = sizeof(struct kvlog_file_hdr);
+	} else
+		err = replay(log, st.st_size);
+
+	if (err < 0) {
+		kvlog_close(log);
+		errno = -err;
+		return NULL;
+	}
+
+	return log;
+}
+
+static void free_op(void *data)
+{
+	struct kvlog_op *op = data;
+
+	free(op->key);
+	free(op);
+}
+
+static void txn_free(struct kvlog_txn *txn)
+{
+	if (!txn)
+		return;
+
+	queue_destroy(txn->ops, free_op);
+	free(txn->buf);
+	free(txn);
+}
+
+void kvlog_close(struct kvlog *log)
+{
+	if (!log)
+		return;
+
+	if (log->txn)
+		kvlog_abort(log);
+
+	index_clear(log);
+	free(log->table);
+	free(log->path);
+	close(log->fd);
+	free(log);
+}
+
+bool kvlog_set_sync(struct kvlog *log, bool sync)
+{
+	if (!log)
+		return false;
+
+	log->sync = sync;
+
+	return true;
+}
+
+bool kvlog_get_stats(struct kvlog *log, struct kvlog_stats *stats)
+{
+	if (!log || !stats)
+		return false;
+
+	stats->entries = log->entries;
+	stats->file_size = log->size;
+	stats->live_bytes = log->live;
+	stats->dead_bytes = log->size - sizeof(struct kvlog_file_hdr) -
+								log->live;
+	stats->compactions = log->compactions;
+
+	return true;
+}
+
+static struct kvlog_entry *find_entry(struct kvlog *log, const char *key)
+{
+	size_t key_len = strlen(key);
+
+	return *index_lookup(log, key, key_len, key_hash(key, key_len));
+}
+
+void *kvlog_get(struct kvlog *log, const char *key, size_t *len)
+{
+	struct kvlog_entry *entry;
+	char *value;
+
+	if (!log || !key)
+		return NULL;
+
+	entry = find_entry(log, key);
+	if (!entry)
+		return NULL;
+
+	value = malloc(entry->len + 1);
+	if (!value)
+		return NULL;
+
+	if (read_all(log->fd, value, entry->len, entry->offset) < 0) {
+		free(value);
+		return NULL;
+	}
+
+	value[entry->len] = '\0';
+
+	if (len)
+		*len = entry->len;
+
+	return value;
+}
+
+bool kvlog_contains(struct kvlog *log, const char *key)
+{
+	if (!log || !key)
+		return false;
+
+	return find_entry(log, key) != NULL;
+}
+
+bool kvlog_begin(struct kvlog *log)
+{
+	if (!log || log->txn)
+		return false;
+
+	log->txn = new0(struct kvlog_txn, 1);
+	log->txn->ops = queue_new();
+
+	return true;
+}
+
+static int txn_flush(struct kvlog *log, size_t len)
+{
+	struct kvlog_txn *txn = log->txn;
+	int err;
+
+	err = write_all(log->fd, txn->buf, len,
+					log->size + txn->flushed);
+	if (err < 0)
+		return err;
+
+	memmove(txn->buf, txn->buf + len, txn->buf_len - len);
+	txn->buf_len -= len;
+	txn->last_rec -= len;
+	txn->flushed += len;
+
+	return 0;
+}
+
+static void seal_rec(uint8_t *rec, uint8_t flags)
+{
+	struct kvlog_rec_hdr *hdr = (void *) rec;
+	uint32_t crc;
+
+	hdr->flags |= flags;
+	crc = crc32_update(0, rec + 4, rec_size(le16_to_cpu(hdr->key_len),
+					le32_to_cpu(hdr->val_len)) - 4);
+	hdr->crc = cpu_to_le32(crc);
+}
+
+static int txn_append(struct kvlog *log, uint8_t type, const char *key,
+					const void *value, size_t len)
+{
+	struct kvlog_txn *txn = log->txn;
+	struct kvlog_rec_hdr hdr;
+	struct kvlog_op *op;
+	size_t key_len = strlen(key);
+	size_t size = rec_size(key_len, len);
+	uint8_t *rec;
+	int err;
+
+	if (!key_len || key_len > UINT16_MAX || len > KVLOG_MAX_VALUE)
+		return -EINVAL;
+
+	/*
+	 * Large transactions are streamed to the file as they grow. The most
+	 * recent record always stays buffered so the commit marker can still
+	 * be set on it.
+	 */
+	if (txn->buf_len >= KVLOG_FLUSH_SIZE) {
+		err = txn_flush(log, txn->buf_len);
+		if (err < 0)
+			return err;
+	}
+
+	if (txn->buf_len + size > txn->buf_size) {
+		size_t buf_size = txn->buf_size ? txn->buf_size : 4096;
+		uint8_t *buf;
+
+		while (buf_size < txn->buf_len + size)
+			buf_size *= 2;
+
+		buf = realloc(txn->buf, buf_size);
+		if (!buf)
+			return -ENOMEM;
+
+		txn->buf = buf;
+		txn->buf_size = buf_size;
+	}
+
+	hdr.crc = 0;
+	hdr.type = type;
+	hdr.flags = 0;
+	hdr.key_len = cpu_to_le16(key_len);
+	hdr.val_len = cpu_to_le32(len);
+
+	rec = txn->buf + txn->buf_len;
+	memcpy(rec, &hdr, sizeof(hdr));
+	memcpy(rec + sizeof(hdr), key, key_len);
+	if (len)
+		memcpy(rec + sizeof(hdr) + key_len, value, len);
+
+	seal_rec(rec, 0);
+
+	op = new0(struct kvlog_op, 1);
+	op->type = type;
+	op->len = len;
+	op->rec_offset = txn->flushed + txn->buf_len;
+	op->key = strdup(key);
+	queue_push_tail(txn->ops, op);
+
+	txn->last_rec = txn->buf_len;
+	txn->buf_len += size;
+
+	return 0;
+}
+
+static int maybe_compact(struct kvlog *log)
+{
+	uint64_t dead = log->size - sizeof(struct kvlog_file_hdr) - log->live;
+
+	if (dead < KVLOG_COMPACT_MIN || dead < log->live)
+		return 0;
+
+	return kvlog_compact(log);
+}
+
+int kvlog_commit(struct kvlog *log)
+{
+	struct kvlog_txn *txn;
+	const struct queue_entry *entry;
+	int err;
+
+	if (!log || !log->txn)
+		return -EINVAL;
+
+	txn = log->txn;
+
+	if (queue_isempty(txn->ops)) {
+		kvlog_abort(log);
+		return 0;
+	}
+
+	/* Only the last record of a transaction carries the commit marker */
+	seal_rec(txn->buf + txn->last_rec, KVLOG_FLAG_COMMIT);
+
+	err = txn_flush(log, txn->buf_len);
+	if (!err && log->sync && fdatasync(log->fd) < 0)
+		err = -errno;
+
+	if (err < 0) {
+		kvlog_abort(log);
+		return err;
+	}
+
+	for (entry = queue_get_entries(txn->ops); entry; entry = entry->next) {
+		struct kvlog_op *op = entry->data;
+		size_t key_len = strlen(op->key);
+
+		if (op->type == KVLOG_REC_PUT)
+			index_put(log, op->key, key_len, log->size +
+					op->rec_offset +
+					sizeof(struct kvlog_rec_hdr) + key_len,
+					op->len);
+		else
+			index_del(log, op->key, key_len);
+	}
+
+	log->size += txn->flushed;
+	log->txn = NULL;
+	txn_free(txn);
+
+	return maybe_compact(log);
+}
+
+void kvlog_abort(struct kvlog *log)
+{
+	if (!log || !log->txn)
+		return;
+
+	/*
+	 * Anything streamed out is uncommitted and can simply be cut off. If
+	 * that fails the next transaction overwrites it from the same offset.
+	 */
+	if (log->txn->flushed && ftruncate(log->fd, log->size) < 0)
+		log->txn->flushed = 0;
+
+	txn_free(log->txn);
+	log->txn = NULL;
+}
+
+static int single_op(struct kvlog *log, uint8_t type, const char *key,
+					const void *value, size_t len)
+{
+	bool own;
+	int err;
+
+	if (!log || !key)
+		return -EINVAL;
+
+	own = kvlog_begin(log);
+
+	err = txn_append(log, type, key, value, len);
+	if (err < 0) {
+		if (own)
+			kvlog_abort(log);
+		return err;
+	}
+
+	return own ? kvlog_commit(log) : 0;
+}
+
+int kvlog_put(struct kvlog *log, const char *key, const void *value,
+								size_t len)
+{
+	return single_op(log, KVLOG_REC_PUT, key, value, len);
+}
+
+int kvlog_del(struct kvlog *log, const char *key)
+{
+	if (!log || !key)
+		return -EINVAL;
+
+	if (!find_entry(log, key))
+		return -ENOENT;
+
+	return single_op(log, KVLOG_REC_DEL, key, NULL, 0);
+}
+
+static void del_key(const char *key, size_t len, void *user_data)
+{
+	struct queue *keys = user_data;
+
+	queue_push_tail(keys, strdup(key));
+}
+
+int kvlog_del_prefix(struct kvlog *log, const char *prefix)
+{
+	struct queue *keys;
+	const struct queue_entry *entry;
+	bool own;
+	int err = 0;
+
+	if (!log || !prefix)
+		return -EINVAL;
+
+	keys = queue_new();
+	kvlog_foreach(log, prefix, del_key, keys);
+
+	if (queue_isempty(keys)) {
+		queue_destroy(keys, NULL);
+		return 0;
+	}
+
+	own = kvlog_begin(log);
+
+	for (entry = queue_get_entries(keys); entry; entry = entry->next) {
+		err = txn_append(log, KVLOG_REC_DEL, entry->data, NULL, 0);
+		if (err < 0)
+			break;
+	}
+
+	queue_destroy(keys, free);
+
+	if (!own)
+		return err;
+
+	if (err < 0) {
+		kvlog_abort(log);
+		return err;
+	}
+
+	return kvlog_commit(log);
+}
+
+void kvlog_foreach(struct kvlog *log, const char *prefix,
+				kvlog_foreach_func_t function, void *user_data)
+{
+	size_t prefix_len;
+	unsigned int i;
+
+	if (!log || !function)
+		return;
+
+	prefix_len = prefix ? strlen(prefix) : 0;
+
+	for (i = 0; i < log->table_size; i++) {
+		struct kvlog_entry *entry;
+
+		for (entry = log->table[i]; entry; entry = entry->next) {
+			if (prefix_len && (entry->key_len < prefix_len ||
+				memcmp(entry->key, prefix, prefix_len)))
+				continue;
+
+			function(entry->key, entry->len, user_data);
+		}
+	}
+}
+
+static int sync_dir(const char *path)
+{
+	char *dir, *sep;
+	int fd, err = 0;
+
+	dir = strdup(path);
+	if (!dir)
+		return -ENOMEM;
+
+	sep = strrchr(dir, '/');
+	if (sep)
+		*(sep == dir ? sep + 1 : sep) = '\0';
+	else
+		strcpy(dir, ".");
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 || fsync(fd) < 0)
+		err = -errno;
+
+	if (fd >= 0)
+		close(fd);
+
+	free(dir);
+
+	return err;
+}
+
+static int compact_entry(struct kvlog *log, int fd, struct kvlog_entry *entry,
+					uint8_t **buf, size_t *buf_size,
+					off_t offset)
+{
+	struct kvlog_rec_hdr hdr;
+	size_t size = rec_size(entry->key_len, entry->len);
+	int err;
+
+	if (size > *buf_size) {
+		uint8_t *tmp = realloc(*buf, size);
+
+		if (!tmp)
+			return -ENOMEM;
+
+		*buf = tmp;
+		*buf_size = size;
+	}
+
+	err = read_all(log->fd, *buf + sizeof(hdr) + entry->key_len,
+						entry->len, entry->offset);
+	if (err < 0)
+		return err;
+
+	hdr.crc = 0;
+	hdr.type = KVLOG_REC_PUT;
+	hdr.flags = 0;
+	hdr.key_len = cpu_to_le16(entry->key_len);
+	hdr.val_len = cpu_to_le32(entry->len);
+
+	memcpy(*buf, &hdr, sizeof(hdr));
+	memcpy(*buf + sizeof(hdr), entry->key, entry->key_len);
+
+	/* Every compacted record is a complete transaction on its own */
+	seal_rec(*buf, KVLOG_FLAG_COMMIT);
+
+	return write_all(fd, *buf, size, offset);
+}
+
+int kvlog_compact(struct kvlog *log)
+{
+	char *tmp_path;
+	uint8_t *buf = NULL;
+	size_t buf_size = 0;
+	off_t offset, *offsets;
+	unsigned int i, n;
+	int fd, err;
+
+	if (!log || log->txn)
+		return -EINVAL;
+
+	if (asprintf(&tmp_path, "%s.tmp", log->path) < 0)
+		return -ENOMEM;
+
+	fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+							S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		err = -errno;
+		free(tmp_path);
+		return err;
+	}
+
+	offsets = new0(off_t, log->entries ? log->entries : 1);
+
+	err = write_file_hdr(fd);
+	offset = sizeof(struct kvlog_file_hdr);
+
+	for (i = 0, n = 0; !err && i < log->table_size; i++) {
+		struct kvlog_entry *entry;
+
+		for (entry = log->table[i]; entry; entry = entry->next) {
+			err = compact_entry(log, fd, entry, &buf, &buf_size,
+									offset);
+			if (err < 0)
+				break;
+
+			offsets[n++] = offset + sizeof(struct kvlog_rec_hdr) +
+								entry->key_len;
+			offset += rec_size(entry->key_len, entry->len);
+		}
+	}
+
+	free(buf);
+
+	if (!err && fsync(fd) < 0)
+		err = -errno;
+
+	if (!err && rename(tmp_path, log->path) < 0)
+		err = -errno;
+
+	if (err < 0) {
+		close(fd);
+		unlink(tmp_path);
+		free(tmp_path);
+		free(offsets);
+		return err;
+	}
+
+	free(tmp_path);
+	sync_dir(log->path);
+
+	/* Take the lock over to the new file before dropping the old one */
+	flock(fd, LOCK_EX | LOCK_NB);
+	close(log->fd);
+	log->fd = fd;
+	log->size = offset;
+	log->compactions++;
+
+	/* The table was walked in the same order when writing the file */
+	for (i = 0, n = 0; i < log->table_size; i++) {
+		struct kvlog_entry *entry;
+
+		for (entry = log->table[i]; entry; entry = entry->next)
+			entry->offset = offsets[n++];
+	}
+
+	free(offsets);
+
+	return 0;
+}
+
+static int import_file(struct kvlog *log, const char *path, const char *key)
+{
+	struct stat st;
+	void *data = NULL;
+	int fd, err;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0) {
+		err = -errno;
+		goto done;
+	}
+
+	if (st.st_size > KVLOG_MAX_VALUE) {
+		err = -EFBIG;
+		goto done;
+	}
+
+	if (st.st_size) {
+		data = malloc(st.st_size);
+		if (!data) {
+			err = -ENOMEM;
+			goto done;
+		}
+
+		err = read_all(fd, data, st.st_size, 0);
+		if (err < 0)
+			goto done;
+	}
+
+	err = txn_append(log, KVLOG_REC_PUT, key, data, st.st_size);
+
+done:
+	free(data);
+	close(fd);
+
+	return err;
+}
+
+static int import_dir(struct kvlog *log, const struct stat *self,
+				const char *dirname, const char *prefix)
+{
+	DIR *dir;
+	struct dirent *entry;
+	int err = 0;
+
+	dir = opendir(dirname);
+	if (!dir)
+		return -errno;
+
+	while (!err && (entry = readdir(dir)) != NULL) {
+		char path[PATH_MAX], key[PATH_MAX];
+		struct stat st;
+
+		/* Skip hidden entries as well as "." and ".." */
+		if (entry->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dirname, entry->d_name);
+		snprintf(key, sizeof(key), "%s%s%s", prefix,
+					*prefix ? "/" : "", entry->d_name);
+
+		if (lstat(path, &st) < 0)
+			continue;
+
+		if (st.st_dev == self->st_dev && st.st_ino == self->st_ino)
+			continue;
+
+		if (S_ISDIR(st.st_mode))
+			err = import_dir(log, self, path, key);
+		else if (S_ISREG(st.st_mode) && strsuffix(entry->d_name,
+									".tmp"))
+			err = import_file(log, path, key);
+	}
+
+	closedir(dir);
+
+	return err;
+}
+
+int kvlog_import_dir(struct kvlog *log, const char *dirname)
+{
+	struct stat self;
+	int err;
+
+	if (!log || !dirname)
+		return -EINVAL;
+
+	if (fstat(log->fd, &self) < 0)
+		return -errno;
+
+	/* The whole tree is imported as a single transaction */
+	if (!kvlog_begin(log))
+		return -EBUSY;
+
+	err = import_dir(log, &self, dirname, "");
+	if (err < 0) {
+		kvlog_abort(log);
+		return err;
+	}
+
+	return kvlog_commit(log);
+}
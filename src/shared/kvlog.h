@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct kvlog;
+
+struct kvlog_stats {
+	unsigned int entries;
+	uint64_t file_size;
+	uint64_t live_bytes;
+	uint64_t dead_bytes;
+	unsigned int compactions;
+};
+
+typedef void (*kvlog_foreach_func_t)(const char *key, size_t len,
+							void *user_data);
+
+struct kvlog *kvlog_open(const char *path, bool *created);
+void kvlog_close(struct kvlog *log);
+
+bool kvlog_set_sync(struct kvlog *log, bool sync);
+bool kvlog_get_stats(struct kvlog *log, struct kvlog_stats *stats);
+
+void *kvlog_get(struct kvlog *log, const char *key, size_t *len);
+bool kvlog_contains(struct kvlog *log, const char *key);
+int kvlog_put(struct kvlog *log, const char *key, const void *value,
+								size_t len);
+int kvlog_del(struct kvlog *log, const char *key);
+int kvlog_del_prefix(struct kvlog *log, const char *prefix);
+
+bool kvlog_begin(struct kvlog *log);
+int kvlog_commit(struct kvlog *log);
+void kvlog_abort(struct kvlog *log);
+
+void kvlog_foreach(struct kvlog *log, const char *prefix,
+				kvlog_foreach_func_t function, void *user_data);
+
+int kvlog_compact(struct kvlog *log);
+int kvlog_import_dir(struct kvlog *log, const char *dirname);
@@ -29,6 +29,7 @@
 
 #include "mainloop.h"
 #include "mainloop-notify.h"
+#include "trace.h"
 
 #define MAX_EPOLL_EVENTS 10
 
@@ -102,9 +103,15 @@ int mainloop_run(void)
 
 		for (n = 0; n < nfds; n++) {
 			struct mainloop_data *data = events[n].data.ptr;
+			int fd = data->fd;
 
-			data->callback(data->fd, events[n].events,
-							data->user_data);
+			BT_TRACE(mainloop_dispatch, fd, events[n].events,
+							data->callback, nfds);
+
+			data->callback(fd, events[n].events, data->user_data);
+
+			/* The callback may have removed and freed data */
+			BT_TRACE(mainloop_return, fd);
 		}
 	}
 
@@ -24,6 +24,7 @@
 #include "src/shared/io.h"
 #include "src/shared/queue.h"
 #include "src/shared/util.h"
+#include "src/shared/trace.h"
 #include "src/shared/mgmt.h"
 
 struct mgmt {
@@ -177,6 +178,10 @@ static bool send_request(struct mgmt *mgmt, struct mgmt_request *request)
 
 	queue_push_tail(mgmt->pending_list, request);
 
+	BT_TRACE(mgmt_write, mgmt, request->id, request->opcode,
+				request->index, request->len,
+				queue_length(mgmt->pending_list));
+
 	return true;
 }
 
@@ -249,6 +254,9 @@ static void request_complete(struct mgmt *mgmt, uint8_t status,
 	request = queue_remove_if(mgmt->pending_list,
 					match_request_opcode_index, &match);
 	if (request) {
+		BT_TRACE(mgmt_complete, mgmt, request->id, opcode, index,
+								status);
+
 		if (request->callback)
 			request->callback(status, length, param,
 							request->user_data);
@@ -716,6 +724,9 @@ unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 		return 0;
 	}
 
+	BT_TRACE(mgmt_send, mgmt, request->id, opcode, index, length,
+				queue_length(mgmt->request_queue));
+
 	wakeup_writer(mgmt);
 
 	return request->id;
@@ -741,6 +752,8 @@ unsigned int mgmt_send_nowait(struct mgmt *mgmt, uint16_t opcode, uint16_t index
 
 	request->id = mgmt->next_request_id++;
 
+	BT_TRACE(mgmt_send, mgmt, request->id, opcode, index, length, 0);
+
 	if (!send_request(mgmt, request))
 		return 0;
 
@@ -773,6 +786,9 @@ unsigned int mgmt_reply(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 		return 0;
 	}
 
+	BT_TRACE(mgmt_send, mgmt, request->id, opcode, index, length,
+				queue_length(mgmt->reply_queue));
+
 	wakeup_writer(mgmt);
 
 	return request->id;
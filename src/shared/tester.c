@@ -20,8 +20,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
 #include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 
 #include <glib.h>
 
@@ -107,6 +109,34 @@ static gboolean option_monitor = FALSE;
 static gboolean option_list = FALSE;
 static const char *option_prefix = NULL;
 static const char *option_string = NULL;
+static gint option_jobs = 0;
+
+/*
+ * With --jobs the tester forks worker processes right after the options
+ * are parsed. Every process registers the same list of test cases, the
+ * parent hands out test cases by their position in that list through a
+ * pipe per worker, and the workers report back on a shared result pipe.
+ */
+struct job_result {
+	uint32_t worker;
+	uint32_t index;
+	uint32_t result;
+	double exec_time;
+};
+
+static int *job_fds;
+static pid_t *job_pids;
+static int job_cmd_fd = -1;
+static int job_result_fd = -1;
+static uint32_t job_worker;
+
+/*
+ * Controllers show up in every process that listens on the management
+ * interface. The pre-setup stage, which creates the emulated controller
+ * and picks up its index, is therefore serialized across the workers.
+ */
+static int pre_setup_lock_fd = -1;
+static bool pre_setup_locked;
 
 struct monitor_hdr {
 	uint16_t opcode;
@@ -357,10 +387,64 @@ void *tester_get_data(void)
 	return test->user_data;
 }
 
+static int compare_exec_time(const void *a, const void *b)
+{
+	const struct test_case *test1 = *(const struct test_case **) a;
+	const struct test_case *test2 = *(const struct test_case **) b;
+	gdouble time1 = test1->end_time - test1->start_time;
+	gdouble time2 = test2->end_time - test2->start_time;
+
+	if (time1 < time2)
+		return 1;
+
+	if (time1 > time2)
+		return -1;
+
+	return 0;
+}
+
+static void print_slowest(unsigned int count)
+{
+	struct test_case **tests;
+	unsigned int num = 0, i;
+	GList *list;
+
+	if (g_list_length(test_list) < 2)
+		return;
+
+	tests = new0(struct test_case *, g_list_length(test_list));
+
+	for (list = g_list_first(test_list); list; list = g_list_next(list)) {
+		struct test_case *test = list->data;
+
+		if (test->result != TEST_RESULT_NOT_RUN)
+			tests[num++] = test;
+	}
+
+	if (num < 2)
+		goto done;
+
+	qsort(tests, num, sizeof(*tests), compare_exec_time);
+
+	if (count > num)
+		count = num;
+
+	tester_log("");
+	print_text(COLOR_HIGHLIGHT, "Slowest Tests");
+	print_text(COLOR_HIGHLIGHT, "-------------");
+
+	for (i = 0; i < count; i++)
+		tester_log("%-52s %8.3f seconds", tests[i]->name,
+				tests[i]->end_time - tests[i]->start_time);
+
+done:
+	free(tests);
+}
+
 static int tester_summarize(void)
 {
 	unsigned int not_run = 0, passed = 0, failed = 0;
-	gdouble execution_time;
+	gdouble execution_time, test_time = 0;
 	GList *list;
 
 	tester_log("");
@@ -374,6 +458,9 @@ static int tester_summarize(void)
 
 		exec_time = test->end_time - test->start_time;
 
+		if (test->result != TEST_RESULT_NOT_RUN)
+			test_time += exec_time;
+
 		switch (test->result) {
 		case TEST_RESULT_NOT_RUN:
 			print_summary(test->name, COLOR_YELLOW, "Not Run", "");
@@ -406,8 +493,17 @@ static int tester_summarize(void)
 			(float) passed * 100 / (not_run + passed + failed) : 0,
 			failed, not_run);
 
+	print_slowest(5);
+
 	execution_time = g_timer_elapsed(test_timer, NULL);
-	tester_log("Overall execution time: %.3g seconds", execution_time);
+
+	if (job_fds)
+		tester_log("Overall execution time: %.3g seconds "
+				"(%.3g seconds of tests in %d jobs)", execution_time,
+				test_time, option_jobs);
+	else
+		tester_log("Overall execution time: %.3g seconds",
+							execution_time);
 
 	return failed;
 }
@@ -446,11 +542,56 @@ static gboolean test_timeout(gpointer user_data)
 	return FALSE;
 }
 
+static void lock_pre_setup(bool lock)
+{
+	struct flock fl;
+
+	if (pre_setup_lock_fd < 0 || pre_setup_locked == lock)
+		return;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = lock ? F_WRLCK : F_UNLCK;
+	fl.l_whence = SEEK_SET;
+
+	/* The lock goes away with the process if a worker crashes */
+	while (fcntl(pre_setup_lock_fd, F_SETLKW, &fl) < 0) {
+		if (errno != EINTR)
+			return;
+	}
+
+	pre_setup_locked = lock;
+}
+
+static GList *next_job(void)
+{
+	uint32_t index;
+
+	if (read(job_cmd_fd, &index, sizeof(index)) != sizeof(index))
+		return NULL;
+
+	return g_list_nth(test_list, index);
+}
+
+static void report_job(struct test_case *test)
+{
+	struct job_result res;
+
+	res.worker = job_worker;
+	res.index = g_list_index(test_list, test);
+	res.result = test->result;
+	res.exec_time = test->end_time - test->start_time;
+
+	if (write(job_result_fd, &res, sizeof(res)) != sizeof(res))
+		tester_warn("Failed to report result: %s", strerror(errno));
+}
+
 static void next_test_case(void)
 {
 	struct test_case *test;
 
-	if (test_current)
+	if (job_cmd_fd >= 0)
+		test_current = next_job();
+	else if (test_current)
 		test_current = g_list_next(test_current);
 	else
 		test_current = test_list;
@@ -475,6 +616,8 @@ static void next_test_case(void)
 
 	test->stage = TEST_STAGE_PRE_SETUP;
 
+	lock_pre_setup(true);
+
 	test->pre_setup_func(test->test_data);
 }
 
@@ -508,7 +651,13 @@ static gboolean done_callback(gpointer user_data)
 
 	test->end_time = g_timer_elapsed(test_timer, NULL);
 
+	lock_pre_setup(false);
+
 	print_progress(test->name, COLOR_BLACK, "done");
+
+	if (job_result_fd >= 0)
+		report_job(test);
+
 	next_test_case();
 
 	return FALSE;
@@ -526,6 +675,8 @@ void tester_pre_setup_complete(void)
 	if (test->stage != TEST_STAGE_PRE_SETUP)
 		return;
 
+	lock_pre_setup(false);
+
 	g_idle_add(setup_callback, test);
 }
 
@@ -546,6 +697,8 @@ void tester_pre_setup_failed(void)
 		test->timeout_id = 0;
 	}
 
+	lock_pre_setup(false);
+
 	print_progress(test->name, COLOR_RED, "pre setup failed");
 
 	g_idle_add(done_callback, test);
@@ -818,9 +971,208 @@ static GOptionEntry options[] = {
 				"Run tests matching provided prefix" },
 	{ "string", 's', 0, G_OPTION_ARG_STRING, &option_string,
 				"Run tests matching provided string" },
+	{ "jobs", 'j', 0, G_OPTION_ARG_INT, &option_jobs,
+				"Run tests in parallel worker processes" },
 	{ NULL },
 };
 
+static void start_workers(void)
+{
+	char path[] = "/tmp/tester-XXXXXX";
+	int results[2];
+	int i;
+
+	pre_setup_lock_fd = mkstemp(path);
+	if (pre_setup_lock_fd < 0) {
+		perror("Failed to create lock file");
+		exit(EXIT_FAILURE);
+	}
+
+	unlink(path);
+
+	if (pipe(results) < 0) {
+		perror("Failed to create result pipe");
+		exit(EXIT_FAILURE);
+	}
+
+	job_fds = new0(int, option_jobs);
+	job_pids = new0(pid_t, option_jobs);
+
+	fflush(stdout);
+
+	for (i = 0; i < option_jobs; i++) {
+		int fds[2];
+		pid_t pid;
+
+		if (pipe(fds) < 0) {
+			perror("Failed to create job pipe");
+			exit(EXIT_FAILURE);
+		}
+
+		pid = fork();
+		if (pid < 0) {
+			perror("Failed to start worker");
+			exit(EXIT_FAILURE);
+		}
+
+		if (!pid) {
+			int j;
+
+			for (j = 0; j < i; j++)
+				close(job_fds[j]);
+
+			free(job_fds);
+			free(job_pids);
+			job_fds = NULL;
+			job_pids = NULL;
+
+			close(fds[1]);
+			close(results[0]);
+
+			job_worker = i;
+			job_cmd_fd = fds[0];
+			job_result_fd = results[1];
+
+			/* Only the parent reports progress */
+			if (!option_debug) {
+				int fd = open("/dev/null", O_WRONLY);
+
+				if (fd >= 0) {
+					dup2(fd, STDOUT_FILENO);
+					close(fd);
+				}
+			}
+
+			return;
+		}
+
+		close(fds[0]);
+		job_fds[i] = fds[1];
+		job_pids[i] = pid;
+	}
+
+	close(results[1]);
+	close(pre_setup_lock_fd);
+	pre_setup_lock_fd = -1;
+	job_result_fd = results[0];
+
+	signal(SIGPIPE, SIG_IGN);
+}
+
+static bool send_job(uint32_t worker, uint32_t index)
+{
+	if (job_fds[worker] < 0)
+		return false;
+
+	if (write(job_fds[worker], &index, sizeof(index)) == sizeof(index))
+		return true;
+
+	close(job_fds[worker]);
+	job_fds[worker] = -1;
+
+	return false;
+}
+
+static void close_job(uint32_t worker)
+{
+	if (job_fds[worker] < 0)
+		return;
+
+	close(job_fds[worker]);
+	job_fds[worker] = -1;
+}
+
+static void run_jobs(void)
+{
+	struct test_case **tests, **running;
+	unsigned int count, next = 0, busy = 0;
+	struct job_result res;
+	GList *list;
+	uint32_t i;
+
+	count = g_list_length(test_list);
+	tests = new0(struct test_case *, count + 1);
+	running = new0(struct test_case *, option_jobs);
+
+	for (list = g_list_first(test_list), i = 0; list;
+					list = g_list_next(list), i++)
+		tests[i] = list->data;
+
+	test_timer = g_timer_new();
+
+	for (i = 0; i < (uint32_t) option_jobs; i++) {
+		if (next < count && send_job(i, next)) {
+			running[i] = tests[next++];
+			busy++;
+		} else
+			close_job(i);
+	}
+
+	/* Reading ends once every worker has gone away */
+	while (busy > 0 &&
+			read(job_result_fd, &res, sizeof(res)) == sizeof(res)) {
+		struct test_case *test;
+
+		if (res.worker >= (uint32_t) option_jobs ||
+						!running[res.worker])
+			continue;
+
+		test = running[res.worker];
+		running[res.worker] = NULL;
+		busy--;
+
+		test->result = res.result;
+		test->start_time = 0;
+		test->end_time = res.exec_time;
+
+		switch (test->result) {
+		case TEST_RESULT_PASSED:
+			print_progress(test->name, COLOR_GREEN,
+					"passed (%.3f seconds)", res.exec_time);
+			break;
+		case TEST_RESULT_FAILED:
+			print_progress(test->name, COLOR_RED,
+					"failed (%.3f seconds)", res.exec_time);
+			break;
+		case TEST_RESULT_TIMED_OUT:
+			print_progress(test->name, COLOR_RED,
+					"timed out (%.3f seconds)",
+					res.exec_time);
+			break;
+		case TEST_RESULT_NOT_RUN:
+			print_progress(test->name, COLOR_YELLOW, "not run");
+			break;
+		}
+
+		if (next < count && send_job(res.worker, next)) {
+			running[res.worker] = tests[next++];
+			busy++;
+		} else
+			close_job(res.worker);
+	}
+
+	for (i = 0; i < (uint32_t) option_jobs; i++) {
+		if (running[i]) {
+			running[i]->result = TEST_RESULT_FAILED;
+			print_progress(running[i]->name, COLOR_RED,
+						"worker %u died", i);
+		}
+
+		close_job(i);
+	}
+
+	for (i = 0; i < (uint32_t) option_jobs; i++)
+		waitpid(job_pids[i], NULL, 0);
+
+	g_timer_stop(test_timer);
+
+	close(job_result_fd);
+	job_result_fd = -1;
+
+	free(running);
+	free(tests);
+}
+
 void tester_init(int *argc, char ***argv)
 {
 	GOptionContext *context;
@@ -845,6 +1197,10 @@ void tester_init(int *argc, char ***argv)
 		exit(EXIT_SUCCESS);
 	}
 
+	/* Fork before the main loop exists so workers get their own */
+	if (option_jobs > 1 && !option_list)
+		start_workers();
+
 	mainloop_init();
 
 	tester_name = strrchr(*argv[0], '/');
@@ -866,11 +1222,22 @@ int tester_run(void)
 		return EXIT_SUCCESS;
 	}
 
-	g_idle_add(start_tester, NULL);
+	if (job_fds) {
+		run_jobs();
+		ret = tester_summarize();
+	} else {
+		g_idle_add(start_tester, NULL);
 
-	mainloop_run_with_signal(signal_callback, NULL);
+		mainloop_run_with_signal(signal_callback, NULL);
 
-	ret = tester_summarize();
+		/* Results of workers are summarized by the parent */
+		if (job_cmd_fd >= 0) {
+			close(job_cmd_fd);
+			close(job_result_fd);
+			ret = 0;
+		} else
+			ret = tester_summarize();
+	}
 
 	g_list_free_full(test_list, test_destroy);
 
@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+/*
+ * Static tracepoints for the hot paths of the shared protocol code.  With
+ * --enable-tracepoints they become USDT probes of the "bluez" provider,
+ * otherwise they compile to nothing.  See doc/tracepoints.txt for the list
+ * of probes and their arguments.
+ */
+
+#ifdef HAVE_TRACEPOINTS
+#include <sys/sdt.h>
+
+#define BT_TRACE(name, ...)	STAP_PROBEV(bluez, name, ##__VA_ARGS__)
+#else
+#define BT_TRACE(name, ...)	do { } while (0)
+#endif
@@ -21,7 +21,9 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <time.h>
+#include <dirent.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <glib.h>
@@ -31,10 +33,17 @@
 #include "lib/sdp_lib.h"
 #include "lib/uuid.h"
 
+#include "src/shared/util.h"
+#include "src/shared/kvlog.h"
+
+#include "log.h"
+#include "btd.h"
 #include "textfile.h"
 #include "uuid-helper.h"
 #include "storage.h"
 
+#define STORAGE_LOG_NAME "store"
+
 /* When all services should trust a remote device */
 #define GLOBAL_TRUST "[all]"
 
@@ -43,6 +52,13 @@ struct match {
 	char *pattern;
 };
 
+struct storage_log {
+	char adapter[18];
+	struct kvlog *kvlog;
+};
+
+static GSList *storage_logs;
+
 static inline int create_filename(char *buf, size_t size,
 				const bdaddr_t *bdaddr, const char *name)
 {
@@ -184,3 +200,351 @@ sdp_record_t *find_record_in_list(sdp_list_t *recs, const char *uuid)
 	}
 	return NULL;
 }
+
+static struct kvlog *open_log(const char *adapter)
+{
+	struct storage_log *log;
+	char dirname[PATH_MAX], filename[PATH_MAX];
+	bool created;
+	GSList *l;
+	int err;
+
+	for (l = storage_logs; l; l = g_slist_next(l)) {
+		log = l->data;
+
+		if (!strcmp(log->adapter, adapter))
+			return log->kvlog;
+	}
+
+	snprintf(dirname, PATH_MAX, STORAGEDIR "/%s", adapter);
+	snprintf(filename, PATH_MAX, "%s/" STORAGE_LOG_NAME, dirname);
+
+	create_file(filename, S_IRUSR | S_IWUSR);
+
+	log = g_new0(struct storage_log, 1);
+	strcpy(log->adapter, adapter);
+
+	log->kvlog = kvlog_open(filename, &created);
+	if (!log->kvlog) {
+		error("Unable to open storage log %s: %s (%d)", filename,
+							strerror(errno), errno);
+		g_free(log);
+		return NULL;
+	}
+
+	/*
+	 * A new log takes over whatever the per-device file layout holds.
+	 * The files themselves are left alone so switching back to
+	 * StorageBackend=files restores the state from before the import.
+	 */
+	if (created) {
+		err = kvlog_import_dir(log->kvlog, dirname);
+		if (err < 0)
+			error("Unable to import %s: %s (%d)", dirname,
+							strerror(-err), -err);
+		else
+			info("Imported storage of %s into %s", adapter,
+								filename);
+	}
+
+	storage_logs = g_slist_prepend(storage_logs, log);
+
+	return log->kvlog;
+}
+
+/*
+ * Map a path below STORAGEDIR/<adapter>/ to the adapter's log and the key
+ * within it. Paths outside of an adapter directory, as well as everything
+ * when the file backend is in use, are handled as regular files.
+ */
+static struct kvlog *path_to_log(const char *path, const char **key)
+{
+	char adapter[18];
+	size_t len = strlen(STORAGEDIR);
+
+	if (btd_opts.storage != BT_STORAGE_LOG)
+		return NULL;
+
+	if (strncmp(path, STORAGEDIR, len) || path[len] != '/')
+		return NULL;
+
+	path += len + 1;
+
+	if (strlen(path) < 17 || (path[17] != '/' && path[17] != '\0'))
+		return NULL;
+
+	memcpy(adapter, path, 17);
+	adapter[17] = '\0';
+
+	if (bachk(adapter) < 0)
+		return NULL;
+
+	*key = path[17] ? path + 18 : path + 17;
+
+	return open_log(adapter);
+}
+
+gboolean btd_storage_exists(const char *filename)
+{
+	struct kvlog *kvlog;
+	const char *key;
+	struct stat st;
+
+	kvlog = path_to_log(filename, &key);
+	if (kvlog)
+		return kvlog_contains(kvlog, key);
+
+	return stat(filename, &st) == 0;
+}
+
+gboolean btd_storage_load(GKeyFile *key_file, const char *filename)
+{
+	struct kvlog *kvlog;
+	const char *key;
+	gboolean ret;
+	size_t len;
+	char *data;
+
+	kvlog = path_to_log(filename, &key);
+	if (!kvlog)
+		return g_key_file_load_from_file(key_file, filename, 0, NULL);
+
+	data = kvlog_get(kvlog, key, &len);
+	if (!data)
+		return FALSE;
+
+	ret = g_key_file_load_from_data(key_file, data, len, 0, NULL);
+	free(data);
+
+	return ret;
+}
+
+int btd_storage_save(const char *filename, const char *data, gsize length)
+{
+	struct kvlog *kvlog;
+	const char *key;
+
+	kvlog = path_to_log(filename, &key);
+	if (kvlog)
+		return kvlog_put(kvlog, key, data, length);
+
+	create_file(filename, S_IRUSR | S_IWUSR);
+
+	if (!g_file_set_contents(filename, data, length, NULL))
+		return -EIO;
+
+	return 0;
+}
+
+/*
+ * Map a binary file read-only. Values kept in the log are copied into an
+ * anonymous mapping so that callers can release both with
+ * btd_storage_unmap().
+ */
+void *btd_storage_map(const char *filename, size_t *length)
+{
+	struct kvlog *kvlog;
+	const char *key;
+	struct stat st;
+	void *addr, *data;
+	size_t len;
+	int fd;
+
+	kvlog = path_to_log(filename, &key);
+	if (kvlog) {
+		data = kvlog_get(kvlog, key, &len);
+		if (!data)
+			return NULL;
+
+		if (!len) {
+			free(data);
+			return NULL;
+		}
+
+		addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (addr == MAP_FAILED) {
+			free(data);
+			return NULL;
+		}
+
+		memcpy(addr, data, len);
+		free(data);
+
+		*length = len;
+		return addr;
+	}
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
+
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	*length = st.st_size;
+
+	return addr;
+}
+
+void btd_storage_unmap(void *data, size_t length)
+{
+	if (data)
+		munmap(data, length);
+}
+
+static void delete_folder_tree(const char *dirname)
+{
+	DIR *dir;
+	struct dirent *entry;
+	char filename[PATH_MAX];
+
+	dir = opendir(dirname);
+	if (dir == NULL)
+		return;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (g_str_equal(entry->d_name, ".") ||
+				g_str_equal(entry->d_name, ".."))
+			continue;
+
+		if (entry->d_type == DT_UNKNOWN)
+			entry->d_type = util_get_dt(dirname, entry->d_name);
+
+		snprintf(filename, PATH_MAX, "%s/%s", dirname, entry->d_name);
+
+		if (entry->d_type == DT_DIR)
+			delete_folder_tree(filename);
+		else
+			unlink(filename);
+	}
+	closedir(dir);
+
+	rmdir(dirname);
+}
+
+void btd_storage_remove(const char *pathname)
+{
+	struct kvlog *kvlog;
+	const char *key;
+	struct stat st;
+	char *prefix;
+
+	kvlog = path_to_log(pathname, &key);
+	if (kvlog) {
+		if (!*key)
+			return;
+
+		/* Remove the entry itself and anything stored below it */
+		prefix = g_strconcat(key, "/", NULL);
+
+		kvlog_begin(kvlog);
+		kvlog_del(kvlog, key);
+		kvlog_del_prefix(kvlog, prefix);
+		kvlog_commit(kvlog);
+
+		g_free(prefix);
+		return;
+	}
+
+	if (lstat(pathname, &st) < 0)
+		return;
+
+	if (S_ISDIR(st.st_mode))
+		delete_folder_tree(pathname);
+	else
+		unlink(pathname);
+}
+
+struct list_dirs {
+	size_t prefix_len;
+	GHashTable *names;
+};
+
+static void list_dirs_entry(const char *key, size_t len, void *user_data)
+{
+	struct list_dirs *data = user_data;
+	const char *name = key + data->prefix_len;
+	const char *sep;
+
+	sep = strchr(name, '/');
+	if (!sep || sep == name)
+		return;
+
+	g_hash_table_add(data->names, g_strndup(name, sep - name));
+}
+
+static void list_dirs_name(gpointer key, gpointer value, gpointer user_data)
+{
+	GSList **names = user_data;
+
+	*names = g_slist_prepend(*names, g_strdup(key));
+}
+
+GSList *btd_storage_list_dirs(const char *dirname)
+{
+	struct kvlog *kvlog;
+	struct list_dirs data;
+	const char *key;
+	GSList *names = NULL;
+	DIR *dir;
+	struct dirent *entry;
+
+	kvlog = path_to_log(dirname, &key);
+	if (kvlog) {
+		char *prefix = *key ? g_strconcat(key, "/", NULL) : NULL;
+
+		/* Directories only exist implicitly as key prefixes */
+		data.prefix_len = prefix ? strlen(prefix) : 0;
+		data.names = g_hash_table_new_full(g_str_hash, g_str_equal,
+								g_free, NULL);
+
+		kvlog_foreach(kvlog, prefix, list_dirs_entry, &data);
+		g_hash_table_foreach(data.names, list_dirs_name, &names);
+
+		g_hash_table_destroy(data.names);
+		g_free(prefix);
+
+		return names;
+	}
+
+	dir = opendir(dirname);
+	if (!dir)
+		return NULL;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_type == DT_UNKNOWN)
+			entry->d_type = util_get_dt(dirname, entry->d_name);
+
+		if (entry->d_type != DT_DIR || entry->d_name[0] == '.')
+			continue;
+
+		names = g_slist_prepend(names, g_strdup(entry->d_name));
+	}
+
+	closedir(dir);
+
+	return names;
+}
+
+static void storage_log_free(gpointer data)
+{
+	struct storage_log *log = data;
+
+	kvlog_close(log->kvlog);
+	g_free(log);
+}
+
+void btd_storage_cleanup(void)
+{
+	g_slist_free_full(storage_logs, storage_log_free);
+	storage_logs = NULL;
+}
@@ -14,3 +14,13 @@ int read_on_mode(const char *src, char *mode, int length);
 int read_local_name(const bdaddr_t *bdaddr, char *name);
 sdp_record_t *record_from_string(const char *str);
 sdp_record_t *find_record_in_list(sdp_list_t *recs, const char *uuid);
+
+gboolean btd_storage_exists(const char *filename);
+gboolean btd_storage_load(GKeyFile *key_file, const char *filename);
+int btd_storage_save(const char *filename, const char *data, gsize length);
+void *btd_storage_map(const char *filename, size_t *length);
+void btd_storage_unmap(void *data, size_t length);
+void btd_storage_remove(const char *pathname);
+GSList *btd_storage_list_dirs(const char *dirname);
+
+void btd_storage_cleanup(void);
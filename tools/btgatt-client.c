@@ -20,6 +20,7 @@
 #include <getopt.h>
 #include <limits.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #include "lib/bluetooth.h"
 #include "lib/hci.h"
@@ -33,9 +34,17 @@
 #include "src/shared/queue.h"
 #include "src/shared/gatt-db.h"
 #include "src/shared/gatt-client.h"
+#include "src/shared/timeout.h"
+#include "tools/xfer-stats.h"
 
 #define ATT_CID 4
 
+#define MAX_EATT_BEARERS	5
+
+/* Commands allowed to wait in the ATT queue while flooding */
+#define FLOOD_WINDOW		128
+#define FLOOD_TICK		1
+
 #define PRLOG(...) \
 	printf(__VA_ARGS__); print_prompt();
 
@@ -50,6 +59,22 @@
 
 static bool verbose = false;
 
+struct flood {
+	bool active;
+	bool read;
+	uint16_t handle;
+	uint16_t size;
+	unsigned int rate;
+	unsigned int depth;
+	unsigned int outstanding;
+	uint64_t issued;
+	uint64_t errors;
+	unsigned int tick_id;
+	unsigned int end_id;
+	uint8_t value[BT_ATT_MAX_LE_MTU];
+	struct xfer_stats stats;
+};
+
 struct client {
 	int fd;
 	struct bt_att *att;
@@ -57,6 +82,8 @@ struct client {
 	struct bt_gatt_client *gatt;
 
 	unsigned int reliable_session_id;
+
+	struct flood flood;
 };
 
 static void print_prompt(void)
@@ -236,6 +263,8 @@ static struct client *client_create(int fd, uint16_t mtu)
 
 static void client_destroy(struct client *cli)
 {
+	timeout_remove(cli->flood.tick_id);
+	timeout_remove(cli->flood.end_id);
 	bt_gatt_client_unref(cli->gatt);
 	bt_att_unref(cli->att);
 	free(cli);
@@ -1295,6 +1324,336 @@ static void cmd_set_sign_key(struct client *cli, char *cmd_str)
 		set_sign_key_usage();
 }
 
+static void flood_usage(bool read)
+{
+	if (read)
+		printf("Usage: read-flood [options] <value_handle>\n"
+			"Options:\n"
+			"\t -p, --depth <num>\tReads in flight (default: 8)\n");
+	else
+		printf("Usage: write-flood [options] <value_handle>\n"
+			"Options:\n"
+			"\t -s, --size <bytes>\tValue size "
+						"(default: MTU - 3)\n");
+
+	printf("\t -r, --rate <num>\tOperations per second "
+						"(default: unlimited)\n"
+		"\t -d, --duration <sec>\tStop after seconds, 0 for never "
+							"(default: 10)\n"
+		"e.g.:\n"
+		"\t%s -r 500 0x0003\n", read ? "read-flood" : "write-flood");
+}
+
+static struct option flood_options[] = {
+	{ "depth",	1, 0, 'p' },
+	{ "size",	1, 0, 's' },
+	{ "rate",	1, 0, 'r' },
+	{ "duration",	1, 0, 'd' },
+	{ }
+};
+
+static void flood_report(struct client *cli)
+{
+	struct flood *flood = &cli->flood;
+	struct xfer_stats *stats = &flood->stats;
+	const char *name = flood->read ? "Read flood" : "Write flood";
+	double secs = stats->elapsed_us / 1000000.0;
+
+	if (secs <= 0)
+		return;
+
+	printf("\n%s: %" PRIu64 " operations in %.2f sec, %" PRIu64
+				" errors, %d bearers\n", name, stats->frames,
+				secs, flood->errors,
+				bt_att_get_channels(cli->att));
+	printf("%s: %.1f ops/sec, %.2f kB/s goodput\n", name,
+				stats->frames / secs,
+				stats->bytes / secs / 1024);
+
+	if (!stats->rtt.count)
+		return;
+
+	printf("%s: latency min %" PRIu64 " p50 %" PRIu64 " p90 %" PRIu64
+				" p99 %" PRIu64 " max %" PRIu64 " usec\n",
+				name, stats->rtt.min,
+				xfer_hist_percentile(&stats->rtt, 50),
+				xfer_hist_percentile(&stats->rtt, 90),
+				xfer_hist_percentile(&stats->rtt, 99),
+				stats->rtt.max);
+}
+
+static void flood_stop(struct client *cli)
+{
+	struct flood *flood = &cli->flood;
+
+	if (!flood->active)
+		return;
+
+	flood->active = false;
+
+	timeout_remove(flood->tick_id);
+	timeout_remove(flood->end_id);
+	flood->tick_id = 0;
+	flood->end_id = 0;
+
+	xfer_stats_stop(&flood->stats);
+
+	/* Writes still queued have not reached the peer */
+	if (!flood->read) {
+		unsigned int queued = bt_att_get_queue_len(cli->att);
+
+		if (queued > flood->stats.frames)
+			queued = flood->stats.frames;
+
+		flood->stats.frames -= queued;
+		flood->stats.bytes -= (uint64_t) queued * flood->size;
+	}
+
+	flood_report(cli);
+}
+
+struct flood_op {
+	struct client *cli;
+	uint64_t start;
+	bool done;
+};
+
+static void flood_op_done(struct flood_op *op)
+{
+	if (op->done)
+		return;
+
+	op->done = true;
+	op->cli->flood.outstanding--;
+}
+
+static void flood_op_free(void *user_data)
+{
+	struct flood_op *op = user_data;
+
+	flood_op_done(op);
+	free(op);
+}
+
+static void flood_fill(struct client *cli);
+
+static void flood_read_cb(bool success, uint8_t att_ecode,
+					const uint8_t *value, uint16_t length,
+					void *user_data)
+{
+	struct flood_op *op = user_data;
+	struct client *cli = op->cli;
+	struct flood *flood = &cli->flood;
+
+	flood_op_done(op);
+
+	if (!flood->active)
+		return;
+
+	if (!success)
+		flood->errors++;
+	else {
+		xfer_stats_received(&flood->stats, length);
+		xfer_stats_rtt(&flood->stats, xfer_now_us() - op->start);
+	}
+
+	flood_fill(cli);
+}
+
+static bool flood_send(struct client *cli)
+{
+	struct flood *flood = &cli->flood;
+	struct flood_op *op;
+
+	if (!flood->read) {
+		if (flood->size >= 4)
+			put_le32(flood->issued, flood->value);
+
+		if (!bt_gatt_client_write_without_response(cli->gatt,
+						flood->handle, false,
+						flood->value, flood->size))
+			return false;
+
+		xfer_stats_sent(&flood->stats, flood->size);
+
+		return true;
+	}
+
+	op = new0(struct flood_op, 1);
+	op->cli = cli;
+	op->start = xfer_now_us();
+
+	if (!bt_gatt_client_read_value(cli->gatt, flood->handle,
+						flood_read_cb, op,
+						flood_op_free)) {
+		free(op);
+		return false;
+	}
+
+	flood->outstanding++;
+
+	return true;
+}
+
+static void flood_fill(struct client *cli)
+{
+	struct flood *flood = &cli->flood;
+	uint64_t allowed = UINT64_MAX;
+
+	if (flood->rate)
+		allowed = (xfer_now_us() - flood->stats.start_us) *
+						flood->rate / 1000000;
+
+	while (flood->issued < allowed) {
+		if (flood->read) {
+			if (flood->outstanding >= flood->depth)
+				break;
+		} else if (bt_att_get_queue_len(cli->att) >= FLOOD_WINDOW)
+			break;
+
+		if (!flood_send(cli)) {
+			flood->errors++;
+			break;
+		}
+
+		flood->issued++;
+	}
+}
+
+static bool flood_tick(void *user_data)
+{
+	struct client *cli = user_data;
+
+	flood_fill(cli);
+
+	return cli->flood.active;
+}
+
+static bool flood_end(void *user_data)
+{
+	struct client *cli = user_data;
+
+	cli->flood.end_id = 0;
+
+	flood_stop(cli);
+	print_prompt();
+
+	return false;
+}
+
+static void flood_start(struct client *cli, char *cmd_str, bool read)
+{
+	struct flood *flood = &cli->flood;
+	char *argvbuf[12];
+	char **argv = argvbuf;
+	int argc = 1;
+	unsigned int duration = 10;
+	unsigned int rate = 0;
+	unsigned int depth = 8;
+	int size = -1;
+	int max_size;
+	uint16_t handle;
+	char *endptr = NULL;
+	int opt;
+
+	if (!bt_gatt_client_is_ready(cli->gatt)) {
+		printf("GATT client not initialized\n");
+		return;
+	}
+
+	if (flood->active) {
+		printf("Flood already running\n");
+		return;
+	}
+
+	if (!parse_args(cmd_str, 10, argv + 1, &argc)) {
+		flood_usage(read);
+		return;
+	}
+
+	optind = 0;
+	argv[0] = read ? "read-flood" : "write-flood";
+	while ((opt = getopt_long(argc, argv, read ? "+p:r:d:" : "+s:r:d:",
+						flood_options, NULL)) != -1) {
+		switch (opt) {
+		case 'p':
+			depth = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		default:
+			flood_usage(read);
+			return;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1 || !depth) {
+		flood_usage(read);
+		return;
+	}
+
+	handle = strtol(argv[0], &endptr, 0);
+	if (!endptr || *endptr != '\0' || !handle) {
+		printf("Invalid value handle: %s\n", argv[0]);
+		return;
+	}
+
+	max_size = bt_att_get_mtu(cli->att) - 3;
+	if (size < 0 || size > max_size)
+		size = max_size;
+
+	/* Reads of an earlier run may still be outstanding */
+	memset(flood->value, 0x7f, sizeof(flood->value));
+	flood->active = true;
+	flood->read = read;
+	flood->handle = handle;
+	flood->size = read ? 0 : size;
+	flood->rate = rate;
+	flood->depth = depth;
+	flood->issued = 0;
+	flood->errors = 0;
+
+	xfer_stats_start(&flood->stats);
+
+	flood->tick_id = timeout_add(FLOOD_TICK, flood_tick, cli, NULL);
+
+	if (duration)
+		flood->end_id = timeout_add(duration * 1000, flood_end, cli,
+									NULL);
+
+	flood_fill(cli);
+}
+
+static void cmd_write_flood(struct client *cli, char *cmd_str)
+{
+	flood_start(cli, cmd_str, false);
+}
+
+static void cmd_read_flood(struct client *cli, char *cmd_str)
+{
+	flood_start(cli, cmd_str, true);
+}
+
+static void cmd_stop_flood(struct client *cli, char *cmd_str)
+{
+	if (!cli->flood.active) {
+		printf("Flood not running\n");
+		return;
+	}
+
+	flood_stop(cli);
+}
+
 static void cmd_help(struct client *cli, char *cmd_str);
 
 typedef void (*command_func_t)(struct client *cli, char *cmd_str);
@@ -1329,6 +1688,11 @@ static struct {
 				"\tGet security level on le connection"},
 	{ "set-sign-key", cmd_set_sign_key,
 				"\tSet signing key for signed write command"},
+	{ "write-flood", cmd_write_flood,
+			"\tFlood a value with write without response" },
+	{ "read-flood", cmd_read_flood,
+				"\tRead a value with pipelined requests" },
+	{ "stop-flood", cmd_stop_flood, "\tStop flooding and report" },
 	{ }
 };
 
@@ -1470,6 +1834,68 @@ static int l2cap_le_att_connect(bdaddr_t *src, bdaddr_t *dst, uint8_t dst_type,
 	return sock;
 }
 
+static int l2cap_le_eatt_connect(bdaddr_t *src, bdaddr_t *dst,
+					uint8_t dst_type, int sec, uint16_t mtu)
+{
+	int sock;
+	struct sockaddr_l2 srcaddr, dstaddr;
+	struct bt_security btsec;
+	uint8_t mode = BT_MODE_EXT_FLOWCTL;
+
+	sock = socket(PF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
+	if (sock < 0) {
+		perror("Failed to create EATT socket");
+		return -1;
+	}
+
+	memset(&srcaddr, 0, sizeof(srcaddr));
+	srcaddr.l2_family = AF_BLUETOOTH;
+	srcaddr.l2_bdaddr_type = BDADDR_LE_PUBLIC;
+	bacpy(&srcaddr.l2_bdaddr, src);
+
+	if (bind(sock, (struct sockaddr *)&srcaddr, sizeof(srcaddr)) < 0) {
+		perror("Failed to bind EATT socket");
+		goto fail;
+	}
+
+	memset(&btsec, 0, sizeof(btsec));
+	btsec.level = sec;
+	if (setsockopt(sock, SOL_BLUETOOTH, BT_SECURITY, &btsec,
+							sizeof(btsec)) != 0) {
+		fprintf(stderr, "Failed to set EATT security level\n");
+		goto fail;
+	}
+
+	if (setsockopt(sock, SOL_BLUETOOTH, BT_MODE, &mode,
+							sizeof(mode)) < 0) {
+		perror("Failed to set EATT mode");
+		goto fail;
+	}
+
+	if (setsockopt(sock, SOL_BLUETOOTH, BT_RCVMTU, &mtu,
+							sizeof(mtu)) < 0) {
+		perror("Failed to set EATT MTU");
+		goto fail;
+	}
+
+	memset(&dstaddr, 0, sizeof(dstaddr));
+	dstaddr.l2_family = AF_BLUETOOTH;
+	dstaddr.l2_psm = htobs(BT_ATT_EATT_PSM);
+	dstaddr.l2_bdaddr_type = dst_type;
+	bacpy(&dstaddr.l2_bdaddr, dst);
+
+	if (connect(sock, (struct sockaddr *) &dstaddr, sizeof(dstaddr)) < 0) {
+		perror("Failed to connect EATT bearer");
+		goto fail;
+	}
+
+	return sock;
+
+fail:
+	close(sock);
+	return -1;
+}
+
 static void usage(void)
 {
 	printf("btgatt-client\n");
@@ -1482,6 +1908,7 @@ static void usage(void)
 		"\t-m, --mtu <mtu> \t\tThe ATT MTU to use\n"
 		"\t-s, --security-level <sec> \tSet security level (low|medium|"
 								"high|fips)\n"
+		"\t-e, --eatt <num>\t\tOpen <num> Enhanced ATT bearers\n"
 		"\t-v, --verbose\t\t\tEnable extra logging\n"
 		"\t-h, --help\t\t\tDisplay help\n");
 }
@@ -1492,6 +1919,7 @@ static struct option main_options[] = {
 	{ "type",		1, 0, 't' },
 	{ "mtu",		1, 0, 'm' },
 	{ "security-level",	1, 0, 's' },
+	{ "eatt",		1, 0, 'e' },
 	{ "verbose",		0, 0, 'v' },
 	{ "help",		0, 0, 'h' },
 	{ }
@@ -1506,10 +1934,11 @@ int main(int argc, char *argv[])
 	bool dst_addr_given = false;
 	bdaddr_t src_addr, dst_addr;
 	int dev_id = -1;
-	int fd;
+	int eatt = 0;
+	int fd, i;
 	struct client *cli;
 
-	while ((opt = getopt_long(argc, argv, "+hvs:m:t:d:i:",
+	while ((opt = getopt_long(argc, argv, "+hvs:m:t:d:i:e:",
 						main_options, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -1577,6 +2006,15 @@ int main(int argc, char *argv[])
 				return EXIT_FAILURE;
 			}
 
+			break;
+		case 'e':
+			eatt = atoi(optarg);
+			if (eatt <= 0 || eatt > MAX_EATT_BEARERS) {
+				fprintf(stderr, "Invalid number of EATT "
+						"bearers: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+
 			break;
 		default:
 			fprintf(stderr, "Invalid option: %c\n", opt);
@@ -1622,6 +2060,24 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	/* Requests are spread over whichever bearer is idle */
+	for (i = 0; i < eatt; i++) {
+		int sk;
+
+		sk = l2cap_le_eatt_connect(&src_addr, &dst_addr, dst_type, sec,
+					mtu ? mtu : BT_ATT_MAX_LE_MTU);
+		if (sk < 0)
+			break;
+
+		if (bt_att_attach_fd(cli->att, sk) < 0) {
+			close(sk);
+			break;
+		}
+	}
+
+	if (eatt)
+		printf("Using %d ATT bearers\n", bt_att_get_channels(cli->att));
+
 	if (mainloop_add_fd(fileno(stdin),
 				EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR,
 				prompt_read_cb, cli, NULL) < 0) {
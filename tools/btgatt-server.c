@@ -20,6 +20,7 @@
 #include <getopt.h>
 #include <unistd.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #include "lib/bluetooth.h"
 #include "lib/hci.h"
@@ -34,6 +35,7 @@
 #include "src/shared/timeout.h"
 #include "src/shared/gatt-db.h"
 #include "src/shared/gatt-server.h"
+#include "tools/xfer-stats.h"
 
 #define UUID_GAP			0x1800
 #define UUID_GATT			0x1801
@@ -42,6 +44,15 @@
 #define UUID_HEART_RATE_BODY		0x2a38
 #define UUID_HEART_RATE_CTRL		0x2a39
 
+#define UUID_STREAM		"6e1e0000-c9f1-4d7e-9b5a-2f0c1d6a8b00"
+#define UUID_STREAM_DATA	"6e1e0001-c9f1-4d7e-9b5a-2f0c1d6a8b00"
+
+#define MAX_STREAM_CHRCS	1000
+
+/* Notifications allowed to wait in the ATT queue while streaming */
+#define STREAM_WINDOW		128
+#define STREAM_TICK		1
+
 #define ATT_CID 4
 
 #define PRLOG(...) \
@@ -67,6 +78,26 @@ static const char test_device_name[] = "Very Long Test Device Name For Testing "
 				"ATT Protocol Operations On GATT Server";
 static bool verbose = false;
 
+struct stream_chrc {
+	uint16_t handle;
+	uint16_t ccc;
+};
+
+struct stream {
+	bool active;
+	bool indicate;
+	unsigned int rate;
+	uint16_t size;
+	unsigned int next;
+	uint32_t seq;
+	uint64_t issued;
+	unsigned int outstanding;
+	unsigned int tick_id;
+	unsigned int end_id;
+	uint8_t value[BT_ATT_MAX_LE_MTU];
+	struct xfer_stats stats;
+};
+
 struct server {
 	int fd;
 	struct bt_att *att;
@@ -86,6 +117,10 @@ struct server {
 	bool hr_msrmt_enabled;
 	int hr_ee_count;
 	unsigned int hr_timeout_id;
+
+	struct stream_chrc *stream_chrcs;
+	unsigned int num_stream_chrcs;
+	struct stream stream;
 };
 
 static void print_prompt(void)
@@ -523,14 +558,94 @@ static void populate_hr_service(struct server *server)
 		gatt_db_service_set_active(service, true);
 }
 
+static void stream_ccc_read_cb(struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset,
+					uint8_t opcode, struct bt_att *att,
+					void *user_data)
+{
+	struct stream_chrc *chrc = user_data;
+	uint8_t value[2];
+
+	put_le16(chrc->ccc, value);
+
+	gatt_db_attribute_read_result(attrib, id, 0, value, 2);
+}
+
+static void stream_ccc_write_cb(struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset,
+					const uint8_t *value, size_t len,
+					uint8_t opcode, struct bt_att *att,
+					void *user_data)
+{
+	struct stream_chrc *chrc = user_data;
+	uint8_t ecode = 0;
+
+	if (!value || len != 2) {
+		ecode = BT_ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LEN;
+		goto done;
+	}
+
+	if (offset) {
+		ecode = BT_ATT_ERROR_INVALID_OFFSET;
+		goto done;
+	}
+
+	chrc->ccc = get_le16(value);
+
+	PRLOG("Stream: 0x%04x notify %s, indicate %s\n", chrc->handle,
+				chrc->ccc & 0x0001 ? "on" : "off",
+				chrc->ccc & 0x0002 ? "on" : "off");
+
+done:
+	gatt_db_attribute_write_result(attrib, id, ecode);
+}
+
+static void populate_stream_service(struct server *server)
+{
+	bt_uuid_t uuid, ccc_uuid;
+	struct gatt_db_attribute *service, *value;
+	unsigned int i;
+
+	if (!server->num_stream_chrcs)
+		return;
+
+	/* Service declaration plus three handles per characteristic */
+	bt_string_to_uuid(&uuid, UUID_STREAM);
+	service = gatt_db_add_service(server->db, &uuid, true,
+					1 + server->num_stream_chrcs * 3);
+
+	bt_string_to_uuid(&uuid, UUID_STREAM_DATA);
+	bt_uuid16_create(&ccc_uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+
+	for (i = 0; i < server->num_stream_chrcs; i++) {
+		struct stream_chrc *chrc = &server->stream_chrcs[i];
+
+		value = gatt_db_service_add_characteristic(service, &uuid,
+						BT_ATT_PERM_NONE,
+						BT_GATT_CHRC_PROP_NOTIFY |
+						BT_GATT_CHRC_PROP_INDICATE,
+						NULL, NULL, NULL);
+		chrc->handle = gatt_db_attribute_get_handle(value);
+
+		gatt_db_service_add_descriptor(service, &ccc_uuid,
+					BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
+					stream_ccc_read_cb,
+					stream_ccc_write_cb, chrc);
+	}
+
+	gatt_db_service_set_active(service, true);
+}
+
 static void populate_db(struct server *server)
 {
 	populate_gap_service(server);
 	populate_gatt_service(server);
 	populate_hr_service(server);
+	populate_stream_service(server);
 }
 
-static struct server *server_create(int fd, uint16_t mtu, bool hr_visible)
+static struct server *server_create(int fd, uint16_t mtu, bool hr_visible,
+						unsigned int stream_chrcs)
 {
 	struct server *server;
 	size_t name_len = strlen(test_device_name);
@@ -583,6 +698,11 @@ static struct server *server_create(int fd, uint16_t mtu, bool hr_visible)
 
 	server->hr_visible = hr_visible;
 
+	if (stream_chrcs) {
+		server->stream_chrcs = new0(struct stream_chrc, stream_chrcs);
+		server->num_stream_chrcs = stream_chrcs;
+	}
+
 	if (verbose) {
 		bt_att_set_debug(server->att, BT_ATT_DEBUG_VERBOSE,
 						att_debug_cb, "att: ", NULL);
@@ -600,6 +720,7 @@ static struct server *server_create(int fd, uint16_t mtu, bool hr_visible)
 
 fail:
 	gatt_db_unref(server->db);
+	free(server->stream_chrcs);
 	free(server->device_name);
 	bt_att_unref(server->att);
 	free(server);
@@ -610,8 +731,11 @@ fail:
 static void server_destroy(struct server *server)
 {
 	timeout_remove(server->hr_timeout_id);
+	timeout_remove(server->stream.tick_id);
+	timeout_remove(server->stream.end_id);
 	bt_gatt_server_unref(server->gatt);
 	gatt_db_unref(server->db);
+	free(server->stream_chrcs);
 }
 
 static void usage(void)
@@ -627,6 +751,9 @@ static void usage(void)
 		"\t-t, --type [random|public] \t The source address type\n"
 		"\t-v, --verbose\t\t\tEnable extra logging\n"
 		"\t-r, --heart-rate\t\tEnable Heart Rate service\n"
+		"\t-n, --stream <num>\t\tAdd a service with <num> "
+						"characteristics to stream\n"
+		"\t-e, --eatt\t\t\tAccept Enhanced ATT bearers\n"
 		"\t-h, --help\t\t\tDisplay help\n");
 }
 
@@ -637,6 +764,8 @@ static struct option main_options[] = {
 	{ "type",		1, 0, 't' },
 	{ "verbose",		0, 0, 'v' },
 	{ "heart-rate",		0, 0, 'r' },
+	{ "stream",		1, 0, 'n' },
+	{ "eatt",		0, 0, 'e' },
 	{ "help",		0, 0, 'h' },
 	{ }
 };
@@ -703,6 +832,81 @@ fail:
 	return -1;
 }
 
+static int l2cap_le_eatt_listen(bdaddr_t *src, int sec, uint8_t src_type,
+								uint16_t mtu)
+{
+	int sk;
+	struct sockaddr_l2 srcaddr;
+	struct bt_security btsec;
+	uint8_t mode = BT_MODE_EXT_FLOWCTL;
+
+	sk = socket(PF_BLUETOOTH, SOCK_SEQPACKET | SOCK_NONBLOCK,
+							BTPROTO_L2CAP);
+	if (sk < 0) {
+		perror("Failed to create EATT socket");
+		return -1;
+	}
+
+	memset(&srcaddr, 0, sizeof(srcaddr));
+	srcaddr.l2_family = AF_BLUETOOTH;
+	srcaddr.l2_psm = htobs(BT_ATT_EATT_PSM);
+	srcaddr.l2_bdaddr_type = src_type;
+	bacpy(&srcaddr.l2_bdaddr, src);
+
+	if (bind(sk, (struct sockaddr *) &srcaddr, sizeof(srcaddr)) < 0) {
+		perror("Failed to bind EATT socket");
+		goto fail;
+	}
+
+	memset(&btsec, 0, sizeof(btsec));
+	btsec.level = sec;
+	if (setsockopt(sk, SOL_BLUETOOTH, BT_SECURITY, &btsec,
+							sizeof(btsec)) != 0) {
+		fprintf(stderr, "Failed to set EATT security level\n");
+		goto fail;
+	}
+
+	if (setsockopt(sk, SOL_BLUETOOTH, BT_MODE, &mode, sizeof(mode)) < 0) {
+		perror("Failed to set EATT mode");
+		goto fail;
+	}
+
+	if (setsockopt(sk, SOL_BLUETOOTH, BT_RCVMTU, &mtu, sizeof(mtu)) < 0) {
+		perror("Failed to set EATT MTU");
+		goto fail;
+	}
+
+	if (listen(sk, 10) < 0) {
+		perror("Listening on EATT socket failed");
+		goto fail;
+	}
+
+	return sk;
+
+fail:
+	close(sk);
+	return -1;
+}
+
+static void eatt_accept_cb(int fd, uint32_t events, void *user_data)
+{
+	struct server *server = user_data;
+	int nsk;
+
+	nsk = accept(fd, NULL, NULL);
+	if (nsk < 0)
+		return;
+
+	if (bt_att_attach_fd(server->att, nsk) < 0) {
+		fprintf(stderr, "Failed to attach EATT bearer\n");
+		close(nsk);
+		return;
+	}
+
+	PRLOG("EATT bearer attached, %d bearers\n",
+					bt_att_get_channels(server->att));
+}
+
 static void notify_usage(void)
 {
 	printf("Usage: notify [options] <value_handle> <value>\n"
@@ -880,6 +1084,314 @@ static void cmd_heart_rate(struct server *server, char *cmd_str)
 						pdu, 4, conf_cb, NULL, NULL);
 }
 
+static void stream_usage(void)
+{
+	printf("Usage: stream [options]\n"
+		"Options:\n"
+		"\t -i, --indicate\t\tSend indications\n"
+		"\t -r, --rate <num>\tValues per second (default: unlimited)\n"
+		"\t -s, --size <bytes>\tValue size (default: MTU - 3)\n"
+		"\t -d, --duration <sec>\tStop after seconds, 0 for never "
+							"(default: 10)\n"
+		"e.g.:\n"
+		"\tstream -r 1000 -s 20\n");
+}
+
+static struct option stream_options[] = {
+	{ "indicate",	0, 0, 'i' },
+	{ "rate",	1, 0, 'r' },
+	{ "size",	1, 0, 's' },
+	{ "duration",	1, 0, 'd' },
+	{ }
+};
+
+static void stream_report(struct server *server)
+{
+	struct stream *stream = &server->stream;
+	struct xfer_stats *stats = &stream->stats;
+	double secs = stats->elapsed_us / 1000000.0;
+
+	if (secs <= 0)
+		return;
+
+	printf("\nStream: %" PRIu64 " %s of %u bytes in %.2f sec\n",
+			stats->frames,
+			stream->indicate ? "indications" : "notifications",
+			stream->size, secs);
+	printf("Stream: %.1f values/sec, %.2f kB/s goodput, %d bearers\n",
+			stats->frames / secs, stats->bytes / secs / 1024,
+			bt_att_get_channels(server->att));
+
+	if (!stats->rtt.count)
+		return;
+
+	printf("Stream: confirmation latency min %" PRIu64 " p50 %" PRIu64
+				" p90 %" PRIu64 " p99 %" PRIu64 " max %" PRIu64
+				" usec\n", stats->rtt.min,
+				xfer_hist_percentile(&stats->rtt, 50),
+				xfer_hist_percentile(&stats->rtt, 90),
+				xfer_hist_percentile(&stats->rtt, 99),
+				stats->rtt.max);
+}
+
+static void stream_stop(struct server *server)
+{
+	struct stream *stream = &server->stream;
+
+	if (!stream->active)
+		return;
+
+	stream->active = false;
+
+	timeout_remove(stream->tick_id);
+	timeout_remove(stream->end_id);
+	stream->tick_id = 0;
+	stream->end_id = 0;
+
+	xfer_stats_stop(&stream->stats);
+	stream_report(server);
+}
+
+struct stream_op {
+	struct server *server;
+	uint64_t start;
+	bool done;
+};
+
+static void stream_op_done(struct stream_op *op)
+{
+	if (op->done)
+		return;
+
+	op->done = true;
+	op->server->stream.outstanding--;
+}
+
+static void stream_fill(struct server *server);
+
+static void stream_conf_cb(void *user_data)
+{
+	struct stream_op *op = user_data;
+	struct server *server = op->server;
+	struct stream *stream = &server->stream;
+
+	stream_op_done(op);
+
+	if (!stream->active)
+		return;
+
+	xfer_stats_received(&stream->stats, stream->size);
+	xfer_stats_rtt(&stream->stats, xfer_now_us() - op->start);
+
+	stream_fill(server);
+}
+
+static void stream_op_free(void *user_data)
+{
+	struct stream_op *op = user_data;
+
+	stream_op_done(op);
+	free(op);
+}
+
+static bool stream_send(struct server *server)
+{
+	struct stream *stream = &server->stream;
+	struct stream_chrc *chrc = NULL;
+	uint16_t mask = stream->indicate ? 0x0002 : 0x0001;
+	struct stream_op *op;
+	unsigned int i;
+
+	/* Go round robin over the subscribed characteristics */
+	for (i = 0; i < server->num_stream_chrcs; i++) {
+		chrc = &server->stream_chrcs[stream->next++ %
+						server->num_stream_chrcs];
+		if (chrc->ccc & mask)
+			break;
+
+		chrc = NULL;
+	}
+
+	if (!chrc)
+		return false;
+
+	if (stream->size >= 4)
+		put_le32(stream->seq, stream->value);
+
+	if (!stream->indicate) {
+		if (!bt_gatt_server_send_notification(server->gatt,
+						chrc->handle, stream->value,
+						stream->size, false))
+			return false;
+
+		xfer_stats_sent(&stream->stats, stream->size);
+		stream->seq++;
+
+		return true;
+	}
+
+	op = new0(struct stream_op, 1);
+	op->server = server;
+	op->start = xfer_now_us();
+
+	/* The destroy callback runs on failure as well */
+	stream->outstanding++;
+
+	if (!bt_gatt_server_send_indication(server->gatt, chrc->handle,
+						stream->value, stream->size,
+						stream_conf_cb, op,
+						stream_op_free))
+		return false;
+
+	stream->seq++;
+
+	return true;
+}
+
+static void stream_fill(struct server *server)
+{
+	struct stream *stream = &server->stream;
+	uint64_t allowed = UINT64_MAX;
+
+	if (stream->rate)
+		allowed = (xfer_now_us() - stream->stats.start_us) *
+						stream->rate / 1000000;
+
+	while (stream->issued < allowed) {
+		/* Keep one indication in flight per bearer */
+		if (stream->indicate) {
+			if (stream->outstanding >= (unsigned int)
+					bt_att_get_channels(server->att))
+				break;
+		} else if (bt_att_get_queue_len(server->att) >= STREAM_WINDOW)
+			break;
+
+		if (!stream_send(server)) {
+			printf("\nStream: no subscribed characteristic\n");
+			stream_stop(server);
+			print_prompt();
+			return;
+		}
+
+		stream->issued++;
+	}
+}
+
+static bool stream_tick(void *user_data)
+{
+	struct server *server = user_data;
+
+	stream_fill(server);
+
+	return server->stream.active;
+}
+
+static bool stream_end(void *user_data)
+{
+	struct server *server = user_data;
+
+	server->stream.end_id = 0;
+
+	stream_stop(server);
+	print_prompt();
+
+	return false;
+}
+
+static void cmd_stream(struct server *server, char *cmd_str)
+{
+	struct stream *stream = &server->stream;
+	char *argvbuf[10];
+	char **argv = argvbuf;
+	int argc = 1;
+	unsigned int duration = 10;
+	unsigned int rate = 0;
+	bool indicate = false;
+	int size = -1;
+	int max_size;
+	int opt;
+
+	if (!server->num_stream_chrcs) {
+		printf("No stream service, start with --stream <num>\n");
+		return;
+	}
+
+	if (stream->active) {
+		printf("Stream already running\n");
+		return;
+	}
+
+	if (!parse_args(cmd_str, 8, argv + 1, &argc)) {
+		stream_usage();
+		return;
+	}
+
+	optind = 0;
+	argv[0] = "stream";
+	while ((opt = getopt_long(argc, argv, "+ir:s:d:", stream_options,
+								NULL)) != -1) {
+		switch (opt) {
+		case 'i':
+			indicate = true;
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		default:
+			stream_usage();
+			return;
+		}
+	}
+
+	if (argc > optind) {
+		stream_usage();
+		return;
+	}
+
+	max_size = bt_att_get_mtu(server->att) - 3;
+	if (size < 0 || size > max_size)
+		size = max_size;
+
+	/* Indications of an earlier run may still be outstanding */
+	memset(stream->value, 0x7f, sizeof(stream->value));
+	stream->active = true;
+	stream->indicate = indicate;
+	stream->rate = rate;
+	stream->size = size;
+	stream->next = 0;
+	stream->seq = 0;
+	stream->issued = 0;
+
+	xfer_stats_start(&stream->stats);
+
+	stream->tick_id = timeout_add(STREAM_TICK, stream_tick, server, NULL);
+
+	if (duration)
+		stream->end_id = timeout_add(duration * 1000, stream_end,
+								server, NULL);
+
+	printf("Streaming %u byte %s\n", stream->size,
+				indicate ? "indications" : "notifications");
+
+	stream_fill(server);
+}
+
+static void cmd_stop_stream(struct server *server, char *cmd_str)
+{
+	if (!server->stream.active) {
+		printf("Stream not running\n");
+		return;
+	}
+
+	stream_stop(server);
+}
+
 static void print_uuid(const bt_uuid_t *uuid)
 {
 	char uuid_str[MAX_LEN_UUID_STR];
@@ -1046,6 +1558,8 @@ static struct {
 	{ "help", cmd_help, "\tDisplay help message" },
 	{ "notify", cmd_notify, "\tSend handle-value notification" },
 	{ "heart-rate", cmd_heart_rate, "\tHide/Unhide Heart Rate Service" },
+	{ "stream", cmd_stream, "\tStream notifications or indications" },
+	{ "stop-stream", cmd_stop_stream, "\tStop streaming and report" },
 	{ "services", cmd_services, "\tEnumerate all services" },
 	{ "set-sign-key", cmd_set_sign_key,
 			"\tSet remote signing key for signed write command"},
@@ -1133,9 +1647,12 @@ int main(int argc, char *argv[])
 	uint8_t src_type = BDADDR_LE_PUBLIC;
 	uint16_t mtu = 0;
 	bool hr_visible = false;
+	unsigned int stream_chrcs = 0;
+	bool eatt = false;
+	int eatt_fd = -1;
 	struct server *server;
 
-	while ((opt = getopt_long(argc, argv, "+hvrs:t:m:i:",
+	while ((opt = getopt_long(argc, argv, "+hvren:s:t:m:i:",
 						main_options, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -1147,6 +1664,17 @@ int main(int argc, char *argv[])
 		case 'r':
 			hr_visible = true;
 			break;
+		case 'n':
+			stream_chrcs = atoi(optarg);
+			if (!stream_chrcs || stream_chrcs > MAX_STREAM_CHRCS) {
+				fprintf(stderr, "Invalid number of stream "
+					"characteristics: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'e':
+			eatt = true;
+			break;
 		case 's':
 			if (strcmp(optarg, "low") == 0)
 				sec = BT_SECURITY_LOW;
@@ -1217,6 +1745,14 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	/* Listen before the peer connects so its bearers are not refused */
+	if (eatt) {
+		eatt_fd = l2cap_le_eatt_listen(&src_addr, sec, src_type,
+					mtu ? mtu : BT_ATT_MAX_LE_MTU);
+		if (eatt_fd < 0)
+			return EXIT_FAILURE;
+	}
+
 	fd = l2cap_le_att_listen_and_accept(&src_addr, sec, src_type);
 	if (fd < 0) {
 		fprintf(stderr, "Failed to accept L2CAP ATT connection\n");
@@ -1225,12 +1761,20 @@ int main(int argc, char *argv[])
 
 	mainloop_init();
 
-	server = server_create(fd, mtu, hr_visible);
+	server = server_create(fd, mtu, hr_visible, stream_chrcs);
 	if (!server) {
 		close(fd);
 		return EXIT_FAILURE;
 	}
 
+	if (eatt_fd >= 0 && mainloop_add_fd(eatt_fd, EPOLLIN, eatt_accept_cb,
+							server, NULL) < 0) {
+		fprintf(stderr, "Failed to accept EATT bearers\n");
+		server_destroy(server);
+
+		return EXIT_FAILURE;
+	}
+
 	if (mainloop_add_fd(fileno(stdin),
 				EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR,
 				prompt_read_cb, server, NULL) < 0) {
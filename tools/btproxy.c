@@ -25,7 +25,9 @@
 #include <getopt.h>
 #include <stdbool.h>
 #include <termios.h>
+#include <inttypes.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -36,6 +38,7 @@
 #include "src/shared/mainloop.h"
 #include "src/shared/ecc.h"
 #include "monitor/bt.h"
+#include "tools/xfer-stats.h"
 
 #define HCI_PRIMARY	0x00
 #define HCI_AMP		0x01
@@ -48,38 +51,96 @@ struct sockaddr_hci {
 };
 #define HCI_CHANNEL_USER	1
 
+/* Packets forwarded per write call and slots per recvmmsg call */
+#define BATCH_SIZE	64
+#define PACKET_SLOTS	16
+#define PACKET_SLOT	4096
+
+enum {
+	FD_STREAM,		/* TCP or Unix stream socket, tty */
+	FD_SOCKET,		/* HCI user channel, one packet per message */
+	FD_DEVICE,		/* /dev/vhci, one packet per read and write */
+};
+
 static uint16_t hci_index = 0;
 static bool client_active = false;
 static bool debug_enabled = false;
 static bool emulate_ecc = false;
 static bool skip_first_zero = false;
+static bool stats_enabled = false;
 
 static void hexdump_print(const char *str, void *user_data)
 {
 	printf("%s%s\n", (char *) user_data, str);
 }
 
+/*
+ * Packets taken from one descriptor are collected here and handed to the
+ * other descriptor with as few system calls as its type allows once the
+ * read has been parsed.
+ */
+struct batch {
+	int fd;
+	uint8_t type;
+	const char *prefix;
+	struct iovec iov[BATCH_SIZE];
+	unsigned int count;
+	unsigned int packets;
+	bool failed;
+
+	/* Statistics */
+	uint64_t read_us;
+	uint64_t reads;
+	uint64_t writes;
+	struct xfer_stats stats;
+};
+
 struct proxy {
 	/* Receive commands, ACL, SCO and ISO data */
 	int host_fd;
-	uint8_t host_buf[4096];
-	uint16_t host_len;
+	uint8_t host_buf[PACKET_SLOTS * PACKET_SLOT];
+	uint32_t host_len;
 	bool host_shutdown;
 	bool host_skip_first_zero;
+	struct batch host_batch;
 
 	/* Receive events, ACL, SCO and ISO data */
 	int dev_fd;
-	uint8_t dev_buf[4096];
-	uint16_t dev_len;
+	uint8_t dev_type;
+	uint8_t dev_buf[PACKET_SLOTS * PACKET_SLOT];
+	uint32_t dev_len;
 	bool dev_shutdown;
+	struct batch dev_batch;
 
 	/* ECC emulation */
 	uint8_t event_mask[8];
 	uint8_t local_sk256[32];
 };
 
-static bool write_packet(int fd, const void *data, size_t size,
-							void *user_data)
+static struct proxy *current_proxy;
+
+static uint8_t fd_type(int fd)
+{
+	struct stat st;
+	socklen_t len;
+	int type;
+
+	if (fstat(fd, &st) < 0)
+		return FD_DEVICE;
+
+	if (!S_ISSOCK(st.st_mode))
+		return isatty(fd) ? FD_STREAM : FD_DEVICE;
+
+	len = sizeof(type);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0 ||
+							type == SOCK_STREAM)
+		return FD_STREAM;
+
+	return FD_SOCKET;
+}
+
+static bool write_packet(int fd, const void *data, size_t size)
 {
 	while (size > 0) {
 		ssize_t written;
@@ -91,10 +152,6 @@ static bool write_packet(int fd, const void *data, size_t size,
 			return false;
 		}
 
-		if (debug_enabled)
-			util_hexdump('<', data, written, hexdump_print,
-								user_data);
-
 		data += written;
 		size -= written;
 	}
@@ -102,20 +159,174 @@ static bool write_packet(int fd, const void *data, size_t size,
 	return true;
 }
 
-static void host_write_packet(struct proxy *proxy, void *buf, uint16_t len)
+static bool write_stream(struct batch *batch)
 {
-	if (!write_packet(proxy->dev_fd, buf, len, "D: ")) {
-		fprintf(stderr, "Write to device descriptor failed\n");
-		mainloop_remove_fd(proxy->dev_fd);
+	struct iovec *iov = batch->iov;
+	int count = batch->count;
+
+	while (count > 0) {
+		ssize_t written;
+
+		written = writev(batch->fd, iov, count);
+		if (written < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return false;
+		}
+
+		batch->writes++;
+
+		while (count > 0 && (size_t) written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+
+		if (count > 0) {
+			iov->iov_base += written;
+			iov->iov_len -= written;
+		}
 	}
+
+	return true;
 }
 
-static void dev_write_packet(struct proxy *proxy, void *buf, uint16_t len)
+static bool send_packets(struct batch *batch)
+{
+	struct mmsghdr msgs[BATCH_SIZE];
+	unsigned int i, sent = 0;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < batch->count; i++) {
+		msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (sent < batch->count) {
+		int ret;
+
+		ret = sendmmsg(batch->fd, msgs + sent, batch->count - sent, 0);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return false;
+		}
+
+		batch->writes++;
+		sent += ret;
+	}
+
+	return true;
+}
+
+static bool flush_batch(struct batch *batch)
+{
+	unsigned int i;
+	bool result = true;
+
+	if (batch->failed)
+		return false;
+
+	if (!batch->count)
+		return true;
+
+	switch (batch->type) {
+	case FD_STREAM:
+		result = write_stream(batch);
+		break;
+	case FD_SOCKET:
+		result = send_packets(batch);
+		break;
+	default:
+		for (i = 0; i < batch->count && result; i++) {
+			result = write_packet(batch->fd, batch->iov[i].iov_base,
+							batch->iov[i].iov_len);
+			batch->writes++;
+		}
+		break;
+	}
+
+	if (stats_enabled) {
+		uint64_t latency = xfer_now_us() - batch->read_us;
+
+		for (i = 0; i < batch->packets; i++)
+			xfer_stats_rtt(&batch->stats, latency);
+	}
+
+	batch->count = 0;
+	batch->packets = 0;
+	batch->failed = !result;
+
+	return result;
+}
+
+static void queue_packet(struct batch *batch, void *buf, uint16_t len)
+{
+	struct iovec *last = batch->count ? &batch->iov[batch->count - 1] :
+									NULL;
+
+	if (debug_enabled)
+		util_hexdump('<', buf, len, hexdump_print,
+						(void *) batch->prefix);
+
+	if (stats_enabled)
+		xfer_stats_sent(&batch->stats, len);
+
+	batch->packets++;
+
+	/* Packets back to back in the read buffer leave as one chunk */
+	if (batch->type == FD_STREAM && last &&
+					last->iov_base + last->iov_len == buf) {
+		last->iov_len += len;
+		return;
+	}
+
+	if (batch->count == BATCH_SIZE)
+		flush_batch(batch);
+
+	batch->iov[batch->count].iov_base = buf;
+	batch->iov[batch->count].iov_len = len;
+	batch->count++;
+}
+
+static bool proxy_flush(struct proxy *proxy)
 {
-	if (!write_packet(proxy->host_fd, buf, len, "H: ")) {
+	if (!flush_batch(&proxy->host_batch)) {
+		fprintf(stderr, "Write to device descriptor failed\n");
+		mainloop_remove_fd(proxy->dev_fd);
+		return false;
+	}
+
+	if (!flush_batch(&proxy->dev_batch)) {
 		fprintf(stderr, "Write to host descriptor failed\n");
 		mainloop_remove_fd(proxy->host_fd);
+		return false;
 	}
+
+	return true;
+}
+
+static void host_write_packet(struct proxy *proxy, void *buf, uint16_t len)
+{
+	queue_packet(&proxy->host_batch, buf, len);
+}
+
+static void dev_write_packet(struct proxy *proxy, void *buf, uint16_t len)
+{
+	queue_packet(&proxy->dev_batch, buf, len);
+}
+
+/*
+ * Events made up while emulating ECC live on the stack, so send them right
+ * away.  They are accounted to the command that triggered them.
+ */
+static void dev_inject_packet(struct proxy *proxy, void *buf, uint16_t len)
+{
+	proxy->dev_batch.read_us = proxy->host_batch.read_us;
+
+	dev_write_packet(proxy, buf, len);
+	flush_batch(&proxy->dev_batch);
 }
 
 static void cmd_status(struct proxy *proxy, uint8_t status, uint16_t opcode)
@@ -135,7 +346,7 @@ static void cmd_status(struct proxy *proxy, uint8_t status, uint16_t opcode)
 	cs->ncmd = 0x01;
 	cs->opcode = cpu_to_le16(opcode);
 
-	dev_write_packet(proxy, buf, buf_size);
+	dev_inject_packet(proxy, buf, buf_size);
 }
 
 static void le_meta_event(struct proxy *proxy, uint8_t event,
@@ -155,7 +366,7 @@ static void le_meta_event(struct proxy *proxy, uint8_t event,
 	if (len > 0)
 		memcpy(buf + 1 + sizeof(*hdr) + 1, data, len);
 
-	dev_write_packet(proxy, buf, buf_size);
+	dev_inject_packet(proxy, buf, buf_size);
 }
 
 static void host_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
@@ -258,6 +469,56 @@ static void dev_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
 	}
 }
 
+static void print_batch_stats(const char *label, struct batch *batch)
+{
+	struct xfer_stats *stats = &batch->stats;
+
+	xfer_stats_stop(stats);
+
+	printf("%s: %" PRIu64 " packets, %" PRIu64 " bytes in %.2f sec "
+			"(%.1f kB/s)\n", label, stats->frames, stats->bytes,
+			stats->elapsed_us / 1000000.0,
+			stats->elapsed_us ? stats->bytes * 1000000.0 /
+					stats->elapsed_us / 1024 : 0);
+
+	printf("%s: %" PRIu64 " reads, %" PRIu64 " writes, %.1f packets "
+			"per write\n", label, batch->reads, batch->writes,
+			batch->writes ? (double) stats->frames / batch->writes :
+									0);
+
+	if (!stats->rtt.count)
+		return;
+
+	printf("%s: latency min %" PRIu64 " p50 %" PRIu64 " p90 %" PRIu64
+			" p99 %" PRIu64 " max %" PRIu64 " usec\n", label,
+			stats->rtt.min, xfer_hist_percentile(&stats->rtt, 50),
+			xfer_hist_percentile(&stats->rtt, 90),
+			xfer_hist_percentile(&stats->rtt, 99), stats->rtt.max);
+}
+
+static void print_stats(struct proxy *proxy)
+{
+	print_batch_stats("Host to device", &proxy->host_batch);
+	print_batch_stats("Device to host", &proxy->dev_batch);
+
+	printf("CPU time %.3f sec\n",
+			proxy->host_batch.stats.cpu_us / 1000000.0);
+
+	fflush(stdout);
+}
+
+static void free_proxy(struct proxy *proxy)
+{
+	if (stats_enabled)
+		print_stats(proxy);
+
+	if (current_proxy == proxy)
+		current_proxy = NULL;
+
+	client_active = false;
+	free(proxy);
+}
+
 static void host_read_destroy(void *user_data)
 {
 	struct proxy *proxy = user_data;
@@ -270,22 +531,59 @@ static void host_read_destroy(void *user_data)
 	close(proxy->host_fd);
 	proxy->host_fd = -1;
 
-	if (proxy->dev_fd < 0) {
-		client_active = false;
-		free(proxy);
-	} else
+	if (proxy->dev_fd < 0)
+		free_proxy(proxy);
+	else
 		mainloop_remove_fd(proxy->dev_fd);
 }
 
+/*
+ * Return the length of the packet at the start of the buffer, 0 if not
+ * enough of its header has arrived yet or -1 for an unknown packet type.
+ */
+static int host_packet_len(const uint8_t *buf, uint32_t len)
+{
+	const struct bt_hci_cmd_hdr *cmd_hdr;
+	const struct bt_hci_acl_hdr *acl_hdr;
+	const struct bt_hci_sco_hdr *sco_hdr;
+	const struct bt_hci_iso_hdr *iso_hdr;
+
+	switch (buf[0]) {
+	case BT_H4_CMD_PKT:
+		if (len < 1 + sizeof(*cmd_hdr))
+			return 0;
+
+		cmd_hdr = (void *) (buf + 1);
+		return 1 + sizeof(*cmd_hdr) + cmd_hdr->plen;
+	case BT_H4_ACL_PKT:
+		if (len < 1 + sizeof(*acl_hdr))
+			return 0;
+
+		acl_hdr = (void *) (buf + 1);
+		return 1 + sizeof(*acl_hdr) + cpu_to_le16(acl_hdr->dlen);
+	case BT_H4_SCO_PKT:
+		if (len < 1 + sizeof(*sco_hdr))
+			return 0;
+
+		sco_hdr = (void *) (buf + 1);
+		return 1 + sizeof(*sco_hdr) + sco_hdr->dlen;
+	case BT_H4_ISO_PKT:
+		if (len < 1 + sizeof(*iso_hdr))
+			return 0;
+
+		iso_hdr = (void *) (buf + 1);
+		return 1 + sizeof(*iso_hdr) + cpu_to_le16(iso_hdr->dlen);
+	}
+
+	return -1;
+}
+
 static void host_read_callback(int fd, uint32_t events, void *user_data)
 {
 	struct proxy *proxy = user_data;
-	struct bt_hci_cmd_hdr *cmd_hdr;
-	struct bt_hci_acl_hdr *acl_hdr;
-	struct bt_hci_sco_hdr *sco_hdr;
-	struct bt_hci_iso_hdr *iso_hdr;
+	uint32_t offset = 0;
 	ssize_t len;
-	uint16_t pktlen;
+	int pktlen;
 
 	if (events & (EPOLLERR | EPOLLHUP)) {
 		fprintf(stderr, "Error from host descriptor\n");
@@ -310,6 +608,11 @@ static void host_read_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
+	proxy->host_batch.reads++;
+
+	if (stats_enabled)
+		proxy->host_batch.read_us = xfer_now_us();
+
 	if (debug_enabled)
 		util_hexdump('>', proxy->host_buf + proxy->host_len, len,
 						hexdump_print, "H: ");
@@ -326,66 +629,48 @@ static void host_read_callback(int fd, uint32_t events, void *user_data)
 
 	proxy->host_len += len;
 
-process_packet:
-	if (proxy->host_len < 1)
-		return;
+	/*
+	 * Queue every complete packet in place and write them all out
+	 * before moving a trailing partial packet to the front.
+	 */
+	while (offset < proxy->host_len) {
+		uint8_t *buf = proxy->host_buf + offset;
+		uint32_t avail = proxy->host_len - offset;
 
-	switch (proxy->host_buf[0]) {
-	case BT_H4_CMD_PKT:
-		if (proxy->host_len < 1 + sizeof(*cmd_hdr))
-			return;
+		/* Notification packet from /dev/vhci - ignore */
+		if (buf[0] == 0xff) {
+			offset = proxy->host_len;
+			break;
+		}
 
-		cmd_hdr = (void *) (proxy->host_buf + 1);
-		pktlen = 1 + sizeof(*cmd_hdr) + cmd_hdr->plen;
-		break;
-	case BT_H4_ACL_PKT:
-		if (proxy->host_len < 1 + sizeof(*acl_hdr))
+		pktlen = host_packet_len(buf, avail);
+		if (pktlen < 0) {
+			fprintf(stderr, "Received unknown host packet type "
+							"0x%02x\n", buf[0]);
+			if (proxy_flush(proxy))
+				mainloop_remove_fd(proxy->host_fd);
 			return;
+		}
 
-		acl_hdr = (void *) (proxy->host_buf + 1);
-		pktlen = 1 + sizeof(*acl_hdr) + cpu_to_le16(acl_hdr->dlen);
-		break;
-	case BT_H4_SCO_PKT:
-		if (proxy->host_len < 1 + sizeof(*sco_hdr))
-			return;
+		if (!pktlen || avail < (uint32_t) pktlen)
+			break;
 
-		sco_hdr = (void *) (proxy->host_buf + 1);
-		pktlen = 1 + sizeof(*sco_hdr) + sco_hdr->dlen;
-		break;
-	case BT_H4_ISO_PKT:
-		if (proxy->host_len < 1 + sizeof(*iso_hdr))
-			return;
+		if (emulate_ecc)
+			host_emulate_ecc(proxy, buf, pktlen);
+		else
+			host_write_packet(proxy, buf, pktlen);
 
-		iso_hdr = (void *) (proxy->host_buf + 1);
-		pktlen = 1 + sizeof(*iso_hdr) + cpu_to_le16(iso_hdr->dlen);
-		break;
-	case 0xff:
-		/* Notification packet from /dev/vhci - ignore */
-		proxy->host_len = 0;
-		return;
-	default:
-		fprintf(stderr, "Received unknown host packet type 0x%02x\n",
-							proxy->host_buf[0]);
-		mainloop_remove_fd(proxy->host_fd);
-		return;
+		offset += pktlen;
 	}
 
-	if (proxy->host_len < pktlen)
+	if (!proxy_flush(proxy))
 		return;
 
-	if (emulate_ecc)
-		host_emulate_ecc(proxy, proxy->host_buf, pktlen);
-	else
-		host_write_packet(proxy, proxy->host_buf, pktlen);
-
-	if (proxy->host_len > pktlen) {
-		memmove(proxy->host_buf, proxy->host_buf + pktlen,
-						proxy->host_len - pktlen);
-		proxy->host_len -= pktlen;
-		goto process_packet;
-	}
+	proxy->host_len -= offset;
 
-	proxy->host_len = 0;
+	if (proxy->host_len)
+		memmove(proxy->host_buf, proxy->host_buf + offset,
+							proxy->host_len);
 }
 
 static void dev_read_destroy(void *user_data)
@@ -400,22 +685,94 @@ static void dev_read_destroy(void *user_data)
 	close(proxy->dev_fd);
 	proxy->dev_fd = -1;
 
-	if (proxy->host_fd < 0) {
-		client_active = false;
-		free(proxy);
-	} else
+	if (proxy->host_fd < 0)
+		free_proxy(proxy);
+	else
 		mainloop_remove_fd(proxy->host_fd);
 }
 
+static int dev_packet_len(const uint8_t *buf, uint32_t len)
+{
+	const struct bt_hci_evt_hdr *evt_hdr;
+
+	if (buf[0] != BT_H4_EVT_PKT)
+		return host_packet_len(buf, len);
+
+	if (len < 1 + sizeof(*evt_hdr))
+		return 0;
+
+	evt_hdr = (void *) (buf + 1);
+	return 1 + sizeof(*evt_hdr) + evt_hdr->plen;
+}
+
+/*
+ * The user channel hands out exactly one packet per message, so fetch
+ * whatever is queued with a single call, each packet into its own slot.
+ */
+static void dev_recv_packets(struct proxy *proxy)
+{
+	struct mmsghdr msgs[PACKET_SLOTS];
+	struct iovec iov[PACKET_SLOTS];
+	int i, count;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < PACKET_SLOTS; i++) {
+		iov[i].iov_base = proxy->dev_buf + i * PACKET_SLOT;
+		iov[i].iov_len = PACKET_SLOT;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	count = recvmmsg(proxy->dev_fd, msgs, PACKET_SLOTS, MSG_DONTWAIT,
+									NULL);
+	if (count < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+
+		fprintf(stderr, "Read from device descriptor failed\n");
+		mainloop_remove_fd(proxy->dev_fd);
+		return;
+	}
+
+	proxy->dev_batch.reads++;
+
+	if (stats_enabled)
+		proxy->dev_batch.read_us = xfer_now_us();
+
+	for (i = 0; i < count; i++) {
+		uint8_t *buf = iov[i].iov_base;
+		uint32_t len = msgs[i].msg_len;
+
+		if (!len)
+			continue;
+
+		if (debug_enabled)
+			util_hexdump('>', buf, len, hexdump_print, "D: ");
+
+		if (dev_packet_len(buf, len) < 0) {
+			fprintf(stderr, "Received unknown device packet type "
+							"0x%02x\n", buf[0]);
+			if (proxy_flush(proxy))
+				mainloop_remove_fd(proxy->dev_fd);
+			return;
+		}
+
+		if (emulate_ecc)
+			dev_emulate_ecc(proxy, buf, len);
+		else
+			dev_write_packet(proxy, buf, len);
+	}
+
+	proxy_flush(proxy);
+}
+
 static void dev_read_callback(int fd, uint32_t events, void *user_data)
 {
 	struct proxy *proxy = user_data;
-	struct bt_hci_evt_hdr *evt_hdr;
-	struct bt_hci_acl_hdr *acl_hdr;
-	struct bt_hci_sco_hdr *sco_hdr;
-	struct bt_hci_iso_hdr *iso_hdr;
+	uint32_t offset = 0;
 	ssize_t len;
-	uint16_t pktlen;
+	int pktlen;
 
 	if (events & (EPOLLERR | EPOLLHUP)) {
 		fprintf(stderr, "Error from device descriptor\n");
@@ -429,6 +786,11 @@ static void dev_read_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
+	if (proxy->dev_type == FD_SOCKET) {
+		dev_recv_packets(proxy);
+		return;
+	}
+
 	len = read(proxy->dev_fd, proxy->dev_buf + proxy->dev_len,
 				sizeof(proxy->dev_buf) - proxy->dev_len);
 	if (len < 0) {
@@ -440,68 +802,49 @@ static void dev_read_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
+	proxy->dev_batch.reads++;
+
+	if (stats_enabled)
+		proxy->dev_batch.read_us = xfer_now_us();
+
 	if (debug_enabled)
 		util_hexdump('>', proxy->dev_buf + proxy->dev_len, len,
 						hexdump_print, "D: ");
 
 	proxy->dev_len += len;
 
-process_packet:
-	if (proxy->dev_len < 1)
-		return;
-
-	switch (proxy->dev_buf[0]) {
-	case BT_H4_EVT_PKT:
-		if (proxy->dev_len < 1 + sizeof(*evt_hdr))
-			return;
+	while (offset < proxy->dev_len) {
+		uint8_t *buf = proxy->dev_buf + offset;
+		uint32_t avail = proxy->dev_len - offset;
 
-		evt_hdr = (void *) (proxy->dev_buf + 1);
-		pktlen = 1 + sizeof(*evt_hdr) + evt_hdr->plen;
-		break;
-	case BT_H4_ACL_PKT:
-		if (proxy->dev_len < 1 + sizeof(*acl_hdr))
+		pktlen = dev_packet_len(buf, avail);
+		if (pktlen < 0) {
+			fprintf(stderr, "Received unknown device packet type "
+							"0x%02x\n", buf[0]);
+			if (proxy_flush(proxy))
+				mainloop_remove_fd(proxy->dev_fd);
 			return;
+		}
 
-		acl_hdr = (void *) (proxy->dev_buf + 1);
-		pktlen = 1 + sizeof(*acl_hdr) + cpu_to_le16(acl_hdr->dlen);
-		break;
-	case BT_H4_SCO_PKT:
-		if (proxy->dev_len < 1 + sizeof(*sco_hdr))
-			return;
+		if (!pktlen || avail < (uint32_t) pktlen)
+			break;
 
-		sco_hdr = (void *) (proxy->dev_buf + 1);
-		pktlen = 1 + sizeof(*sco_hdr) + sco_hdr->dlen;
-		break;
-	case BT_H4_ISO_PKT:
-		if (proxy->dev_len < 1 + sizeof(*iso_hdr))
-			return;
+		if (emulate_ecc)
+			dev_emulate_ecc(proxy, buf, pktlen);
+		else
+			dev_write_packet(proxy, buf, pktlen);
 
-		iso_hdr = (void *) (proxy->dev_buf + 1);
-		pktlen = 1 + sizeof(*iso_hdr) + cpu_to_le16(iso_hdr->dlen);
-		break;
-	default:
-		fprintf(stderr, "Received unknown device packet type 0x%02x\n",
-							proxy->dev_buf[0]);
-		mainloop_remove_fd(proxy->dev_fd);
-		return;
+		offset += pktlen;
 	}
 
-	if (proxy->dev_len < pktlen)
+	if (!proxy_flush(proxy))
 		return;
 
-	if (emulate_ecc)
-		dev_emulate_ecc(proxy, proxy->dev_buf, pktlen);
-	else
-		dev_write_packet(proxy, proxy->dev_buf, pktlen);
-
-	if (proxy->dev_len > pktlen) {
-		memmove(proxy->dev_buf, proxy->dev_buf + pktlen,
-						proxy->dev_len - pktlen);
-		proxy->dev_len -= pktlen;
-		goto process_packet;
-	}
+	proxy->dev_len -= offset;
 
-	proxy->dev_len = 0;
+	if (proxy->dev_len)
+		memmove(proxy->dev_buf, proxy->dev_buf + offset,
+							proxy->dev_len);
 }
 
 static bool setup_proxy(int host_fd, bool host_shutdown,
@@ -521,8 +864,24 @@ static bool setup_proxy(int host_fd, bool host_shutdown,
 	proxy->host_skip_first_zero = skip_first_zero;
 
 	proxy->dev_fd = dev_fd;
+	proxy->dev_type = fd_type(dev_fd);
 	proxy->dev_shutdown = dev_shutdown;
 
+	proxy->host_batch.fd = dev_fd;
+	proxy->host_batch.type = proxy->dev_type;
+	proxy->host_batch.prefix = "D: ";
+
+	proxy->dev_batch.fd = host_fd;
+	proxy->dev_batch.type = fd_type(host_fd);
+	proxy->dev_batch.prefix = "H: ";
+
+	if (stats_enabled) {
+		xfer_stats_start(&proxy->host_batch.stats);
+		xfer_stats_start(&proxy->dev_batch.stats);
+	}
+
+	current_proxy = proxy;
+
 	mainloop_add_fd(proxy->host_fd, EPOLLIN | EPOLLRDHUP,
 				host_read_callback, proxy, host_read_destroy);
 
@@ -740,6 +1099,10 @@ static void signal_callback(int signum, void *user_data)
 	case SIGTERM:
 		mainloop_quit();
 		break;
+	case SIGUSR2:
+		if (current_proxy && stats_enabled)
+			print_stats(current_proxy);
+		break;
 	}
 }
 
@@ -756,6 +1119,7 @@ static void usage(void)
 		"\t-i, --index <num>           Use specified controller\n"
 		"\t-a, --amp                   Create AMP controller\n"
 		"\t-e, --ecc                   Emulate ECC support\n"
+		"\t-s, --stats                 Print forwarding statistics\n"
 		"\t-d, --debug                 Enable debugging output\n"
 		"\t-h, --help                  Show help options\n");
 }
@@ -769,6 +1133,7 @@ static const struct option main_options[] = {
 	{ "index",    required_argument, NULL, 'i' },
 	{ "amp",      no_argument,       NULL, 'a' },
 	{ "ecc",      no_argument,       NULL, 'e' },
+	{ "stats",    no_argument,       NULL, 's' },
 	{ "debug",    no_argument,       NULL, 'd' },
 	{ "version",  no_argument,       NULL, 'v' },
 	{ "help",     no_argument,       NULL, 'h' },
@@ -788,7 +1153,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "rc:l::u::p:i:aezdvh",
+		opt = getopt_long(argc, argv, "rc:l::u::p:i:aezsdvh",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -842,6 +1207,9 @@ int main(int argc, char *argv[])
 		case 'z':
 			skip_first_zero = true;
 			break;
+		case 's':
+			stats_enabled = true;
+			break;
 		case 'd':
 			debug_enabled = true;
 			break;
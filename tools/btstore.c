@@ -0,0 +1,617 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/kvlog.h"
+
+#define STORE_NAME "store"
+
+static const char *info_template =
+	"[General]\n"
+	"Name=Device %u\n"
+	"AddressType=public\n"
+	"SupportedTechnologies=LE;\n"
+	"Trusted=false\n"
+	"Blocked=false\n"
+	"Services=00001800-0000-1000-8000-00805f9b34fb;"
+	"00001801-0000-1000-8000-00805f9b34fb;\n"
+	"\n"
+	"[IdentityResolvingKey]\n"
+	"Key=%08X9A4F0D2E6C1B3A5D7E9F0A1B\n"
+	"\n"
+	"[LongTermKey]\n"
+	"Key=%08XE1D2C3B4A5968778695A4B3C\n"
+	"Authenticated=0\n"
+	"EncSize=16\n"
+	"EDiv=0\n"
+	"Rand=0\n"
+	"\n"
+	"[ConnectionParameters]\n"
+	"MinInterval=24\n"
+	"MaxInterval=40\n"
+	"Latency=0\n"
+	"Timeout=42\n";
+
+static char *store_path(const char *dirname)
+{
+	char *path;
+
+	if (asprintf(&path, "%s/" STORE_NAME, dirname) < 0)
+		return NULL;
+
+	return path;
+}
+
+static struct kvlog *open_store(const char *dirname, bool *created)
+{
+	struct kvlog *log;
+	char *path;
+
+	path = store_path(dirname);
+	if (!path)
+		return NULL;
+
+	log = kvlog_open(path, created);
+	if (!log)
+		fprintf(stderr, "Failed to open %s: %s\n", path,
+							strerror(errno));
+
+	free(path);
+
+	return log;
+}
+
+static int cmd_import(const char *dirname)
+{
+	struct kvlog_stats stats;
+	struct kvlog *log;
+	bool created;
+	int err;
+
+	log = open_store(dirname, &created);
+	if (!log)
+		return EXIT_FAILURE;
+
+	if (!created) {
+		fprintf(stderr, "Store in %s already exists\n", dirname);
+		kvlog_close(log);
+		return EXIT_FAILURE;
+	}
+
+	err = kvlog_import_dir(log, dirname);
+	if (err < 0) {
+		fprintf(stderr, "Import failed: %s\n", strerror(-err));
+		kvlog_close(log);
+		return EXIT_FAILURE;
+	}
+
+	kvlog_get_stats(log, &stats);
+	printf("Imported %u entries (%llu bytes)\n", stats.entries,
+				(unsigned long long) stats.live_bytes);
+
+	kvlog_close(log);
+
+	return EXIT_SUCCESS;
+}
+
+static void collect_key(const char *key, size_t len, void *user_data)
+{
+	queue_push_tail(user_data, strdup(key));
+}
+
+static int make_parents(char *path)
+{
+	char *sep;
+
+	for (sep = strchr(path + 1, '/'); sep; sep = strchr(sep + 1, '/')) {
+		*sep = '\0';
+
+		if (mkdir(path, S_IRWXU) < 0 && errno != EEXIST) {
+			*sep = '/';
+			return -errno;
+		}
+
+		*sep = '/';
+	}
+
+	return 0;
+}
+
+static int write_file(const char *path, const void *data, size_t len)
+{
+	ssize_t written;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+							S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return -errno;
+
+	written = write(fd, data, len);
+	close(fd);
+
+	if (written < 0)
+		return -errno;
+
+	return (size_t) written == len ? 0 : -EIO;
+}
+
+static int cmd_export(const char *dirname)
+{
+	struct kvlog *log;
+	struct queue *keys;
+	char *key;
+	unsigned int count = 0;
+	int err = 0;
+
+	log = open_store(dirname, NULL);
+	if (!log)
+		return EXIT_FAILURE;
+
+	keys = queue_new();
+	kvlog_foreach(log, NULL, collect_key, keys);
+
+	while ((key = queue_pop_head(keys))) {
+		char path[PATH_MAX];
+		size_t len;
+		void *data;
+		int n;
+
+		data = kvlog_get(log, key, &len);
+		n = snprintf(path, sizeof(path), "%s/%s", dirname, key);
+		free(key);
+
+		if (!data)
+			continue;
+
+		if (n < 0 || (size_t) n >= sizeof(path)) {
+			fprintf(stderr, "Path too long for %s\n", dirname);
+			free(data);
+			err = -ENAMETOOLONG;
+			break;
+		}
+
+		err = make_parents(path);
+		if (!err)
+			err = write_file(path, data, len);
+
+		free(data);
+
+		if (err < 0) {
+			fprintf(stderr, "Failed to write %s: %s\n", path,
+							strerror(-err));
+			break;
+		}
+
+		count++;
+	}
+
+	queue_destroy(keys, free);
+	kvlog_close(log);
+
+	printf("Exported %u entries\n", count);
+
+	return err < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void print_key(const char *key, size_t len, void *user_data)
+{
+	printf("%-48s %zu\n", key, len);
+}
+
+static int cmd_list(const char *dirname)
+{
+	struct kvlog_stats stats;
+	struct kvlog *log;
+
+	log = open_store(dirname, NULL);
+	if (!log)
+		return EXIT_FAILURE;
+
+	kvlog_foreach(log, NULL, print_key, NULL);
+
+	kvlog_get_stats(log, &stats);
+	printf("%u entries, %llu bytes live, %llu bytes reclaimable\n",
+				stats.entries,
+				(unsigned long long) stats.live_bytes,
+				(unsigned long long) stats.dead_bytes);
+
+	kvlog_close(log);
+
+	return EXIT_SUCCESS;
+}
+
+static int cmd_compact(const char *dirname)
+{
+	struct kvlog_stats before, after;
+	struct kvlog *log;
+	int err;
+
+	log = open_store(dirname, NULL);
+	if (!log)
+		return EXIT_FAILURE;
+
+	kvlog_get_stats(log, &before);
+
+	err = kvlog_compact(log);
+	if (err < 0) {
+		fprintf(stderr, "Compaction failed: %s\n", strerror(-err));
+		kvlog_close(log);
+		return EXIT_FAILURE;
+	}
+
+	kvlog_get_stats(log, &after);
+	printf("Compacted %llu bytes to %llu bytes\n",
+				(unsigned long long) before.file_size,
+				(unsigned long long) after.file_size);
+
+	kvlog_close(log);
+
+	return EXIT_SUCCESS;
+}
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void device_name(unsigned int i, char *addr)
+{
+	sprintf(addr, "00:11:22:%2.2X:%2.2X:%2.2X", (i >> 16) & 0xff,
+						(i >> 8) & 0xff, i & 0xff);
+}
+
+static int bench_populate(const char *dirname, unsigned int count)
+{
+	char path[PATH_MAX], data[1024], addr[18];
+	unsigned int i;
+	int len, err;
+
+	for (i = 0; i < count; i++) {
+		device_name(i, addr);
+
+		len = snprintf(path, sizeof(path), "%s/%s/info", dirname, addr);
+		if (len < 0 || (size_t) len >= sizeof(path))
+			return -ENAMETOOLONG;
+
+		len = snprintf(data, sizeof(data), info_template, i, i, i);
+
+		err = make_parents(path);
+		if (!err)
+			err = write_file(path, data, len);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static unsigned int bench_load_files(const char *dirname)
+{
+	DIR *dir;
+	struct dirent *entry;
+	unsigned int count = 0;
+
+	dir = opendir(dirname);
+	if (!dir)
+		return 0;
+
+	/* Same access pattern as load_devices() with the file backend */
+	while ((entry = readdir(dir)) != NULL) {
+		char path[PATH_MAX], buf[1024];
+		int fd, len;
+
+		if (entry->d_type == DT_UNKNOWN)
+			entry->d_type = util_get_dt(dirname, entry->d_name);
+
+		if (entry->d_type != DT_DIR || entry->d_name[0] == '.')
+			continue;
+
+		len = snprintf(path, sizeof(path), "%s/%s/info", dirname,
+							entry->d_name);
+		if (len < 0 || (size_t) len >= sizeof(path))
+			continue;
+
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		if (read(fd, buf, sizeof(buf)) > 0)
+			count++;
+
+		close(fd);
+	}
+
+	closedir(dir);
+
+	return count;
+}
+
+struct bench_load {
+	struct kvlog *log;
+	unsigned int count;
+};
+
+static void bench_load_entry(const char *key, size_t len, void *user_data)
+{
+	struct bench_load *load = user_data;
+	void *data;
+
+	if (!strsuffix(key, "/info")) {
+		data = kvlog_get(load->log, key, NULL);
+		if (data)
+			load->count++;
+		free(data);
+	}
+}
+
+static unsigned int bench_load_log(const char *dirname)
+{
+	struct bench_load load;
+
+	load.log = open_store(dirname, NULL);
+	if (!load.log)
+		return 0;
+
+	load.count = 0;
+	kvlog_foreach(load.log, NULL, bench_load_entry, &load);
+	kvlog_close(load.log);
+
+	return load.count;
+}
+
+static int store_file(const char *path, const char *data, size_t len)
+{
+	char tmp[PATH_MAX];
+	int fd, n;
+
+	/* Write, sync and rename just like g_file_set_contents() */
+	n = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	if (n < 0 || (size_t) n >= sizeof(tmp))
+		return -ENAMETOOLONG;
+
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return -errno;
+
+	if (write(fd, data, len) != (ssize_t) len || fsync(fd) < 0) {
+		close(fd);
+		unlink(tmp);
+		return -EIO;
+	}
+
+	close(fd);
+
+	return rename(tmp, path) < 0 ? -errno : 0;
+}
+
+static void print_result(const char *name, uint64_t total, uint64_t max,
+							unsigned int count)
+{
+	printf("  %-22s %10.1f us avg %10llu us max\n", name,
+				(double) total / count,
+				(unsigned long long) max);
+}
+
+static int cmd_bench(const char *dirname, unsigned int count,
+							unsigned int rounds)
+{
+	char files[PATH_MAX], path[PATH_MAX], data[1024], addr[18];
+	uint64_t start, total, max, t;
+	struct kvlog *log;
+	unsigned int i, loaded;
+	int err, len;
+
+	len = snprintf(files, sizeof(files), "%s/btstore-bench-XXXXXX",
+								dirname);
+	if (len < 0 || (size_t) len >= sizeof(files)) {
+		fprintf(stderr, "Path too long for %s\n", dirname);
+		return EXIT_FAILURE;
+	}
+
+	if (!mkdtemp(files)) {
+		fprintf(stderr, "Failed to create %s: %s\n", files,
+							strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	printf("Populating %u devices in %s\n", count, files);
+
+	err = bench_populate(files, count);
+	if (err < 0) {
+		fprintf(stderr, "Failed to populate: %s\n", strerror(-err));
+		return EXIT_FAILURE;
+	}
+
+	log = open_store(files, NULL);
+	if (!log)
+		return EXIT_FAILURE;
+
+	err = kvlog_import_dir(log, files);
+	kvlog_close(log);
+
+	if (err < 0) {
+		fprintf(stderr, "Import failed: %s\n", strerror(-err));
+		return EXIT_FAILURE;
+	}
+
+	printf("Startup (load all device info):\n");
+
+	start = now_usec();
+	loaded = bench_load_files(files);
+	printf("  %-22s %10llu us (%u devices)\n", "files",
+			(unsigned long long) (now_usec() - start), loaded);
+
+	start = now_usec();
+	loaded = bench_load_log(files);
+	printf("  %-22s %10llu us (%u devices)\n", "log",
+			(unsigned long long) (now_usec() - start), loaded);
+
+	printf("Pairing store (%u synced updates):\n", rounds);
+
+	for (i = 0, total = 0, max = 0; i < rounds; i++) {
+		device_name(i % count, addr);
+		len = snprintf(path, sizeof(path), "%s/%s/info", files, addr);
+		if (len < 0 || (size_t) len >= sizeof(path)) {
+			fprintf(stderr, "Path too long for %s\n", files);
+			return EXIT_FAILURE;
+		}
+
+		len = snprintf(data, sizeof(data), info_template, i, i + 1,
+									i + 2);
+
+		start = now_usec();
+		store_file(path, data, len);
+		t = now_usec() - start;
+
+		total += t;
+		max = t > max ? t : max;
+	}
+
+	print_result("files", total, max, rounds);
+
+	log = open_store(files, NULL);
+	if (!log)
+		return EXIT_FAILURE;
+
+	for (i = 0, total = 0, max = 0; i < rounds; i++) {
+		device_name(i % count, addr);
+		snprintf(path, sizeof(path), "%s/info", addr);
+		len = snprintf(data, sizeof(data), info_template, i, i + 1,
+									i + 2);
+
+		start = now_usec();
+		kvlog_put(log, path, data, len);
+		t = now_usec() - start;
+
+		total += t;
+		max = t > max ? t : max;
+	}
+
+	print_result("log", total, max, rounds);
+
+	kvlog_close(log);
+
+	printf("Scratch data left in %s\n", files);
+
+	return EXIT_SUCCESS;
+}
+
+static void usage(void)
+{
+	printf("btstore - Bluetooth storage log utility\n"
+		"Usage:\n");
+	printf("\tbtstore [options] <command> <directory>\n");
+	printf("Commands:\n"
+		"\timport <adapter dir>   Import per-device files into log\n"
+		"\texport <adapter dir>   Write log back as per-device files\n"
+		"\tlist <adapter dir>     List stored entries\n"
+		"\tcompact <adapter dir>  Reclaim space of stale entries\n"
+		"\tbench <scratch dir>    Compare file and log backends\n");
+	printf("Options:\n"
+		"\t-n, --devices <num>    Number of devices for bench\n"
+		"\t-r, --rounds <num>     Number of updates for bench\n"
+		"\t-h, --help             Show help options\n");
+}
+
+static const struct option main_options[] = {
+	{ "devices", required_argument, NULL, 'n' },
+	{ "rounds",  required_argument, NULL, 'r' },
+	{ "version", no_argument,       NULL, 'v' },
+	{ "help",    no_argument,       NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned int devices = 5000;
+	unsigned int rounds = 200;
+	const char *cmd, *dirname;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "n:r:vh", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'n':
+			devices = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'v':
+			printf("%s\n", VERSION);
+			return EXIT_SUCCESS;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	cmd = argv[optind];
+	dirname = argv[optind + 1];
+
+	if (!strcmp(cmd, "import"))
+		return cmd_import(dirname);
+
+	if (!strcmp(cmd, "export"))
+		return cmd_export(dirname);
+
+	if (!strcmp(cmd, "list"))
+		return cmd_list(dirname);
+
+	if (!strcmp(cmd, "compact"))
+		return cmd_compact(dirname);
+
+	if (!strcmp(cmd, "bench")) {
+		if (!devices || !rounds) {
+			fprintf(stderr, "Invalid number of devices/rounds\n");
+			return EXIT_FAILURE;
+		}
+
+		return cmd_bench(dirname, devices, rounds);
+	}
+
+	fprintf(stderr, "Unknown command: %s\n", cmd);
+
+	return EXIT_FAILURE;
+}
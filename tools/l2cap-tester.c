@@ -16,6 +16,8 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <inttypes.h>
+#include <sys/uio.h>
 
 #include <glib.h>
 
@@ -24,6 +26,7 @@
 #include "lib/mgmt.h"
 
 #include "monitor/bt.h"
+#include "emulator/btdev.h"
 #include "emulator/bthost.h"
 #include "emulator/hciemu.h"
 
@@ -43,6 +46,9 @@ struct test_data {
 	int sk;
 	int sk2;
 	bool host_disconnected;
+	uint32_t tx_bytes;
+	uint32_t rx_bytes;
+	int64_t tx_start;
 };
 
 struct l2cap_data {
@@ -83,6 +89,9 @@ struct l2cap_data {
 	bool close_1;
 
 	bool shut_sock_wr;
+
+	uint32_t throughput_len;
+	const struct btdev_acl_config *acl_config;
 };
 
 static void print_debug(const char *str, void *user_data)
@@ -140,6 +149,9 @@ static void index_added_callback(uint16_t index, uint16_t length,
 	tester_print("Index Added callback");
 	tester_print("  Index: 0x%04x", index);
 
+	if (data->mgmt_index != MGMT_INDEX_NONE)
+		return;
+
 	data->mgmt_index = index;
 
 	mgmt_send(data->mgmt, MGMT_OP_READ_INFO, data->mgmt_index, 0, NULL,
@@ -169,6 +181,7 @@ static void read_index_list_callback(uint8_t status, uint16_t length,
 					const void *param, void *user_data)
 {
 	struct test_data *data = tester_get_data();
+	const struct l2cap_data *l2data = data->test_data;
 
 	tester_print("Read Index List callback");
 	tester_print("  Status: 0x%02x", status);
@@ -188,8 +201,12 @@ static void read_index_list_callback(uint8_t status, uint16_t length,
 	if (!data->hciemu) {
 		tester_warn("Failed to setup HCI emulation");
 		tester_pre_setup_failed();
+		return;
 	}
 
+	if (l2data && l2data->acl_config)
+		hciemu_set_acl_config(data->hciemu, l2data->acl_config);
+
 	if (tester_use_debug())
 		hciemu_set_debug(data->hciemu, print_debug, "hciemu: ", NULL);
 
@@ -241,6 +258,7 @@ static void test_data_free(void *test_data)
 		if (!user) \
 			break; \
 		user->hciemu_type = HCIEMU_TYPE_BREDR; \
+		user->mgmt_index = MGMT_INDEX_NONE; \
 		user->io_id = 0; \
 		user->test_data = data; \
 		tester_add_full(name, data, \
@@ -255,6 +273,7 @@ static void test_data_free(void *test_data)
 		if (!user) \
 			break; \
 		user->hciemu_type = HCIEMU_TYPE_LE; \
+		user->mgmt_index = MGMT_INDEX_NONE; \
 		user->io_id = 0; \
 		user->test_data = data; \
 		tester_add_full(name, data, \
@@ -309,6 +328,25 @@ static const struct l2cap_data client_connect_write_success_test = {
 	.data_len = sizeof(l2_data),
 };
 
+/* Controller buffers and a ~2 Mbit/s link with 5 ms of air latency */
+static const struct btdev_acl_config bredr_acl_config = {
+	.mtu = 1021,
+	.max_pkt = 8,
+	.rate = 250000,
+	.latency = 5,
+	.ncp_interval = 10,
+};
+
+static uint8_t throughput_data[672];
+
+static const struct l2cap_data client_connect_throughput_test = {
+	.client_psm = 0x1001,
+	.server_psm = 0x1001,
+	.data_len = sizeof(throughput_data),
+	.throughput_len = 256 * 1024,
+	.acl_config = &bredr_acl_config,
+};
+
 static const struct l2cap_data client_connect_shut_wr_success_test = {
 	.client_psm = 0x1001,
 	.server_psm = 0x1001,
@@ -545,6 +583,23 @@ static const struct l2cap_data le_att_client_connect_success_test_1 = {
 	.sec_level = BT_SECURITY_LOW,
 };
 
+/* LE data length extension buffers on a ~700 kbit/s link */
+static const struct btdev_acl_config le_acl_config = {
+	.mtu = 251,
+	.max_pkt = 4,
+	.rate = 90000,
+	.latency = 8,
+	.ncp_interval = 8,
+};
+
+static const struct l2cap_data le_att_client_throughput_test = {
+	.cid = 0x0004,
+	.sec_level = BT_SECURITY_LOW,
+	.data_len = 23,
+	.throughput_len = 64 * 1024,
+	.acl_config = &le_acl_config,
+};
+
 static const struct l2cap_data le_att_server_success_test_1 = {
 	.cid = 0x0004,
 };
@@ -966,6 +1021,56 @@ static void server_bthost_received_data(const void *buf, uint16_t len,
 		tester_test_passed();
 }
 
+static void throughput_received(const void *buf, uint16_t len,
+							void *user_data)
+{
+	struct test_data *data = tester_get_data();
+	const struct l2cap_data *l2data = data->test_data;
+	int64_t ms;
+
+	data->rx_bytes += len;
+	if (data->rx_bytes < l2data->throughput_len)
+		return;
+
+	ms = (g_get_monotonic_time() - data->tx_start) / 1000;
+
+	tester_print("%u bytes in %" PRId64 " ms: %" PRId64 " kbit/s",
+					data->rx_bytes, ms,
+					ms ? data->rx_bytes * 8 / ms : 0);
+
+	tester_test_passed();
+}
+
+static gboolean throughput_write(GIOChannel *io, GIOCondition cond,
+							gpointer user_data)
+{
+	struct test_data *data = tester_get_data();
+	const struct l2cap_data *l2data = data->test_data;
+	int sk;
+
+	sk = g_io_channel_unix_get_fd(io);
+
+	while (data->tx_bytes < l2data->throughput_len) {
+		ssize_t ret;
+
+		ret = write(sk, throughput_data, l2data->data_len);
+		if (ret < 0 && errno == EAGAIN)
+			return TRUE;
+
+		if (ret != l2data->data_len) {
+			tester_warn("Unable to write all data");
+			tester_test_failed();
+			break;
+		}
+
+		data->tx_bytes += ret;
+	}
+
+	data->io_id = 0;
+
+	return FALSE;
+}
+
 static gboolean socket_closed_cb(GIOChannel *io, GIOCondition cond,
 							gpointer user_data)
 {
@@ -1082,6 +1187,20 @@ static gboolean l2cap_connect_cb(GIOChannel *io, GIOCondition cond,
 			tester_test_failed();
 		}
 
+		return FALSE;
+	} else if (l2data->throughput_len) {
+		struct bthost *bthost;
+
+		bthost = hciemu_client_get_host(data->hciemu);
+		bthost_add_cid_hook(bthost, data->handle, data->dcid,
+					throughput_received, NULL);
+
+		data->tx_bytes = 0;
+		data->rx_bytes = 0;
+		data->tx_start = g_get_monotonic_time();
+		data->io_id = g_io_add_watch(io, G_IO_OUT, throughput_write,
+									NULL);
+
 		return FALSE;
 	} else if (l2data->shut_sock_wr) {
 		g_io_add_watch(io, G_IO_HUP, socket_closed_cb, NULL);
@@ -1239,6 +1358,15 @@ static void client_l2cap_connect_cb(uint16_t handle, uint16_t cid,
 	data->handle = handle;
 }
 
+static void client_new_conn_cb(uint16_t handle, void *user_data)
+{
+	struct test_data *data = user_data;
+	const struct l2cap_data *l2data = data->test_data;
+
+	data->dcid = l2data->cid;
+	data->handle = handle;
+}
+
 static void client_l2cap_disconnect_cb(void *user_data)
 {
 	struct test_data *data = user_data;
@@ -1300,6 +1428,12 @@ static void test_connect(const void *test_data)
 					data);
 	}
 
+	if (l2data->cid && l2data->data_len) {
+		struct bthost *bthost = hciemu_client_get_host(data->hciemu);
+
+		bthost_set_connect_cb(bthost, client_new_conn_cb, data);
+	}
+
 	if (l2data->direct_advertising)
 		hciemu_add_master_post_command_hook(data->hciemu,
 						direct_adv_cmd_complete, NULL);
@@ -1952,6 +2086,10 @@ int main(int argc, char *argv[])
 					&client_connect_write_success_test,
 					setup_powered_client, test_connect);
 
+	test_l2cap_bredr("L2CAP BR/EDR Client - Throughput",
+					&client_connect_throughput_test,
+					setup_powered_client, test_connect);
+
 	test_l2cap_bredr("L2CAP BR/EDR Client - Invalid PSM 1",
 					&client_connect_nval_psm_test_1,
 					setup_powered_client, test_connect);
@@ -2068,6 +2206,9 @@ int main(int argc, char *argv[])
 	test_l2cap_le("L2CAP LE ATT Client - Success",
 				&le_att_client_connect_success_test_1,
 				setup_powered_client, test_connect);
+	test_l2cap_le("L2CAP LE ATT Client - Throughput",
+				&le_att_client_throughput_test,
+				setup_powered_client, test_connect);
 	test_l2cap_le("L2CAP LE ATT Server - Success",
 				&le_att_server_success_test_1,
 				setup_powered_server, test_server);
@@ -37,12 +37,16 @@
 
 #include "src/shared/util.h"
 #include "monitor/display.h"
+#include "tools/xfer-stats.h"
 
 #define NIBBLE_TO_ASCII(c)  ((c) < 0x0a ? (c) + 0x30 : (c) + 0x57)
 
 #define BREDR_DEFAULT_PSM	0x1011
 #define LE_DEFAULT_PSM		0x0080
 
+/* Milliseconds to wait for an echo before counting the frame as lost */
+#define RTT_TIMEOUT		1000
+
 #ifndef SIOCGSTAMP_OLD
 #define SIOCGSTAMP_OLD SIOCGSTAMP
 #endif
@@ -63,6 +67,8 @@ enum {
 	CSENDRECV,
 	INFOREQ,
 	PAIRING,
+	ECHO,
+	RTT,
 };
 
 static unsigned char *buf;
@@ -124,6 +130,13 @@ static int rcvbuf = 0;
 static int chan_policy = -1;
 static int bdaddr_type = 0;
 
+/* Transfer statistics */
+static struct xfer_stats stats;
+static unsigned int duration = 0;
+static const char *json_file = NULL;
+static int channels = 1;
+static int stats_fd = -1;
+
 struct lookup_table {
 	const char *name;
 	int flag;
@@ -763,6 +776,38 @@ error:
 	exit(1);
 }
 
+/* Poll timeout that ends the wait when the test duration runs out */
+static int poll_timeout(void)
+{
+	uint64_t elapsed;
+
+	if (!duration)
+		return -1;
+
+	elapsed = xfer_now_us() - stats.start_us;
+	if (elapsed >= duration * 1000000ULL)
+		return 0;
+
+	return (duration * 1000000ULL - elapsed + 999) / 1000;
+}
+
+static void report_stats(const char *label)
+{
+	xfer_stats_stop(&stats);
+	xfer_stats_print(&stats, label);
+
+	/* Parallel channels hand their results to the parent */
+	if (stats_fd >= 0) {
+		if (write(stats_fd, &stats, sizeof(stats)) != sizeof(stats))
+			syslog(LOG_ERR, "Can't report statistics: %s (%d)",
+							strerror(errno), errno);
+		return;
+	}
+
+	if (json_file)
+		xfer_stats_write_json(&stats, label, 1, json_file);
+}
+
 static void dump_mode(int sk)
 {
 	socklen_t optlen;
@@ -818,7 +863,7 @@ static void dump_mode(int sk)
 	}
 }
 
-static void recv_mode(int sk)
+static void do_recv(int sk)
 {
 	struct timeval tv_beg, tv_end, tv_diff;
 	struct pollfd p;
@@ -850,8 +895,10 @@ static void recv_mode(int sk)
 	p.fd = sk;
 	p.events = POLLIN | POLLERR | POLLHUP;
 
+	xfer_stats_start(&stats);
+
 	seq = 0;
-	while (1) {
+	while (!xfer_stats_expired(&stats, duration)) {
 		gettimeofday(&tv_beg, NULL);
 		total = 0;
 		while (total < data_size) {
@@ -860,7 +907,7 @@ static void recv_mode(int sk)
 			int i;
 
 			p.revents = 0;
-			if (poll(&p, 1, -1) <= 0)
+			if (poll(&p, 1, poll_timeout()) <= 0)
 				return;
 
 			if (p.revents & (POLLERR | POLLHUP))
@@ -886,6 +933,8 @@ static void recv_mode(int sk)
 			if (len < 6)
 				break;
 
+			xfer_stats_received(&stats, len);
+
 			if (timestamp) {
 				struct timeval tv;
 
@@ -900,6 +949,7 @@ static void recv_mode(int sk)
 
 			/* Check sequence */
 			sq = get_le32(buf);
+			xfer_stats_seq(&stats, sq);
 			if (seq != sq) {
 				syslog(LOG_INFO, "seq missmatch: %d -> %d", seq, sq);
 				seq = sq;
@@ -930,6 +980,13 @@ static void recv_mode(int sk)
 	}
 }
 
+static void recv_mode(int sk)
+{
+	do_recv(sk);
+
+	report_stats("recv");
+}
+
 static void do_send(int sk)
 {
 	uint32_t seq;
@@ -940,6 +997,8 @@ static void do_send(int sk)
 	if (data_size < 0)
 		data_size = omtu;
 
+	xfer_stats_start(&stats);
+
 	if (filename) {
 		fd = open(filename, O_RDONLY);
 		if (fd < 0) {
@@ -971,6 +1030,9 @@ static void do_send(int sk)
 
 	seq = seq_start;
 	while ((num_frames == -1) || (num_frames-- > 0)) {
+		if (xfer_stats_expired(&stats, duration))
+			break;
+
 		put_le32(seq, buf);
 		put_le16(data_size, buf + 4);
 
@@ -992,6 +1054,8 @@ static void do_send(int sk)
 			size -= len;
 		}
 
+		xfer_stats_sent(&stats, sent);
+
 		if (num_frames && send_delay && count &&
 						!(seq % (count + seq_start)))
 			usleep(send_delay);
@@ -1002,6 +1066,8 @@ static void send_mode(int sk)
 {
 	do_send(sk);
 
+	report_stats("send");
+
 	if (disc_delay)
 		usleep(disc_delay);
 
@@ -1035,6 +1101,200 @@ static void send_and_recv_mode(int sk)
 	return;
 }
 
+static void echo_mode(int sk)
+{
+	struct pollfd p;
+	int len;
+
+	if (data_size < 0)
+		data_size = imtu;
+
+	syslog(LOG_INFO, "Echoing ...");
+
+	p.fd = sk;
+	p.events = POLLIN | POLLERR | POLLHUP;
+
+	xfer_stats_start(&stats);
+
+	while (!xfer_stats_expired(&stats, duration)) {
+		p.revents = 0;
+		if (poll(&p, 1, poll_timeout()) <= 0)
+			break;
+
+		if (p.revents & (POLLERR | POLLHUP))
+			break;
+
+		len = recv(sk, buf, data_size, 0);
+		if (len <= 0)
+			break;
+
+		xfer_stats_received(&stats, len);
+
+		if (len > omtu)
+			len = omtu;
+
+		if (send(sk, buf, len, 0) != len) {
+			syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+			break;
+		}
+	}
+
+	report_stats("echo");
+}
+
+static void rtt_mode(int sk)
+{
+	struct pollfd p;
+	uint32_t seq;
+	int i, len;
+
+	if (data_size < 0)
+		data_size = omtu;
+
+	if (data_size < 6)
+		data_size = 6;
+
+	for (i = 6; i < data_size; i++)
+		buf[i] = 0x7f;
+
+	syslog(LOG_INFO, "Measuring round trips ...");
+
+	p.fd = sk;
+	p.events = POLLIN | POLLERR | POLLHUP;
+
+	xfer_stats_start(&stats);
+
+	seq = seq_start;
+	while ((num_frames == -1) || (num_frames-- > 0)) {
+		uint64_t start;
+
+		if (xfer_stats_expired(&stats, duration))
+			break;
+
+		put_le32(seq, buf);
+		put_le16(data_size, buf + 4);
+
+		start = xfer_now_us();
+
+		if (send(sk, buf, data_size, 0) != data_size) {
+			syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+			break;
+		}
+
+		/* Echoes of frames that already timed out are skipped */
+		while (1) {
+			int64_t timeout = RTT_TIMEOUT -
+				(int64_t) (xfer_now_us() - start) / 1000;
+			int ret = 0;
+
+			p.revents = 0;
+			if (timeout > 0)
+				ret = poll(&p, 1, timeout);
+
+			if (ret < 0)
+				goto done;
+
+			if (!ret) {
+				stats.lost++;
+				break;
+			}
+
+			if (p.revents & (POLLERR | POLLHUP))
+				goto done;
+
+			len = recv(sk, buf, data_size, 0);
+			if (len <= 0)
+				goto done;
+
+			if (len < 6 || get_le32(buf) != seq) {
+				stats.out_of_order++;
+				continue;
+			}
+
+			xfer_stats_received(&stats, len);
+			xfer_stats_rtt(&stats, xfer_now_us() - start);
+			break;
+		}
+
+		seq++;
+
+		if (send_delay)
+			usleep(send_delay);
+	}
+
+done:
+	report_stats("rtt");
+}
+
+/* Runs the handler on a number of channels connected in parallel */
+static void run_channels(char *svr, void (*handler)(int sk),
+							const char *label)
+{
+	struct xfer_stats total, result;
+	int fds[2], i, n = 0;
+
+	if (channels < 2) {
+		int sk = do_connect(svr);
+
+		if (sk < 0)
+			exit(1);
+
+		handler(sk);
+		return;
+	}
+
+	if (pipe(fds) < 0) {
+		syslog(LOG_ERR, "Can't create pipe: %s (%d)",
+							strerror(errno), errno);
+		exit(1);
+	}
+
+	for (i = 0; i < channels; i++) {
+		pid_t pid;
+		int sk;
+
+		pid = fork();
+		if (pid < 0) {
+			syslog(LOG_ERR, "Can't fork: %s (%d)",
+							strerror(errno), errno);
+			break;
+		}
+
+		if (pid)
+			continue;
+
+		close(fds[0]);
+		stats_fd = fds[1];
+
+		sk = do_connect(svr);
+		if (sk < 0)
+			exit(1);
+
+		handler(sk);
+		exit(0);
+	}
+
+	close(fds[1]);
+
+	memset(&total, 0, sizeof(total));
+
+	/* Each result is smaller than PIPE_BUF so writes never interleave */
+	while (read(fds[0], &result, sizeof(result)) == sizeof(result)) {
+		xfer_stats_merge(&total, &result);
+		n++;
+	}
+
+	close(fds[0]);
+
+	syslog(LOG_INFO, "Aggregate of %d of %d channels", n, channels);
+	xfer_stats_print(&total, label);
+
+	if (json_file)
+		xfer_stats_write_json(&total, label, n, json_file);
+}
+
 static void reconnect_mode(char *svr)
 {
 	while (1) {
@@ -1297,7 +1557,9 @@ static void usage(void)
 		"\t-c connect, disconnect, connect, ...\n"
 		"\t-m multiple connects\n"
 		"\t-p trigger dedicated bonding\n"
-		"\t-z information request\n");
+		"\t-z information request\n"
+		"\t-o listen and echo incoming data\n"
+		"\t-l connect, send and measure round trips of echoed data\n");
 
 	printf("Options:\n"
 		"\t[-b bytes] [-i device] [-P psm] [-J cid]\n"
@@ -1326,7 +1588,10 @@ static void usage(void)
 		"\t[-M] become master\n"
 		"\t[-T] enable timestamps\n"
 		"\t[-V type] address type (help for list, default = bredr)\n"
-		"\t[-e seq] initial sequence value (default = 0)\n");
+		"\t[-e seq] initial sequence value (default = 0)\n"
+		"\t[-k seconds] stop sending or receiving after seconds\n"
+		"\t[-j filename] write summary as JSON (- for stdout)\n"
+		"\t[-f num] connect num channels in parallel (-s, -u, -l)\n");
 }
 
 int main(int argc, char *argv[])
@@ -1336,7 +1601,7 @@ int main(int argc, char *argv[])
 
 	bacpy(&bdaddr, BDADDR_ANY);
 
-	while ((opt = getopt(argc, argv, "a:b:cde:g:i:mnpqrstuwxyz"
+	while ((opt = getopt(argc, argv, "a:b:cde:f:g:i:j:k:lmnopqrstuwxyz"
 		"AB:C:D:EF:GH:I:J:K:L:MN:O:P:Q:RSTUV:W:X:Y:Z:")) != EOF) {
 		switch (opt) {
 		case 'r':
@@ -1403,6 +1668,15 @@ int main(int argc, char *argv[])
 			need_addr = 1;
 			break;
 
+		case 'o':
+			mode = ECHO;
+			break;
+
+		case 'l':
+			mode = RTT;
+			need_addr = 1;
+			break;
+
 		case 'b':
 			data_size = atoi(optarg);
 			break;
@@ -1551,6 +1825,18 @@ int main(int argc, char *argv[])
 			disc_delay = atoi(optarg) * 1000;
 			break;
 
+		case 'k':
+			duration = atoi(optarg);
+			break;
+
+		case 'j':
+			json_file = optarg;
+			break;
+
+		case 'f':
+			channels = atoi(optarg);
+			break;
+
 		default:
 			usage();
 			exit(1);
@@ -1592,10 +1878,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case CRECV:
-			sk = do_connect(argv[optind]);
-			if (sk < 0)
-				exit(1);
-			recv_mode(sk);
+			run_channels(argv[optind], recv_mode, "recv");
 			break;
 
 		case DUMP:
@@ -1603,10 +1886,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case SEND:
-			sk = do_connect(argv[optind]);
-			if (sk < 0)
-				exit(1);
-			send_mode(sk);
+			run_channels(argv[optind], send_mode, "send");
 			break;
 
 		case LSEND:
@@ -1655,6 +1935,14 @@ int main(int argc, char *argv[])
 		case PAIRING:
 			do_pairing(argv[optind]);
 			exit(0);
+
+		case ECHO:
+			do_listen(echo_mode);
+			break;
+
+		case RTT:
+			run_channels(argv[optind], rtt_mode, "rtt");
+			break;
 	}
 
 	syslog(LOG_INFO, "Exit");
@@ -0,0 +1,1301 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <ell/ell.h>
+
+#include "mesh/mesh-defs.h"
+#include "mesh/mesh.h"
+#include "mesh/mesh-io.h"
+#include "mesh/mesh-config.h"
+#include "mesh/error.h"
+#include "mesh/crypto.h"
+#include "mesh/net.h"
+#include "mesh/net-keys.h"
+#include "mesh/node.h"
+#include "mesh/keyring.h"
+#include "mesh/provision.h"
+#include "mesh/util.h"
+
+/* Not tools/mesh/model.h */
+#include "../mesh/model.h"
+
+/*
+ * Runs a chain of nodes over the simulated unix bearer, one process per
+ * node. Each process is a bluetooth-meshd core without D-Bus: the node is
+ * created in its own storage directory and loaded by mesh_init(), so the
+ * network layer, SAR, relay and friend code of the daemon carry the
+ * traffic. A vendor model on the first node sends messages to the same
+ * model on the last one, which records when each message arrives.
+ *
+ * With --friend, the last node is a Low Power Node and the node before
+ * it its Friend. bluetooth-meshd has no Low Power role, so the LPN is
+ * emulated here: it establishes the friendship, polls the Friend Queue
+ * and reassembles what the Friend delivers.
+ *
+ * With --provision, the first node is a Provisioner and all others are
+ * unprovisioned devices in range of it, each running the daemon's PB-ADV
+ * acceptor as Join() would. The Provisioner adds them with up to
+ * --sessions concurrent PB-ADV sessions, like AddNode() calls would. No
+ * agent is involved, so the devices are provisioned with No OOB.
+ */
+
+#define BENCH_CID		0x05f1
+#define BENCH_MODEL_ID		SET_ID(BENCH_CID, 0x0001)
+#define BENCH_OPCODE		0xc1f105
+#define BENCH_HDR_LEN		7	/* Opcode and message index */
+#define NET_IDX			0x000
+#define APP_IDX			0x000
+#define IV_INDEX		0x00000000
+#define TRANS_MIC_LEN		4
+#define MAX_SEGS		32
+#define XMIT_INTERVAL		20
+#define CACHE_SIZE		64
+#define DRAIN_CHECK		100	/* ms */
+
+#define LPN_RECV_DELAY		10	/* ms */
+#define LPN_POLL_TIMEOUT	100	/* 10 s, in 100 ms steps */
+#define LPN_REQUEST_RETRIES	10
+
+#define PROV_TIMEOUT		60	/* s */
+#define MAX_DEVICES		200
+#define MAX_SESSIONS		16	/* ProvSessions in mesh-main.conf */
+
+struct msg {
+	uint64_t sent;
+	uint64_t received;
+};
+
+/* Shared by all node processes */
+struct results {
+	unsigned int sent;
+	struct msg msgs[];
+};
+
+static const uint8_t net_key[16] = {
+	0x7d, 0xd7, 0x36, 0x4c, 0xd8, 0x42, 0xad, 0x18,
+	0xc1, 0x7c, 0x2b, 0x82, 0x0c, 0x84, 0xc3, 0xd6,
+};
+
+static const uint8_t app_key[16] = {
+	0x63, 0x96, 0x47, 0x71, 0x73, 0x4f, 0xbd, 0x76,
+	0xe3, 0xb4, 0x05, 0x19, 0xd1, 0xd9, 0x4a, 0x48,
+};
+
+static struct {
+	struct mesh_io *io;
+	struct l_timeout *timeout;
+	uint32_t net_key_id;
+	uint32_t frnd_key_id;
+	uint32_t seq;
+	uint16_t addr;
+	uint16_t frnd;
+	uint16_t counter;
+	uint8_t recv_window;
+	unsigned int requests;
+	bool fsn;
+	uint32_t cache[CACHE_SIZE];
+	unsigned int cache_pos;
+	struct {
+		uint16_t src;
+		uint32_t seq_auth;
+		uint32_t mask;
+		uint8_t seg_n;
+		uint8_t last_len;
+		uint8_t data[MAX_SEGS * MAX_SEG_LEN];
+	} sar;
+} lpn;
+
+static struct results *results;
+static struct msg *msgs;
+static size_t results_size;
+static unsigned int msg_count = 100;
+static unsigned int msg_size = 8;
+static unsigned int msg_segs;
+static unsigned int interval = 100;
+static unsigned int hops = 3;
+static unsigned int loss;
+static unsigned int delay;
+static unsigned int xmit = 1;
+static unsigned int poll_interval = 100;
+static bool friend_mode;
+static unsigned int devices;
+static unsigned int sessions = 1;
+static unsigned int in_flight;
+static bool debug;
+
+static char dir[] = "/tmp/mesh-bench-XXXXXX";
+static unsigned int num_nodes;
+static unsigned int node_index;
+static uint8_t node_uuid[16];
+static struct mesh_node *node;
+static int ready_fd = -1;
+static int go_fd = -1;
+static bool ready_sent;
+
+static struct l_io *go_io;
+static struct l_timeout *send_timeout;
+static uint64_t last_progress;
+static unsigned int last_received;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static bool is_lpn(unsigned int index)
+{
+	return friend_mode && index == num_nodes - 1;
+}
+
+static void set_uuid(uint8_t uuid[16], unsigned int index)
+{
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		uuid[i] = 0xb0 + i;
+
+	uuid[15] = index;
+}
+
+static void notify_ready(bool result)
+{
+	uint8_t val = result;
+
+	if (ready_sent)
+		return;
+
+	ready_sent = true;
+
+	if (write(ready_fd, &val, 1) != 1)
+		l_error("Failed to notify readiness: %s", strerror(errno));
+}
+
+static void bench_msg_rx(const uint8_t *data, uint16_t len)
+{
+	uint32_t opcode, idx;
+	uint16_t n;
+
+	if (!mesh_model_opcode_get(data, len, &opcode, &n) ||
+					opcode != BENCH_OPCODE || len < n + 4)
+		return;
+
+	idx = l_get_le32(data + n);
+	if (idx >= msg_count)
+		return;
+
+	if (!__atomic_load_n(&msgs[idx].received, __ATOMIC_RELAXED))
+		__atomic_store_n(&msgs[idx].received, now_us(),
+							__ATOMIC_RELAXED);
+}
+
+static bool bench_recv(uint16_t src, uint16_t unicast, uint16_t app_idx,
+					uint16_t net_idx, const uint8_t *data,
+					uint16_t len, const void *user_data)
+{
+	bench_msg_rx(data, len);
+
+	return true;
+}
+
+static const struct mesh_model_ops bench_ops = {
+	.unregister = NULL,
+	.recv = bench_recv,
+	.bind = NULL,
+	.pub = NULL,
+	.sub = NULL,
+};
+
+static unsigned int count_received(void)
+{
+	unsigned int i, received = 0;
+
+	for (i = 0; i < msg_count; i++) {
+		if (__atomic_load_n(&msgs[i].received, __ATOMIC_RELAXED))
+			received++;
+	}
+
+	return received;
+}
+
+static void send_msg(void)
+{
+	uint8_t buf[MAX_MSG_LEN];
+	unsigned int idx = results->sent;
+	uint16_t n;
+
+	memset(buf, 0, sizeof(buf));
+	n = mesh_model_opcode_set(BENCH_OPCODE, buf);
+	l_put_le32(idx, buf + n);
+
+	msgs[idx].sent = now_us();
+	last_progress = msgs[idx].sent;
+	__atomic_store_n(&results->sent, idx + 1, __ATOMIC_RELAXED);
+
+	if (!mesh_model_send(node, 0, num_nodes, APP_IDX, NET_IDX,
+					DEFAULT_TTL, false, msg_size, buf))
+		l_error("Failed to send message %u", idx);
+}
+
+static void send_to(struct l_timeout *timeout, void *user_data)
+{
+	unsigned int received;
+	uint64_t drain;
+
+	if (results->sent < msg_count) {
+		send_msg();
+		l_timeout_modify_ms(timeout, results->sent < msg_count ?
+							interval : DRAIN_CHECK);
+		return;
+	}
+
+	/* Wait until nothing has made it through for a while */
+	received = count_received();
+	if (received != last_received) {
+		last_received = received;
+		last_progress = now_us();
+	}
+
+	drain = 2000 + hops * (delay + XMIT_INTERVAL * xmit);
+	if (friend_mode)
+		drain += 2 * poll_interval;
+
+	if (received == msg_count || now_us() - last_progress > drain * 1000) {
+		l_main_quit();
+		return;
+	}
+
+	l_timeout_modify_ms(timeout, DRAIN_CHECK);
+}
+
+static void prov_next(void *user_data);
+
+static void prov_done(void)
+{
+	in_flight--;
+	l_idle_oneshot(prov_next, NULL, NULL);
+}
+
+static void prov_start(void *user_data, int err)
+{
+	unsigned int index = L_PTR_TO_UINT(user_data);
+
+	if (err == MESH_ERROR_NONE)
+		return;
+
+	l_error("Failed to open link to device %u", index);
+	prov_done();
+}
+
+static bool prov_data_req(void *user_data, uint8_t num_ele)
+{
+	unsigned int index = L_PTR_TO_UINT(user_data);
+
+	/* The Provisioner is 0x0001, device n gets n + 1 */
+	initiator_prov_data(NET_IDX, index + 1, user_data);
+
+	return true;
+}
+
+static bool prov_complete(void *user_data, uint8_t status,
+					struct mesh_prov_node_info *info)
+{
+	unsigned int index = L_PTR_TO_UINT(user_data);
+
+	if (status == PROV_ERR_SUCCESS)
+		__atomic_store_n(&msgs[index - 1].received, now_us(),
+							__ATOMIC_RELAXED);
+	else
+		l_error("Failed to provision device %u: %u", index, status);
+
+	/* The session is only freed after this returns */
+	prov_done();
+
+	return true;
+}
+
+static void prov_next(void *user_data)
+{
+	while (results->sent < msg_count && in_flight < sessions) {
+		unsigned int idx = results->sent;
+		uint8_t uuid[16];
+
+		set_uuid(uuid, idx + 1);
+
+		msgs[idx].sent = now_us();
+		__atomic_store_n(&results->sent, idx + 1, __ATOMIC_RELAXED);
+
+		if (!initiator_start(PB_ADV, uuid, 1, PROV_TIMEOUT, NULL,
+					prov_start, prov_data_req,
+					prov_complete, node,
+					L_UINT_TO_PTR(idx + 1))) {
+			l_error("Failed to start provisioning device %u",
+								idx + 1);
+			continue;
+		}
+
+		in_flight++;
+	}
+
+	if (!in_flight)
+		l_main_quit();
+}
+
+static bool go_read(struct l_io *io, void *user_data)
+{
+	uint8_t val;
+
+	if (read(go_fd, &val, 1) != 1) {
+		l_main_quit();
+		return false;
+	}
+
+	if (devices)
+		l_idle_oneshot(prov_next, NULL, NULL);
+	else
+		send_timeout = l_timeout_create_ms(1, send_to, NULL, NULL);
+
+	return false;
+}
+
+static void node_ready(void *user_data, bool success)
+{
+	if (!success) {
+		l_error("Failed to start node %u", node_index);
+		goto fail;
+	}
+
+	node = node_find_by_uuid(node_uuid);
+	if (!node)
+		goto fail;
+
+	if (devices) {
+		struct keyring_net_key key;
+
+		/* What ImportSubnet() would give a Provisioner */
+		key.net_idx = NET_IDX;
+		key.phase = KEY_REFRESH_PHASE_NONE;
+		memcpy(key.old_key, net_key, 16);
+		memcpy(key.new_key, net_key, 16);
+
+		if (!keyring_put_net_key(node, NET_IDX, &key))
+			goto fail;
+	} else if (node_index == 0 || node_index == num_nodes - 1) {
+		if (!mesh_model_register(node, PRIMARY_ELE_IDX,
+						BENCH_MODEL_ID, &bench_ops,
+						NULL))
+			goto fail;
+	}
+
+	if (node_index == 0) {
+		go_io = l_io_new(go_fd);
+		l_io_set_read_handler(go_io, go_read, NULL, NULL);
+	}
+
+	notify_ready(true);
+	return;
+
+fail:
+	notify_ready(false);
+	l_main_quit();
+}
+
+static char *io_opts(unsigned int index)
+{
+	char *opts, *tmp;
+
+	/* Chain topology, when provisioning everybody is in range */
+	if (devices)
+		opts = l_strdup_printf("%s,name=%u", dir, index);
+	else if (!index)
+		opts = l_strdup_printf("%s,name=0,peers=1", dir);
+	else if (index == num_nodes - 1)
+		opts = l_strdup_printf("%s,name=%u,peers=%u", dir, index,
+								index - 1);
+	else
+		opts = l_strdup_printf("%s,name=%u,peers=%u+%u", dir, index,
+							index - 1, index + 1);
+
+	if (!loss && !delay)
+		return opts;
+
+	tmp = opts;
+	opts = l_strdup_printf("%s,loss=%u,delay=%u", tmp, loss, delay);
+	l_free(tmp);
+
+	return opts;
+}
+
+static bool create_node(const char *storage_dir, unsigned int index)
+{
+	struct mesh_config_node db_node;
+	struct mesh_config_element ele;
+	struct mesh_config_model cfg_srv, bench;
+	struct mesh_config *cfg;
+	uint16_t unicast = index + 1;
+	uint8_t dev_key[16], token[8];
+	bool relay = index && index < num_nodes - 1;
+	bool result;
+
+	memset(&cfg_srv, 0, sizeof(cfg_srv));
+	cfg_srv.id = 0x0000;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.id = BENCH_MODEL_ID;
+	bench.vendor = true;
+
+	memset(&ele, 0, sizeof(ele));
+	ele.index = PRIMARY_ELE_IDX;
+	ele.models = l_queue_new();
+	l_queue_push_tail(ele.models, &cfg_srv);
+	l_queue_push_tail(ele.models, &bench);
+
+	memset(&db_node, 0, sizeof(db_node));
+	db_node.elements = l_queue_new();
+	l_queue_push_tail(db_node.elements, &ele);
+	db_node.cid = BENCH_CID;
+	db_node.crpl = mesh_get_crpl();
+	db_node.ttl = TTL_MASK;
+	db_node.modes.relay.state = relay ? MESH_MODE_ENABLED :
+							MESH_MODE_DISABLED;
+	db_node.modes.relay.cnt = xmit;
+	db_node.modes.relay.interval = XMIT_INTERVAL;
+	db_node.modes.lpn = MESH_MODE_UNSUPPORTED;
+	db_node.modes.proxy = MESH_MODE_UNSUPPORTED;
+	db_node.modes.beacon = MESH_MODE_DISABLED;
+
+	if (friend_mode && index == num_nodes - 2)
+		db_node.modes.friend = MESH_MODE_ENABLED;
+	else
+		db_node.modes.friend = MESH_MODE_DISABLED;
+
+	cfg = mesh_config_create(storage_dir, node_uuid, &db_node);
+
+	l_queue_destroy(db_node.elements, NULL);
+	l_queue_destroy(ele.models, NULL);
+
+	if (!cfg)
+		return false;
+
+	l_getrandom(dev_key, sizeof(dev_key));
+	l_getrandom(token, sizeof(token));
+
+	/* Provision the node like a Provisioner and Configuration Client */
+	mesh_config_begin(cfg);
+
+	result = mesh_config_write_unicast(cfg, unicast) &&
+		mesh_config_write_device_key(cfg, dev_key) &&
+		mesh_config_write_token(cfg, token) &&
+		mesh_config_write_iv_index(cfg, IV_INDEX, false) &&
+		mesh_config_net_key_add(cfg, NET_IDX, net_key) &&
+		mesh_config_app_key_add(cfg, NET_IDX, APP_IDX, app_key) &&
+		mesh_config_write_net_transmit(cfg, xmit, XMIT_INTERVAL) &&
+		mesh_config_model_binding_add(cfg, unicast, BENCH_MODEL_ID,
+								true, APP_IDX);
+
+	result = mesh_config_commit(cfg) && result;
+	mesh_config_release(cfg);
+
+	return result;
+}
+
+static bool start_node(unsigned int index)
+{
+	char *storage_dir, *conf, *opts;
+	bool result = false;
+
+	storage_dir = l_strdup_printf("%s/node%u", dir, index);
+	conf = l_strdup_printf("%s/mesh-main.conf", dir);
+	opts = io_opts(index);
+
+	if (mkdir(storage_dir, 0700) < 0 || !create_node(storage_dir, index)) {
+		l_error("Failed to create node %u", index);
+		goto done;
+	}
+
+	/* The configuration file doesn't exist, defaults apply */
+	result = mesh_init(storage_dir, conf, MESH_IO_TYPE_UNIX, opts,
+							node_ready, NULL);
+
+done:
+	l_free(opts);
+	l_free(conf);
+	l_free(storage_dir);
+
+	return result;
+}
+
+static bool device_complete(void *user_data, uint8_t status,
+					struct mesh_prov_node_info *info)
+{
+	/* Join() would create the node, the Provisioner keeps the time */
+	return true;
+}
+
+static void device_ready(void *user_data, bool success)
+{
+	if (success && acceptor_start(1, node_uuid, 0x0001, PROV_TIMEOUT,
+					NULL, device_complete, NULL)) {
+		notify_ready(true);
+		return;
+	}
+
+	l_error("Failed to start device %u", node_index);
+	notify_ready(false);
+	l_main_quit();
+}
+
+static bool start_device(unsigned int index)
+{
+	char *storage_dir, *conf, *opts;
+	bool result = false;
+
+	storage_dir = l_strdup_printf("%s/node%u", dir, index);
+	conf = l_strdup_printf("%s/mesh-main.conf", dir);
+	opts = io_opts(index);
+
+	/* No nodes to load, the device is unprovisioned */
+	if (mkdir(storage_dir, 0700) < 0)
+		l_error("Failed to create device %u", index);
+	else
+		result = mesh_init(storage_dir, conf, MESH_IO_TYPE_UNIX, opts,
+							device_ready, NULL);
+
+	l_free(opts);
+	l_free(conf);
+	l_free(storage_dir);
+
+	return result;
+}
+
+static bool check_cache(uint16_t src, uint32_t seq)
+{
+	uint32_t id = ((uint32_t) src << 24) | (seq & 0xffffff);
+	unsigned int i;
+
+	for (i = 0; i < CACHE_SIZE; i++) {
+		if (lpn.cache[i] == id)
+			return true;
+	}
+
+	lpn.cache[lpn.cache_pos++ % CACHE_SIZE] = id;
+
+	return false;
+}
+
+static void lpn_send_ctl(uint32_t key_id, uint16_t dst, uint8_t opcode,
+					const uint8_t *params, uint8_t len)
+{
+	struct mesh_io_send_info info = {
+		.type = MESH_IO_TIMING_TYPE_GENERAL,
+		.u.gen.interval = XMIT_INTERVAL,
+		.u.gen.cnt = xmit,
+		.u.gen.min_delay = 0,
+		.u.gen.max_delay = 0,
+	};
+	uint8_t packet[30];
+	uint8_t packet_len;
+
+	if (!mesh_crypto_packet_build(true, 0, lpn.seq++, lpn.addr, dst,
+					opcode, false, 0, false, false, 0, 0,
+					0, params, len, packet + 1,
+					&packet_len))
+		return;
+
+	if (!net_key_encrypt(key_id, IV_INDEX, packet + 1, packet_len))
+		return;
+
+	packet[0] = MESH_AD_TYPE_NETWORK;
+	mesh_io_send(lpn.io, &info, packet, packet_len + 1);
+}
+
+static void lpn_poll(void);
+
+static void lpn_poll_to(struct l_timeout *timeout, void *user_data)
+{
+	lpn_poll();
+}
+
+static void lpn_poll(void)
+{
+	uint8_t fsn = lpn.fsn;
+
+	lpn_send_ctl(lpn.frnd_key_id, lpn.frnd, NET_OP_FRND_POLL, &fsn, 1);
+
+	/* Poll again with the same FSN if the Friend doesn't answer */
+	l_timeout_remove(lpn.timeout);
+	lpn.timeout = l_timeout_create_ms(LPN_RECV_DELAY + lpn.recv_window +
+						2 * (delay + XMIT_INTERVAL),
+						lpn_poll_to, NULL, NULL);
+}
+
+static void lpn_response(bool more)
+{
+	lpn.fsn = !lpn.fsn;
+
+	if (more) {
+		lpn_poll();
+		return;
+	}
+
+	/* Friend Queue is empty, sleep until the next poll */
+	l_timeout_remove(lpn.timeout);
+	lpn.timeout = l_timeout_create_ms(poll_interval, lpn_poll_to, NULL,
+									NULL);
+}
+
+static void lpn_request(void);
+
+static void lpn_request_to(struct l_timeout *timeout, void *user_data)
+{
+	l_timeout_remove(lpn.timeout);
+	lpn.timeout = NULL;
+	lpn.counter++;
+	lpn_request();
+}
+
+static void lpn_request(void)
+{
+	uint8_t msg[10];
+
+	if (lpn.requests++ == LPN_REQUEST_RETRIES) {
+		l_error("No Friend Offer received");
+		notify_ready(false);
+		l_main_quit();
+		return;
+	}
+
+	msg[0] = 0x01;			/* Min Queue Size of 2 */
+	msg[1] = LPN_RECV_DELAY;
+	msg[2] = LPN_POLL_TIMEOUT >> 16;
+	l_put_be16(LPN_POLL_TIMEOUT & 0xffff, msg + 3);
+	l_put_be16(UNASSIGNED_ADDRESS, msg + 5);
+	msg[7] = 1;			/* Number of elements */
+	l_put_be16(lpn.counter, msg + 8);
+
+	lpn_send_ctl(lpn.net_key_id, FRIENDS_ADDRESS, NET_OP_FRND_REQUEST,
+							msg, sizeof(msg));
+
+	/* Offers arrive within the 1 s Receive Window plus Receive Delay */
+	lpn.timeout = l_timeout_create_ms(1100 + 2 * delay, lpn_request_to,
+								NULL, NULL);
+}
+
+static void lpn_ctl_recv(uint32_t key_id, uint16_t src, uint8_t opcode,
+					const uint8_t *params, uint8_t len)
+{
+	switch (opcode) {
+	case NET_OP_FRND_OFFER:
+		if (key_id != lpn.net_key_id || lpn.frnd || len != 6)
+			return;
+
+		lpn.frnd = src;
+		lpn.recv_window = params[0];
+		lpn.frnd_key_id = net_key_frnd_add(lpn.net_key_id, lpn.addr,
+						src, lpn.counter,
+						l_get_be16(params + 4));
+		if (!lpn.frnd_key_id) {
+			notify_ready(false);
+			l_main_quit();
+			return;
+		}
+
+		lpn_poll();
+		break;
+
+	case NET_OP_FRND_UPDATE:
+		if (key_id != lpn.frnd_key_id || src != lpn.frnd || len != 6)
+			return;
+
+		/* The first Update establishes the friendship */
+		notify_ready(true);
+		lpn_response(params[5]);
+		break;
+	}
+}
+
+static void lpn_msg_recv(uint16_t src, uint32_t seq_auth, uint8_t key_aid,
+				bool szmic, const uint8_t *data, uint16_t len)
+{
+	uint8_t out[MAX_SEGS * MAX_SEG_LEN];
+	uint8_t mic_len = szmic ? 8 : 4;
+
+	if (len <= mic_len)
+		return;
+
+	if (!mesh_crypto_payload_decrypt(NULL, 0, data, len, szmic, src,
+						lpn.addr, key_aid, seq_auth,
+						IV_INDEX, out, app_key))
+		return;
+
+	bench_msg_rx(out, len - mic_len);
+}
+
+static void lpn_seg_recv(uint16_t src, uint32_t seq, uint8_t key_aid,
+				bool szmic, uint16_t seq_zero, uint8_t seg_o,
+				uint8_t seg_n, const uint8_t *data, uint8_t len)
+{
+	uint32_t seq_auth = seq - ((seq - seq_zero) & SEQ_ZERO_MASK);
+	uint32_t expected = 0xffffffff >> (31 - seg_n);
+
+	if (seg_o > seg_n || len > MAX_SEG_LEN)
+		return;
+
+	if (lpn.sar.src != src || lpn.sar.seq_auth != seq_auth) {
+		lpn.sar.src = src;
+		lpn.sar.seq_auth = seq_auth;
+		lpn.sar.seg_n = seg_n;
+		lpn.sar.mask = 0;
+	}
+
+	/* Already delivered */
+	if (lpn.sar.mask == expected)
+		return;
+
+	memcpy(lpn.sar.data + seg_o * MAX_SEG_LEN, data, len);
+	lpn.sar.mask |= 1U << seg_o;
+
+	if (seg_o == seg_n)
+		lpn.sar.last_len = len;
+
+	if (lpn.sar.mask != expected)
+		return;
+
+	lpn_msg_recv(src, seq_auth, key_aid, szmic, lpn.sar.data,
+				seg_n * MAX_SEG_LEN + lpn.sar.last_len);
+}
+
+static void lpn_recv(void *user_data, struct mesh_io_recv_info *info,
+					const uint8_t *data, uint16_t len)
+{
+	const uint8_t *payload;
+	uint8_t *out;
+	size_t out_len;
+	uint32_t key_id, seq;
+	uint16_t src, dst, seq_zero;
+	uint8_t opcode, key_aid, seg_o, seg_n, payload_len;
+	bool ctl, segmented, szmic;
+
+	/* Skip AD type */
+	key_id = net_key_decrypt(IV_INDEX, data + 1, len - 1, &out, &out_len);
+	if (!key_id)
+		return;
+
+	if (!mesh_crypto_packet_parse(out, out_len, &ctl, NULL, &seq, &src,
+					&dst, NULL, &opcode, &segmented,
+					&key_aid, &szmic, NULL, &seq_zero,
+					&seg_o, &seg_n, &payload,
+					&payload_len))
+		return;
+
+	if (dst != lpn.addr || check_cache(src, seq))
+		return;
+
+	if (ctl) {
+		lpn_ctl_recv(key_id, src, opcode, payload, payload_len);
+		return;
+	}
+
+	/* Messages for us only come through the Friend */
+	if (!lpn.frnd_key_id || key_id != lpn.frnd_key_id)
+		return;
+
+	if (segmented)
+		lpn_seg_recv(src, seq, key_aid, szmic, seq_zero, seg_o, seg_n,
+							payload, payload_len);
+	else
+		lpn_msg_recv(src, seq, key_aid, false, payload, payload_len);
+
+	lpn_response(true);
+}
+
+static void lpn_io_ready(void *user_data, bool result)
+{
+	static const uint8_t filter[] = { MESH_AD_TYPE_NETWORK };
+
+	if (!result) {
+		l_error("Failed to start Low Power Node");
+		notify_ready(false);
+		l_main_quit();
+		return;
+	}
+
+	mesh_io_register_recv_cb(lpn.io, filter, sizeof(filter), lpn_recv,
+									NULL);
+
+	lpn.net_key_id = net_key_add(net_key);
+	if (!lpn.net_key_id) {
+		notify_ready(false);
+		l_main_quit();
+		return;
+	}
+
+	lpn_request();
+}
+
+static bool start_lpn(unsigned int index)
+{
+	char *opts = io_opts(index);
+
+	lpn.addr = index + 1;
+	lpn.seq = 1;
+	lpn.io = mesh_io_new(MESH_IO_TYPE_UNIX, opts, lpn_io_ready, NULL);
+	l_free(opts);
+
+	return lpn.io != NULL;
+}
+
+static void stop_lpn(void)
+{
+	l_timeout_remove(lpn.timeout);
+	mesh_io_destroy(lpn.io);
+	net_key_cleanup();
+}
+
+static void signal_handler(uint32_t signo, void *user_data)
+{
+	switch (signo) {
+	case SIGINT:
+	case SIGTERM:
+		l_main_quit();
+		break;
+	}
+}
+
+static int run_node(unsigned int index)
+{
+	bool lpn_node = is_lpn(index);
+	int status = EXIT_FAILURE;
+	bool result;
+
+	node_index = index;
+	set_uuid(node_uuid, index);
+
+	if (!l_main_init()) {
+		notify_ready(false);
+		return EXIT_FAILURE;
+	}
+
+	if (debug) {
+		l_log_set_stderr();
+		enable_debug();
+	}
+
+	if (lpn_node)
+		result = start_lpn(index);
+	else if (devices && index)
+		result = start_device(index);
+	else
+		result = start_node(index);
+
+	if (result)
+		status = l_main_run_with_signal(signal_handler, NULL);
+	else
+		notify_ready(false);
+
+	l_timeout_remove(send_timeout);
+	l_io_destroy(go_io);
+
+	if (lpn_node)
+		stop_lpn();
+	else
+		mesh_cleanup();
+
+	l_main_exit();
+
+	return status;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+							struct FTW *ftwbuf)
+{
+	return remove(path);
+}
+
+static bool write_conf(void)
+{
+	char *path;
+	FILE *f;
+	int err;
+
+	path = l_strdup_printf("%s/mesh-main.conf", dir);
+	f = fopen(path, "w");
+	l_free(path);
+
+	if (!f)
+		return false;
+
+	fprintf(f, "[General]\nProvSessions = %u\n", sessions);
+	err = fclose(f);
+
+	return !err;
+}
+
+static bool wait_ready(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_nodes; i++) {
+		uint8_t val;
+
+		if (read(ready_fd, &val, 1) != 1 || !val)
+			return false;
+	}
+
+	return true;
+}
+
+static void stop_nodes(pid_t *pids)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_nodes; i++) {
+		if (pids[i] > 0)
+			kill(pids[i], SIGTERM);
+	}
+
+	for (i = 0; i < num_nodes; i++) {
+		if (pids[i] > 0)
+			waitpid(pids[i], NULL, 0);
+	}
+}
+
+static void print_results(void)
+{
+	uint64_t first = 0, last = 0, total = 0;
+	uint64_t min = UINT64_MAX, max = 0;
+	unsigned int i, received = 0;
+
+	for (i = 0; i < results->sent; i++) {
+		struct msg *msg = &msgs[i];
+		uint64_t latency;
+
+		if (!first)
+			first = msg->sent;
+
+		if (!msg->received)
+			continue;
+
+		latency = msg->received - msg->sent;
+		total += latency;
+		received++;
+
+		if (latency < min)
+			min = latency;
+
+		if (latency > max)
+			max = latency;
+
+		if (msg->received > last)
+			last = msg->received;
+	}
+
+	printf("Hops %u, %s messages of %u bytes (%u segments)\n", hops,
+				msg_segs > 1 ? "segmented" : "unsegmented",
+				msg_size, msg_segs);
+	printf("Loss %u%%, delay %u ms per hop, %u transmissions\n", loss,
+								delay, xmit);
+
+	if (friend_mode)
+		printf("Low Power Node polling every %u ms\n", poll_interval);
+
+	printf("Delivered %u of %u messages\n", received, results->sent);
+
+	if (!received)
+		return;
+
+	printf("Latency min %.1f avg %.1f max %.1f ms\n", min / 1000.0,
+				total / 1000.0 / received, max / 1000.0);
+
+	if (last > first)
+		printf("Goodput %.1f bytes/s\n",
+			(double) received * msg_size * 1000000 /
+							(last - first));
+}
+
+static void print_prov_results(void)
+{
+	uint64_t first = UINT64_MAX, last = 0, total = 0;
+	uint64_t min = UINT64_MAX, max = 0;
+	unsigned int i, provisioned = 0;
+
+	for (i = 0; i < results->sent; i++) {
+		struct msg *msg = &msgs[i];
+		uint64_t duration;
+
+		if (msg->sent < first)
+			first = msg->sent;
+
+		if (!msg->received)
+			continue;
+
+		duration = msg->received - msg->sent;
+		total += duration;
+		provisioned++;
+
+		if (duration < min)
+			min = duration;
+
+		if (duration > max)
+			max = duration;
+
+		if (msg->received > last)
+			last = msg->received;
+	}
+
+	printf("%u devices, %u concurrent sessions\n", devices, sessions);
+	printf("Loss %u%%, delay %u ms\n", loss, delay);
+	printf("Provisioned %u of %u devices\n", provisioned, results->sent);
+
+	if (!provisioned)
+		return;
+
+	printf("Session min %.2f avg %.2f max %.2f s\n", min / 1000000.0,
+			total / 1000000.0 / provisioned, max / 1000000.0);
+	printf("Total %.2f s, %.1f devices per minute\n",
+			(last - first) / 1000000.0,
+			provisioned * 60000000.0 / (last - first));
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage:\n"
+		"\tmesh-bench [options]\n");
+	fprintf(stderr,
+		"Options:\n"
+		"\t--hops <n>        Number of relays (default 3)\n"
+		"\t--count <n>       Number of messages (default 100)\n"
+		"\t--size <n>        Access payload size, %u to %u,\n"
+		"\t                  segmented above %u (default 8)\n"
+		"\t--interval <ms>   Time between messages (default 100)\n"
+		"\t--xmit <n>        Transmissions per PDU (default 1)\n"
+		"\t--loss <percent>  Loss on every link (default 0)\n"
+		"\t--delay <ms>      Latency on every link (default 0)\n"
+		"\t--friend          Deliver to a Low Power Node through\n"
+		"\t                  the last relay as its Friend\n"
+		"\t--poll <ms>       Low Power Node poll interval\n"
+		"\t                  (default 100)\n"
+		"\t--provision <n>   Provision n devices instead, 1 to %u\n"
+		"\t--sessions <n>    Concurrent provisioning sessions,\n"
+		"\t                  1 to %u (default 1)\n"
+		"\t--debug           Enable debug output of the nodes\n"
+		"\t--help            Show %s information\n",
+					BENCH_HDR_LEN, MAX_MSG_LEN,
+					MAX_UNSEG_LEN - TRANS_MIC_LEN,
+					MAX_DEVICES, MAX_SESSIONS, __func__);
+}
+
+static const struct option main_options[] = {
+	{ "hops",	required_argument,	NULL, 'n' },
+	{ "count",	required_argument,	NULL, 'c' },
+	{ "size",	required_argument,	NULL, 's' },
+	{ "interval",	required_argument,	NULL, 'i' },
+	{ "xmit",	required_argument,	NULL, 'x' },
+	{ "loss",	required_argument,	NULL, 'l' },
+	{ "delay",	required_argument,	NULL, 'd' },
+	{ "friend",	no_argument,		NULL, 'f' },
+	{ "poll",	required_argument,	NULL, 'p' },
+	{ "provision",	required_argument,	NULL, 'P' },
+	{ "sessions",	required_argument,	NULL, 'S' },
+	{ "debug",	no_argument,		NULL, 'D' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	int ready_fds[2], go_fds[2];
+	pid_t *pids;
+	int wstatus;
+	unsigned int i;
+	int status = EXIT_FAILURE;
+	uint8_t val = 1;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "n:c:s:i:x:l:d:fp:P:S:Dh",
+							main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'n':
+			hops = atoi(optarg);
+			break;
+		case 'c':
+			msg_count = atoi(optarg);
+			break;
+		case 's':
+			msg_size = atoi(optarg);
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'x':
+			xmit = atoi(optarg);
+			break;
+		case 'l':
+			loss = atoi(optarg);
+			break;
+		case 'd':
+			delay = atoi(optarg);
+			break;
+		case 'f':
+			friend_mode = true;
+			break;
+		case 'p':
+			poll_interval = atoi(optarg);
+			break;
+		case 'P':
+			devices = atoi(optarg);
+			break;
+		case 'S':
+			sessions = atoi(optarg);
+			break;
+		case 'D':
+			debug = true;
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* In friend mode the last relay is the Friend */
+	if (hops > 126 || (friend_mode && !hops) || !msg_count ||
+			!interval || !xmit || xmit > 8 || loss > 100 ||
+			!poll_interval || msg_size < BENCH_HDR_LEN ||
+			msg_size > MAX_MSG_LEN || devices > MAX_DEVICES ||
+			(devices && friend_mode) || !sessions ||
+			sessions > MAX_SESSIONS) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	msg_segs = SEG_MAX(false, msg_size + TRANS_MIC_LEN) + 1;
+	num_nodes = hops + 2;
+
+	/* One entry per device, holding when its session started and ended */
+	if (devices) {
+		msg_count = devices;
+		num_nodes = devices + 1;
+	}
+
+	if (!mkdtemp(dir)) {
+		perror("Failed to create directory");
+		return EXIT_FAILURE;
+	}
+
+	if (devices && !write_conf()) {
+		perror("Failed to write configuration");
+		goto remove;
+	}
+
+	results_size = sizeof(*results) + msg_count * sizeof(struct msg);
+	results = mmap(NULL, results_size, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (results == MAP_FAILED) {
+		perror("Failed to map results");
+		goto remove;
+	}
+
+	msgs = results->msgs;
+
+	if (pipe(ready_fds) < 0 || pipe(go_fds) < 0) {
+		perror("Failed to create pipes");
+		goto unmap;
+	}
+
+	pids = calloc(num_nodes, sizeof(pid_t));
+	fflush(stdout);
+
+	for (i = 0; i < num_nodes; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			break;
+
+		if (!pids[i]) {
+			close(ready_fds[0]);
+			close(go_fds[1]);
+			ready_fd = ready_fds[1];
+			go_fd = go_fds[0];
+			exit(run_node(i));
+		}
+	}
+
+	close(ready_fds[1]);
+	close(go_fds[0]);
+	ready_fd = ready_fds[0];
+	go_fd = go_fds[1];
+
+	if (i < num_nodes) {
+		perror("Failed to start node");
+		goto stop;
+	}
+
+	if (!wait_ready()) {
+		fprintf(stderr, "Failed to start nodes\n");
+		goto stop;
+	}
+
+	/* The first node sends until everything is delivered or stalls */
+	if (write(go_fd, &val, 1) != 1 ||
+			waitpid(pids[0], &wstatus, 0) != pids[0])
+		goto stop;
+
+	pids[0] = 0;
+
+	if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == EXIT_SUCCESS) {
+		if (devices)
+			print_prov_results();
+		else
+			print_results();
+
+		status = EXIT_SUCCESS;
+	}
+
+stop:
+	stop_nodes(pids);
+	free(pids);
+	close(ready_fd);
+	close(go_fd);
+
+unmap:
+	munmap(results, results_size);
+
+remove:
+	nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+	return status;
+}
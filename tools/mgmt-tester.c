@@ -220,6 +220,9 @@ static void index_added_callback(uint16_t index, uint16_t length,
 	tester_print("Index Added callback");
 	tester_print("  Index: 0x%04x", index);
 
+	if (data->mgmt_index != MGMT_INDEX_NONE)
+		return;
+
 	data->mgmt_index = index;
 
 	mgmt_send(data->mgmt, MGMT_OP_READ_INFO, data->mgmt_index, 0, NULL,
@@ -424,6 +427,7 @@ static void test_condition_complete(struct test_data *data)
 		struct test_data *user; \
 		user = new0(struct test_data, 1); \
 		user->hciemu_type = type; \
+		user->mgmt_index = MGMT_INDEX_NONE; \
 		user->test_setup = setup; \
 		user->test_data = data; \
 		user->expected_version = version; \
@@ -0,0 +1,326 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "src/shared/util.h"
+#include "src/shared/mainloop.h"
+#include "src/shared/timeout.h"
+#include "emulator/phy.h"
+
+/*
+ * Starts a number of participant processes on the same virtual radio.
+ * Every participant broadcasts advertising sized frames at a fixed rate
+ * and counts the frames it receives from all others, which measures how
+ * many frames per second the transport moves between processes and how
+ * long they take to arrive.
+ */
+
+#define FRAME_LEN		40
+#define SEND_INTERVAL		10
+
+struct result {
+	uint64_t sent;
+	uint64_t received;
+	uint64_t latency_us;
+	uint64_t max_latency_us;
+};
+
+static const char *transport;
+static unsigned int participants;
+static unsigned int rate = 64000;
+static unsigned int duration = 3;
+
+static struct bt_phy *phy;
+static struct result result;
+static unsigned int burst;
+static char shm_name[32];
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void phy_recv(uint16_t type, const void *data, size_t size,
+							void *user_data)
+{
+	uint64_t sent, latency;
+
+	if (type != BT_PHY_PKT_ADV || size != FRAME_LEN)
+		return;
+
+	memcpy(&sent, data, sizeof(sent));
+	latency = now_us() - sent;
+
+	result.received++;
+	result.latency_us += latency;
+
+	if (latency > result.max_latency_us)
+		result.max_latency_us = latency;
+}
+
+static bool send_frames(void *user_data)
+{
+	uint8_t frame[FRAME_LEN];
+	unsigned int i;
+
+	memset(frame, 0, sizeof(frame));
+
+	for (i = 0; i < burst; i++) {
+		uint64_t sent = now_us();
+
+		memcpy(frame, &sent, sizeof(sent));
+
+		if (bt_phy_send(phy, BT_PHY_PKT_ADV, frame, sizeof(frame)))
+			result.sent++;
+	}
+
+	return true;
+}
+
+static bool stop_participant(void *user_data)
+{
+	mainloop_quit();
+
+	return false;
+}
+
+static bool drain_participant(void *user_data)
+{
+	timeout_remove(PTR_TO_UINT(user_data));
+
+	/* Give in-flight frames a moment to arrive */
+	timeout_add(200, stop_participant, NULL, NULL);
+
+	return false;
+}
+
+static int run_participant(int ready_fd, int start_fd, int result_fd)
+{
+	unsigned int send_id;
+	char c = 0;
+
+	mainloop_init();
+
+	if (!strcmp(transport, "shm"))
+		phy = bt_phy_new_shm(shm_name);
+	else
+		phy = bt_phy_new();
+
+	if (!phy)
+		return EXIT_FAILURE;
+
+	bt_phy_register(phy, phy_recv, NULL);
+
+	if (write(ready_fd, &c, 1) != 1 || read(start_fd, &c, 1) != 1)
+		return EXIT_FAILURE;
+
+	burst = rate / participants * SEND_INTERVAL / 1000;
+	if (!burst)
+		burst = 1;
+
+	send_id = timeout_add(SEND_INTERVAL, send_frames, NULL, NULL);
+	timeout_add(duration * 1000, drain_participant,
+					UINT_TO_PTR(send_id), NULL);
+
+	mainloop_run();
+
+	bt_phy_unref(phy);
+
+	if (write(result_fd, &result, sizeof(result)) != sizeof(result))
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
+
+static bool run_bench(const char *name, unsigned int count)
+{
+	struct result total, res;
+	int ready[2], start[2], results[2];
+	unsigned int i, done = 0;
+	char c;
+
+	transport = name;
+	participants = count;
+	snprintf(shm_name, sizeof(shm_name), "bench-%d", getpid());
+
+	if (pipe(ready) < 0 || pipe(start) < 0 || pipe(results) < 0) {
+		perror("Failed to create pipes");
+		return false;
+	}
+
+	for (i = 0; i < count; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("Failed to fork");
+			break;
+		}
+
+		if (!pid) {
+			close(ready[0]);
+			close(start[1]);
+			close(results[0]);
+			_exit(run_participant(ready[1], start[0], results[1]));
+		}
+	}
+
+	close(ready[1]);
+	close(start[0]);
+	close(results[1]);
+
+	/* Start everybody at once */
+	for (i = 0; i < count && read(ready[0], &c, 1) == 1; i++);
+
+	for (i = 0; i < count; i++) {
+		if (write(start[1], &c, 1) != 1)
+			break;
+	}
+
+	memset(&total, 0, sizeof(total));
+
+	while (read(results[0], &res, sizeof(res)) == sizeof(res)) {
+		total.sent += res.sent;
+		total.received += res.received;
+		total.latency_us += res.latency_us;
+		if (res.max_latency_us > total.max_latency_us)
+			total.max_latency_us = res.max_latency_us;
+		done++;
+	}
+
+	while (wait(NULL) > 0);
+
+	close(ready[0]);
+	close(start[1]);
+	close(results[0]);
+
+	if (done != count) {
+		fprintf(stderr, "%s: %u of %u participants failed\n", name,
+							count - done, count);
+		return false;
+	}
+
+	printf("%-4s %3u participants: %8" PRIu64 " frames/s sent, "
+			"%9" PRIu64 " frames/s received (%5.1f%%), "
+			"latency avg %" PRIu64 " us max %" PRIu64 " us\n",
+			name, count, total.sent / duration,
+			total.received / duration,
+			total.sent ? 100.0 * total.received /
+					(total.sent * (count - 1)) : 0.0,
+			total.received ? total.latency_us / total.received : 0,
+			total.max_latency_us);
+
+	return true;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage:\n"
+		"\tphy-bench [options]\n");
+	fprintf(stderr,
+		"Options:\n"
+		"\t--transport <udp|shm>  Transport (default both)\n"
+		"\t--participants <n>     Processes on the radio\n"
+		"\t                       (default 2, 16 and 64)\n"
+		"\t--rate <n>             Frames per second offered by all\n"
+		"\t                       participants (default 64000)\n"
+		"\t--duration <s>         Seconds to send (default 3)\n"
+		"\t--help                 Show %s information\n", __func__);
+}
+
+static const struct option main_options[] = {
+	{ "transport",		required_argument,	NULL, 't' },
+	{ "participants",	required_argument,	NULL, 'n' },
+	{ "rate",		required_argument,	NULL, 'r' },
+	{ "duration",		required_argument,	NULL, 'd' },
+	{ "help",		no_argument,		NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	static const unsigned int counts[] = { 2, 16, 64 };
+	static const char *transports[] = { "udp", "shm" };
+	const char *only_transport = NULL;
+	unsigned int only_count = 0;
+	unsigned int t, n;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "t:n:r:d:h", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 't':
+			only_transport = optarg;
+			break;
+		case 'n':
+			only_count = atoi(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ((only_transport && strcmp(only_transport, "udp") &&
+				strcmp(only_transport, "shm")) ||
+				(optind < argc) || !rate || !duration) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for (t = 0; t < ARRAY_SIZE(transports); t++) {
+		if (only_transport && strcmp(only_transport, transports[t]))
+			continue;
+
+		for (n = 0; n < ARRAY_SIZE(counts); n++) {
+			unsigned int count = only_count ? : counts[n];
+
+			if (count < 2 || !run_bench(transports[t], count))
+				return EXIT_FAILURE;
+
+			if (only_count)
+				break;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
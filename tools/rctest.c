@@ -23,6 +23,7 @@
 #include <getopt.h>
 #include <syslog.h>
 #include <signal.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
@@ -36,11 +37,15 @@
 #include "lib/sdp_lib.h"
 
 #include "src/shared/util.h"
+#include "tools/xfer-stats.h"
 
 #ifndef SIOCGSTAMP_OLD
 #define SIOCGSTAMP_OLD SIOCGSTAMP
 #endif
 
+/* Milliseconds to wait for an echo before counting the frame as lost */
+#define RTT_TIMEOUT	1000
+
 /* Test modes */
 enum {
 	SEND,
@@ -52,6 +57,8 @@ enum {
 	CRECV,
 	LSEND,
 	AUTO,
+	ECHO,
+	RTT,
 };
 
 static unsigned char *buf;
@@ -86,6 +93,13 @@ static int timestamp = 0;
 static int defer_setup = 0;
 static int priority = -1;
 
+/* Transfer statistics */
+static struct xfer_stats stats;
+static unsigned int duration = 0;
+static const char *json_file = NULL;
+static int channels = 1;
+static int stats_fd = -1;
+
 static float tv2fl(struct timeval tv)
 {
 	return (float)tv.tv_sec + (float)(tv.tv_usec/1000000.0);
@@ -437,6 +451,38 @@ error:
 	exit(1);
 }
 
+/* Poll timeout that ends the wait when the test duration runs out */
+static int poll_timeout(void)
+{
+	uint64_t elapsed;
+
+	if (!duration)
+		return -1;
+
+	elapsed = xfer_now_us() - stats.start_us;
+	if (elapsed >= duration * 1000000ULL)
+		return 0;
+
+	return (duration * 1000000ULL - elapsed + 999) / 1000;
+}
+
+static void report_stats(const char *label)
+{
+	xfer_stats_stop(&stats);
+	xfer_stats_print(&stats, label);
+
+	/* Parallel channels hand their results to the parent */
+	if (stats_fd >= 0) {
+		if (write(stats_fd, &stats, sizeof(stats)) != sizeof(stats))
+			syslog(LOG_ERR, "Can't report statistics: %s (%d)",
+							strerror(errno), errno);
+		return;
+	}
+
+	if (json_file)
+		xfer_stats_write_json(&stats, label, 1, json_file);
+}
+
 static void dump_mode(int sk)
 {
 	int len;
@@ -468,9 +514,10 @@ done:
 	free(b);
 }
 
-static void recv_mode(int sk)
+static void do_recv(int sk)
 {
 	struct timeval tv_beg, tv_end, tv_diff;
+	struct pollfd p;
 	char ts[30];
 	long total;
 
@@ -478,7 +525,12 @@ static void recv_mode(int sk)
 
 	memset(ts, 0, sizeof(ts));
 
-	while (1) {
+	p.fd = sk;
+	p.events = POLLIN | POLLERR | POLLHUP;
+
+	xfer_stats_start(&stats);
+
+	while (!xfer_stats_expired(&stats, duration)) {
 		gettimeofday(&tv_beg,NULL);
 		total = 0;
 		while (total < data_size) {
@@ -486,13 +538,23 @@ static void recv_mode(int sk)
 			//uint16_t l;
 			int r;
 
-			if ((r = recv(sk, buf, data_size, 0)) < 0) {
+			p.revents = 0;
+			if (poll(&p, 1, poll_timeout()) <= 0)
+				return;
+
+			/* Whole frames keep the sequence numbers in place */
+			if ((r = recv(sk, buf, data_size, MSG_WAITALL)) <= 0) {
 				if (r < 0)
 					syslog(LOG_ERR, "Read failed: %s (%d)",
 							strerror(errno), errno);
 				return;
 			}
 
+			xfer_stats_received(&stats, r);
+
+			if (r == data_size && r >= 6)
+				xfer_stats_seq(&stats, get_le32(buf));
+
 			if (timestamp) {
 				struct timeval tv;
 
@@ -538,6 +600,13 @@ static void recv_mode(int sk)
 	}
 }
 
+static void recv_mode(int sk)
+{
+	do_recv(sk);
+
+	report_stats("recv");
+}
+
 static void do_send(int sk)
 {
 	uint32_t seq;
@@ -545,6 +614,8 @@ static void do_send(int sk)
 
 	syslog(LOG_INFO,"Sending ...");
 
+	xfer_stats_start(&stats);
+
 	if (filename) {
 		fd = open(filename, O_RDONLY);
 		if (fd < 0) {
@@ -563,6 +634,9 @@ static void do_send(int sk)
 
 	seq = 0;
 	while ((num_frames == -1) || (num_frames-- > 0)) {
+		if (xfer_stats_expired(&stats, duration))
+			break;
+
 		put_le32(seq, buf);
 		put_le16(data_size, buf + 4);
 
@@ -574,6 +648,8 @@ static void do_send(int sk)
 			exit(1);
 		}
 
+		xfer_stats_sent(&stats, data_size);
+
 		if (num_frames && delay && count && !(seq % count))
 			usleep(delay);
 	}
@@ -583,6 +659,8 @@ static void send_mode(int sk)
 {
 	do_send(sk);
 
+	report_stats("send");
+
 	syslog(LOG_INFO, "Closing channel ...");
 	if (shutdown(sk, SHUT_RDWR) < 0)
 		syslog(LOG_INFO, "Close failed: %m");
@@ -591,6 +669,193 @@ static void send_mode(int sk)
 	close(sk);
 }
 
+static void echo_mode(int sk)
+{
+	struct pollfd p;
+	int len;
+
+	syslog(LOG_INFO, "Echoing ...");
+
+	p.fd = sk;
+	p.events = POLLIN | POLLERR | POLLHUP;
+
+	xfer_stats_start(&stats);
+
+	while (!xfer_stats_expired(&stats, duration)) {
+		p.revents = 0;
+		if (poll(&p, 1, poll_timeout()) <= 0)
+			break;
+
+		if (p.revents & (POLLERR | POLLHUP))
+			break;
+
+		len = recv(sk, buf, data_size, 0);
+		if (len <= 0)
+			break;
+
+		xfer_stats_received(&stats, len);
+
+		if (send(sk, buf, len, 0) != len) {
+			syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+			break;
+		}
+	}
+
+	report_stats("echo");
+}
+
+static void rtt_mode(int sk)
+{
+	struct pollfd p;
+	uint32_t seq;
+	int i, len;
+
+	if (data_size < 6) {
+		syslog(LOG_ERR, "Frames need at least 6 bytes");
+		return;
+	}
+
+	for (i = 6; i < data_size; i++)
+		buf[i] = 0x7f;
+
+	syslog(LOG_INFO, "Measuring round trips ...");
+
+	p.fd = sk;
+	p.events = POLLIN | POLLERR | POLLHUP;
+
+	xfer_stats_start(&stats);
+
+	seq = 0;
+	while ((num_frames == -1) || (num_frames-- > 0)) {
+		uint64_t start;
+
+		if (xfer_stats_expired(&stats, duration))
+			break;
+
+		put_le32(seq, buf);
+		put_le16(data_size, buf + 4);
+
+		start = xfer_now_us();
+
+		if (send(sk, buf, data_size, 0) != data_size) {
+			syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+			break;
+		}
+
+		/* Echoes of frames that already timed out are skipped */
+		while (1) {
+			int64_t timeout = RTT_TIMEOUT -
+				(int64_t) (xfer_now_us() - start) / 1000;
+			int ret = 0;
+
+			p.revents = 0;
+			if (timeout > 0)
+				ret = poll(&p, 1, timeout);
+
+			if (ret < 0)
+				goto done;
+
+			if (!ret) {
+				stats.lost++;
+				break;
+			}
+
+			if (p.revents & (POLLERR | POLLHUP))
+				goto done;
+
+			len = recv(sk, buf, data_size, MSG_WAITALL);
+			if (len <= 0)
+				goto done;
+
+			if (len < 6 || get_le32(buf) != seq) {
+				stats.out_of_order++;
+				continue;
+			}
+
+			xfer_stats_received(&stats, len);
+			xfer_stats_rtt(&stats, xfer_now_us() - start);
+			break;
+		}
+
+		seq++;
+
+		if (delay)
+			usleep(delay);
+	}
+
+done:
+	report_stats("rtt");
+}
+
+/* Runs the handler on a number of channels connected in parallel */
+static void run_channels(char *svr, void (*handler)(int sk),
+							const char *label)
+{
+	struct xfer_stats total, result;
+	int fds[2], i, n = 0;
+
+	if (channels < 2) {
+		int sk = do_connect(svr);
+
+		if (sk < 0)
+			exit(1);
+
+		handler(sk);
+		return;
+	}
+
+	if (pipe(fds) < 0) {
+		syslog(LOG_ERR, "Can't create pipe: %s (%d)",
+							strerror(errno), errno);
+		exit(1);
+	}
+
+	for (i = 0; i < channels; i++) {
+		pid_t pid;
+		int sk;
+
+		pid = fork();
+		if (pid < 0) {
+			syslog(LOG_ERR, "Can't fork: %s (%d)",
+							strerror(errno), errno);
+			break;
+		}
+
+		if (pid)
+			continue;
+
+		close(fds[0]);
+		stats_fd = fds[1];
+
+		sk = do_connect(svr);
+		if (sk < 0)
+			exit(1);
+
+		handler(sk);
+		exit(0);
+	}
+
+	close(fds[1]);
+
+	memset(&total, 0, sizeof(total));
+
+	/* Each result is smaller than PIPE_BUF so writes never interleave */
+	while (read(fds[0], &result, sizeof(result)) == sizeof(result)) {
+		xfer_stats_merge(&total, &result);
+		n++;
+	}
+
+	close(fds[0]);
+
+	syslog(LOG_INFO, "Aggregate of %d of %d channels", n, channels);
+	xfer_stats_print(&total, label);
+
+	if (json_file)
+		xfer_stats_write_json(&total, label, n, json_file);
+}
+
 static void reconnect_mode(char *svr)
 {
 	while(1) {
@@ -671,7 +936,9 @@ static void usage(void)
 		"\t-n connect and be silent\n"
 		"\t-c connect, disconnect, connect, ...\n"
 		"\t-m multiple connects\n"
-		"\t-a automated test (receive hcix as parameter)\n");
+		"\t-a automated test (receive hcix as parameter)\n"
+		"\t-o listen and echo incoming data\n"
+		"\t-l connect, send and measure round trips of echoed data\n");
 
 	printf("Options:\n"
 		"\t[-b bytes] [-i device] [-P channel] [-U uuid]\n"
@@ -687,7 +954,10 @@ static void usage(void)
 		"\t[-E] request encryption\n"
 		"\t[-S] secure connection\n"
 		"\t[-M] become master\n"
-		"\t[-T] enable timestamps\n");
+		"\t[-T] enable timestamps\n"
+		"\t[-k seconds] stop sending or receiving after seconds\n"
+		"\t[-j filename] write summary as JSON (- for stdout)\n"
+		"\t[-f num] connect num channels in parallel (-s, -u, -l)\n");
 }
 
 int main(int argc, char *argv[])
@@ -698,7 +968,7 @@ int main(int argc, char *argv[])
 	bacpy(&bdaddr, BDADDR_ANY);
 	bacpy(&auto_bdaddr, BDADDR_ANY);
 
-	while ((opt=getopt(argc,argv,"rdscuwmna:b:i:P:U:B:O:N:MAESL:W:C:D:Y:T")) != EOF) {
+	while ((opt=getopt(argc,argv,"rdscuwmnolf:j:k:a:b:i:P:U:B:O:N:MAESL:W:C:D:Y:T")) != EOF) {
 		switch (opt) {
 		case 'r':
 			mode = RECV;
@@ -737,6 +1007,15 @@ int main(int argc, char *argv[])
 			need_addr = 1;
 			break;
 
+		case 'o':
+			mode = ECHO;
+			break;
+
+		case 'l':
+			mode = RTT;
+			need_addr = 1;
+			break;
+
 		case 'a':
 			mode = AUTO;
 
@@ -822,6 +1101,18 @@ int main(int argc, char *argv[])
 			timestamp = 1;
 			break;
 
+		case 'k':
+			duration = atoi(optarg);
+			break;
+
+		case 'j':
+			json_file = optarg;
+			break;
+
+		case 'f':
+			channels = atoi(optarg);
+			break;
+
 		default:
 			usage();
 			exit(1);
@@ -854,10 +1145,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case CRECV:
-			sk = do_connect(argv[optind]);
-			if (sk < 0)
-				exit(1);
-			recv_mode(sk);
+			run_channels(argv[optind], recv_mode, "recv");
 			break;
 
 		case DUMP:
@@ -865,10 +1153,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case SEND:
-			sk = do_connect(argv[optind]);
-			if (sk < 0)
-				exit(1);
-			send_mode(sk);
+			run_channels(argv[optind], send_mode, "send");
 			break;
 
 		case LSEND:
@@ -893,6 +1178,14 @@ int main(int argc, char *argv[])
 		case AUTO:
 			automated_send_recv();
 			break;
+
+		case ECHO:
+			do_listen(echo_mode);
+			break;
+
+		case RTT:
+			run_channels(argv[optind], rtt_mode, "rtt");
+			break;
 	}
 
 	syslog(LOG_INFO, "Exit");
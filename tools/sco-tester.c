@@ -99,6 +99,9 @@ static void index_added_callback(uint16_t index, uint16_t length,
 	tester_print("Index Added callback");
 	tester_print("  Index: 0x%04x", index);
 
+	if (data->mgmt_index != MGMT_INDEX_NONE)
+		return;
+
 	data->mgmt_index = index;
 
 	mgmt_send(data->mgmt, MGMT_OP_READ_INFO, data->mgmt_index, 0, NULL,
@@ -209,6 +212,7 @@ static void test_data_free(void *test_data)
 		if (!user) \
 			break; \
 		user->hciemu_type = HCIEMU_TYPE_BREDRLE; \
+		user->mgmt_index = MGMT_INDEX_NONE; \
 		user->io_id = 0; \
 		user->test_data = data; \
 		user->disable_esco = _disable_esco; \
@@ -0,0 +1,344 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "tools/xfer-stats.h"
+
+uint64_t xfer_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static uint64_t cpu_time_us(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0)
+		return 0;
+
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL +
+				ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static unsigned int hist_index(uint64_t value)
+{
+	unsigned int msb;
+
+	if (value < XFER_HIST_SUB)
+		return value;
+
+	msb = 63 - __builtin_clzll(value);
+	if (msb > 31)
+		return XFER_HIST_BUCKETS - 1;
+
+	return (msb - 3) * XFER_HIST_SUB + ((value >> (msb - 4)) & 0x0f);
+}
+
+static uint64_t hist_value(unsigned int index)
+{
+	unsigned int group = index / XFER_HIST_SUB;
+	unsigned int sub = index % XFER_HIST_SUB;
+	unsigned int shift;
+
+	if (!group)
+		return index;
+
+	/* Upper end of the bucket */
+	shift = group - 1;
+
+	return ((uint64_t) (XFER_HIST_SUB + sub + 1) << shift) - 1;
+}
+
+static void hist_add(struct xfer_hist *hist, uint64_t value)
+{
+	if (!hist->count || value < hist->min)
+		hist->min = value;
+
+	if (value > hist->max)
+		hist->max = value;
+
+	hist->buckets[hist_index(value)]++;
+	hist->count++;
+}
+
+uint64_t xfer_hist_percentile(const struct xfer_hist *hist, unsigned int pct)
+{
+	uint64_t target, sum = 0;
+	unsigned int i;
+
+	if (!hist->count)
+		return 0;
+
+	target = (hist->count * pct + 99) / 100;
+
+	for (i = 0; i < XFER_HIST_BUCKETS; i++) {
+		sum += hist->buckets[i];
+		if (sum < target)
+			continue;
+
+		if (hist_value(i) > hist->max)
+			return hist->max;
+
+		if (hist_value(i) < hist->min)
+			return hist->min;
+
+		return hist_value(i);
+	}
+
+	return hist->max;
+}
+
+static void hist_merge(struct xfer_hist *total, const struct xfer_hist *hist)
+{
+	unsigned int i;
+
+	if (!hist->count)
+		return;
+
+	if (!total->count || hist->min < total->min)
+		total->min = hist->min;
+
+	if (hist->max > total->max)
+		total->max = hist->max;
+
+	for (i = 0; i < XFER_HIST_BUCKETS; i++)
+		total->buckets[i] += hist->buckets[i];
+
+	total->count += hist->count;
+}
+
+void xfer_stats_start(struct xfer_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	stats->start_us = xfer_now_us();
+	stats->cpu_start_us = cpu_time_us();
+}
+
+void xfer_stats_stop(struct xfer_stats *stats)
+{
+	stats->elapsed_us = xfer_now_us() - stats->start_us;
+	stats->cpu_us = cpu_time_us() - stats->cpu_start_us;
+}
+
+bool xfer_stats_expired(const struct xfer_stats *stats, unsigned int seconds)
+{
+	if (!seconds)
+		return false;
+
+	return xfer_now_us() - stats->start_us >= seconds * 1000000ULL;
+}
+
+void xfer_stats_sent(struct xfer_stats *stats, unsigned int len)
+{
+	stats->bytes += len;
+	stats->frames++;
+}
+
+void xfer_stats_received(struct xfer_stats *stats, unsigned int len)
+{
+	uint64_t now = xfer_now_us();
+
+	stats->bytes += len;
+	stats->frames++;
+
+	if (stats->last_rx_us) {
+		uint64_t gap = now - stats->last_rx_us;
+		int64_t diff = gap - stats->last_gap_us;
+
+		hist_add(&stats->gap, gap);
+
+		/* Smoothed like the RFC 3550 interarrival jitter */
+		if (stats->gap.count > 1) {
+			if (diff < 0)
+				diff = -diff;
+
+			stats->jitter_us += (diff - stats->jitter_us) / 16;
+		}
+
+		stats->last_gap_us = gap;
+	}
+
+	stats->last_rx_us = now;
+}
+
+void xfer_stats_seq(struct xfer_stats *stats, uint32_t seq)
+{
+	if (!stats->seq_valid) {
+		stats->seq_valid = true;
+		stats->next_seq = seq + 1;
+		return;
+	}
+
+	if (seq == stats->next_seq) {
+		stats->next_seq++;
+		return;
+	}
+
+	/* Later than expected means frames in between went missing */
+	if ((int32_t) (seq - stats->next_seq) > 0) {
+		stats->lost += seq - stats->next_seq;
+		stats->next_seq = seq + 1;
+		return;
+	}
+
+	/* A frame counted as lost showed up after all */
+	stats->out_of_order++;
+
+	if (stats->lost)
+		stats->lost--;
+}
+
+void xfer_stats_rtt(struct xfer_stats *stats, uint64_t usec)
+{
+	hist_add(&stats->rtt, usec);
+}
+
+void xfer_stats_merge(struct xfer_stats *total,
+					const struct xfer_stats *stats)
+{
+	if (stats->elapsed_us > total->elapsed_us)
+		total->elapsed_us = stats->elapsed_us;
+
+	total->cpu_us += stats->cpu_us;
+	total->bytes += stats->bytes;
+	total->frames += stats->frames;
+	total->lost += stats->lost;
+	total->out_of_order += stats->out_of_order;
+
+	/* Report the channel that suffered most */
+	if (stats->jitter_us > total->jitter_us)
+		total->jitter_us = stats->jitter_us;
+
+	hist_merge(&total->gap, &stats->gap);
+	hist_merge(&total->rtt, &stats->rtt);
+}
+
+static double kbps(const struct xfer_stats *stats)
+{
+	if (!stats->elapsed_us)
+		return 0;
+
+	return stats->bytes * 1000000.0 / stats->elapsed_us / 1024.0;
+}
+
+static double cpu_ms_per_mb(const struct xfer_stats *stats)
+{
+	if (!stats->bytes)
+		return 0;
+
+	return stats->cpu_us / 1000.0 / (stats->bytes / 1048576.0);
+}
+
+static double loss_pct(const struct xfer_stats *stats)
+{
+	if (!stats->frames && !stats->lost)
+		return 0;
+
+	return stats->lost * 100.0 / (stats->frames + stats->lost);
+}
+
+void xfer_stats_print(const struct xfer_stats *stats, const char *label)
+{
+	syslog(LOG_INFO, "%s: %" PRIu64 " bytes in %.2f sec, %.2f kB/s, "
+			"%.2f ms CPU per MB", label, stats->bytes,
+			stats->elapsed_us / 1000000.0, kbps(stats),
+			cpu_ms_per_mb(stats));
+
+	if (stats->seq_valid || stats->lost)
+		syslog(LOG_INFO, "%s: %" PRIu64 " frames, %" PRIu64
+				" lost (%.2f%%), %" PRIu64 " out of order",
+				label, stats->frames, stats->lost,
+				loss_pct(stats), stats->out_of_order);
+
+	if (stats->gap.count)
+		syslog(LOG_INFO, "%s: inter-arrival p50 %" PRIu64 " p90 %"
+				PRIu64 " p99 %" PRIu64 " max %" PRIu64
+				" usec, jitter %.1f usec", label,
+				xfer_hist_percentile(&stats->gap, 50),
+				xfer_hist_percentile(&stats->gap, 90),
+				xfer_hist_percentile(&stats->gap, 99),
+				stats->gap.max, stats->jitter_us);
+
+	if (stats->rtt.count)
+		syslog(LOG_INFO, "%s: %" PRIu64 " round trips, min %" PRIu64
+				" p50 %" PRIu64 " p90 %" PRIu64 " p99 %"
+				PRIu64 " max %" PRIu64 " usec", label,
+				stats->rtt.count, stats->rtt.min,
+				xfer_hist_percentile(&stats->rtt, 50),
+				xfer_hist_percentile(&stats->rtt, 90),
+				xfer_hist_percentile(&stats->rtt, 99),
+				stats->rtt.max);
+}
+
+static void print_hist_json(FILE *fp, const char *name,
+					const struct xfer_hist *hist)
+{
+	fprintf(fp, ",\n  \"%s\": { \"count\": %" PRIu64 ", \"min\": %"
+			PRIu64 ", \"p50\": %" PRIu64 ", \"p90\": %" PRIu64
+			", \"p99\": %" PRIu64 ", \"max\": %" PRIu64 " }",
+			name, hist->count, hist->min,
+			xfer_hist_percentile(hist, 50),
+			xfer_hist_percentile(hist, 90),
+			xfer_hist_percentile(hist, 99), hist->max);
+}
+
+bool xfer_stats_write_json(const struct xfer_stats *stats, const char *mode,
+				unsigned int channels, const char *path)
+{
+	FILE *fp;
+
+	if (!strcmp(path, "-"))
+		fp = stdout;
+	else
+		fp = fopen(path, "w");
+
+	if (!fp) {
+		syslog(LOG_ERR, "Can't open %s: %m", path);
+		return false;
+	}
+
+	fprintf(fp, "{\n  \"mode\": \"%s\",\n  \"channels\": %u,\n"
+			"  \"seconds\": %.3f,\n  \"bytes\": %" PRIu64 ",\n"
+			"  \"kbytes_per_sec\": %.2f,\n"
+			"  \"cpu_ms_per_mb\": %.3f,\n"
+			"  \"frames\": %" PRIu64 ",\n  \"lost\": %" PRIu64 ",\n"
+			"  \"loss_pct\": %.3f,\n"
+			"  \"out_of_order\": %" PRIu64 ",\n"
+			"  \"jitter_usec\": %.1f",
+			mode, channels, stats->elapsed_us / 1000000.0,
+			stats->bytes, kbps(stats), cpu_ms_per_mb(stats),
+			stats->frames, stats->lost, loss_pct(stats),
+			stats->out_of_order, stats->jitter_us);
+
+	print_hist_json(fp, "inter_arrival_usec", &stats->gap);
+	print_hist_json(fp, "rtt_usec", &stats->rtt);
+
+	fprintf(fp, "\n}\n");
+
+	if (fp == stdout)
+		fflush(fp);
+	else
+		fclose(fp);
+
+	return true;
+}
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Log-linear buckets, 16 per power of two, cover up to 2^32 usec */
+#define XFER_HIST_SUB		16
+#define XFER_HIST_BUCKETS	(XFER_HIST_SUB * 29)
+
+struct xfer_hist {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint32_t buckets[XFER_HIST_BUCKETS];
+};
+
+struct xfer_stats {
+	uint64_t start_us;
+	uint64_t elapsed_us;
+	uint64_t cpu_start_us;
+	uint64_t cpu_us;
+	uint64_t bytes;
+	uint64_t frames;
+	uint64_t lost;
+	uint64_t out_of_order;
+	uint32_t next_seq;
+	bool seq_valid;
+	uint64_t last_rx_us;
+	uint64_t last_gap_us;
+	double jitter_us;
+	struct xfer_hist gap;
+	struct xfer_hist rtt;
+};
+
+uint64_t xfer_now_us(void);
+
+uint64_t xfer_hist_percentile(const struct xfer_hist *hist, unsigned int pct);
+
+void xfer_stats_start(struct xfer_stats *stats);
+void xfer_stats_stop(struct xfer_stats *stats);
+bool xfer_stats_expired(const struct xfer_stats *stats, unsigned int seconds);
+
+void xfer_stats_sent(struct xfer_stats *stats, unsigned int len);
+void xfer_stats_received(struct xfer_stats *stats, unsigned int len);
+void xfer_stats_seq(struct xfer_stats *stats, uint32_t seq);
+void xfer_stats_rtt(struct xfer_stats *stats, uint64_t usec);
+
+void xfer_stats_merge(struct xfer_stats *total,
+					const struct xfer_stats *stats);
+
+void xfer_stats_print(const struct xfer_stats *stats, const char *label);
+bool xfer_stats_write_json(const struct xfer_stats *stats, const char *mode,
+				unsigned int channels, const char *path);
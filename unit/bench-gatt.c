@@ -0,0 +1,609 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/mainloop.h"
+#include "src/shared/timeout.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/gatt-server.h"
+#include "src/shared/gatt-client.h"
+
+/*
+ * Connects a bt_gatt_server and a bt_gatt_client over a SOCK_SEQPACKET
+ * socketpair inside one process and times discovery, reads, writes, Read
+ * Multiple, long reads and notifications. Every benchmark reports the
+ * rate, the heap allocations per operation and the p50/p99 latency.
+ */
+
+#define VALUE_LEN		20
+#define LONG_VALUE_LEN		512
+#define NUM_MULTIPLE		8
+#define NFY_WINDOW		64
+
+enum bench_type {
+	BENCH_DISCOVER,
+	BENCH_READ,
+	BENCH_WRITE,
+	BENCH_READ_MULTIPLE,
+	BENCH_READ_LONG,
+	BENCH_NOTIFY,
+};
+
+struct bench {
+	const char *name;
+	enum bench_type type;
+	uint16_t mtu;
+	unsigned int count;
+	unsigned int services;
+	uint16_t value_len;
+	uint8_t nfy_batch;
+};
+
+struct context {
+	struct gatt_db *server_db;
+	struct gatt_db *client_db;
+	struct bt_gatt_server *server;
+	struct bt_gatt_client *client;
+	uint16_t read_handle;
+	uint16_t write_handle;
+	uint16_t long_handle;
+	uint16_t nfy_handle;
+	uint16_t multiple_handles[NUM_MULTIPLE];
+};
+
+struct run {
+	const struct bench *bench;
+	unsigned int count;
+	unsigned int sent;
+	unsigned int done;
+	unsigned int in_flight;
+	uint64_t bytes;
+	uint64_t start;
+	uint64_t op_start;
+	uint64_t elapsed;
+	uint64_t *latency;
+	unsigned long start_allocs;
+	unsigned long allocs;
+};
+
+static const struct bench benches[] = {
+	{ "Discover 10 services", BENCH_DISCOVER, 23, 50, 10 },
+	{ "Discover 100 services", BENCH_DISCOVER, 23, 20, 100 },
+	{ "Discover 1000 services", BENCH_DISCOVER, 23, 5, 1000 },
+	{ "Discover 1000 services MTU 517", BENCH_DISCOVER, 517, 5, 1000 },
+	{ "Read", BENCH_READ, 23, 20000 },
+	{ "Write", BENCH_WRITE, 23, 20000 },
+	{ "Read Multiple", BENCH_READ_MULTIPLE, 185, 10000 },
+	{ "Read Long MTU 23", BENCH_READ_LONG, 23, 1000 },
+	{ "Read Long MTU 185", BENCH_READ_LONG, 185, 5000 },
+	{ "Notify MTU 23", BENCH_NOTIFY, 23, 50000, 0, 20,
+					BT_GATT_SERVER_NFY_BATCH_OFF },
+	{ "Notify MTU 185", BENCH_NOTIFY, 185, 50000, 0, 182,
+					BT_GATT_SERVER_NFY_BATCH_OFF },
+	{ "Notify MTU 517", BENCH_NOTIFY, 517, 50000, 0, 514,
+					BT_GATT_SERVER_NFY_BATCH_OFF },
+	{ "Notify MTU 185 batched", BENCH_NOTIFY, 185, 50000, 0, 20,
+					BT_GATT_SERVER_NFY_BATCH_ADAPTIVE },
+};
+
+static const char *option_filter;
+static unsigned int option_scale = 1;
+
+static unsigned int bench_index;
+static struct context *context;
+static struct run run;
+static uint8_t long_value[LONG_VALUE_LEN];
+
+/*
+ * glibc no longer has malloc hooks, so count allocations by interposing
+ * the allocator entry points the shared code uses.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocs;
+
+void *malloc(size_t size)
+{
+	allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void read_cb(struct gatt_db_attribute *attrib, unsigned int id,
+					uint16_t offset, uint8_t opcode,
+					struct bt_att *att, void *user_data)
+{
+	uint16_t len = PTR_TO_UINT(user_data);
+
+	if (len == LONG_VALUE_LEN) {
+		if (offset > len) {
+			gatt_db_attribute_read_result(attrib, id,
+					BT_ATT_ERROR_INVALID_OFFSET, NULL, 0);
+			return;
+		}
+
+		gatt_db_attribute_read_result(attrib, id, 0,
+					long_value + offset, len - offset);
+		return;
+	}
+
+	gatt_db_attribute_read_result(attrib, id, 0, long_value, len);
+}
+
+static void write_cb(struct gatt_db_attribute *attrib, unsigned int id,
+					uint16_t offset, const uint8_t *value,
+					size_t len, uint8_t opcode,
+					struct bt_att *att, void *user_data)
+{
+	gatt_db_attribute_write_result(attrib, id, 0);
+}
+
+static uint16_t add_chrc(struct gatt_db_attribute *service, uint16_t uuid16,
+					uint8_t props, uint16_t len)
+{
+	struct gatt_db_attribute *attrib;
+	bt_uuid_t uuid;
+
+	bt_uuid16_create(&uuid, uuid16);
+	attrib = gatt_db_service_add_characteristic(service, &uuid,
+					BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
+					props, read_cb, write_cb,
+					UINT_TO_PTR(len));
+
+	if (props & BT_GATT_CHRC_PROP_NOTIFY) {
+		bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+		gatt_db_service_add_descriptor(service, &uuid,
+					BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
+					read_cb, write_cb, UINT_TO_PTR(2));
+	}
+
+	return gatt_db_attribute_get_handle(attrib);
+}
+
+static void populate_db(struct context *ctx, unsigned int services)
+{
+	struct gatt_db_attribute *service;
+	bt_uuid_t uuid;
+	unsigned int i;
+
+	/* Filler services look like a typical device: 3 characteristics */
+	for (i = 0; i < services; i++) {
+		bt_uuid16_create(&uuid, 0x1800 + (i % 0x100));
+		service = gatt_db_add_service(ctx->server_db, &uuid, true, 8);
+		add_chrc(service, 0x2a00 + (i % 0x100),
+				BT_GATT_CHRC_PROP_READ |
+				BT_GATT_CHRC_PROP_NOTIFY, VALUE_LEN);
+		add_chrc(service, 0x2b00, BT_GATT_CHRC_PROP_WRITE, VALUE_LEN);
+		add_chrc(service, 0x2b01, BT_GATT_CHRC_PROP_READ, VALUE_LEN);
+		gatt_db_service_set_active(service, true);
+	}
+
+	bt_uuid16_create(&uuid, 0xfff0);
+	service = gatt_db_add_service(ctx->server_db, &uuid, true,
+						10 + NUM_MULTIPLE * 2);
+
+	ctx->read_handle = add_chrc(service, 0xfff1, BT_GATT_CHRC_PROP_READ,
+								VALUE_LEN);
+	ctx->write_handle = add_chrc(service, 0xfff2, BT_GATT_CHRC_PROP_WRITE,
+								VALUE_LEN);
+	ctx->long_handle = add_chrc(service, 0xfff3, BT_GATT_CHRC_PROP_READ,
+								LONG_VALUE_LEN);
+	ctx->nfy_handle = add_chrc(service, 0xfff4, BT_GATT_CHRC_PROP_NOTIFY,
+								VALUE_LEN);
+
+	for (i = 0; i < NUM_MULTIPLE; i++)
+		ctx->multiple_handles[i] = add_chrc(service, 0xfff5,
+						BT_GATT_CHRC_PROP_READ, 8);
+
+	gatt_db_service_set_active(service, true);
+}
+
+static void op_done(uint16_t len)
+{
+	uint64_t now = now_ns();
+
+	run.latency[run.done++] = now - run.op_start;
+	run.bytes += len;
+	run.op_start = now;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+	uint64_t la = *(const uint64_t *) a;
+	uint64_t lb = *(const uint64_t *) b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+static void report(void)
+{
+	double secs = run.elapsed / 1e9;
+
+	qsort(run.latency, run.done, sizeof(uint64_t), compare_latency);
+
+	printf("%-32s %8u %10.0f %10.1f %9.1f %9.1f %9.1f\n",
+			run.bench->name, run.done, run.done / secs,
+			run.bytes / 1024.0 / secs,
+			(double) run.allocs / run.done,
+			run.latency[run.done / 2] / 1000.0,
+			run.latency[run.done * 99 / 100] / 1000.0);
+}
+
+static bool step(void *user_data);
+
+static void start_ops(void)
+{
+	run.start = now_ns();
+	run.op_start = run.start;
+	run.start_allocs = allocs;
+}
+
+static void finish(void)
+{
+	run.elapsed = now_ns() - run.start;
+	run.allocs = allocs - run.start_allocs;
+
+	timeout_add(1, step, NULL, NULL);
+}
+
+static void issue(void);
+
+static void op_read_cb(bool success, uint8_t att_ecode, const uint8_t *value,
+					uint16_t length, void *user_data)
+{
+	if (!success) {
+		fprintf(stderr, "%s: failed with 0x%02x\n", run.bench->name,
+								att_ecode);
+		mainloop_exit_failure();
+		return;
+	}
+
+	op_done(length);
+	issue();
+}
+
+static void op_write_cb(bool success, uint8_t att_ecode, void *user_data)
+{
+	op_read_cb(success, att_ecode, NULL, VALUE_LEN, user_data);
+}
+
+static void issue(void)
+{
+	static const uint8_t value[VALUE_LEN];
+	unsigned int id = 0;
+
+	if (run.done == run.count) {
+		finish();
+		return;
+	}
+
+	run.sent++;
+
+	switch (run.bench->type) {
+	case BENCH_READ:
+		id = bt_gatt_client_read_value(context->client,
+						context->read_handle,
+						op_read_cb, NULL, NULL);
+		break;
+	case BENCH_WRITE:
+		id = bt_gatt_client_write_value(context->client,
+						context->write_handle,
+						value, sizeof(value),
+						op_write_cb, NULL, NULL);
+		break;
+	case BENCH_READ_MULTIPLE:
+		id = bt_gatt_client_read_multiple(context->client,
+						context->multiple_handles,
+						NUM_MULTIPLE, op_read_cb,
+						NULL, NULL);
+		break;
+	case BENCH_READ_LONG:
+		id = bt_gatt_client_read_long_value(context->client,
+						context->long_handle, 0,
+						op_read_cb, NULL, NULL);
+		break;
+	case BENCH_DISCOVER:
+	case BENCH_NOTIFY:
+		break;
+	}
+
+	if (!id) {
+		fprintf(stderr, "%s: failed to send request\n",
+							run.bench->name);
+		mainloop_exit_failure();
+	}
+}
+
+static void send_notifications(void)
+{
+	uint8_t value[BT_ATT_MAX_LE_MTU];
+
+	memset(value, 0, sizeof(value));
+
+	while (run.in_flight < NFY_WINDOW && run.sent < run.count) {
+		uint64_t now = now_ns();
+
+		/* The receiver takes the latency from the send time */
+		memcpy(value, &now, sizeof(now));
+
+		if (!bt_gatt_server_send_notification(context->server,
+						context->nfy_handle, value,
+						run.bench->value_len, true)) {
+			fprintf(stderr, "%s: failed to notify\n",
+							run.bench->name);
+			mainloop_exit_failure();
+			return;
+		}
+
+		run.sent++;
+		run.in_flight++;
+	}
+}
+
+static void notify_cb(uint16_t value_handle, const uint8_t *value,
+					uint16_t length, void *user_data)
+{
+	uint64_t sent;
+
+	if (length < sizeof(sent) || run.done == run.count)
+		return;
+
+	memcpy(&sent, value, sizeof(sent));
+
+	run.latency[run.done++] = now_ns() - sent;
+	run.bytes += length;
+	run.in_flight--;
+
+	if (run.done == run.count) {
+		finish();
+		return;
+	}
+
+	send_notifications();
+}
+
+static void register_cb(uint16_t att_ecode, void *user_data)
+{
+	if (att_ecode) {
+		fprintf(stderr, "%s: failed to enable notifications\n",
+							run.bench->name);
+		mainloop_exit_failure();
+		return;
+	}
+
+	start_ops();
+	send_notifications();
+}
+
+static void ready_cb(bool success, uint8_t att_ecode, void *user_data)
+{
+	if (!success) {
+		fprintf(stderr, "%s: discovery failed\n", run.bench->name);
+		mainloop_exit_failure();
+		return;
+	}
+
+	switch (run.bench->type) {
+	case BENCH_DISCOVER:
+		/* Every discovery needs a client that knows nothing yet */
+		run.elapsed += now_ns() - run.op_start;
+		run.allocs += allocs - run.start_allocs;
+		op_done(0);
+		timeout_add(1, step, NULL, NULL);
+		break;
+	case BENCH_NOTIFY:
+		bt_gatt_server_set_nfy_batching(context->server,
+						run.bench->nfy_batch, 0);
+		bt_gatt_client_register_notify(context->client,
+						context->nfy_handle,
+						register_cb, notify_cb,
+						NULL, NULL);
+		break;
+	case BENCH_READ:
+	case BENCH_WRITE:
+	case BENCH_READ_MULTIPLE:
+	case BENCH_READ_LONG:
+		start_ops();
+		issue();
+		break;
+	}
+}
+
+static void destroy_context(struct context *ctx)
+{
+	bt_gatt_client_unref(ctx->client);
+	bt_gatt_server_unref(ctx->server);
+	gatt_db_unref(ctx->client_db);
+	gatt_db_unref(ctx->server_db);
+	free(ctx);
+}
+
+static struct context *create_context(const struct bench *bench)
+{
+	struct context *ctx;
+	struct bt_att *att;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+		perror("Failed to create socket pair");
+		return NULL;
+	}
+
+	ctx = new0(struct context, 1);
+	ctx->server_db = gatt_db_new();
+	ctx->client_db = gatt_db_new();
+
+	populate_db(ctx, bench->services);
+
+	att = bt_att_new(sv[0], false);
+	bt_att_set_close_on_unref(att, true);
+	ctx->server = bt_gatt_server_new(ctx->server_db, att, bench->mtu, 0);
+	bt_att_unref(att);
+
+	/* Discovery starts right away */
+	run.op_start = now_ns();
+	run.start_allocs = allocs;
+
+	att = bt_att_new(sv[1], false);
+	bt_att_set_close_on_unref(att, true);
+	ctx->client = bt_gatt_client_new(ctx->client_db, att, bench->mtu, 0);
+	bt_att_unref(att);
+
+	if (!ctx->server || !ctx->client) {
+		fprintf(stderr, "%s: failed to create server or client\n",
+								bench->name);
+		destroy_context(ctx);
+		return NULL;
+	}
+
+	bt_gatt_client_ready_register(ctx->client, ready_cb, NULL, NULL);
+
+	return ctx;
+}
+
+static bool step(void *user_data)
+{
+	if (context) {
+		destroy_context(context);
+		context = NULL;
+	}
+
+	if (!run.bench || run.done == run.count) {
+		if (run.bench) {
+			report();
+			free(run.latency);
+			bench_index++;
+		}
+
+		for (; bench_index < ARRAY_SIZE(benches); bench_index++) {
+			if (!option_filter || strstr(benches[bench_index].name,
+							option_filter))
+				break;
+		}
+
+		if (bench_index == ARRAY_SIZE(benches)) {
+			mainloop_quit();
+			return false;
+		}
+
+		memset(&run, 0, sizeof(run));
+		run.bench = &benches[bench_index];
+		run.count = run.bench->count / option_scale ? : 1;
+		run.latency = new0(uint64_t, run.count);
+	}
+
+	context = create_context(run.bench);
+	if (!context)
+		mainloop_exit_failure();
+
+	return false;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage:\n"
+		"\tbench-gatt [options]\n");
+	fprintf(stderr,
+		"Options:\n"
+		"\t--filter <string>      Run benchmarks matching string\n"
+		"\t--quick                Run a tenth of the operations\n"
+		"\t--help                 Show %s information\n", __func__);
+}
+
+static const struct option main_options[] = {
+	{ "filter",	required_argument,	NULL, 'f' },
+	{ "quick",	no_argument,		NULL, 'q' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "f:qh", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'f':
+			option_filter = optarg;
+			break;
+		case 'q':
+			option_scale = 10;
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < sizeof(long_value); i++)
+		long_value[i] = i;
+
+	mainloop_init();
+
+	printf("%-32s %8s %10s %10s %9s %9s %9s\n", "Benchmark", "Ops",
+			"Ops/s", "KiB/s", "Allocs/op", "p50 us", "p99 us");
+
+	timeout_add(1, step, NULL, NULL);
+
+	return mainloop_run();
+}
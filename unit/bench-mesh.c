@@ -0,0 +1,520 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ell/ell.h>
+
+#include "mesh/cache.h"
+#include "mesh/sar.h"
+#include "mesh/friend-queue.h"
+
+/*
+ * Feeds the same synthetic traffic to the data structures of the mesh
+ * daemon and to the l_queue based code they replaced in mesh/net.c, and
+ * reports the time per operation of both.
+ */
+
+#define NUM_SOURCES	500
+#define NUM_PACKETS	200000
+#define CRPL		NUM_SOURCES
+#define MSG_CACHE_SIZE	70
+#define REPEATS		3
+
+#define NUM_SESSIONS	256
+#define NUM_SEGMENTS	32
+#define NUM_ROUNDS	200
+
+#define NUM_LPNS	32
+#define CACHE_SIZE	16
+#define NUM_POLL_ROUNDS	100000
+#define SLOW_NS		1000
+
+struct bench {
+	const char *name;
+	bool (*func)(unsigned int scale);
+};
+
+struct packet {
+	uint16_t src;
+	uint32_t seq;
+	uint32_t mic;
+};
+
+struct rpl_entry {
+	uint16_t src;
+	uint32_t seq;
+};
+
+struct session {
+	uint16_t remote;
+	uint16_t seq_zero;
+	struct l_timeout *timeout;
+	struct mesh_sar_timer *timer;
+};
+
+struct msg {
+	uint16_t src;
+	uint16_t len;
+	bool ack;
+	uint8_t data[380];
+};
+
+static const char *option_filter;
+static unsigned int option_scale = 1;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct packet *make_stream(unsigned int packets, unsigned int *count)
+{
+	uint32_t seq[NUM_SOURCES] = { 0 };
+	struct packet *pkts;
+	unsigned int i, n = 0;
+
+	pkts = l_new(struct packet, packets * REPEATS);
+	srand(1);
+
+	/* Every packet is heard once directly and then relayed */
+	for (i = 0; i < packets; i++) {
+		uint16_t src = rand() % NUM_SOURCES;
+		struct packet pkt = {
+			.src = src + 1,
+			.seq = ++seq[src],
+			.mic = rand(),
+		};
+		int r;
+
+		for (r = 0; r < REPEATS; r++)
+			pkts[n++] = pkt;
+	}
+
+	*count = n;
+
+	return pkts;
+}
+
+static bool match_msg(const void *a, const void *b)
+{
+	const struct packet *msg = a;
+	const struct packet *tst = b;
+
+	return msg->src == tst->src && msg->seq == tst->seq &&
+							msg->mic == tst->mic;
+}
+
+static bool match_src(const void *a, const void *b)
+{
+	const struct rpl_entry *rpe = a;
+
+	return rpe->src == L_PTR_TO_UINT(b);
+}
+
+/* The list based caches as used by mesh/net.c before */
+static unsigned int run_queue(const struct packet *pkts, unsigned int count)
+{
+	struct l_queue *msg_cache = l_queue_new();
+	struct l_queue *rpl = l_queue_new();
+	unsigned int i, accepted = 0;
+
+	for (i = 0; i < count; i++) {
+		const struct packet *pkt = &pkts[i];
+		struct rpl_entry *rpe;
+		struct packet *msg;
+
+		msg = l_queue_remove_if(msg_cache, match_msg, pkt);
+		if (msg) {
+			l_queue_push_head(msg_cache, msg);
+			continue;
+		}
+
+		msg = l_memdup(pkt, sizeof(*pkt));
+		l_queue_push_head(msg_cache, msg);
+
+		if (l_queue_length(msg_cache) > MSG_CACHE_SIZE) {
+			msg = l_queue_peek_tail(msg_cache);
+			l_queue_remove(msg_cache, msg);
+			l_free(msg);
+		}
+
+		rpe = l_queue_find(rpl, match_src, L_UINT_TO_PTR(pkt->src));
+		if (rpe && pkt->seq <= rpe->seq)
+			continue;
+
+		rpe = l_queue_remove_if(rpl, match_src,
+						L_UINT_TO_PTR(pkt->src));
+		if (!rpe) {
+			rpe = l_new(struct rpl_entry, 1);
+			rpe->src = pkt->src;
+		}
+
+		rpe->seq = pkt->seq;
+		l_queue_push_head(rpl, rpe);
+		accepted++;
+	}
+
+	l_queue_destroy(msg_cache, l_free);
+	l_queue_destroy(rpl, l_free);
+
+	return accepted;
+}
+
+static unsigned int run_cache(const struct packet *pkts, unsigned int count)
+{
+	struct mesh_cache *msg_cache = mesh_cache_new(MSG_CACHE_SIZE);
+	struct mesh_cache *rpl = mesh_cache_new(CRPL);
+	unsigned int i, accepted = 0;
+
+	for (i = 0; i < count; i++) {
+		const struct packet *pkt = &pkts[i];
+		uint64_t key = (uint64_t) pkt->src << 24 | pkt->seq;
+		uint64_t value;
+
+		if (mesh_cache_lookup(msg_cache, key, &value) &&
+							value == pkt->mic)
+			continue;
+
+		mesh_cache_insert(msg_cache, key, pkt->mic);
+
+		if (mesh_cache_lookup(rpl, pkt->src, &value) &&
+							pkt->seq <= value)
+			continue;
+
+		mesh_cache_insert(rpl, pkt->src, pkt->seq);
+		accepted++;
+	}
+
+	mesh_cache_free(msg_cache);
+	mesh_cache_free(rpl);
+
+	return accepted;
+}
+
+static bool bench_caches(unsigned int scale)
+{
+	unsigned int packets = NUM_PACKETS / scale;
+	struct packet *pkts;
+	unsigned int count, accepted_queue, accepted_cache;
+	uint64_t start, queue_ns, cache_ns;
+
+	pkts = make_stream(packets, &count);
+
+	start = now_ns();
+	accepted_queue = run_queue(pkts, count);
+	queue_ns = now_ns() - start;
+
+	start = now_ns();
+	accepted_cache = run_cache(pkts, count);
+	cache_ns = now_ns() - start;
+
+	l_free(pkts);
+
+	printf("%u packets from %u sources: queue %" PRIu64 " ns/pkt, "
+					"hashed %" PRIu64 " ns/pkt\n",
+					count, NUM_SOURCES, queue_ns / count,
+					cache_ns / count);
+
+	/* Each packet is accepted once, its relayed copies are not */
+	return accepted_queue == packets && accepted_cache == packets;
+}
+
+static bool match_remote(const void *a, const void *b)
+{
+	const struct session *sess = a;
+
+	return sess->remote == L_PTR_TO_UINT(b);
+}
+
+static void timeout_cb(struct l_timeout *timeout, void *user_data)
+{
+}
+
+static void wheel_cb(void *user_data)
+{
+}
+
+/*
+ * NUM_SESSIONS transfers in progress, each receiving NUM_SEGMENTS
+ * segments: every segment looks up its context and restarts its
+ * segment timer, as mesh/net.c does.
+ */
+static bool bench_sessions(unsigned int scale)
+{
+	unsigned int rounds = NUM_ROUNDS / scale;
+	struct session *sess = l_new(struct session, NUM_SESSIONS);
+	struct l_queue *queue = l_queue_new();
+	struct mesh_sar_table *table = mesh_sar_table_new();
+	struct mesh_sar_wheel *wheel = mesh_sar_wheel_new(100);
+	uint64_t start, queue_ns, table_ns;
+	unsigned int i, r, n = 0;
+
+	for (i = 0; i < NUM_SESSIONS; i++) {
+		sess[i].remote = 0x100 + i * 3;
+		sess[i].seq_zero = i;
+		l_queue_push_head(queue, &sess[i]);
+		mesh_sar_table_insert(table, sess[i].remote, sess[i].seq_zero,
+								&sess[i]);
+	}
+
+	start = now_ns();
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < NUM_SESSIONS * NUM_SEGMENTS; i++) {
+			struct session *s = &sess[(i * 7) % NUM_SESSIONS];
+
+			s = l_queue_find(queue, match_remote,
+						L_UINT_TO_PTR(s->remote));
+			l_timeout_remove(s->timeout);
+			s->timeout = l_timeout_create(2, timeout_cb, s, NULL);
+			n++;
+		}
+	}
+
+	queue_ns = now_ns() - start;
+
+	for (i = 0; i < NUM_SESSIONS; i++) {
+		l_timeout_remove(sess[i].timeout);
+		sess[i].timeout = NULL;
+	}
+
+	start = now_ns();
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < NUM_SESSIONS * NUM_SEGMENTS; i++) {
+			struct session *s = &sess[(i * 7) % NUM_SESSIONS];
+
+			s = mesh_sar_table_lookup(table, s->remote,
+								s->seq_zero);
+			mesh_sar_timer_remove(s->timer);
+			s->timer = mesh_sar_timer_add(wheel, 2000, wheel_cb, s);
+		}
+	}
+
+	table_ns = now_ns() - start;
+
+	printf("%u sessions, %u segments: queue+l_timeout %" PRIu64
+				" ns/seg, table+wheel %" PRIu64 " ns/seg\n",
+				NUM_SESSIONS, n, queue_ns / n, table_ns / n);
+
+	mesh_sar_wheel_free(wheel);
+	mesh_sar_table_free(table, NULL);
+	l_queue_destroy(queue, NULL);
+	l_free(sess);
+
+	return true;
+}
+
+static bool match_ack(const void *a, const void *b)
+{
+	const struct msg *old = a;
+	const struct msg *rx = b;
+
+	return old->ack && rx->ack && old->src == rx->src;
+}
+
+static struct msg *next_msg(struct msg *msg, unsigned int n)
+{
+	msg->src = 0x100 + (n % 7);
+	msg->ack = (n % 10) < 3;
+
+	/* Mostly unsegmented traffic, with a few 4 and 15 segment bursts */
+	if (msg->ack || (n % 10) < 8)
+		msg->len = 48;
+	else if (n % 10 == 8)
+		msg->len = 116;
+	else
+		msg->len = 380;
+
+	return msg;
+}
+
+/*
+ * NUM_LPNS friendships each receive one message per round and answer one
+ * poll, as mesh/net.c and mesh/friend.c do for a busy Friend node.
+ */
+static bool bench_poll(unsigned int scale)
+{
+	unsigned int rounds = NUM_POLL_ROUNDS / scale;
+	struct mesh_friend_queue *rings[NUM_LPNS];
+	struct l_queue *queues[NUM_LPNS];
+	uint64_t start, ns, queue_ns = 0, ring_ns = 0;
+	unsigned int queue_slow = 0, ring_slow = 0;
+	unsigned int i, r, n = 0;
+	struct msg msg;
+
+	memset(&msg, 0, sizeof(msg));
+
+	for (i = 0; i < NUM_LPNS; i++) {
+		queues[i] = l_queue_new();
+		rings[i] = mesh_friend_queue_new(CACHE_SIZE);
+	}
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < NUM_LPNS; i++, n++) {
+			struct l_queue *queue = queues[i];
+			struct msg *pkt;
+
+			next_msg(&msg, n);
+
+			start = now_ns();
+
+			while (msg.ack && (pkt = l_queue_remove_if(queue,
+							match_ack, &msg)))
+				l_free(pkt);
+
+			pkt = l_malloc(msg.len);
+			memcpy(pkt, &msg, msg.len);
+			l_queue_push_tail(queue, pkt);
+
+			if (l_queue_length(queue) > CACHE_SIZE)
+				l_free(l_queue_pop_head(queue));
+
+			if (r & 1)
+				l_free(l_queue_pop_head(queue));
+
+			ns = now_ns() - start;
+			queue_ns += ns;
+			if (ns > SLOW_NS)
+				queue_slow++;
+		}
+	}
+
+	n = 0;
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < NUM_LPNS; i++, n++) {
+			struct mesh_friend_queue *ring = rings[i];
+
+			next_msg(&msg, n);
+
+			start = now_ns();
+
+			if (msg.ack)
+				mesh_friend_queue_remove_if(ring, match_ack,
+									&msg);
+
+			mesh_friend_queue_push(ring, &msg, msg.len);
+
+			if (r & 1)
+				mesh_friend_queue_pop_head(ring);
+
+			ns = now_ns() - start;
+			ring_ns += ns;
+			if (ns > SLOW_NS)
+				ring_slow++;
+		}
+	}
+
+	printf("%u LPNs, %u polls: queue %" PRIu64 " ns (%u over %u ns), "
+			"ring %" PRIu64 " ns (%u over %u ns)\n",
+			NUM_LPNS, n, queue_ns / n, queue_slow, SLOW_NS,
+			ring_ns / n, ring_slow, SLOW_NS);
+
+	for (i = 0; i < NUM_LPNS; i++) {
+		l_queue_destroy(queues[i], l_free);
+		mesh_friend_queue_free(rings[i]);
+	}
+
+	return true;
+}
+
+static const struct bench benches[] = {
+	{ "Replay and message caches", bench_caches },
+	{ "SAR sessions", bench_sessions },
+	{ "Friend Queue polls", bench_poll },
+};
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage:\n"
+		"\tbench-mesh [options]\n");
+	fprintf(stderr,
+		"Options:\n"
+		"\t--filter <string>      Run benchmarks matching string\n"
+		"\t--quick                Run a tenth of the operations\n"
+		"\t--help                 Show %s information\n", __func__);
+}
+
+static const struct option main_options[] = {
+	{ "filter",	required_argument,	NULL, 'f' },
+	{ "quick",	no_argument,		NULL, 'q' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	bool result = true;
+	unsigned int i;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "f:qh", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'f':
+			option_filter = optarg;
+			break;
+		case 'q':
+			option_scale = 10;
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	/* l_timeout and the SAR timer wheel need the ell main loop */
+	if (!l_main_init())
+		return EXIT_FAILURE;
+
+	for (i = 0; i < L_ARRAY_SIZE(benches); i++) {
+		if (option_filter && !strstr(benches[i].name, option_filter))
+			continue;
+
+		printf("%s\n", benches[i].name);
+
+		if (!benches[i].func(option_scale)) {
+			fprintf(stderr, "%s: unexpected result\n",
+							benches[i].name);
+			result = false;
+		}
+	}
+
+	l_main_exit();
+
+	return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
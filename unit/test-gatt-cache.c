@@ -0,0 +1,232 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/gatt-cache.h"
+#include "src/shared/tester.h"
+
+static const uint8_t db_hash[16] = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+};
+
+static void write_cb(struct gatt_db_attribute *attrib, int err,
+							void *user_data)
+{
+	g_assert(err == 0);
+}
+
+static struct gatt_db *make_db(void)
+{
+	struct gatt_db_attribute *svc, *incl, *attr;
+	struct gatt_db *db;
+	uint128_t u128;
+	uint8_t ext[2] = { 0x01, 0x00 };
+	bt_uuid_t uuid;
+	int i;
+
+	db = gatt_db_new();
+
+	/* Secondary service that gets included by the next one */
+	bt_uuid16_create(&uuid, 0x180f);
+	incl = gatt_db_insert_service(db, 0x0001, &uuid, false, 4);
+	g_assert(incl);
+	bt_uuid16_create(&uuid, 0x2a19);
+	g_assert(gatt_db_service_insert_characteristic(incl, 0x0003, &uuid, 0,
+						0x12, NULL, NULL, NULL));
+	gatt_db_service_set_active(incl, true);
+
+	bt_uuid16_create(&uuid, 0x1801);
+	svc = gatt_db_insert_service(db, 0x0010, &uuid, true, 8);
+	g_assert(svc);
+	g_assert(gatt_db_service_insert_included(svc, 0x0011, incl));
+
+	bt_uuid16_create(&uuid, GATT_CHARAC_DB_HASH);
+	attr = gatt_db_service_insert_characteristic(svc, 0x0013, &uuid, 0,
+						0x02, NULL, NULL, NULL);
+	g_assert(attr);
+	g_assert(gatt_db_attribute_write(attr, 0, db_hash, sizeof(db_hash), 0,
+						NULL, write_cb, NULL));
+
+	bt_uuid32_create(&uuid, 0x12345678);
+	g_assert(gatt_db_service_insert_characteristic(svc, 0x0015, &uuid, 0,
+						0x8a, NULL, NULL, NULL));
+	bt_uuid16_create(&uuid, GATT_CHARAC_EXT_PROPER_UUID);
+	attr = gatt_db_service_insert_descriptor(svc, 0x0016, &uuid, 0,
+						NULL, NULL, NULL);
+	g_assert(attr);
+	g_assert(gatt_db_attribute_write(attr, 0, ext, sizeof(ext), 0, NULL,
+						write_cb, NULL));
+	gatt_db_service_set_active(svc, true);
+
+	/* Vendor service with many characteristics sharing one UUID */
+	for (i = 0; i < 16; i++)
+		u128.data[i] = i;
+	bt_uuid128_create(&uuid, u128);
+	svc = gatt_db_insert_service(db, 0x0020, &uuid, true, 64);
+	g_assert(svc);
+
+	for (i = 0; i < 20; i++) {
+		g_assert(gatt_db_service_insert_characteristic(svc,
+						0x0022 + i * 3, &uuid, 0,
+						0x10, NULL, NULL, NULL));
+		bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+		g_assert(gatt_db_service_insert_descriptor(svc, 0x0023 + i * 3,
+						&uuid, 0, NULL, NULL, NULL));
+		bt_uuid128_create(&uuid, u128);
+	}
+	gatt_db_service_set_active(svc, true);
+
+	return db;
+}
+
+struct compare_data {
+	struct gatt_db *db;
+	unsigned int count;
+};
+
+static void read_cb(struct gatt_db_attribute *attrib, int err,
+				const uint8_t *value, size_t length,
+				void *user_data)
+{
+	struct iovec *iov = user_data;
+
+	g_assert(err == 0);
+
+	iov->iov_base = (void *) value;
+	iov->iov_len = length;
+}
+
+static void compare_attr(struct gatt_db_attribute *a, void *user_data)
+{
+	struct compare_data *data = user_data;
+	struct gatt_db_attribute *b;
+	struct iovec va, vb;
+	uint16_t handle;
+
+	handle = gatt_db_attribute_get_handle(a);
+	b = gatt_db_get_attribute(data->db, handle);
+	g_assert(b);
+
+	g_assert(!bt_uuid_cmp(gatt_db_attribute_get_type(a),
+					gatt_db_attribute_get_type(b)));
+
+	memset(&va, 0, sizeof(va));
+	memset(&vb, 0, sizeof(vb));
+	gatt_db_attribute_read(a, 0, BT_ATT_OP_READ_REQ, NULL, read_cb, &va);
+	gatt_db_attribute_read(b, 0, BT_ATT_OP_READ_REQ, NULL, read_cb, &vb);
+
+	g_assert(va.iov_len == vb.iov_len);
+	g_assert(!va.iov_len || !memcmp(va.iov_base, vb.iov_base, va.iov_len));
+
+	data->count++;
+}
+
+static void compare_service(struct gatt_db_attribute *attr, void *user_data)
+{
+	g_assert(gatt_db_service_get_active(attr));
+
+	gatt_db_service_foreach(attr, NULL, compare_attr, user_data);
+}
+
+static void test_roundtrip(const void *test_data)
+{
+	struct compare_data data;
+	struct gatt_db *db, *copy;
+	uint8_t hash[16];
+	void *buf;
+	ssize_t len;
+
+	db = make_db();
+
+	len = gatt_cache_encode(db, &buf);
+	g_assert(len > 0);
+
+	g_assert(gatt_cache_get_hash(buf, len, hash));
+	g_assert(!memcmp(hash, db_hash, sizeof(hash)));
+
+	copy = gatt_db_new();
+	g_assert(gatt_cache_decode(copy, buf, len) == 0);
+
+	data.db = copy;
+	data.count = 0;
+	gatt_db_foreach_service(db, NULL, compare_service, &data);
+	g_assert(data.count == 71);
+
+	data.db = db;
+	data.count = 0;
+	gatt_db_foreach_service(copy, NULL, compare_service, &data);
+	g_assert(data.count == 71);
+
+	free(buf);
+	gatt_db_unref(copy);
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+static void test_invalid(const void *test_data)
+{
+	struct gatt_db *db, *copy;
+	uint8_t hash[16];
+	uint8_t *buf;
+	ssize_t len;
+
+	db = make_db();
+
+	len = gatt_cache_encode(db, (void **) &buf);
+	g_assert(len > 0);
+
+	copy = gatt_db_new();
+
+	/* Truncated */
+	g_assert(gatt_cache_decode(copy, buf, len - 1) == -EILSEQ);
+	g_assert(gatt_db_isempty(copy));
+
+	/* Unknown record type */
+	buf[32 + 8] = 0xff;
+	g_assert(gatt_cache_decode(copy, buf, len) == -EIO);
+	g_assert(gatt_db_isempty(copy));
+
+	/* Wrong magic */
+	buf[0] = 'X';
+	g_assert(gatt_cache_decode(copy, buf, len) == -EILSEQ);
+	g_assert(!gatt_cache_get_hash(buf, len, hash));
+
+	free(buf);
+	gatt_db_unref(copy);
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/gatt-cache/roundtrip", NULL, NULL, test_roundtrip, NULL);
+	tester_add("/gatt-cache/invalid", NULL, NULL, test_invalid, NULL);
+
+	return tester_run();
+}
@@ -2268,6 +2268,141 @@ static const struct test_step test_notification_server_1 = {
 	.length = 0x03,
 };
 
+static void test_server_notification_multiple(struct context *context)
+{
+	const struct test_step *step = context->data->step;
+	int i;
+
+	for (i = 0; i < 3; i++)
+		bt_gatt_server_send_notification(context->server, step->handle,
+						step->value, step->length, true);
+}
+
+static const struct test_step test_notification_server_2 = {
+	.handle = 0x0003,
+	.func = test_server_notification_multiple,
+	.value = read_data_1,
+	.length = 0x03,
+};
+
+static void test_server_notification_single(struct context *context)
+{
+	const struct test_step *step = context->data->step;
+
+	bt_gatt_server_send_notification(context->server, step->handle,
+					step->value, step->length, true);
+}
+
+static const struct test_step test_notification_server_3 = {
+	.handle = 0x0003,
+	.func = test_server_notification_single,
+	.value = read_data_1,
+	.length = 0x03,
+};
+
+static void test_server_notification_batch(struct context *context,
+						uint8_t mode, int count)
+{
+	const struct test_step *step = context->data->step;
+	struct bt_gatt_server_nfy_stats stats;
+	int i;
+
+	/*
+	 * The empty PDUs separating the expected notifications trigger the
+	 * step again, only send the values the first time around.
+	 */
+	g_assert(bt_gatt_server_get_nfy_stats(context->server, &stats));
+	if (stats.notifications)
+		return;
+
+	g_assert(bt_gatt_server_set_nfy_batching(context->server, mode, 0));
+
+	for (i = 0; i < count; i++)
+		bt_gatt_server_send_notification(context->server, step->handle,
+						step->value, step->length,
+						true);
+}
+
+static void test_server_notification_batch_off(struct context *context)
+{
+	test_server_notification_batch(context, BT_GATT_SERVER_NFY_BATCH_OFF,
+									3);
+}
+
+static void test_server_notification_batch_off_stats(struct context *context)
+{
+	struct bt_gatt_server_nfy_stats stats;
+
+	g_assert(bt_gatt_server_get_nfy_stats(context->server, &stats));
+	g_assert(stats.notifications == 3);
+	g_assert(stats.pdus == 3);
+	g_assert(stats.mult_pdus == 0);
+	g_assert(stats.full_flushes == 0);
+	g_assert(stats.timeout_flushes == 0);
+}
+
+static const struct test_step test_notification_server_4 = {
+	.handle = 0x0003,
+	.func = test_server_notification_batch_off,
+	.post_func = test_server_notification_batch_off_stats,
+	.value = read_data_1,
+	.length = 0x03,
+};
+
+static void test_server_notification_adaptive(struct context *context)
+{
+	test_server_notification_batch(context,
+					BT_GATT_SERVER_NFY_BATCH_ADAPTIVE, 3);
+}
+
+static void test_server_notification_adaptive_stats(struct context *context)
+{
+	struct bt_gatt_server_nfy_stats stats;
+
+	/* Only the values queued behind the first one are combined */
+	g_assert(bt_gatt_server_get_nfy_stats(context->server, &stats));
+	g_assert(stats.notifications == 3);
+	g_assert(stats.pdus == 2);
+	g_assert(stats.mult_pdus == 1);
+	g_assert(stats.full_flushes == 0);
+	g_assert(stats.timeout_flushes == 1);
+}
+
+static const struct test_step test_notification_server_5 = {
+	.handle = 0x0003,
+	.func = test_server_notification_adaptive,
+	.post_func = test_server_notification_adaptive_stats,
+	.value = read_data_1,
+	.length = 0x03,
+};
+
+static void test_server_notification_full(struct context *context)
+{
+	test_server_notification_batch(context, BT_GATT_SERVER_NFY_BATCH_ON,
+									4);
+}
+
+static void test_server_notification_full_stats(struct context *context)
+{
+	struct bt_gatt_server_nfy_stats stats;
+
+	/* Three values fill the default MTU, the last one goes on timeout */
+	g_assert(bt_gatt_server_get_nfy_stats(context->server, &stats));
+	g_assert(stats.notifications == 4);
+	g_assert(stats.pdus == 2);
+	g_assert(stats.mult_pdus == 1);
+	g_assert(stats.full_flushes == 1);
+	g_assert(stats.timeout_flushes == 1);
+}
+
+static const struct test_step test_notification_server_6 = {
+	.handle = 0x0003,
+	.func = test_server_notification_full,
+	.post_func = test_server_notification_full_stats,
+	.value = read_data_1,
+	.length = 0x03,
+};
+
 static uint8_t indication_received;
 
 static void test_indication_cb(void *user_data)
@@ -3246,6 +3381,16 @@ int main(int argc, char *argv[])
 			raw_pdu(),
 			raw_pdu(0x1B, 0x03, 0x00, 0x01, 0x02, 0x03));
 
+	define_test_client("/client/notify-multiple", test_client,
+			ts_small_db, &test_notification_1,
+			CLIENT_INIT_PDUS,
+			SMALL_DB_DISCOVERY_PDUS,
+			raw_pdu(0x12, 0x04, 0x00, 0x03, 0x00),
+			raw_pdu(0x13),
+			raw_pdu(),
+			raw_pdu(0x23, 0x07, 0x00, 0x02, 0x00, 0xaa, 0xbb,
+				0x03, 0x00, 0x03, 0x00, 0x01, 0x02, 0x03));
+
 	define_test_server("/TP/GAN/SR/BV-01-C", test_server, ts_small_db,
 			&test_notification_server_1,
 			raw_pdu(0x03, 0x00, 0x02),
@@ -3254,6 +3399,59 @@ int main(int argc, char *argv[])
 			raw_pdu(),
 			raw_pdu(0x1B, 0x03, 0x00, 0x01, 0x02, 0x03));
 
+	define_test_server("/server/notify-multiple", test_server,
+			ts_small_db, &test_notification_server_2,
+			raw_pdu(0x03, 0x00, 0x02),
+			raw_pdu(0x12, 0x04, 0x00, 0x01, 0x00),
+			raw_pdu(0x13),
+			raw_pdu(),
+			raw_pdu(0x23, 0x03, 0x00, 0x03, 0x00, 0x01, 0x02, 0x03,
+				0x03, 0x00, 0x03, 0x00, 0x01, 0x02, 0x03,
+				0x03, 0x00, 0x03, 0x00, 0x01, 0x02, 0x03));
+
+	define_test_server("/server/notify-multiple-single", test_server,
+			ts_small_db, &test_notification_server_3,
+			raw_pdu(0x03, 0x00, 0x02),
+			raw_pdu(0x12, 0x04, 0x00, 0x01, 0x00),
+			raw_pdu(0x13),
+			raw_pdu(),
+			raw_pdu(0x1B, 0x03, 0x00, 0x01, 0x02, 0x03));
+
+	define_test_server("/server/notify-multiple-off", test_server,
+			ts_small_db, &test_notification_server_4,
+			raw_pdu(0x03, 0x00, 0x02),
+			raw_pdu(0x12, 0x04, 0x00, 0x01, 0x00),
+			raw_pdu(0x13),
+			raw_pdu(),
+			raw_pdu(0x1B, 0x03, 0x00, 0x01, 0x02, 0x03),
+			raw_pdu(),
+			raw_pdu(0x1B, 0x03, 0x00, 0x01, 0x02, 0x03),
+			raw_pdu(),
+			raw_pdu(0x1B, 0x03, 0x00, 0x01, 0x02, 0x03));
+
+	define_test_server("/server/notify-multiple-adaptive", test_server,
+			ts_small_db, &test_notification_server_5,
+			raw_pdu(0x03, 0x00, 0x02),
+			raw_pdu(0x12, 0x04, 0x00, 0x01, 0x00),
+			raw_pdu(0x13),
+			raw_pdu(),
+			raw_pdu(0x1B, 0x03, 0x00, 0x01, 0x02, 0x03),
+			raw_pdu(),
+			raw_pdu(0x23, 0x03, 0x00, 0x03, 0x00, 0x01, 0x02, 0x03,
+				0x03, 0x00, 0x03, 0x00, 0x01, 0x02, 0x03));
+
+	define_test_server("/server/notify-multiple-full", test_server,
+			ts_small_db, &test_notification_server_6,
+			raw_pdu(0x03, 0x00, 0x02),
+			raw_pdu(0x12, 0x04, 0x00, 0x01, 0x00),
+			raw_pdu(0x13),
+			raw_pdu(),
+			raw_pdu(0x23, 0x03, 0x00, 0x03, 0x00, 0x01, 0x02, 0x03,
+				0x03, 0x00, 0x03, 0x00, 0x01, 0x02, 0x03,
+				0x03, 0x00, 0x03, 0x00, 0x01, 0x02, 0x03),
+			raw_pdu(),
+			raw_pdu(0x1B, 0x03, 0x00, 0x01, 0x02, 0x03));
+
 	define_test_server("/TP/GAI/SR/BV-01-C", test_server, ts_small_db,
 			&test_indication_server_1,
 			raw_pdu(0x03, 0x00, 0x02),
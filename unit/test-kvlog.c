@@ -0,0 +1,330 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/kvlog.h"
+#include "src/shared/tester.h"
+
+static char test_dirname[PATH_MAX];
+static char test_pathname[PATH_MAX];
+
+static struct kvlog *create_log(void)
+{
+	struct kvlog *log;
+	bool created;
+
+	strcpy(test_dirname, "/tmp/kvlog-XXXXXX");
+	g_assert(mkdtemp(test_dirname) != NULL);
+
+	snprintf(test_pathname, sizeof(test_pathname), "%s/store",
+							test_dirname);
+
+	log = kvlog_open(test_pathname, &created);
+	g_assert(log != NULL);
+	g_assert(created);
+
+	return log;
+}
+
+static void remove_log(void)
+{
+	unlink(test_pathname);
+	rmdir(test_dirname);
+}
+
+static struct kvlog *reopen_log(struct kvlog *log)
+{
+	bool created;
+
+	kvlog_close(log);
+
+	log = kvlog_open(test_pathname, &created);
+	g_assert(log != NULL);
+	g_assert(!created);
+
+	return log;
+}
+
+static void assert_value(struct kvlog *log, const char *key,
+							const char *value)
+{
+	size_t len;
+	char *str;
+
+	str = kvlog_get(log, key, &len);
+	g_assert(str != NULL);
+	g_assert(len == strlen(value));
+	g_assert(!strcmp(str, value));
+	free(str);
+}
+
+static void test_basic(const void *data)
+{
+	struct kvlog *log;
+
+	log = create_log();
+
+	g_assert(kvlog_put(log, "00:11:22:33:44:55/info", "a", 1) == 0);
+	g_assert(kvlog_put(log, "settings", "b", 1) == 0);
+	g_assert(kvlog_put(log, "00:11:22:33:44:55/info", "cc", 2) == 0);
+
+	assert_value(log, "00:11:22:33:44:55/info", "cc");
+	assert_value(log, "settings", "b");
+	g_assert(!kvlog_get(log, "missing", NULL));
+
+	g_assert(kvlog_del(log, "settings") == 0);
+	g_assert(kvlog_del(log, "settings") == -ENOENT);
+	g_assert(!kvlog_contains(log, "settings"));
+
+	log = reopen_log(log);
+
+	assert_value(log, "00:11:22:33:44:55/info", "cc");
+	g_assert(!kvlog_contains(log, "settings"));
+
+	kvlog_close(log);
+	remove_log();
+	tester_test_passed();
+}
+
+static void test_exclusive(const void *data)
+{
+	struct kvlog *log;
+
+	log = create_log();
+
+	g_assert(kvlog_open(test_pathname, NULL) == NULL);
+
+	kvlog_close(log);
+	remove_log();
+	tester_test_passed();
+}
+
+static void test_transaction(const void *data)
+{
+	struct kvlog *log;
+
+	log = create_log();
+
+	g_assert(kvlog_begin(log));
+	g_assert(!kvlog_begin(log));
+	g_assert(kvlog_put(log, "dev/info", "ltk", 3) == 0);
+	g_assert(kvlog_put(log, "dev/attributes", "ccc", 3) == 0);
+
+	/* Uncommitted writes are not visible */
+	g_assert(!kvlog_contains(log, "dev/info"));
+
+	kvlog_abort(log);
+	g_assert(!kvlog_contains(log, "dev/info"));
+
+	g_assert(kvlog_begin(log));
+	g_assert(kvlog_put(log, "dev/info", "ltk", 3) == 0);
+	g_assert(kvlog_put(log, "dev/attributes", "ccc", 3) == 0);
+	g_assert(kvlog_commit(log) == 0);
+
+	log = reopen_log(log);
+
+	assert_value(log, "dev/info", "ltk");
+	assert_value(log, "dev/attributes", "ccc");
+
+	kvlog_close(log);
+	remove_log();
+	tester_test_passed();
+}
+
+static void test_torn_write(const void *data)
+{
+	struct kvlog_stats before, after;
+	struct kvlog *log;
+	struct stat st;
+	int fd;
+
+	log = create_log();
+
+	g_assert(kvlog_put(log, "dev/info", "old", 3) == 0);
+	g_assert(kvlog_get_stats(log, &before));
+
+	g_assert(kvlog_begin(log));
+	g_assert(kvlog_put(log, "dev/info", "new", 3) == 0);
+	g_assert(kvlog_put(log, "other/info", "x", 1) == 0);
+	g_assert(kvlog_commit(log) == 0);
+
+	kvlog_close(log);
+
+	/* Cut the last record in half, losing the commit marker */
+	g_assert(stat(test_pathname, &st) == 0);
+	g_assert(truncate(test_pathname, st.st_size - 3) == 0);
+
+	/* Trailing garbage must be ignored as well */
+	fd = open(test_pathname, O_WRONLY | O_APPEND);
+	g_assert(fd >= 0);
+	g_assert(write(fd, "garbage", 7) == 7);
+	close(fd);
+
+	log = kvlog_open(test_pathname, NULL);
+	g_assert(log != NULL);
+
+	assert_value(log, "dev/info", "old");
+	g_assert(!kvlog_contains(log, "other/info"));
+
+	g_assert(kvlog_get_stats(log, &after));
+	g_assert(after.file_size == before.file_size);
+
+	kvlog_close(log);
+	remove_log();
+	tester_test_passed();
+}
+
+static void count_key(const char *key, size_t len, void *user_data)
+{
+	unsigned int *count = user_data;
+
+	(*count)++;
+}
+
+static void test_prefix(const void *data)
+{
+	struct kvlog *log;
+	unsigned int count = 0;
+
+	log = create_log();
+
+	g_assert(kvlog_put(log, "AA/info", "1", 1) == 0);
+	g_assert(kvlog_put(log, "AA/attributes", "2", 1) == 0);
+	g_assert(kvlog_put(log, "AAB/info", "3", 1) == 0);
+	g_assert(kvlog_put(log, "cache/AA", "4", 1) == 0);
+
+	kvlog_foreach(log, "AA/", count_key, &count);
+	g_assert(count == 2);
+
+	g_assert(kvlog_del_prefix(log, "AA/") == 0);
+
+	count = 0;
+	kvlog_foreach(log, NULL, count_key, &count);
+	g_assert(count == 2);
+	g_assert(kvlog_contains(log, "AAB/info"));
+	g_assert(kvlog_contains(log, "cache/AA"));
+
+	kvlog_close(log);
+	remove_log();
+	tester_test_passed();
+}
+
+static void test_compact(const void *data)
+{
+	struct kvlog_stats stats;
+	struct kvlog *log;
+	char key[32], value[32];
+	unsigned int i;
+
+	log = create_log();
+	g_assert(kvlog_set_sync(log, false));
+
+	for (i = 0; i < 4096; i++) {
+		snprintf(key, sizeof(key), "dev%u/info", i % 64);
+		snprintf(value, sizeof(value), "value %u", i);
+		g_assert(kvlog_put(log, key, value, strlen(value)) == 0);
+	}
+
+	g_assert(kvlog_compact(log) == 0);
+	g_assert(kvlog_get_stats(log, &stats));
+	g_assert(stats.entries == 64);
+	g_assert(stats.dead_bytes == 0);
+	g_assert(stats.compactions > 0);
+
+	assert_value(log, "dev63/info", "value 4095");
+
+	log = reopen_log(log);
+
+	g_assert(kvlog_get_stats(log, &stats));
+	g_assert(stats.entries == 64);
+	assert_value(log, "dev0/info", "value 4032");
+
+	kvlog_close(log);
+	remove_log();
+	tester_test_passed();
+}
+
+static void test_import(const void *data)
+{
+	char dirname[] = "/tmp/kvlog-import-XXXXXX";
+	char path[PATH_MAX];
+	struct kvlog *log;
+	bool created;
+	int fd;
+
+	g_assert(mkdtemp(dirname) != NULL);
+
+	snprintf(path, sizeof(path), "%s/00:11:22:33:44:55", dirname);
+	g_assert(mkdir(path, 0700) == 0);
+
+	snprintf(path, sizeof(path), "%s/00:11:22:33:44:55/info", dirname);
+	fd = creat(path, 0600);
+	g_assert(fd >= 0);
+	g_assert(write(fd, "[General]\n", 10) == 10);
+	close(fd);
+
+	snprintf(path, sizeof(path), "%s/settings", dirname);
+	fd = creat(path, 0600);
+	g_assert(fd >= 0);
+	close(fd);
+
+	snprintf(path, sizeof(path), "%s/store", dirname);
+	log = kvlog_open(path, &created);
+	g_assert(log != NULL);
+	g_assert(created);
+
+	g_assert(kvlog_import_dir(log, dirname) == 0);
+
+	assert_value(log, "00:11:22:33:44:55/info", "[General]\n");
+	assert_value(log, "settings", "");
+	g_assert(!kvlog_contains(log, "store"));
+
+	kvlog_close(log);
+
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/settings", dirname);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/00:11:22:33:44:55/info", dirname);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/00:11:22:33:44:55", dirname);
+	rmdir(path);
+	rmdir(dirname);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/kvlog/basic", NULL, NULL, test_basic, NULL);
+	tester_add("/kvlog/exclusive", NULL, NULL, test_exclusive, NULL);
+	tester_add("/kvlog/transaction", NULL, NULL, test_transaction, NULL);
+	tester_add("/kvlog/torn_write", NULL, NULL, test_torn_write, NULL);
+	tester_add("/kvlog/prefix", NULL, NULL, test_prefix, NULL);
+	tester_add("/kvlog/compact", NULL, NULL, test_compact, NULL);
+	tester_add("/kvlog/import", NULL, NULL, test_import, NULL);
+
+	return tester_run();
+}
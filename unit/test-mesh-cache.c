@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include <ell/ell.h>
+
+#include "mesh/cache.h"
+
+#include "src/shared/tester.h"
+
+static void test_lru(const void *data)
+{
+	struct mesh_cache *cache;
+	uint64_t value;
+	int i;
+
+	cache = mesh_cache_new(4);
+	g_assert(cache != NULL);
+
+	for (i = 0; i < 4; i++)
+		mesh_cache_insert(cache, i, i * 10);
+
+	g_assert(mesh_cache_count(cache) == 4);
+
+	/* Touch 0 so that 1 is now the least recently used */
+	g_assert(mesh_cache_lookup(cache, 0, &value) && value == 0);
+
+	mesh_cache_insert(cache, 4, 40);
+	g_assert(mesh_cache_count(cache) == 4);
+	g_assert(!mesh_cache_lookup(cache, 1, NULL));
+	g_assert(mesh_cache_lookup(cache, 0, NULL));
+
+	/* Replace keeps the count */
+	mesh_cache_insert(cache, 4, 41);
+	g_assert(mesh_cache_lookup(cache, 4, &value) && value == 41);
+	g_assert(mesh_cache_count(cache) == 4);
+
+	g_assert(mesh_cache_remove(cache, 2));
+	g_assert(!mesh_cache_remove(cache, 2));
+	g_assert(mesh_cache_count(cache) == 3);
+
+	mesh_cache_clear(cache);
+	g_assert(mesh_cache_count(cache) == 0);
+	g_assert(!mesh_cache_lookup(cache, 0, NULL));
+
+	mesh_cache_free(cache);
+	tester_test_passed();
+}
+
+static bool remove_odd(uint64_t key, uint64_t value, void *user_data)
+{
+	return key & 1;
+}
+
+static void test_foreach_remove(const void *data)
+{
+	struct mesh_cache *cache;
+	int i;
+
+	cache = mesh_cache_new(1000);
+
+	for (i = 0; i < 1000; i++)
+		mesh_cache_insert(cache, (uint64_t) i << 40 | i, i);
+
+	g_assert(mesh_cache_foreach_remove(cache, remove_odd, NULL) == 500);
+
+	for (i = 0; i < 1000; i++)
+		g_assert(mesh_cache_lookup(cache, (uint64_t) i << 40 | i,
+							NULL) == !(i & 1));
+
+	/* Freed entries are reused without evicting */
+	for (i = 0; i < 500; i++)
+		mesh_cache_insert(cache, 5000 + i, i);
+
+	g_assert(mesh_cache_count(cache) == 1000);
+	g_assert(mesh_cache_lookup(cache, 0, NULL));
+
+	mesh_cache_free(cache);
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/mesh/cache/lru", NULL, NULL, test_lru, NULL);
+	tester_add("/mesh/cache/foreach_remove", NULL, NULL,
+						test_foreach_remove, NULL);
+
+	return tester_run();
+}
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include <ell/ell.h>
+
+#include "mesh/friend-queue.h"
+
+#include "src/shared/tester.h"
+
+struct msg {
+	uint16_t src;
+	uint16_t len;
+	bool ack;
+	uint8_t data[380];
+};
+
+static bool match_ack(const void *a, const void *b)
+{
+	const struct msg *old = a;
+	const struct msg *rx = b;
+
+	return old->ack && rx->ack && old->src == rx->src;
+}
+
+static uint16_t head_src(struct mesh_friend_queue *queue)
+{
+	struct msg *msg = mesh_friend_queue_peek_head(queue);
+
+	return msg ? msg->src : 0;
+}
+
+static void test_queue(const void *data)
+{
+	struct mesh_friend_queue *queue = mesh_friend_queue_new(4);
+	struct msg msg = { 0 };
+	unsigned int i;
+
+	g_assert(!mesh_friend_queue_new(0));
+	g_assert(mesh_friend_queue_size(queue) == 4);
+	g_assert(!mesh_friend_queue_peek_head(queue));
+
+	for (i = 1; i <= 4; i++) {
+		msg.src = i;
+		g_assert(!mesh_friend_queue_push(queue, &msg, sizeof(msg)));
+	}
+
+	/* Full: the oldest message makes room */
+	msg.src = 5;
+	g_assert(mesh_friend_queue_push(queue, &msg, sizeof(msg)));
+	g_assert(mesh_friend_queue_length(queue) == 4);
+	g_assert(head_src(queue) == 2);
+
+	/* Order is kept across the wrap of the ring */
+	mesh_friend_queue_pop_head(queue);
+	mesh_friend_queue_pop_head(queue);
+
+	for (i = 6; i <= 7; i++) {
+		msg.src = i;
+		g_assert(!mesh_friend_queue_push(queue, &msg, 8));
+	}
+
+	for (i = 4; i <= 7; i++) {
+		g_assert(head_src(queue) == i);
+		mesh_friend_queue_pop_head(queue);
+	}
+
+	g_assert(!mesh_friend_queue_length(queue));
+
+	/* Matching messages are removed in place */
+	for (i = 1; i <= 4; i++) {
+		msg.src = i & 1;
+		msg.ack = !(i & 2);
+		mesh_friend_queue_push(queue, &msg, 8);
+	}
+
+	msg.src = 1;
+	msg.ack = 1;
+	g_assert(mesh_friend_queue_remove_if(queue, match_ack, &msg) == 1);
+	g_assert(mesh_friend_queue_length(queue) == 3);
+
+	msg.src = 0;
+	g_assert(mesh_friend_queue_remove_if(queue, match_ack, &msg) == 1);
+	g_assert(head_src(queue) == 0);
+	mesh_friend_queue_pop_head(queue);
+	g_assert(head_src(queue) == 1);
+
+	mesh_friend_queue_free(queue);
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/mesh/friend-queue/ring", NULL, NULL, test_queue, NULL);
+
+	return tester_run();
+}
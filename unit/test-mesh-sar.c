@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <ell/ell.h>
+
+#include "mesh/sar.h"
+
+#include "src/shared/tester.h"
+
+struct session {
+	uint16_t remote;
+	uint16_t seq_zero;
+};
+
+static bool match_seq_zero(const void *a, const void *b)
+{
+	const struct session *sess = a;
+
+	return sess->seq_zero == L_PTR_TO_UINT(b);
+}
+
+static void test_table(const void *data)
+{
+	struct mesh_sar_table *table = mesh_sar_table_new();
+	struct session *sess = l_new(struct session, 1000);
+	unsigned int i;
+
+	for (i = 0; i < 1000; i++) {
+		sess[i].remote = i + 1;
+		sess[i].seq_zero = (i * 7) & 0x1fff;
+		g_assert(mesh_sar_table_insert(table, sess[i].remote,
+					sess[i].seq_zero, &sess[i]));
+	}
+
+	g_assert(mesh_sar_table_count(table) == 1000);
+	g_assert(!mesh_sar_table_insert(table, 1, 0, &sess[0]));
+
+	for (i = 0; i < 1000; i++) {
+		g_assert(mesh_sar_table_lookup(table, sess[i].remote,
+				sess[i].seq_zero) == &sess[i]);
+		g_assert(mesh_sar_table_lookup_addr(table,
+						sess[i].remote) == &sess[i]);
+	}
+
+	g_assert(!mesh_sar_table_lookup(table, 1, 1));
+	g_assert(mesh_sar_table_find(table, match_seq_zero,
+			L_UINT_TO_PTR(sess[500].seq_zero)) == &sess[500]);
+
+	for (i = 0; i < 1000; i += 2)
+		g_assert(mesh_sar_table_remove(table, sess[i].remote,
+				sess[i].seq_zero) == &sess[i]);
+
+	g_assert(mesh_sar_table_count(table) == 500);
+	g_assert(!mesh_sar_table_lookup_addr(table, sess[0].remote));
+	g_assert(mesh_sar_table_lookup_addr(table, sess[1].remote) ==
+								&sess[1]);
+
+	mesh_sar_table_free(table, NULL);
+	l_free(sess);
+	tester_test_passed();
+}
+
+static void test_slab(const void *data)
+{
+	struct mesh_sar_slab *slab = mesh_sar_slab_new(16);
+	uint8_t *a, *b;
+
+	a = mesh_sar_slab_alloc(slab, 30);
+	memset(a, 0xaa, 16 + 30);
+	mesh_sar_slab_release(slab, a);
+
+	/* Same size class is recycled, and handed out cleared */
+	b = mesh_sar_slab_alloc(slab, 40);
+	g_assert(a == b);
+	g_assert(b[0] == 0 && b[16 + 40 - 1] == 0);
+	mesh_sar_slab_release(slab, b);
+
+	a = mesh_sar_slab_alloc(slab, 500);
+	memset(a, 0, 16 + 500);
+	mesh_sar_slab_release(slab, a);
+
+	mesh_sar_slab_free(slab);
+	tester_test_passed();
+}
+
+struct wheel_test {
+	struct mesh_sar_wheel *wheel;
+	struct mesh_sar_timer *cancel;
+	char order[8];
+	unsigned int fired;
+};
+
+static struct wheel_test wheel_test;
+
+static void timer_fired(void *user_data)
+{
+	char id = L_PTR_TO_UINT(user_data);
+
+	wheel_test.order[wheel_test.fired++] = id;
+
+	/* Callbacks may add and remove timers */
+	if (id == 'a') {
+		mesh_sar_timer_remove(wheel_test.cancel);
+		mesh_sar_timer_add(wheel_test.wheel, 10, timer_fired,
+							L_UINT_TO_PTR('b'));
+	}
+
+	if (id == 'd')
+		l_main_quit();
+}
+
+static void test_wheel(const void *data)
+{
+	struct mesh_sar_wheel *wheel = mesh_sar_wheel_new(10);
+
+	wheel_test.wheel = wheel;
+
+	mesh_sar_timer_add(wheel, 300, timer_fired, L_UINT_TO_PTR('d'));
+	mesh_sar_timer_add(wheel, 100, timer_fired, L_UINT_TO_PTR('c'));
+	mesh_sar_timer_add(wheel, 20, timer_fired, L_UINT_TO_PTR('a'));
+	wheel_test.cancel = mesh_sar_timer_add(wheel, 60, timer_fired,
+							L_UINT_TO_PTR('x'));
+
+	g_assert(mesh_sar_wheel_count(wheel) == 4);
+
+	l_main_run();
+
+	g_assert(wheel_test.fired == 4);
+	g_assert(!memcmp(wheel_test.order, "abcd", 4));
+	g_assert(mesh_sar_wheel_count(wheel) == 0);
+
+	mesh_sar_wheel_free(wheel);
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	int result;
+
+	tester_init(&argc, &argv);
+
+	/* The timer wheel runs on the ell main loop */
+	if (!l_main_init())
+		return EXIT_FAILURE;
+
+	tester_add("/mesh/sar/table", NULL, NULL, test_table, NULL);
+	tester_add("/mesh/sar/slab", NULL, NULL, test_slab, NULL);
+	tester_add("/mesh/sar/wheel", NULL, NULL, test_wheel, NULL);
+
+	result = tester_run();
+
+	l_main_exit();
+
+	return result;
+}